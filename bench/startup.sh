@@ -0,0 +1,37 @@
+#!/bin/sh
+# Startup time of a Bolt program that does nothing, built three ways:
+#   libc          linked with cc, the default
+#   libc-static   linked with cc -static
+#   freestanding  compiled with -ffreestanding, linked with ld -static
+# Each one is run RUNS times; the time per run includes the fork and exec.
+#
+# usage: bench/startup.sh [runs]       (needs nasm, ld and cc)
+#        BOLT=path/to/bolt-compiler bench/startup.sh
+set -e
+BOLT=${BOLT:-build/bolt-compiler}
+RUNS=${1:-2000}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+echo 'int main() { return 0; }' > "$tmp/startup.bolt"
+
+"$BOLT" -o "$tmp/libc.asm" "$tmp/startup.bolt" > /dev/null
+nasm -f elf64 -o "$tmp/libc.o" "$tmp/libc.asm"
+cc -o "$tmp/libc" "$tmp/libc.o"
+cc -static -o "$tmp/libc-static" "$tmp/libc.o"
+
+"$BOLT" -ffreestanding -o "$tmp/freestanding.asm" "$tmp/startup.bolt" > /dev/null
+nasm -f elf64 -o "$tmp/freestanding.o" "$tmp/freestanding.asm"
+ld -static -o "$tmp/freestanding" "$tmp/freestanding.o"
+
+for program in libc libc-static freestanding; do
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$tmp/$program"
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    size=$(wc -c < "$tmp/$program")
+    printf '%-14s %6d us/run  %8d bytes\n' "$program" $(( (end - start) / RUNS / 1000 )) "$size"
+done
@@ -0,0 +1,481 @@
+#include "bounds.hpp"
+#include <algorithm>
+#include <climits>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+// How far up a chain of single-predecessor blocks to look for branches
+static const int MAX_FACT_DEPTH = 8;
+
+typedef __int128 wide;
+
+static bool same_value(Instr* a, Instr* b) {
+    return a == b || (a->is_const() && b->is_const() && a->imm == b->imm);
+}
+
+static bool is_invariant(const Loop& loop, Instr* value) {
+    return value->is_const() || !loop.contains(value);
+}
+
+// --- Counted Loops ---
+
+// A loop that only leaves from 'exiting', which goes round again while
+// 'iv.next cc bound'
+struct CountedLoop {
+    InductionVariable iv;
+    CondCode cc;
+    Instr* bound;
+    BasicBlock* exiting;
+};
+
+static bool find_counted_loop(const Loop& loop, BasicBlock* preheader, CountedLoop& counted) {
+    BasicBlock* exiting = nullptr;
+    for (BasicBlock* block : loop.blocks) {
+        std::vector<BasicBlock*> succs = block->successors();
+        if (succs.empty()) return false; // A 'return' inside the loop
+        for (BasicBlock* succ : succs) {
+            if (loop.contains(succ)) continue;
+            if (exiting && exiting != block) return false;
+            exiting = block;
+        }
+    }
+    if (!exiting) return false;
+
+    Instr* term = exiting->terminator();
+    if (term->op != Opcode::CondBr || term->operands[0]->op != Opcode::Cmp) return false;
+    bool continue_if_true = loop.contains(term->targets[0]);
+    BasicBlock* next_block = term->targets[continue_if_true ? 0 : 1];
+    // Straight back to the header, maybe through an empty latch
+    if (next_block != loop.header &&
+        !(next_block->instrs.size() == 1 && next_block->successors() == std::vector<BasicBlock*>{loop.header})) {
+        return false;
+    }
+
+    Instr* condition = term->operands[0];
+    CondCode cc = continue_if_true ? condition->cond : negate_cond(condition->cond);
+    for (Instr* phi : loop.header->phis()) {
+        InductionVariable iv;
+        if (!find_induction_variable(loop, preheader, phi, iv)) continue;
+        if (condition->operands[0] == iv.next && is_invariant(loop, condition->operands[1])) {
+            counted = {iv, cc, condition->operands[1], exiting};
+            return true;
+        }
+        if (condition->operands[1] == iv.next && is_invariant(loop, condition->operands[0])) {
+            counted = {iv, swap_cond(cc), condition->operands[0], exiting};
+            return true;
+        }
+    }
+    return false;
+}
+
+// --- Range Analysis ---
+
+struct Range {
+    int64_t lo = INT64_MIN;
+    int64_t hi = INT64_MAX;
+};
+
+static Range make_range(wide lo, wide hi) {
+    if (lo < INT64_MIN || hi > INT64_MAX) return Range();
+    return {static_cast<int64_t>(lo), static_cast<int64_t>(hi)};
+}
+
+// The range of an 'bits'-bit integer
+static Range integer_range(int bits, bool is_signed) {
+    if (bits >= 64) return Range();
+    if (is_signed) return {-(INT64_C(1) << (bits - 1)), (INT64_C(1) << (bits - 1)) - 1};
+    return {0, (INT64_C(1) << bits) - 1};
+}
+
+class RangeAnalysis {
+public:
+    RangeAnalysis(const LoopInfo& loops) : m_loops(loops) {}
+
+    // What 'value' can be, wherever it's used
+    Range of(Instr* value) {
+        auto cached = m_cache.find(value);
+        if (cached != m_cache.end()) return cached->second;
+        if (!m_visiting.insert(value).second) return Range(); // A cycle of phis
+        Range range = compute(value);
+        m_visiting.erase(value);
+        m_cache[value] = range;
+        return range;
+    }
+
+    // What 'value' can be in 'block', given the branches taken to get there
+    Range at(Instr* value, BasicBlock* block) {
+        Range range = of(value);
+        for_each_fact(block, [&](Instr* lhs, CondCode cc, Instr* rhs) {
+            if (lhs == value) range = narrow(range, cc, of(rhs));
+            if (rhs == value) range = narrow(range, swap_cond(cc), of(lhs));
+        });
+        return range;
+    }
+
+    // True if 'lhs cc rhs' (LT or LE) always holds in 'block'
+    bool proves(Instr* lhs, CondCode cc, Instr* rhs, BasicBlock* block) {
+        Range a = at(lhs, block);
+        Range b = at(rhs, block);
+        if (cc == CondCode::LT ? a.hi < b.lo : a.hi <= b.lo) return true;
+
+        bool proven = false;
+        for_each_fact(block, [&](Instr* x, CondCode fact, Instr* y) {
+            if (!same_value(x, lhs) || !same_value(y, rhs)) {
+                if (!same_value(x, rhs) || !same_value(y, lhs)) return;
+                fact = swap_cond(fact);
+            }
+            proven |= fact == cc || (fact == CondCode::LT && cc == CondCode::LE);
+        });
+        return proven;
+    }
+
+private:
+    const LoopInfo& m_loops;
+    std::unordered_map<Instr*, Range> m_cache;
+    std::unordered_set<Instr*> m_visiting;
+
+    // Calls 'f(lhs, cc, rhs)' for every comparison known to hold in 'block',
+    // because a conditional branch on it led there
+    template <typename F>
+    void for_each_fact(BasicBlock* block, F f) {
+        for (int depth = 0; depth < MAX_FACT_DEPTH && block->preds.size() == 1; depth++) {
+            BasicBlock* pred = block->preds[0];
+            Instr* term = pred->terminator();
+            if (term->op == Opcode::CondBr && term->targets[0] != term->targets[1] &&
+                term->operands[0]->op == Opcode::Cmp) {
+                Instr* condition = term->operands[0];
+                CondCode cc = block == term->targets[0] ? condition->cond : negate_cond(condition->cond);
+                f(condition->operands[0], cc, condition->operands[1]);
+            }
+            block = pred;
+        }
+    }
+
+    // 'range', knowing that the value is 'cc' something in 'other'
+    static Range narrow(Range range, CondCode cc, Range other) {
+        Range result = range;
+        switch (cc) {
+            case CondCode::LT:
+                if (other.hi == INT64_MIN) return range;
+                result.hi = std::min(range.hi, other.hi - 1);
+                break;
+            case CondCode::LE:
+                result.hi = std::min(range.hi, other.hi);
+                break;
+            case CondCode::GT:
+                if (other.lo == INT64_MAX) return range;
+                result.lo = std::max(range.lo, other.lo + 1);
+                break;
+            case CondCode::GE:
+                result.lo = std::max(range.lo, other.lo);
+                break;
+            case CondCode::EQ:
+                result.lo = std::max(range.lo, other.lo);
+                result.hi = std::min(range.hi, other.hi);
+                break;
+            case CondCode::ULT:
+            case CondCode::ULE:
+                // Below a non-negative number, unsigned: so not negative either
+                if (other.lo < 0 || (cc == CondCode::ULT && other.hi == 0)) return range;
+                result.lo = std::max<int64_t>(range.lo, 0);
+                result.hi = std::min(range.hi, cc == CondCode::ULT ? other.hi - 1 : other.hi);
+                break;
+            default:
+                return range;
+        }
+        // Empty: the block can't be reached. Nothing to gain from that.
+        return result.lo <= result.hi ? result : range;
+    }
+
+    Range compute(Instr* value) {
+        switch (value->op) {
+            case Opcode::Const:
+                return {value->imm, value->imm};
+            case Opcode::Cmp:
+            case Opcode::BitTest:
+                return {0, 1};
+            case Opcode::Popcnt:
+            case Opcode::Clz:
+            case Opcode::Ctz:
+                return {0, 64};
+            case Opcode::SExt:
+            case Opcode::SLoad:
+                return integer_range(static_cast<int>(value->imm), true);
+            case Opcode::ZExt:
+            case Opcode::ZLoad:
+                return integer_range(static_cast<int>(value->imm), false);
+            case Opcode::Add:
+            case Opcode::Sub: {
+                Range a = of(value->operands[0]);
+                Range b = of(value->operands[1]);
+                if (value->op == Opcode::Add) return make_range(wide(a.lo) + b.lo, wide(a.hi) + b.hi);
+                return make_range(wide(a.lo) - b.hi, wide(a.hi) - b.lo);
+            }
+            case Opcode::Mul: {
+                Range a = of(value->operands[0]);
+                Range b = of(value->operands[1]);
+                if (!value->operands[1]->is_const()) return Range();
+                wide c = b.lo;
+                return make_range(std::min(a.lo * c, a.hi * c), std::max(a.lo * c, a.hi * c));
+            }
+            case Opcode::URem:
+            case Opcode::SRem:
+            case Opcode::UDiv:
+            case Opcode::SDiv:
+                return divide(value);
+            case Opcode::Phi:
+                return phi_range(value);
+            default:
+                return Range();
+        }
+    }
+
+    // Division and remainder by a positive constant
+    Range divide(Instr* value) {
+        Range a = of(value->operands[0]);
+        Instr* divisor = value->operands[1];
+        if (!divisor->is_const() || divisor->imm <= 0) return Range();
+        int64_t c = divisor->imm;
+        bool is_unsigned = value->op == Opcode::URem || value->op == Opcode::UDiv;
+        // Unsigned math on a negative number sees a huge one
+        if (is_unsigned && a.lo < 0) return value->op == Opcode::URem ? Range{0, c - 1} : Range();
+        switch (value->op) {
+            case Opcode::URem:
+            case Opcode::SRem:
+                if (a.lo >= 0) return {0, std::min(a.hi, c - 1)};
+                return {-(c - 1), c - 1};
+            default:
+                // Rounding toward zero keeps the order
+                return {a.lo / c, a.hi / c};
+        }
+    }
+
+    Range phi_range(Instr* phi) {
+        Loop* loop = m_loops.loop_for(phi->parent);
+        BasicBlock* preheader = loop && loop->header == phi->parent ? loop->preheader() : nullptr;
+        CountedLoop counted;
+        if (preheader && find_counted_loop(*loop, preheader, counted) && counted.iv.phi == phi) {
+            return induction_range(counted, preheader);
+        }
+
+        // Anything that comes in
+        Range hull = {INT64_MAX, INT64_MIN};
+        for (size_t i = 0; i < phi->operands.size(); i++) {
+            Range incoming = at(phi->operands[i], phi->targets[i]);
+            hull.lo = std::min(hull.lo, incoming.lo);
+            hull.hi = std::max(hull.hi, incoming.hi);
+        }
+        return hull.lo <= hull.hi ? hull : Range();
+    }
+
+    // The phi is 'init' on the first iteration. After that it's a 'next'
+    // that passed the test, so it's on the right side of the bound, and
+    // it can't have wrapped around getting there if the range doesn't.
+    Range induction_range(const CountedLoop& counted, BasicBlock* preheader) {
+        const InductionVariable& iv = counted.iv;
+        Range init = at(iv.init, preheader);
+        Range bound = of(counted.bound);
+        if (iv.step > 0 && (counted.cc == CondCode::LT || counted.cc == CondCode::LE)) {
+            wide last = wide(bound.hi) - (counted.cc == CondCode::LT);
+            wide hi = std::max<wide>(init.hi, last);
+            if (hi + iv.step > INT64_MAX) return Range();
+            return make_range(init.lo, hi);
+        }
+        if (iv.step < 0 && (counted.cc == CondCode::GT || counted.cc == CondCode::GE)) {
+            wide last = wide(bound.lo) + (counted.cc == CondCode::GT);
+            wide lo = std::min<wide>(init.lo, last);
+            if (lo + iv.step < INT64_MIN) return Range();
+            return make_range(lo, init.hi);
+        }
+        return Range();
+    }
+};
+
+// --- The Pass ---
+
+class BoundsCheckEliminator {
+public:
+    explicit BoundsCheckEliminator(IRFunction& function)
+        : m_function(function), m_domtree(function), m_loops(function, m_domtree), m_ranges(m_loops) {}
+
+    BoundsCheckStats run() {
+        m_stats.total = count_bounds_checks(m_function);
+        if (m_stats.total == 0) return m_stats;
+
+        remove_redundant();
+        for (Loop* loop : m_loops.loops()) {
+            hoist(*loop);
+        }
+        // The checks made for the hoisted ones may repeat each other
+        remove_redundant();
+        return m_stats;
+    }
+
+private:
+    IRFunction& m_function;
+    DominatorTree m_domtree;
+    LoopInfo m_loops;
+    RangeAnalysis m_ranges;
+    BoundsCheckStats m_stats;
+
+    bool is_redundant(Instr* check) {
+        Instr* index = check->operands[0];
+        Instr* length = check->operands[1];
+        BasicBlock* block = check->parent;
+
+        Range range = m_ranges.at(index, block);
+        if (range.lo >= 0 && range.hi < m_ranges.at(length, block).lo) return true;
+        if (range.lo >= 0 && m_ranges.proves(index, CondCode::LT, length, block)) return true;
+        if (index->op == Opcode::URem && same_value(index->operands[1], length)) return true;
+
+        // The same check, earlier in this block or in a dominator
+        for (BasicBlock* dom = block; dom; dom = m_domtree.idom(dom)) {
+            for (auto& instr : dom->instrs) {
+                if (instr.get() == check) break;
+                if (instr->op == Opcode::BoundsCheck && same_value(instr->operands[0], index) &&
+                    same_value(instr->operands[1], length)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void remove_redundant() {
+        for (BasicBlock* block : m_domtree.reverse_post_order()) {
+            auto& instrs = block->instrs;
+            for (size_t i = 0; i < instrs.size();) {
+                if (instrs[i]->op == Opcode::BoundsCheck && is_redundant(instrs[i].get())) {
+                    instrs.erase(instrs.begin() + i);
+                    m_stats.removed++;
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    // The loop's blocks that can be entered after a store in the same
+    // iteration
+    static std::set<BasicBlock*> after_stores(const Loop& loop) {
+        std::set<BasicBlock*> dirty;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (BasicBlock* block : loop.blocks) {
+                if (block == loop.header || dirty.count(block)) continue;
+                for (BasicBlock* pred : block->preds) {
+                    if (!loop.contains(pred) || !(dirty.count(pred) || stores(pred))) continue;
+                    dirty.insert(block);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+        return dirty;
+    }
+
+    static bool stores(BasicBlock* block) {
+        for (auto& instr : block->instrs) {
+            if (instr->op == Opcode::Store || instr->op == Opcode::VStore || instr->op == Opcode::MemZero) return true;
+        }
+        return false;
+    }
+
+    void hoist(const Loop& loop) {
+        BasicBlock* preheader = loop.preheader();
+        CountedLoop counted;
+        if (!preheader || !find_counted_loop(loop, preheader, counted)) return;
+        // A call might never return, and the iteration that fails might
+        // not have been reached
+        for (BasicBlock* block : loop.blocks) {
+            for (auto& instr : block->instrs) {
+                if (instr->op == Opcode::Call) return;
+            }
+        }
+
+        std::set<BasicBlock*> dirty = after_stores(loop);
+        for (BasicBlock* block : m_domtree.reverse_post_order()) {
+            // Only checks that run on every iteration, before any store
+            if (!loop.contains(block) || !m_domtree.dominates(block, counted.exiting) || dirty.count(block)) {
+                continue;
+            }
+            auto& instrs = block->instrs;
+            for (size_t i = 0; i < instrs.size();) {
+                Instr* check = instrs[i].get();
+                if (check->op == Opcode::Store || check->op == Opcode::VStore || check->op == Opcode::MemZero) break;
+                if (check->op == Opcode::BoundsCheck && is_invariant(loop, check->operands[1]) &&
+                    hoist_check(loop, counted, preheader, check)) {
+                    instrs.erase(instrs.begin() + i);
+                    m_stats.hoisted++;
+                } else {
+                    i++;
+                }
+            }
+        }
+    }
+
+    bool hoist_check(const Loop& loop, const CountedLoop& counted, BasicBlock* preheader, Instr* check) {
+        IRBuilder builder(&m_function);
+        builder.set_insert_point(preheader);
+        Instr* index = check->operands[0];
+        Instr* length = check->operands[1];
+        if (is_invariant(loop, index)) {
+            builder.bounds_check(index, length);
+            return true;
+        }
+
+        // 'iv + k'
+        const InductionVariable& iv = counted.iv;
+        int64_t k = 0;
+        if (index != iv.phi) {
+            if ((index->op != Opcode::Add && index->op != Opcode::Sub) || index->operands[0] != iv.phi ||
+                !index->operands[1]->is_const()) {
+                return false;
+            }
+            uint64_t c = static_cast<uint64_t>(index->operands[1]->imm);
+            k = static_cast<int64_t>(index->op == Opcode::Add ? c : 0 - c);
+        }
+
+        // Counting by one, the last value is right next to the bound, and
+        // it's never before the first: the loop was entered, so the bound
+        // wasn't passed yet
+        Instr* last;
+        if (iv.step == 1 && (counted.cc == CondCode::LT || counted.cc == CondCode::LE)) {
+            if (!m_ranges.proves(iv.init, counted.cc, counted.bound, preheader)) return false;
+            last = counted.cc == CondCode::LT ? builder.binary(Opcode::Sub, counted.bound, builder.const_int(1))
+                                              : counted.bound;
+        } else if (iv.step == -1 && (counted.cc == CondCode::GT || counted.cc == CondCode::GE)) {
+            if (!m_ranges.proves(counted.bound, swap_cond(counted.cc), iv.init, preheader)) return false;
+            last = counted.cc == CondCode::GT ? builder.binary(Opcode::Add, counted.bound, builder.const_int(1))
+                                              : counted.bound;
+        } else {
+            return false;
+        }
+
+        Instr* offset = builder.const_int(k);
+        builder.bounds_check(builder.binary(Opcode::Add, iv.init, offset), length);
+        builder.bounds_check(builder.binary(Opcode::Add, last, offset), length);
+        if (k != 0) {
+            Instr* distance = iv.step > 0 ? builder.binary(Opcode::Sub, last, iv.init)
+                                          : builder.binary(Opcode::Sub, iv.init, last);
+            builder.bounds_check(distance, length);
+        }
+        return true;
+    }
+};
+
+BoundsCheckStats eliminate_bounds_checks(IRFunction& function) {
+    return BoundsCheckEliminator(function).run();
+}
+
+int count_bounds_checks(const IRFunction& function) {
+    int count = 0;
+    for (auto& block : function.blocks) {
+        for (auto& instr : block->instrs) {
+            if (instr->op == Opcode::BoundsCheck) count++;
+        }
+    }
+    return count;
+}
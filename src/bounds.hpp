@@ -0,0 +1,50 @@
+#pragma once
+
+#include "cfg.hpp"
+#include "ir.hpp"
+
+// --- Bounds Check Elimination ---
+// Every 'a[i]' on an array starts out with a bounds check (Opcode::BoundsCheck,
+// a cmp and a jae to a ud2). Most of them can be proven to never fail, or
+// be done once before a loop instead of on every iteration.
+//
+// A range analysis gives every value a signed interval [lo, hi]:
+// constants, narrow integers (an i32 is in [-2^31, 2^31 - 1]), the
+// result of '%' and '/' by a constant, sums and products of those, and
+// induction variables: in
+//
+//     for (int i = 0; i < n; i++) ...
+//
+// 'i' is in [0, n - 1], because the loop only goes round again while
+// 'i + 1 < n'. A branch narrows a value in the blocks it leads to, so
+// inside 'if (j < 10) ...' j is below 10.
+//
+// A check is removed if
+//  - the index is in [0, length) whatever happens,
+//  - the index is 'x % length' (unsigned), or
+//  - the same check already ran: it's in a block that dominates this one.
+//
+// A check that's left in a loop, runs on every iteration, and whose
+// length doesn't change in the loop moves to the preheader:
+//  - if the index doesn't change either, as is;
+//  - if it's 'i + k', where i counts by one towards a bound the loop
+//    tests at the bottom, as checks of its first and last value (and of
+//    how far apart they are, if k isn't 0: then the others can't wrap).
+//    Both are always reached, so checking them up front gives the same
+//    answer, only earlier: a loop that would have failed half-way now
+//    fails before its first iteration.
+// Failing earlier must not be visible, so nothing may happen before the
+// check that the early trap would skip: the loop makes no calls (one
+// that never returns would have ended the program before the failing
+// iteration), and no store comes before the check in the iteration.
+
+struct BoundsCheckStats {
+    int total = 0;   // Checks before the pass
+    int removed = 0; // Proven unnecessary
+    int hoisted = 0; // Moved out of their loop
+};
+
+// Needs preheaders (see optimize_loops). Doesn't change the CFG.
+BoundsCheckStats eliminate_bounds_checks(IRFunction& function);
+
+int count_bounds_checks(const IRFunction& function);
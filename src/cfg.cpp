@@ -0,0 +1,524 @@
+#include "cfg.hpp"
+#include <algorithm>
+#include <cmath>
+
+// --- DominatorTree ---
+
+DominatorTree::DominatorTree(IRFunction& function) {
+    function.compute_predecessors();
+
+    // 1. Number the reachable blocks in reverse post-order
+    BasicBlock* entry = function.blocks[0].get();
+    std::set<BasicBlock*> visited = {entry};
+    std::vector<std::pair<BasicBlock*, size_t>> stack = {{entry, 0}};
+    std::vector<BasicBlock*> post_order;
+    while (!stack.empty()) {
+        BasicBlock* block = stack.back().first;
+        std::vector<BasicBlock*> succs = block->successors();
+        size_t& next = stack.back().second;
+        if (next < succs.size()) {
+            BasicBlock* succ = succs[next++];
+            if (visited.insert(succ).second) stack.push_back({succ, 0});
+        } else {
+            post_order.push_back(block);
+            stack.pop_back();
+        }
+    }
+    m_rpo.assign(post_order.rbegin(), post_order.rend());
+    for (size_t i = 0; i < m_rpo.size(); i++) {
+        m_rpo_index[m_rpo[i]] = static_cast<int>(i);
+    }
+
+    // 2. Iterate until every block's idom is stable
+    auto intersect = [&](BasicBlock* a, BasicBlock* b) {
+        while (a != b) {
+            while (m_rpo_index[a] > m_rpo_index[b]) a = m_idom[a];
+            while (m_rpo_index[b] > m_rpo_index[a]) b = m_idom[b];
+        }
+        return a;
+    };
+
+    m_idom[entry] = entry;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < m_rpo.size(); i++) {
+            BasicBlock* block = m_rpo[i];
+            BasicBlock* new_idom = nullptr;
+            for (BasicBlock* pred : block->preds) {
+                if (!m_idom.count(pred)) continue; // Not processed yet (or unreachable)
+                new_idom = new_idom ? intersect(pred, new_idom) : pred;
+            }
+            if (m_idom[block] != new_idom) {
+                m_idom[block] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    m_idom[entry] = nullptr;
+    for (size_t i = 1; i < m_rpo.size(); i++) {
+        m_children[m_idom[m_rpo[i]]].push_back(m_rpo[i]);
+    }
+}
+
+BasicBlock* DominatorTree::idom(BasicBlock* block) const {
+    auto it = m_idom.find(block);
+    return it != m_idom.end() ? it->second : nullptr;
+}
+
+bool DominatorTree::dominates(BasicBlock* a, BasicBlock* b) const {
+    if (!m_rpo_index.count(b)) return false; // Unreachable
+    for (BasicBlock* block = b; block; block = idom(block)) {
+        if (block == a) return true;
+    }
+    return false;
+}
+
+const std::vector<BasicBlock*>& DominatorTree::children(BasicBlock* block) const {
+    static const std::vector<BasicBlock*> none;
+    auto it = m_children.find(block);
+    return it != m_children.end() ? it->second : none;
+}
+
+// --- Loop ---
+
+BasicBlock* Loop::preheader() const {
+    BasicBlock* outside = nullptr;
+    for (BasicBlock* pred : header->preds) {
+        if (contains(pred)) continue;
+        if (outside) return nullptr; // More than one way in
+        outside = pred;
+    }
+    if (!outside || outside->successors().size() != 1) return nullptr;
+    return outside;
+}
+
+std::vector<BasicBlock*> Loop::exit_blocks() const {
+    std::vector<BasicBlock*> exits;
+    for (BasicBlock* block : blocks) {
+        for (BasicBlock* succ : block->successors()) {
+            if (!contains(succ) && std::find(exits.begin(), exits.end(), succ) == exits.end()) {
+                exits.push_back(succ);
+            }
+        }
+    }
+    return exits;
+}
+
+// --- LoopInfo ---
+
+LoopInfo::LoopInfo(IRFunction&, const DominatorTree& domtree) {
+    // 1. A back edge is an edge to a block that dominates its source.
+    //    All back edges to one header make one loop.
+    for (BasicBlock* header : domtree.reverse_post_order()) {
+        std::vector<BasicBlock*> latches;
+        for (BasicBlock* pred : header->preds) {
+            if (domtree.dominates(header, pred)) latches.push_back(pred);
+        }
+        if (latches.empty()) continue;
+
+        auto loop = std::make_unique<Loop>();
+        loop->header = header;
+        loop->latches = latches;
+
+        // 2. The loop body: everything that reaches a latch without
+        //    going through the header
+        loop->blocks.insert(header);
+        std::vector<BasicBlock*> worklist = latches;
+        while (!worklist.empty()) {
+            BasicBlock* block = worklist.back();
+            worklist.pop_back();
+            if (!loop->blocks.insert(block).second) continue;
+            for (BasicBlock* pred : block->preds) {
+                if (domtree.dominates(header, pred)) worklist.push_back(pred);
+            }
+        }
+        m_loops.push_back(std::move(loop));
+    }
+
+    // 3. Nesting: a loop's parent is the smallest other loop around its header.
+    //    Two natural loops are either nested or disjoint.
+    for (auto& loop : m_loops) {
+        for (auto& other : m_loops) {
+            if (other == loop || !other->contains(loop->header)) continue;
+            if (other->blocks.size() <= loop->blocks.size()) continue;
+            if (!loop->parent || other->blocks.size() < loop->parent->blocks.size()) {
+                loop->parent = other.get();
+            }
+        }
+    }
+    for (auto& loop : m_loops) {
+        if (loop->parent) loop->parent->children.push_back(loop.get());
+        for (Loop* outer = loop->parent; outer; outer = outer->parent) loop->depth++;
+        m_order.push_back(loop.get());
+    }
+
+    std::stable_sort(m_order.begin(), m_order.end(),
+        [](const Loop* a, const Loop* b) { return a->depth > b->depth; });
+
+    for (Loop* loop : m_order) {
+        for (BasicBlock* block : loop->blocks) {
+            if (!m_innermost.count(block)) m_innermost[block] = loop; // Deepest comes first
+        }
+    }
+}
+
+Loop* LoopInfo::loop_for(BasicBlock* block) const {
+    auto it = m_innermost.find(block);
+    return it != m_innermost.end() ? it->second : nullptr;
+}
+
+// --- Critical Edges ---
+
+void split_critical_edges(IRFunction& function, bool for_profile) {
+    function.compute_predecessors();
+    IRBuilder builder(&function);
+
+    // Collect first: splitting adds blocks
+    std::vector<BasicBlock*> blocks;
+    for (auto& block : function.blocks) blocks.push_back(block.get());
+
+    for (BasicBlock* block : blocks) {
+        Instr* term = block->terminator();
+        if (!term || term->targets.size() < 2) continue;
+
+        for (size_t t = 0; t < term->targets.size(); t++) {
+            BasicBlock* succ = term->targets[t];
+            if (succ->phis().empty() && !(for_profile && succ->preds.size() > 1)) continue;
+
+            // The new block goes right after 'block', where the jump
+            // into it is most likely to fall through
+            auto it = std::find_if(function.blocks.begin(), function.blocks.end(),
+                [&](const std::unique_ptr<BasicBlock>& b) { return b.get() == block; });
+            ++it;
+            BasicBlock* middle = it == function.blocks.end() ? function.create_block()
+                                                             : function.create_block_before(it->get());
+            builder.set_insert_point(middle);
+            builder.br(succ);
+
+            for (BasicBlock*& target : term->targets) {
+                if (target == succ) target = middle;
+            }
+            for (Instr* phi : succ->phis()) {
+                for (BasicBlock*& from : phi->targets) {
+                    if (from == block) from = middle;
+                }
+            }
+        }
+    }
+    function.compute_predecessors();
+}
+
+// --- Induction Variables ---
+
+bool find_induction_variable(const Loop& loop, BasicBlock* preheader, Instr* phi, InductionVariable& iv) {
+    if (loop.latches.size() != 1 || phi->operands.size() != 2) return false;
+    Instr* init = phi->incoming_value(preheader);
+    Instr* next = phi->incoming_value(loop.latches[0]);
+    if (!init || !next) return false;
+    if (next->op != Opcode::Add && next->op != Opcode::Sub) return false;
+    if (next->operands[0] != phi || !next->operands[1]->is_const()) return false;
+
+    uint64_t step = static_cast<uint64_t>(next->operands[1]->imm);
+    iv.phi = phi;
+    iv.next = next;
+    iv.init = init;
+    iv.step = static_cast<int64_t>(next->op == Opcode::Add ? step : 0 - step);
+    return true;
+}
+
+bool solve_trip_count(int64_t init, int64_t step, CondCode cc, int64_t bound, int64_t& trips) {
+    typedef __int128 wide;
+    auto continues = [&](wide value) {
+        switch (cc) {
+            case CondCode::EQ: return value == bound;
+            case CondCode::NE: return value != bound;
+            case CondCode::LT: return value < bound;
+            case CondCode::LE: return value <= bound;
+            case CondCode::GT: return value > bound;
+            case CondCode::GE: return value >= bound;
+            default:           return false;
+        }
+    };
+    // Only signed counters (an unsigned one would need the math mod 2^64)
+    if (step == 0 || is_unsigned_cond(cc)) return false;
+
+    wide distance = static_cast<wide>(bound) - init;
+    wide k;
+    if (!continues(static_cast<wide>(init) + step)) {
+        k = 1;
+    } else {
+        switch (cc) {
+            case CondCode::LT:
+                if (step < 0) return false;
+                k = (distance + step - 1) / step;
+                break;
+            case CondCode::LE:
+                if (step < 0) return false;
+                k = distance / step + 1;
+                break;
+            case CondCode::GT:
+                if (step > 0) return false;
+                k = (-distance - step - 1) / -static_cast<wide>(step);
+                break;
+            case CondCode::GE:
+                if (step > 0) return false;
+                k = -distance / -static_cast<wide>(step) + 1;
+                break;
+            case CondCode::NE:
+                if (distance % step != 0) return false;
+                k = distance / step;
+                break;
+            case CondCode::EQ:
+                k = 2;
+                break;
+            default:
+                return false;
+        }
+    }
+
+    // Double-check: the last test fails, the one before passes, and the
+    // counter never left the int64 range on the way
+    wide last = static_cast<wide>(init) + k * step;
+    if (k < 1 || k > INT64_MAX || last < INT64_MIN || last > INT64_MAX || continues(last)) return false;
+    if (k > 1 && !continues(last - step)) return false;
+    trips = static_cast<int64_t>(k);
+    return true;
+}
+
+bool compute_trip_count(const Loop& loop, BasicBlock* preheader, int64_t& trips, InductionVariable* counter) {
+    if (loop.latches.size() != 1) return false;
+    BasicBlock* latch = loop.latches[0];
+    for (BasicBlock* block : loop.blocks) {
+        std::vector<BasicBlock*> succs = block->successors();
+        if (succs.empty()) return false; // A 'return' inside the loop
+        if (block == latch) continue;
+        for (BasicBlock* succ : succs) {
+            if (!loop.contains(succ)) return false;
+        }
+    }
+
+    Instr* term = latch->terminator();
+    if (term->op != Opcode::CondBr) return false;
+    bool continue_if_true = term->targets[0] == loop.header;
+    if (!continue_if_true && term->targets[1] != loop.header) return false;
+
+    Instr* condition = term->operands[0];
+    if (condition->op != Opcode::Cmp || !condition->operands[1]->is_const()) return false;
+    CondCode cc = continue_if_true ? condition->cond : negate_cond(condition->cond);
+
+    for (Instr* phi : loop.header->phis()) {
+        InductionVariable iv;
+        if (!find_induction_variable(loop, preheader, phi, iv)) continue;
+        if (iv.next != condition->operands[0] || !iv.init->is_const()) continue;
+        if (!solve_trip_count(iv.init->imm, iv.step, cc, condition->operands[1]->imm, trips)) return false;
+        if (counter) *counter = iv;
+        return true;
+    }
+    return false;
+}
+
+// --- Branch Weights ---
+
+void weight_cold_calls(IRFunction& function, const std::set<std::string>& cold_functions) {
+    // 1. Cold blocks: they call a cold function, or can only go on to cold blocks
+    std::set<BasicBlock*> cold;
+    for (auto& block : function.blocks) {
+        for (auto& instr : block->instrs) {
+            if (instr->op == Opcode::Call && cold_functions.count(instr->symbol)) cold.insert(block.get());
+        }
+    }
+    for (bool changed = !cold.empty(); changed;) {
+        changed = false;
+        for (auto& block : function.blocks) {
+            std::vector<BasicBlock*> succs = block->successors();
+            if (cold.count(block.get()) || succs.empty()) continue;
+            if (std::all_of(succs.begin(), succs.end(), [&](BasicBlock* succ) { return cold.count(succ) > 0; })) {
+                cold.insert(block.get());
+                changed = true;
+            }
+        }
+    }
+
+    // 2. A branch between a cold and a hot block is unlikely to take the cold one
+    for (auto& block : function.blocks) {
+        Instr* term = block->terminator();
+        if (!term || term->op != Opcode::CondBr || !term->weights.empty()) continue;
+        bool cold_true = cold.count(term->targets[0]) > 0;
+        bool cold_false = cold.count(term->targets[1]) > 0;
+        if (cold_true != cold_false) {
+            term->weights = cold_true ? std::vector<uint32_t>{UNLIKELY_WEIGHT, LIKELY_WEIGHT}
+                                      : std::vector<uint32_t>{LIKELY_WEIGHT, UNLIKELY_WEIGHT};
+        }
+    }
+}
+
+std::vector<double> branch_probabilities(const BasicBlock* block) {
+    Instr* term = block->terminator();
+    if (!term || term->targets.empty()) return {};
+
+    // Branch weights if there are any; a switch target by how many cases go
+    // there; otherwise every way is as likely
+    std::vector<double> weights(term->targets.size(), 1.0);
+    if (term->weights.size() == term->targets.size()) {
+        for (size_t i = 0; i < weights.size(); i++) weights[i] = term->weights[i];
+    } else if (term->op == Opcode::Switch) {
+        for (const auto& entry : term->cases) weights[entry.second] += 1.0;
+    }
+    double total = 0;
+    for (double weight : weights) total += weight;
+    for (double& weight : weights) weight = total > 0 ? weight / total : 1.0 / weights.size();
+    return weights;
+}
+
+// --- Edge Profiles ---
+
+// Calls 'f(term, t, edge)' for every way out of a branch or switch:
+// target 't' of 'term' is edge number 'edge'. A branch that goes the
+// same way either way has nothing to count.
+template <typename F>
+static void for_each_profile_edge(IRFunction& function, F f) {
+    int edge = 0;
+    for (auto& block : function.blocks) {
+        Instr* term = block->terminator();
+        if (!term || term->targets.size() < 2) continue;
+        if (term->op == Opcode::CondBr && term->targets[0] == term->targets[1]) continue;
+        for (size_t t = 0; t < term->targets.size(); t++) {
+            f(term, t, edge++);
+        }
+    }
+}
+
+void number_profile_edges(IRFunction& function) {
+    for_each_profile_edge(function, [](Instr* term, size_t t, int edge) {
+        term->targets[t]->profile_edge = edge;
+    });
+}
+
+void weight_from_profile(IRFunction& function, const ProfileData& profile) {
+    std::unordered_map<Instr*, std::vector<uint64_t>> counts;
+    for_each_profile_edge(function, [&](Instr* term, size_t t, int edge) {
+        std::vector<uint64_t>& taken = counts[term];
+        taken.resize(term->targets.size());
+        taken[t] = profile.edge_count(function.name, edge);
+    });
+    for (auto& entry : counts) {
+        uint64_t most = *std::max_element(entry.second.begin(), entry.second.end());
+        if (most == 0) continue; // Never ran: the guesses stay
+        // Weights are 32 bits: scale the counts down to fit
+        int shift = 0;
+        while ((most >> shift) > UINT32_MAX) shift++;
+        entry.first->weights.clear();
+        for (uint64_t taken : entry.second) {
+            entry.first->weights.push_back(static_cast<uint32_t>(taken >> shift));
+        }
+    }
+}
+
+// --- Block Frequencies ---
+
+// Every loop is guessed to go round this many times per entry
+static const double LOOP_ITERATIONS = 8.0;
+
+void estimate_block_frequencies(IRFunction& function, const DominatorTree& domtree, const LoopInfo& loops) {
+    // The entry block runs once. Every other block gets what its
+    // predecessors send its way (their frequency times the branch
+    // probability), in an order where the predecessors are done first.
+    // Back edges don't count; instead a loop header gets 8 times what
+    // enters the loop. What leaves a loop adds up to what entered it,
+    // shared out among the exits by how likely each one is.
+    function.compute_predecessors();
+    std::unordered_map<BasicBlock*, double> frequency;
+    std::unordered_map<const Loop*, double> entered;
+    std::unordered_map<const Loop*, double> exited;
+
+    // The outermost loop the edge from -> to leaves (nullptr if none)
+    auto loop_left = [&](BasicBlock* from, BasicBlock* to) {
+        Loop* left = nullptr;
+        for (Loop* loop = loops.loop_for(from); loop && !loop->contains(to); loop = loop->parent) left = loop;
+        return left;
+    };
+    auto is_back_edge = [&](BasicBlock* from, BasicBlock* to) {
+        Loop* loop = loops.loop_for(to);
+        return loop && loop->header == to && loop->contains(from);
+    };
+    auto edge_probability = [](BasicBlock* from, BasicBlock* to) {
+        std::vector<double> probabilities = branch_probabilities(from);
+        std::vector<BasicBlock*> succs = from->successors();
+        double probability = 0;
+        for (size_t i = 0; i < succs.size(); i++) {
+            if (succs[i] == to) probability += probabilities[i];
+        }
+        return probability;
+    };
+    // How much leaves 'loop' in total, per run of its header
+    auto exit_total = [&](const Loop* loop) {
+        auto it = exited.find(loop);
+        if (it != exited.end()) return it->second;
+        double total = 0;
+        for (BasicBlock* block : loop->blocks) {
+            for (BasicBlock* succ : block->successors()) {
+                if (!loop->contains(succ)) total += frequency[block] * edge_probability(block, succ);
+            }
+        }
+        return exited[loop] = total;
+    };
+
+    const std::vector<BasicBlock*>& rpo = domtree.reverse_post_order();
+    std::set<BasicBlock*> reachable(rpo.begin(), rpo.end());
+    auto ready = [&](BasicBlock* block) {
+        for (BasicBlock* pred : block->preds) {
+            if (is_back_edge(pred, block) || !reachable.count(pred)) continue;
+            if (!frequency.count(pred)) return false;
+            if (Loop* left = loop_left(pred, block)) {
+                for (BasicBlock* inside : left->blocks) {
+                    if (!frequency.count(inside)) return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    auto compute = [&](BasicBlock* block) {
+        double incoming = block == function.blocks[0].get() ? 1.0 : 0.0;
+        std::set<BasicBlock*> seen;
+        for (BasicBlock* pred : block->preds) {
+            if (!seen.insert(pred).second || is_back_edge(pred, block) || !frequency.count(pred)) continue;
+            double flow = frequency[pred] * edge_probability(pred, block);
+            if (Loop* left = loop_left(pred, block)) {
+                double total = exit_total(left);
+                flow = total > 0 ? entered[left] * flow / total : 0;
+            }
+            incoming += flow;
+        }
+        Loop* loop = loops.loop_for(block);
+        if (loop && loop->header == block) {
+            entered[loop] = incoming;
+            incoming *= LOOP_ITERATIONS;
+        }
+        frequency[block] = incoming;
+    };
+
+    // Reverse post-order almost works, except that a loop's exits can come
+    // before the rest of the loop
+    std::vector<BasicBlock*> pending = rpo;
+    while (!pending.empty()) {
+        std::vector<BasicBlock*> waiting;
+        for (BasicBlock* block : pending) {
+            if (ready(block)) compute(block);
+            else waiting.push_back(block);
+        }
+        // Only an irreducible loop can get us stuck: take the blocks as they come
+        if (waiting.size() == pending.size()) {
+            for (BasicBlock* block : waiting) compute(block);
+            waiting.clear();
+        }
+        pending = std::move(waiting);
+    }
+
+    for (auto& block : function.blocks) {
+        auto it = frequency.find(block.get());
+        block->frequency = it != frequency.end() ? it->second : 0.0;
+    }
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "ir.hpp"
+#include "profile.hpp"
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// --- Control Flow Analysis ---
+// Dominators and loops over the IR's basic blocks. Both are snapshots:
+// rebuild them after changing the CFG.
+
+// Block A dominates block B if every path from the entry to B goes
+// through A. Computed with the iterative algorithm from Cooper, Harvey
+// and Kennedy, "A Simple, Fast Dominance Algorithm".
+class DominatorTree {
+public:
+    DominatorTree(IRFunction& function);
+
+    // The immediate dominator (nullptr for the entry block)
+    BasicBlock* idom(BasicBlock* block) const;
+    bool dominates(BasicBlock* a, BasicBlock* b) const;
+    // Blocks immediately dominated by 'block'
+    const std::vector<BasicBlock*>& children(BasicBlock* block) const;
+    // Reachable blocks in reverse post-order: every block comes after its
+    // dominators
+    const std::vector<BasicBlock*>& reverse_post_order() const { return m_rpo; }
+
+private:
+    std::vector<BasicBlock*> m_rpo;
+    std::unordered_map<BasicBlock*, int> m_rpo_index;
+    std::unordered_map<BasicBlock*, BasicBlock*> m_idom;
+    std::unordered_map<BasicBlock*, std::vector<BasicBlock*>> m_children;
+};
+
+// A natural loop: the header dominates every block in it, and each latch
+// jumps back to the header
+struct Loop {
+    BasicBlock* header = nullptr;
+    std::vector<BasicBlock*> latches;
+    std::set<BasicBlock*> blocks;
+    Loop* parent = nullptr;
+    std::vector<Loop*> children;
+    int depth = 1;
+
+    bool contains(BasicBlock* block) const { return blocks.count(block) > 0; }
+    // True if 'value' is computed inside the loop
+    bool contains(Instr* value) const { return contains(value->parent); }
+    // The one block outside the loop that enters it, if it only jumps to the
+    // header. nullptr if there is none (see ensure_preheader in loopopt).
+    BasicBlock* preheader() const;
+    // Blocks outside the loop that are jumped to from inside
+    std::vector<BasicBlock*> exit_blocks() const;
+};
+
+class LoopInfo {
+public:
+    LoopInfo(IRFunction& function, const DominatorTree& domtree);
+
+    // Innermost loops first, so transforming one never invalidates
+    // a loop we still have to visit
+    const std::vector<Loop*>& loops() const { return m_order; }
+    // The innermost loop containing 'block' (nullptr if none)
+    Loop* loop_for(BasicBlock* block) const;
+
+private:
+    std::vector<std::unique_ptr<Loop>> m_loops;
+    std::vector<Loop*> m_order;
+    std::unordered_map<BasicBlock*, Loop*> m_innermost;
+};
+
+// --- Induction Variables ---
+
+// A "basic" induction variable: phi = [init, preheader], [phi + step, latch]
+struct InductionVariable {
+    Instr* phi;  // The value during an iteration
+    Instr* next; // phi + step, fed back from the latch
+    Instr* init;
+    int64_t step;
+};
+
+// True if 'phi' (in the header of 'loop') is an induction variable
+bool find_induction_variable(const Loop& loop, BasicBlock* preheader, Instr* phi, InductionVariable& iv);
+
+// How many times the body runs, given that it's entered and that the
+// latch tests 'init + k * step' (for k = 1, 2, ...) with 'cc' against
+// 'bound'. False if it's unknown, or the counter would overflow first.
+bool solve_trip_count(int64_t init, int64_t step, CondCode cc, int64_t bound, int64_t& trips);
+
+// The trip count of a loop that exits only from the bottom, counting a
+// constant up or down to a constant. 'counter' gets the variable it tests.
+bool compute_trip_count(const Loop& loop, BasicBlock* preheader, int64_t& trips, InductionVariable* counter = nullptr);
+
+// An edge from a block with several successors to a block with phis is
+// "critical" for us: the phi's copies would have to go on the edge itself.
+// This puts a new block on every such edge. With 'for_profile', also on
+// the ones to a block that can be reached some other way, so each edge
+// out of a branch has a block that only it leads to (see
+// number_profile_edges).
+void split_critical_edges(IRFunction& function, bool for_profile = false);
+
+// --- Branch Weights and Block Frequencies ---
+
+// Gives the branches that lead to calls to 'cold_functions' (the @cold
+// ones) the weights of an unlikely() branch, unless they have some already
+void weight_cold_calls(IRFunction& function, const std::set<std::string>& cold_functions);
+
+// How likely each target of the block's terminator is, from its branch
+// weights (likely(), unlikely(), @cold calls). Sums to 1.
+std::vector<double> branch_probabilities(const BasicBlock* block);
+
+// --- Edge Profiles ---
+// -fprofile-generate counts how often each way out of a conditional
+// branch or switch is taken, and -fprofile-use turns those counts into
+// the branches' weights. The edges are numbered in block order (see
+// profile_edge_key), the same way in both builds, as long as they're
+// made with the same options.
+
+// Gives each edge's target its number (BasicBlock::profile_edge), for
+// the code generator to count it on entry. Needs the blocks from
+// split_critical_edges(function, true).
+void number_profile_edges(IRFunction& function);
+
+// Weights every branch and switch that ran by how often it went each way
+void weight_from_profile(IRFunction& function, const ProfileData& profile);
+
+// Guesses how often each block runs per call, from the branch
+// probabilities and 8 iterations per loop. Used for spill weights in the
+// register allocator and by the block placement (see place_blocks).
+void estimate_block_frequencies(IRFunction& function, const DominatorTree& domtree, const LoopInfo& loops);
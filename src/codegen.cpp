@@ -1,103 +1,660 @@
 #include "codegen.hpp"
+#include "bounds.hpp"
+#include "cfg.hpp"
+#include "comptime.hpp"
+#include "instcache.hpp"
+#include "irgen.hpp"
+#include "isel.hpp"
+#include "loopopt.hpp"
+#include "regalloc.hpp"
+#include "runtime.hpp"
+#include "switch.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <map>
 
-CodeGenerator::CodeGenerator(ProgramNode ast) : m_ast(std::move(ast)) {}
+CodeGenerator::CodeGenerator(ProgramNode ast, CompilerOptions options, ProfileData profile)
+    : m_ast(std::move(ast)), m_options(std::move(options)), m_profile(std::move(profile)) {}
 
 std::string CodeGenerator::generate() {
+    // --- Lower the AST to IR ---
+    IRGenerator irgen(m_options);
+    IRModule module = irgen.generate(m_ast);
+
+    // Calls to comptime functions become constants, at every -O level:
+    // it's part of the language, not an optimization
+    size_t functions = module.functions.size();
+    int folded = fold_comptime_calls(module);
+    if (m_options.print_stats) {
+        std::cerr << "stats: comptime: folded " << folded << " calls, dropped "
+                  << functions - module.functions.size() << " functions\n";
+    }
+
+    // --- Optimize every function ---
+    // Calls to @cold functions are as unlikely as an unlikely() branch
+    std::set<std::string> cold_functions;
+    for (auto& function : module.functions) {
+        if (function->is_cold) cold_functions.insert(function->name);
+    }
+
+    // The runtime's functions only overwrite what 'syscall' does, and its
+    // helpers what they list
+    CalleeTable callees;
+    for (const RuntimeFunction& function : runtime_functions()) {
+        callees[function.symbol] = {CallingConvention::SysV, runtime_clobbers(function)};
+    }
+    for (const RuntimeHelper& helper : runtime_helpers()) {
+        callees[helper.symbol] = {helper.convention, helper.clobbers};
+    }
+    std::set<std::string> runtime_used;
+    std::set<std::string> called;
+    std::set<std::string> defined;
+    for (auto& function : module.functions) defined.insert(function->name);
+    for (auto& function : module.functions) {
+        weight_cold_calls(*function, cold_functions);
+        if (m_options.opt_level > 0) {
+            optimize_loops(*function, m_options);
+        } else if (m_options.report_bounds_checks && count_bounds_checks(*function) > 0) {
+            std::cerr << "remark: " << function->name << ": " << count_bounds_checks(*function)
+                      << " bounds checks, not optimized at -O0\n";
+        }
+        // Switches become jump tables, bit tests and compares (at every
+        // -O level: a chain of compares isn't what anyone asked for)
+        SwitchStats switches = lower_switches(*function);
+        if (m_options.print_stats && switches.jump_tables + switches.bit_tests + switches.compares > 0) {
+            std::cerr << "stats: " << function->name << ": switches: " << switches.jump_tables
+                      << " jump tables, " << switches.bit_tests << " bit tests, " << switches.compares
+                      << " compares\n";
+        }
+        // Phi copies need a block of their own on critical edges, and so
+        // do the edge counters of -fprofile-generate
+        split_critical_edges(*function, m_options.profile_generate);
+        if (m_options.profile_generate) {
+            number_profile_edges(*function);
+        } else if (!m_profile.empty()) {
+            weight_from_profile(*function, m_profile);
+        }
+        DominatorTree domtree(*function);
+        estimate_block_frequencies(*function, domtree, LoopInfo(*function, domtree));
+        if (m_options.opt_level > 0) {
+            place_blocks(*function);
+        }
+
+        m_call_graph.add_function(function->name);
+        for (auto& block : function->blocks) {
+            for (auto& instr : block->instrs) {
+                if (instr->op == Opcode::Call && !is_atomic_intrinsic(instr->symbol)) {
+                    m_call_graph.add_call(function->name, instr->symbol);
+                    called.insert(instr->symbol);
+                    if (is_runtime_symbol(instr->symbol)) runtime_used.insert(instr->symbol);
+                }
+                // A function whose address is taken (a parallel for body, a
+                // thread's entry) is run from here, through the runtime
+                if (instr->op == Opcode::GlobalAddr && defined.count(instr->symbol)) {
+                    m_call_graph.add_call(function->name, instr->symbol);
+                }
+            }
+        }
+
+        if (m_options.emit_ir) {
+            std::cout << print_ir(*function);
+        }
+        callees[function->name].convention =
+            function->is_exported ? CallingConvention::SysV : CallingConvention::Internal;
+    }
+
+    // --- Compile every function ---
+    // Callees go before their callers (except around recursion), so a
+    // call knows exactly which registers the callee overwrites. Each one
+    // is generated into a fresh buffer.
+    std::vector<IRFunction*> bottom_up;
+    std::set<std::string> visited;
+    std::function<void(const std::string&)> visit = [&](const std::string& name) {
+        if (!visited.insert(name).second) return;
+        for (const auto& callee : m_call_graph.callees(name)) visit(callee);
+        for (auto& function : module.functions) {
+            if (function->name == name) bottom_up.push_back(function.get());
+        }
+    };
+    for (const auto& name : m_call_graph.functions()) visit(name);
+
+    // An instance compiled before, in this file or another, comes from the
+    // cache (instcache.hpp). Not with -fprofile-generate: its counters are
+    // this file's.
+    InstanceCache cache(m_options.profile_generate ? "" : m_options.instance_cache, m_options);
+    std::set<std::string> instances;
+    for (IRFunction* function : bottom_up) {
+        std::string key;
+        if (function->is_instance) {
+            instances.insert(function->name);
+            CachedInstance cached;
+            if (cache.enabled()) key = cache.key(*function, callees);
+            if (cache.enabled() && cache.load(key, cached)) {
+                if (m_options.print_stats) std::cerr << "stats: " << function->name << ": from the instance cache\n";
+                callees[function->name].clobbers = cached.clobbers;
+                m_functions.push_back({function->name, cached.code, cached.cold_code, cached.constants});
+                continue;
+            }
+        }
+
+        InstructionSelector selector(*function, m_options.target, callees);
+        MFunction mfunction = selector.select();
+        RegisterAllocator(mfunction).run();
+        callees[function->name].clobbers = clobbered_registers(mfunction);
+
+        m_output.str("");
+        m_cold_output.str("");
+        m_constants.str("");
+        emit_function(mfunction);
+        m_functions.push_back({function->name, m_output.str(), m_cold_output.str(), m_constants.str()});
+        if (!key.empty()) {
+            const EmittedFunction& emitted = m_functions.back();
+            cache.store(key, {emitted.code, emitted.cold_code, emitted.constants, callees[function->name].clobbers});
+        }
+    }
+    fold_identical_instances(instances);
+    for (const EmittedFunction& function : m_functions) {
+        m_rodata << function.constants;
+    }
+    emit_strings(module.strings);
+    emit_globals(module.globals);
+
+    // --- Function Layout ---
+    // 1. Split off the cold functions (never run, @cold, or only reachable
+    //    from cold code). They go to .text.cold, away from the hot code,
+    //    with the cold blocks of the hot functions.
+    // 2. Order the rest so callers and their hot callees sit together.
+    //    With a profile, edges are weighted by how often they really ran.
+    //    Code outside the module calls 'main' and the 'export' functions
+    //    (__bolt_flush among them: .fini_array, _start and exit() call
+    //    it), and whatever a global holds the address of may be called
+    //    from anywhere.
+    for (auto& function : module.functions) {
+        if (function->name == "main" || function->is_exported) {
+            m_call_graph.add_entry_point(function->name);
+        }
+    }
+    for (const GlobalVariable& global : module.globals) {
+        for (const GlobalVariable::Relocation& relocation : global.relocations) {
+            if (defined.count(relocation.symbol)) m_call_graph.add_entry_point(relocation.symbol);
+        }
+    }
+    CallGraph graph = m_profile.empty() ? m_call_graph : m_call_graph.with_profile(m_profile);
+    std::set<std::string> cold = find_cold_functions(graph, m_profile, cold_functions);
+    std::vector<std::string> order = order_functions(graph, m_profile, cold);
+
+    auto emitted = [this](const std::string& name) -> const EmittedFunction& {
+        for (const auto& func : m_functions) {
+            if (func.name == name) return func;
+        }
+        static const EmittedFunction none;
+        return none;
+    };
+
     // --- Assembly Preamble ---
-    // .global main tells the linker that 'main' is the entry point
+    // .global makes 'main' (the entry point) and the 'export' functions
+    // visible to the linker
     // .section .text contains all the executable code
-    
-    m_output << "global main\n";
+    // extern names the functions defined elsewhere ('extern' declarations)
+    m_output.str("");
+    for (auto& function : module.functions) {
+        if (function->is_exported) {
+            m_output << "global " << function->name << "\n";
+        }
+    }
+    for (const auto& name : called) {
+        if (!callees.count(name)) {
+            m_output << "extern " << name << "\n";
+        }
+    }
     m_output << "section .text\n";
 
-    // --- Visit Top-Level Statements ---
-    // This will loop through our AST and find all function definitions
-    for (const auto& stmt : m_ast.statements) {
-        visit(stmt.get());
+    for (const auto& name : order) {
+        m_output << emitted(name).code;
+    }
+    // A program that prints flushes its output at exit: with the C
+    // library, from .fini_array; without it, from _start and exit()
+    bool buffered_output = std::any_of(module.functions.begin(), module.functions.end(),
+                                       [](const auto& function) { return function->name == "__bolt_flush"; });
+    m_output << emit_runtime(runtime_used, buffered_output, m_options);
+
+    if (!m_rodata.str().empty()) {
+        m_output << "\nsection .rodata\n" << m_rodata.str();
+    }
+    if (!m_data.str().empty()) {
+        m_output << "\nsection .data\n" << m_data.str();
+    }
+    if (!m_bss.str().empty()) {
+        m_output << "\nsection .bss\n" << m_bss.str();
+    }
+
+    bool has_cold_blocks = std::any_of(m_functions.begin(), m_functions.end(),
+        [](const EmittedFunction& func) { return !func.cold_code.empty(); });
+    if (!cold.empty() || has_cold_blocks) {
+        m_output << "\nsection .text.cold progbits alloc exec nowrite align=16\n";
+        for (const auto& name : order) {
+            m_output << emitted(name).cold_code;
+        }
+        for (const auto& name : m_call_graph.functions()) {
+            if (cold.count(name)) {
+                m_output << emitted(name).code << emitted(name).cold_code;
+            }
+        }
+    }
+
+    if (buffered_output && !m_options.freestanding) {
+        m_output << "\nsection .fini_array progbits alloc noexec write align=8\n";
+        m_output << "  dq __bolt_flush\n";
+    }
+    if (m_options.profile_generate) {
+        emit_profile_runtime();
     }
 
     return m_output.str();
 }
 
-// --- Statement Visitors ---
-
-// This is the main "router" for statements.
-void CodeGenerator::visit(StmtNode* node) {
-    if (!node) return; // Skip null statements
-    
-    // We use dynamic_cast to figure out what *kind* of statement this is
-    // and call the correct, specific visitor.
-    
-    if (auto func_def = dynamic_cast<FunctionDefNode*>(node)) {
-        visit(func_def);
-    } else if (auto return_stmt = dynamic_cast<ReturnStmtNode*>(node)) {
-        visit(return_stmt);
-    } else if (auto block_stmt = dynamic_cast<BlockStmtNode*>(node)) {
-        visit(block_stmt);
-    } else {
-        // We don't know how to compile this type of statement yet!
-        // This is fine, we'll just ignore it (like our parser does).
+// --- Emission ---
+
+// The jump that goes the other way ('jl' -> 'jge')
+static std::string inverted_jump(const std::string& jcc) {
+    static const std::pair<const char*, const char*> pairs[] = {
+        {"je", "jne"}, {"jl", "jge"}, {"jle", "jg"}, {"jb", "jae"}, {"jbe", "ja"},
+    };
+    for (const auto& pair : pairs) {
+        if (jcc == pair.first) return pair.second;
+        if (jcc == pair.second) return pair.first;
     }
+    return "";
 }
 
-void CodeGenerator::visit(FunctionDefNode* node) {
-    // 1. Emit the function label (e.g., "main:")
-    m_output << node->name << ":\n";
+void CodeGenerator::emit_function(MFunction& function) {
+    // --- 1. Lay out the stack frame ---
+    //   [rbp + 8]   return address
+    //   [rbp]       caller's rbp
+    //   [rbp - 8]   saved callee-saved registers
+    //   ...         stack slots (spills, arrays)
+    //   [rsp]       16-byte aligned, as every call wants it
+    int saved_bytes = static_cast<int>(function.used_callee_saved.size()) * 8;
+    int offset = saved_bytes;
+    for (StackSlot& slot : function.slots) {
+        offset += slot.size;
+        offset = (offset + slot.align - 1) / slot.align * slot.align;
+        slot.offset = offset;
+    }
+    int frame_size = offset - saved_bytes;
+    if ((saved_bytes + frame_size) % 16 != 0) {
+        frame_size += 16 - (saved_bytes + frame_size) % 16;
+    }
 
-    // 2. Emit the function "prologue"
+    // --- 2. Emit the function "prologue" ---
     //    - push rbp: Save the old base pointer
     //    - mov rbp, rsp: Set our new stack frame
+    //    - save the callee-saved registers we use and make room for the slots
+    m_output << function.name << ":\n";
     m_output << "  push rbp\n";
     m_output << "  mov rbp, rsp\n";
+    for (int reg : function.used_callee_saved) {
+        m_output << "  push " << reg_name(reg) << "\n";
+    }
+    if (frame_size > 0) {
+        m_output << "  sub rsp, " << frame_size << "\n";
+    }
+
+    // With -fprofile-generate, count every time we enter the function
+    if (m_options.profile_generate) {
+        emit_counter_increment(function.name, m_output);
+    }
 
-    // 3. Visit all statements in the function's body
-    visit(node->body.get());
+    // --- 3. Emit the blocks ---
+    // With -O1 the cold ones (see place_blocks) go to .text.cold
+    std::vector<size_t> hot_blocks, cold_blocks;
+    for (size_t b = 0; b < function.blocks.size(); b++) {
+        bool cold = m_options.opt_level > 0 && b > 0 && function.blocks[b].frequency < COLD_BLOCK_FREQUENCY;
+        (cold ? cold_blocks : hot_blocks).push_back(b);
+    }
+    emit_blocks(function, hot_blocks, saved_bytes, m_output);
+    emit_blocks(function, cold_blocks, saved_bytes, m_cold_output);
 
-    // 4. Emit the function "epilogue"
-    //    (Note: The 'return' statement will actually do this)
-    //    If a function doesn't return, we'd add it here.
+    // --- 4. Its constants go to .rodata, aligned for 'movdqa' ---
+    // (jump tables hold offsets from their own start: no relocations)
+    for (const MConstant& constant : function.constants) {
+        if (!constant.jump_targets.empty()) {
+            m_constants << "align 4\n" << constant.label << ":\n  dd ";
+            for (size_t i = 0; i < constant.jump_targets.size(); i++) {
+                m_constants << (i == 0 ? "" : ", ") << constant.jump_targets[i] << " - " << constant.label;
+            }
+            m_constants << "\n";
+            continue;
+        }
+        m_constants << "align 32\n" << constant.label << ":\n  dq ";
+        for (size_t i = 0; i < constant.qwords.size(); i++) {
+            m_constants << (i == 0 ? "" : ", ") << constant.qwords[i];
+        }
+        m_constants << "\n";
+    }
 }
 
-void CodeGenerator::visit(BlockStmtNode* node) {
-    // A block is just a list of statements. We visit them in order.
-    for (const auto& stmt : node->statements) {
-        visit(stmt.get());
+// 'text' with the labels of function 'name' (its own, its blocks' and
+// its constants') written the same for every function
+static std::string without_own_labels(const std::string& text, const std::string& name) {
+    auto is_label_char = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$';
+    };
+    auto is_own_suffix = [](const std::string& suffix) {
+        // .bb<N>, .c<N> and .bounds_fail (see InstructionSelector)
+        if (suffix == "bounds_fail") return true;
+        size_t digits = suffix.compare(0, 2, "bb") == 0 ? 2 : suffix.compare(0, 1, "c") == 0 ? 1 : 0;
+        return digits > 0 && suffix.size() > digits &&
+               std::all_of(suffix.begin() + digits, suffix.end(), [](char c) { return std::isdigit(c); });
+    };
+    std::string result;
+    size_t i = 0;
+    while (i < text.size()) {
+        if (!is_label_char(text[i])) {
+            result += text[i++];
+            continue;
+        }
+        size_t end = i;
+        while (end < text.size() && is_label_char(text[end])) end++;
+        std::string word = text.substr(i, end - i);
+        if (word == name) {
+            word = "@";
+        } else if (word.size() > name.size() + 1 && word.compare(0, name.size() + 1, name + ".") == 0 &&
+                   is_own_suffix(word.substr(name.size() + 1))) {
+            word = "@" + word.substr(name.size());
+        }
+        result += word;
+        i = end;
     }
+    return result;
 }
 
-void CodeGenerator::visit(ReturnStmtNode* node) {
-    // 1. Visit the expression.
-    //    This will put the expression's result (e.g., "0")
-    //    into the 'rax' register.
-    visit(node->expression.get());
-    
-    // 2. Emit the function "epilogue"
-    //    - mov rsp, rbp: Restore the old stack pointer
-    //    - pop rbp: Restore the old base pointer
-    m_output << "  mov rsp, rbp\n";
-    m_output << "  pop rbp\n";
-    
-    // 3. Emit the 'ret' (return) instruction
-    m_output << "  ret\n";
+void CodeGenerator::fold_identical_instances(const std::set<std::string>& instances) {
+    // By their code (and cold code and constants) with their own labels
+    // left out: the instance that stays
+    std::map<std::string, size_t> kept;
+    std::vector<EmittedFunction> functions;
+    for (EmittedFunction& function : m_functions) {
+        if (!instances.count(function.name)) {
+            functions.push_back(std::move(function));
+            continue;
+        }
+        std::string code = without_own_labels(function.code, function.name) + '\0' +
+                           without_own_labels(function.cold_code, function.name) + '\0' +
+                           without_own_labels(function.constants, function.name);
+        auto same = kept.emplace(std::move(code), functions.size());
+        if (same.second) {
+            functions.push_back(std::move(function));
+            continue;
+        }
+        EmittedFunction& original = functions[same.first->second];
+        if (m_options.print_stats) {
+            std::cerr << "stats: " << function.name << ": the same code as " << original.name << ", folded\n";
+        }
+        original.code = function.name + ":\n" + original.code;
+    }
+    m_functions = std::move(functions);
+}
+
+void CodeGenerator::emit_strings(const std::vector<std::string>& strings) {
+    // The bytes each literal needs, 0 included. IRGenerator already made
+    // identical literals one.
+    std::vector<std::string> data;
+    for (const auto& string : strings) data.push_back(string + '\0');
+
+    // Sorted by their reversed bytes, a string that ends another comes
+    // right before it, or before one that ends it too. So going backwards,
+    // each string is hosted by the next one's host if it ends it.
+    std::vector<size_t> sorted(data.size());
+    for (size_t i = 0; i < sorted.size(); i++) sorted[i] = i;
+    auto reversed = [&](size_t i) { return std::string(data[i].rbegin(), data[i].rend()); };
+    std::sort(sorted.begin(), sorted.end(), [&](size_t a, size_t b) { return reversed(a) < reversed(b); });
+
+    std::vector<size_t> host(data.size());
+    for (size_t k = sorted.size(); k-- > 0;) {
+        size_t i = sorted[k];
+        host[i] = i;
+        if (k + 1 < sorted.size()) {
+            const std::string& next = data[sorted[k + 1]];
+            if (next.size() >= data[i].size() && next.compare(next.size() - data[i].size(), data[i].size(), data[i]) == 0) {
+                host[i] = host[sorted[k + 1]];
+            }
+        }
+    }
+
+    // Each host is written out once, with the labels of the strings it
+    // hosts where they start
+    size_t bytes = 0;
+    size_t saved = 0;
+    for (size_t h = 0; h < data.size(); h++) {
+        if (host[h] != h) {
+            saved += data[h].size();
+            continue;
+        }
+        std::map<size_t, std::vector<size_t>> starts; // Offset -> strings starting there
+        for (size_t i = 0; i < data.size(); i++) {
+            if (host[i] == h) starts[data[h].size() - data[i].size()].push_back(i);
+        }
+        // The bytes as numbers, so no character needs escaping
+        auto it = starts.begin();
+        for (size_t offset = 0; offset < data[h].size(); offset++) {
+            bool label = it != starts.end() && it->first == offset;
+            if (label) {
+                if (offset > 0) m_rodata << "\n";
+                for (size_t i : it->second) m_rodata << string_label(i) << ":\n";
+                ++it;
+            }
+            m_rodata << (label ? "  db " : ", ") << static_cast<int>(static_cast<unsigned char>(data[h][offset]));
+        }
+        m_rodata << "\n";
+        bytes += data[h].size();
+    }
+
+    if (m_options.print_stats && !strings.empty()) {
+        std::cerr << "stats: strings: " << strings.size() << " literals, " << bytes << " bytes in .rodata ("
+                  << saved << " saved by sharing suffixes)\n";
+    }
+}
+
+void CodeGenerator::emit_globals(const std::vector<GlobalVariable>& globals) {
+    int in_data = 0;
+    int in_bss = 0;
+    int in_rodata = 0;
+    for (const GlobalVariable& global : globals) {
+        bool zero = global.relocations.empty() &&
+                    std::all_of(global.bytes.begin(), global.bytes.end(), [](uint8_t byte) { return byte == 0; });
+        if (zero && !global.read_only) {
+            m_bss << "alignb " << global.align << "\n" << global.symbol << ": resb " << global.bytes.size() << "\n";
+            in_bss++;
+            continue;
+        }
+        // A const global with an address in it goes to .data all the same:
+        // the address is only known once the program is loaded
+        bool read_only = global.read_only && global.relocations.empty();
+        std::ostream& out = read_only ? m_rodata : m_data;
+        (read_only ? in_rodata : in_data)++;
+        out << "align " << global.align << "\n" << global.symbol << ":\n";
+
+        // The bytes as numbers, runs of 0s as 'times', and the addresses
+        std::vector<GlobalVariable::Relocation> relocations = global.relocations;
+        std::sort(relocations.begin(), relocations.end(),
+                  [](const GlobalVariable::Relocation& a, const GlobalVariable::Relocation& b) { return a.offset < b.offset; });
+        auto relocation = relocations.begin();
+        size_t offset = 0;
+        while (offset < global.bytes.size()) {
+            if (relocation != relocations.end() && relocation->offset == static_cast<int64_t>(offset)) {
+                out << "  dq " << relocation->symbol;
+                if (relocation->addend != 0) out << (relocation->addend < 0 ? " - " : " + ") << std::abs(relocation->addend);
+                out << "\n";
+                ++relocation;
+                offset += 8;
+                continue;
+            }
+            size_t end = relocation != relocations.end() ? relocation->offset : global.bytes.size();
+            size_t zeros = 0;
+            while (offset + zeros < end && global.bytes[offset + zeros] == 0) zeros++;
+            if (zeros >= 16) {
+                out << "  times " << zeros << " db 0\n";
+                offset += zeros;
+                continue;
+            }
+            // Up to the next long run of 0s, 16 to a line
+            size_t run = offset;
+            while (run < end && run - offset < 16) {
+                zeros = 0;
+                while (run + zeros < end && global.bytes[run + zeros] == 0) zeros++;
+                if (zeros >= 16) break;
+                run++;
+            }
+            out << "  db ";
+            for (size_t i = offset; i < run; i++) {
+                out << (i == offset ? "" : ", ") << static_cast<int>(global.bytes[i]);
+            }
+            out << "\n";
+            offset = run;
+        }
+    }
+
+    if (m_options.print_stats && !globals.empty()) {
+        std::cerr << "stats: globals: " << in_rodata << " in .rodata, " << in_data << " in .data, " << in_bss
+                  << " in .bss\n";
+    }
 }
 
+void CodeGenerator::emit_blocks(const MFunction& function, const std::vector<size_t>& order, int saved_bytes,
+                                std::ostream& out) {
+    for (size_t n = 0; n < order.size(); n++) {
+        const MBlock& block = function.blocks[order[n]];
+        std::string next_label = n + 1 < order.size() ? function.blocks[order[n + 1]].label : "";
+
+        // Nothing ever jumps back to the entry block
+        if (order[n] > 0) {
+            out << block.label << ":\n";
+        }
+        if (m_options.profile_generate && block.profile_edge >= 0) {
+            emit_counter_increment(profile_edge_key(function.name, block.profile_edge), out);
+        }
+
+        for (size_t i = 0; i < block.instrs.size(); i++) {
+            const MInstr& instr = block.instrs[i];
+
+            // 'jcc next; jmp other' becomes 'j!cc other'
+            if (i + 1 < block.instrs.size() && block.instrs[i + 1].opcode == "jmp" &&
+                !inverted_jump(instr.opcode).empty() && instr.ops[0].label == next_label) {
+                out << "  " << inverted_jump(instr.opcode) << " " << block.instrs[i + 1].ops[0].label << "\n";
+                i++;
+                continue;
+            }
+
+            // A jump to the very next block is a no-op
+            if (instr.opcode == "jmp" && instr.ops[0].kind == MOperand::Kind::Label &&
+                instr.ops[0].label == next_label) {
+                continue;
+            }
 
-// --- Expression Visitors ---
+            // Dirty upper YMM halves make SSE code elsewhere slow
+            if (function.uses_ymm && (instr.opcode == "ret" || instr.opcode == "call")) {
+                out << "  vzeroupper\n";
+            }
 
-// This is the main "router" for expressions.
-void CodeGenerator::visit(ExprNode* node) {
-    if (auto num_literal = dynamic_cast<NumberLiteralNode*>(node)) {
-        visit(num_literal);
-    } else {
-        // We don't know how to compile this expression yet
-        std::cerr << "CodeGen Warning: Unknown expression type!" << std::endl;
+            // Every 'ret' gets the function "epilogue" in front of it
+            //    - restore rsp and the callee-saved registers
+            //    - pop rbp: Restore the old base pointer
+            if (instr.opcode == "ret") {
+                if (function.used_callee_saved.empty()) {
+                    out << "  mov rsp, rbp\n";
+                } else {
+                    out << "  lea rsp, [rbp - " << saved_bytes << "]\n";
+                    for (auto it = function.used_callee_saved.rbegin(); it != function.used_callee_saved.rend(); ++it) {
+                        out << "  pop " << reg_name(*it) << "\n";
+                    }
+                }
+                out << "  pop rbp\n";
+            }
+
+            out << "  " << format_instr(instr, function) << "\n";
+        }
     }
 }
 
-void CodeGenerator::visit(NumberLiteralNode* node) {
-    // This is the simplest code gen!
-    // We move the number's value into the 'rax' register.
-    // 'rax' is the standard register for return values in C-like languages.
-    m_output << "  mov rax, " << node->value << "\n";
-}
\ No newline at end of file
+// --- Profile Instrumentation ---
+
+void CodeGenerator::emit_counter_increment(const std::string& counter_name, std::ostream& out) {
+    // Every counter is one 64-bit slot in the __bolt_prof_counters table.
+    // Threads share it, so the increment is atomic.
+    int index = static_cast<int>(m_counter_names.size());
+    m_counter_names.push_back(counter_name);
+    out << "  lock inc qword [rel __bolt_prof_counters + " << index * 8 << "]\n";
+}
+
+void CodeGenerator::emit_profile_runtime() {
+    // This is the tiny runtime that writes the counters out when the
+    // program exits. It only uses raw syscalls, so it doesn't need libc.
+    // The file layout is described in profile.hpp.
+
+    // 1. The file header: magic, counter count and counter names.
+    //    It never changes, so we can build it at compile time.
+    size_t header_size = 16;
+    m_output << "\nsection .rodata\n";
+    m_output << "__bolt_prof_header:\n";
+    m_output << "  db \"" << PROFILE_MAGIC << "\"\n";
+    m_output << "  dq " << m_counter_names.size() << "\n";
+    for (const auto& name : m_counter_names) {
+        m_output << "  db \"" << name << "\", 0\n";
+        header_size += name.size() + 1;
+    }
+    if (header_size % 8 != 0) {
+        m_output << "  times " << 8 - header_size % 8 << " db 0\n";
+    }
+    m_output << "__bolt_prof_header_end:\n";
+
+    // The output path, as raw bytes so any file name is safe to embed
+    m_output << "__bolt_prof_path:\n";
+    m_output << "  db ";
+    for (unsigned char c : m_options.profile_generate_path) {
+        m_output << static_cast<int>(c) << ", ";
+    }
+    m_output << "0\n";
+
+    // 2. The counters themselves (zero-initialized)
+    m_output << "\nsection .bss\n";
+    m_output << "alignb 8\n";
+    m_output << "__bolt_prof_counters:\n";
+    m_output << "  resq " << std::max<size_t>(m_counter_names.size(), 1) << "\n";
+
+    // 3. The dump function:
+    //    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    //    write(fd, header, header_size)
+    //    write(fd, counters, 8 * num_counters)
+    //    close(fd)
+    m_output << "\nsection .text\n";
+    m_output << "__bolt_prof_dump:\n";
+    m_output << "  mov rax, 2\n";
+    m_output << "  lea rdi, [rel __bolt_prof_path]\n";
+    m_output << "  mov rsi, 577\n";
+    m_output << "  mov rdx, 420\n";
+    m_output << "  syscall\n";
+    m_output << "  test rax, rax\n";
+    m_output << "  js __bolt_prof_dump_done\n";
+    m_output << "  mov rdi, rax\n";
+    m_output << "  mov rax, 1\n";
+    m_output << "  lea rsi, [rel __bolt_prof_header]\n";
+    m_output << "  mov rdx, __bolt_prof_header_end - __bolt_prof_header\n";
+    m_output << "  syscall\n";
+    m_output << "  mov rax, 1\n";
+    m_output << "  lea rsi, [rel __bolt_prof_counters]\n";
+    m_output << "  mov rdx, " << m_counter_names.size() * 8 << "\n";
+    m_output << "  syscall\n";
+    m_output << "  mov rax, 3\n";
+    m_output << "  syscall\n";
+    m_output << "__bolt_prof_dump_done:\n";
+    m_output << "  ret\n";
+
+    // 4. Ask the C runtime to call the dump function at exit. (Without
+    //    one, with -ffreestanding, _start and exit() call it themselves.)
+    m_output << "\nsection .fini_array progbits alloc noexec write align=8\n";
+    m_output << "  dq __bolt_prof_dump\n";
+}
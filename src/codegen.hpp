@@ -1,34 +1,75 @@
 #pragma once
 
 #include "parser.hpp" // We need the AST definitions
+#include "options.hpp"
+#include "profile.hpp"
+#include "layout.hpp"
+#include "mir.hpp"
+#include <set>
 #include <string>
 #include <sstream>
+#include <vector>
 
-// This class walks the AST (from parser.hpp) and generates assembly code.
+// This class drives the back end and produces the final assembly:
+//   AST --(IRGenerator)--> IR --(InstructionSelector)--> MIR
+//       --(RegisterAllocator)--> NASM text
 class CodeGenerator {
 public:
-    // Takes the root of the AST
-    CodeGenerator(ProgramNode ast);
+    // Takes the root of the AST, the command-line options and the
+    // profile loaded with -fprofile-use (empty if there is none)
+    CodeGenerator(ProgramNode ast, CompilerOptions options = {}, ProfileData profile = {});
 
     // Main function to generate the assembly string
     std::string generate();
 
 private:
     ProgramNode m_ast;
+    CompilerOptions m_options;
+    ProfileData m_profile;
     std::stringstream m_output; // We build the assembly string here
+    std::stringstream m_cold_output; // The cold blocks of the function being emitted
+    std::stringstream m_constants;   // Its constants
 
-    // --- Visitor Functions ---
-    // We need one "visit" function for every AST node type.
-
-    // Statements
-    void visit(StmtNode* node);
-    void visit(FunctionDefNode* node);
-    void visit(ReturnStmtNode* node);
-    void visit(BlockStmtNode* node);
-    // (We'll add VarDeclNode, ForLoopNode, etc. later)
-
-    // Expressions
-    void visit(ExprNode* node);
-    void visit(NumberLiteralNode* node);
-    // (We'll add VarUsageNode, BinaryOpNode, etc. later)
-};
\ No newline at end of file
+    // Each function is generated into its own buffer, so we can decide
+    // the order they end up in the final file afterwards.
+    struct EmittedFunction {
+        std::string name;
+        std::string code;
+        std::string cold_code; // Its cold blocks, for .text.cold
+        std::string constants; // Its vector constants and jump tables, for .rodata
+    };
+    std::vector<EmittedFunction> m_functions;
+    // Read-only data: every function's constants, the string literals and
+    // the const globals
+    std::stringstream m_rodata;
+    std::stringstream m_data; // Globals with initial values
+    std::stringstream m_bss;  // Globals that start as all 0s
+
+    // Filled in from the calls in the IR; used to lay out the functions at the end
+    CallGraph m_call_graph;
+
+    // --- Emission ---
+    // Lays out the stack frame and prints the function: prologue, blocks,
+    // and an epilogue in front of every 'ret'. Its constants go to
+    // m_constants, its cold blocks (with -O1) to m_cold_output.
+    void emit_function(MFunction& function);
+    // Instances of generics often come out as the same machine code:
+    // swap<i64> and swap<u64> move the same 8 bytes. Drops each instance
+    // (in 'instances') that's the same as one before it, but for its own
+    // labels, and puts its name on that one's code as a second label.
+    void fold_identical_instances(const std::set<std::string>& instances);
+    // Prints the blocks 'order' lists, in that order, to 'out'
+    void emit_blocks(const MFunction& function, const std::vector<size_t>& order, int saved_bytes, std::ostream& out);
+    // Puts the string literals in m_rodata, each followed by a 0. One that
+    // ends another ("lo" and "hello") is stored inside it.
+    void emit_strings(const std::vector<std::string>& strings);
+    // Puts each global in m_rodata, m_data or m_bss
+    void emit_globals(const std::vector<GlobalVariable>& globals);
+
+    // --- Profile Instrumentation (-fprofile-generate) ---
+    // The names of all counters, in the order they live in memory.
+    std::vector<std::string> m_counter_names;
+
+    void emit_counter_increment(const std::string& counter_name, std::ostream& out);
+    void emit_profile_runtime();
+};
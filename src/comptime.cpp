@@ -0,0 +1,338 @@
+#include "comptime.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+
+ComptimeEvaluator::ComptimeEvaluator(const IRModule& module, ComptimeLimits limits)
+    : m_module(module), m_limits(limits) {
+    for (size_t i = 0; i < module.strings.size(); i++) {
+        m_symbol_addresses[string_label(i)] = RODATA_BASE + static_cast<int64_t>(m_rodata.size());
+        m_rodata.insert(m_rodata.end(), module.strings[i].begin(), module.strings[i].end());
+        m_rodata.push_back(0);
+    }
+    for (const GlobalVariable& global : module.globals) {
+        if (!global.read_only) continue;
+        m_rodata.resize((m_rodata.size() + global.align - 1) / global.align * global.align);
+        m_symbol_addresses[global.symbol] = RODATA_BASE + static_cast<int64_t>(m_rodata.size());
+        m_rodata.insert(m_rodata.end(), global.bytes.begin(), global.bytes.end());
+    }
+    // The addresses in them, now that everything has one. One of a global
+    // that isn't const stays null.
+    for (const GlobalVariable& global : module.globals) {
+        if (!global.read_only) continue;
+        for (const GlobalVariable::Relocation& relocation : global.relocations) {
+            const int64_t* target = symbol_address(relocation.symbol);
+            int64_t address = target ? *target + relocation.addend : 0;
+            std::memcpy(&m_rodata[m_symbol_addresses[global.symbol] - RODATA_BASE + relocation.offset], &address, 8);
+        }
+    }
+}
+
+const int64_t* ComptimeEvaluator::symbol_address(const std::string& symbol) const {
+    auto it = m_symbol_addresses.find(symbol);
+    return it == m_symbol_addresses.end() ? nullptr : &it->second;
+}
+
+const IRFunction& ComptimeEvaluator::find_function(const std::string& name) const {
+    for (const auto& function : m_module.functions) {
+        if (function->name == name) return *function;
+    }
+    throw std::runtime_error("Unknown function '" + name + "'");
+}
+
+int64_t ComptimeEvaluator::call(const std::string& function, const std::vector<int64_t>& arguments) {
+    return call(find_function(function), arguments);
+}
+
+int64_t ComptimeEvaluator::call(const IRFunction& function, const std::vector<int64_t>& arguments) {
+    m_steps = 0;
+    m_depth = 0;
+    m_memory = 0;
+    m_heap.clear();
+    return run(function, arguments);
+}
+
+size_t ComptimeEvaluator::heap_offset(const IRFunction& function, int64_t address, int64_t bytes) {
+    uint64_t offset = static_cast<uint64_t>(address) - HEAP_BASE;
+    if (offset >= m_heap.size() || m_heap.size() - offset < static_cast<uint64_t>(bytes)) {
+        throw std::runtime_error("Can't evaluate '" + function.name + "' at compile time: it accesses address " +
+                                 std::to_string(address) + ", which isn't in an array");
+    }
+    m_lowest_access = std::min(m_lowest_access, static_cast<int64_t>(offset));
+    return static_cast<size_t>(offset);
+}
+
+const uint8_t* ComptimeEvaluator::rodata(int64_t address, int64_t bytes) const {
+    uint64_t offset = static_cast<uint64_t>(address) - RODATA_BASE;
+    if (offset >= m_rodata.size() || m_rodata.size() - offset < static_cast<uint64_t>(bytes)) return nullptr;
+    return &m_rodata[offset];
+}
+
+int64_t ComptimeEvaluator::run(const IRFunction& function, const std::vector<int64_t>& arguments) {
+    auto fail = [&](const std::string& why) -> std::runtime_error {
+        return std::runtime_error("Can't evaluate '" + function.name + "' at compile time: " + why);
+    };
+    // Comptime functions are pure, so a call we've seen has the same result
+    // (this also makes naive recursion like fib() linear)
+    auto key = std::make_pair(function.name, arguments);
+    auto cached = m_cache.find(key);
+    if (cached != m_cache.end()) return cached->second;
+
+    if (static_cast<int>(arguments.size()) != function.num_params) {
+        throw fail("it takes " + std::to_string(function.num_params) + " arguments");
+    }
+    if (++m_depth > m_limits.max_depth) {
+        throw fail("more than " + std::to_string(m_limits.max_depth) + " nested calls");
+    }
+
+    // One slot per value number
+    int64_t frame_bytes = static_cast<int64_t>(function.next_value_id) * sizeof(int64_t);
+    m_memory += frame_bytes;
+    if (m_memory > m_limits.max_memory) {
+        throw fail("it needs more than " + std::to_string(m_limits.max_memory >> 20) + " MB");
+    }
+    std::vector<int64_t> values(function.next_value_id, 0);
+
+    // This call's arrays go on top of the heap, one per stackaddr (a loop
+    // reuses it, like the generated code does)
+    size_t heap_base = m_heap.size();
+    std::unordered_map<const Instr*, int64_t> arrays;
+    int64_t caller_lowest_access = m_lowest_access;
+    m_lowest_access = INT64_MAX;
+
+    BasicBlock* block = function.blocks[0].get();
+    BasicBlock* from = nullptr;
+    while (true) {
+        // Phis read the values from the end of the block we came from, all
+        // at once (one phi may feed another)
+        std::vector<std::pair<int, int64_t>> phi_values;
+        for (Instr* phi : block->phis()) {
+            phi_values.push_back({phi->id, values[phi->incoming_value(from)->id]});
+        }
+        for (auto& entry : phi_values) values[entry.first] = entry.second;
+
+        for (auto& owned : block->instrs) {
+            Instr* instr = owned.get();
+            if (instr->is_phi()) continue;
+            if (++m_steps > m_limits.max_steps) {
+                throw fail("it runs more than " + std::to_string(m_limits.max_steps) + " instructions");
+            }
+
+            auto operand = [&](size_t i) { return values[instr->operands[i]->id]; };
+            int64_t& result = values[instr->id];
+            switch (instr->op) {
+                case Opcode::Const:
+                    result = instr->imm;
+                    break;
+                case Opcode::Param:
+                    result = arguments[instr->imm];
+                    break;
+                case Opcode::Neg:
+                case Opcode::Popcnt:
+                case Opcode::Clz:
+                case Opcode::Ctz:
+                case Opcode::Bswap:
+                    result = fold_unary(instr->op, operand(0));
+                    break;
+                case Opcode::SExt:
+                case Opcode::ZExt:
+                    result = fold_extend(instr->op, static_cast<int>(instr->imm), operand(0));
+                    break;
+                case Opcode::Add:
+                case Opcode::Sub:
+                case Opcode::Mul:
+                case Opcode::SDiv:
+                case Opcode::SRem:
+                case Opcode::UDiv:
+                case Opcode::URem:
+                case Opcode::Rotl:
+                case Opcode::Rotr:
+                    if (!fold_binary(instr->op, operand(0), operand(1), result)) {
+                        throw fail("division by zero (or INT64_MIN / -1)");
+                    }
+                    break;
+                case Opcode::Cmp:
+                    result = evaluate_cond(instr->cond, operand(0), operand(1)) ? 1 : 0;
+                    break;
+                case Opcode::BitTest:
+                    result = (static_cast<uint64_t>(instr->imm) >> (operand(0) & 63)) & 1;
+                    break;
+                case Opcode::Call: {
+                    const IRFunction& callee = find_function(instr->symbol);
+                    if (!callee.is_comptime) {
+                        throw fail("it calls '" + instr->symbol + "', which isn't comptime");
+                    }
+                    std::vector<int64_t> callee_arguments;
+                    for (size_t i = 0; i < instr->operands.size(); i++) callee_arguments.push_back(operand(i));
+                    result = run(callee, callee_arguments);
+                    break;
+                }
+                case Opcode::StackAddr: {
+                    auto it = arrays.find(instr);
+                    if (it == arrays.end()) {
+                        size_t offset = (m_heap.size() + 15) / 16 * 16;
+                        m_memory += static_cast<int64_t>(offset + instr->imm - m_heap.size());
+                        if (m_memory > m_limits.max_memory) {
+                            throw fail("it needs more than " + std::to_string(m_limits.max_memory >> 20) + " MB");
+                        }
+                        m_heap.resize(offset + instr->imm);
+                        it = arrays.emplace(instr, HEAP_BASE + static_cast<int64_t>(offset)).first;
+                    }
+                    result = it->second;
+                    break;
+                }
+                case Opcode::GlobalAddr: {
+                    const int64_t* address = symbol_address(instr->symbol);
+                    if (!address) throw fail("it uses '" + instr->symbol + "', which isn't const");
+                    result = *address;
+                    break;
+                }
+                case Opcode::ZLoad:
+                case Opcode::SLoad: {
+                    int bytes = static_cast<int>(instr->imm / 8);
+                    uint64_t loaded = 0;
+                    const uint8_t* source = rodata(operand(0), bytes);
+                    if (!source) source = &m_heap[heap_offset(function, operand(0), bytes)];
+                    std::memcpy(&loaded, source, bytes); // Little-endian
+                    result = bytes == 8 ? static_cast<int64_t>(loaded)
+                                        : fold_extend(instr->op == Opcode::SLoad ? Opcode::SExt : Opcode::ZExt,
+                                                      bytes * 8, static_cast<int64_t>(loaded));
+                    break;
+                }
+                case Opcode::Store: {
+                    int bytes = static_cast<int>(instr->imm / 8);
+                    if (rodata(operand(0), bytes)) throw fail("it writes to a string literal");
+                    int64_t stored = operand(1);
+                    std::memcpy(&m_heap[heap_offset(function, operand(0), bytes)], &stored, bytes);
+                    break;
+                }
+                case Opcode::MemZero:
+                    if (rodata(operand(0), instr->imm)) throw fail("it writes to a string literal");
+                    std::fill_n(m_heap.begin() + heap_offset(function, operand(0), instr->imm), instr->imm, 0);
+                    break;
+                case Opcode::BoundsCheck:
+                    if (static_cast<uint64_t>(operand(0)) >= static_cast<uint64_t>(operand(1))) {
+                        throw fail("index " + std::to_string(operand(0)) + " is out of bounds (the array has " +
+                                   std::to_string(operand(1)) + " elements)");
+                    }
+                    break;
+                case Opcode::Prefetch: // Nothing to bring in
+                    break;
+                case Opcode::Ret:
+                    m_depth--;
+                    m_memory -= frame_bytes + static_cast<int64_t>(m_heap.size() - heap_base);
+                    m_heap.resize(heap_base);
+                    // Only memory of its own: the same arguments give the same result
+                    if (m_lowest_access >= static_cast<int64_t>(heap_base)) m_cache[key] = operand(0);
+                    m_lowest_access = std::min(caller_lowest_access, m_lowest_access);
+                    return operand(0);
+                case Opcode::Br:
+                    from = block;
+                    block = instr->targets[0];
+                    break;
+                case Opcode::CondBr:
+                    from = block;
+                    block = instr->targets[operand(0) != 0 ? 0 : 1];
+                    break;
+                case Opcode::Switch: {
+                    from = block;
+                    block = instr->targets[0];
+                    for (const auto& entry : instr->cases) {
+                        if (entry.first == operand(0)) block = instr->targets[entry.second];
+                    }
+                    break;
+                }
+                default:
+                    throw fail("it uses vectors");
+            }
+            if (instr->is_terminator()) break;
+        }
+    }
+}
+
+int fold_comptime_calls(IRModule& module, ComptimeLimits limits) {
+    // The globals first: a comptime function may read them. A fresh
+    // evaluator for each one sees the ones before it.
+    for (size_t i = 0; i < module.initializers.size();) {
+        const std::string symbol = module.initializers[i].symbol;
+        auto global = std::find_if(module.globals.begin(), module.globals.end(),
+                                   [&](const GlobalVariable& candidate) { return candidate.symbol == symbol; });
+        ComptimeEvaluator evaluator(module, limits);
+        for (; i < module.initializers.size() && module.initializers[i].symbol == symbol; i++) {
+            const GlobalInitializer& initializer = module.initializers[i];
+            if (global == module.globals.end()) continue; // An unused library global
+            int64_t value = evaluator.call(*initializer.function, {});
+            std::memcpy(&global->bytes[initializer.offset], &value, initializer.bytes); // Little-endian
+        }
+    }
+    module.initializers.clear();
+
+    ComptimeEvaluator evaluator(module, limits);
+    int folded = 0;
+    for (auto& function : module.functions) {
+        for (auto& block : function->blocks) {
+            for (auto& instr : block->instrs) {
+                if (instr->op != Opcode::Call) continue;
+                const IRFunction* callee = nullptr;
+                for (const auto& candidate : module.functions) {
+                    if (candidate->name == instr->symbol) callee = candidate.get();
+                }
+                if (!callee || !callee->is_comptime) continue;
+
+                std::vector<int64_t> arguments;
+                bool constant = true;
+                for (Instr* operand : instr->operands) {
+                    if (operand->op == Opcode::GlobalAddr && evaluator.symbol_address(operand->symbol)) {
+                        arguments.push_back(*evaluator.symbol_address(operand->symbol));
+                        continue;
+                    }
+                    constant = constant && operand->is_const();
+                    if (constant) arguments.push_back(operand->imm);
+                }
+                if (!constant) continue;
+
+                // The call becomes the constant, in place
+                int64_t result = evaluator.call(instr->symbol, arguments);
+                instr->op = Opcode::Const;
+                instr->imm = result;
+                instr->symbol.clear();
+                instr->operands.clear();
+                folded++;
+            }
+        }
+    }
+
+    // What's left runs: the functions that aren't comptime, and the
+    // comptime ones they (or the globals' initializers) still call or
+    // take the address of
+    std::set<std::string> used;
+    std::vector<std::string> worklist;
+    for (const auto& function : module.functions) {
+        if (!function->is_comptime || function->is_exported) worklist.push_back(function->name);
+    }
+    for (const GlobalVariable& global : module.globals) {
+        for (const GlobalVariable::Relocation& relocation : global.relocations) worklist.push_back(relocation.symbol);
+    }
+    while (!worklist.empty()) {
+        std::string name = worklist.back();
+        worklist.pop_back();
+        if (!used.insert(name).second) continue;
+        for (const auto& function : module.functions) {
+            if (function->name != name) continue;
+            for (const auto& block : function->blocks) {
+                for (const auto& instr : block->instrs) {
+                    if (instr->op == Opcode::Call || instr->op == Opcode::GlobalAddr) worklist.push_back(instr->symbol);
+                }
+            }
+        }
+    }
+    auto only_at_compile_time = [&](const std::unique_ptr<IRFunction>& function) {
+        return function->is_comptime && !used.count(function->name);
+    };
+    module.functions.erase(std::remove_if(module.functions.begin(), module.functions.end(), only_at_compile_time),
+                           module.functions.end());
+    return folded;
+}
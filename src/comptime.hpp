@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// --- Compile-Time Evaluation ---
+// Functions declared 'comptime' are run by the compiler: every call to
+// one whose arguments are constants is replaced with its result, so
+//
+//     comptime int table_size() { ... }
+//     int main() { return table_size(); }
+//
+// compiles to 'mov eax, <result>'. The evaluator interprets the SSA IR
+// straight out of IRGenerator, with the same wrapping arithmetic as the
+// generated code (fold_binary/fold_unary). A comptime function may only
+// call other comptime functions. Results are cached, since comptime
+// functions are pure, unless the call read or wrote memory its caller
+// owns (an array passed by pointer). A string literal or const global
+// counts as a constant argument. Calls whose arguments aren't constants stay
+// ordinary calls, made at run time.
+//
+// Arrays live in a byte heap of the evaluator's own, stacked like the
+// frames that declared them; addresses into it start at HEAP_BASE, so
+// null is never valid. The module's string literals and const globals
+// are in a read-only area of their own at RODATA_BASE. Globals that
+// aren't const can change at run time, so a call that uses one can't be
+// evaluated.
+//
+// Global initializers are evaluated the same way, so
+//
+//     const i64 squares[4] = {square(0), square(1), square(2), square(3)};
+//
+// is a table in .rodata, and a global that isn't const starts out in
+// .data with what they computed.
+//
+// A call that can't be evaluated (division by zero, an index out of
+// bounds, a load or store outside the heap, a store to a string literal,
+// vector code, or hitting one of the limits) is a compile error:
+// 'comptime' promises the result is known at compile time.
+
+struct ComptimeLimits {
+    int64_t max_steps = 50'000'000;    // IR instructions executed, per top-level call
+    int max_depth = 2'000;             // Nested calls
+    int64_t max_memory = 64 << 20;     // Bytes of values and arrays held by the live frames
+};
+
+class ComptimeEvaluator {
+public:
+    ComptimeEvaluator(const IRModule& module, ComptimeLimits limits = {});
+
+    // The result of calling 'function' with 'arguments'. Throws
+    // std::runtime_error if it can't be computed.
+    int64_t call(const std::string& function, const std::vector<int64_t>& arguments);
+    int64_t call(const IRFunction& function, const std::vector<int64_t>& arguments);
+
+    // Where the evaluator keeps the string literal or const global
+    // 'symbol', or null if it doesn't have it
+    const int64_t* symbol_address(const std::string& symbol) const;
+
+private:
+    const IRModule& m_module;
+    ComptimeLimits m_limits;
+    std::map<std::pair<std::string, std::vector<int64_t>>, int64_t> m_cache;
+
+    // Usage of the call in progress
+    int64_t m_steps = 0;
+    int m_depth = 0;
+    int64_t m_memory = 0;
+
+    static const int64_t HEAP_BASE = 0x10000;
+    std::vector<uint8_t> m_heap;
+    // The lowest heap offset the running call (and its callees) touched
+    int64_t m_lowest_access = 0;
+
+    // The heap offset of 'bytes' bytes at 'address'; throws if they're outside it
+    size_t heap_offset(const IRFunction& function, int64_t address, int64_t bytes);
+
+    static const int64_t RODATA_BASE = int64_t{1} << 40;
+    std::vector<uint8_t> m_rodata;
+    std::unordered_map<std::string, int64_t> m_symbol_addresses;
+    // The read-only bytes at 'address', or null if it isn't in the area
+    const uint8_t* rodata(int64_t address, int64_t bytes) const;
+
+    const IRFunction& find_function(const std::string& name) const;
+    int64_t run(const IRFunction& function, const std::vector<int64_t>& arguments);
+};
+
+// Fills in the globals' initializers that call functions (see
+// GlobalInitializer), in order, so each can read the const globals
+// before it. Then it replaces each call to a comptime function in
+// 'module' with a constant, and drops the comptime functions nothing
+// calls at run time anymore (unless they're exported). Returns how many
+// calls were folded.
+int fold_comptime_calls(IRModule& module, ComptimeLimits limits = {});
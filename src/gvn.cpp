@@ -0,0 +1,236 @@
+#include "gvn.hpp"
+#include "cfg.hpp"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include <tuple>
+
+// Everything that makes two instructions compute the same value
+struct ValueKey {
+    Opcode op;
+    ValueType type;
+    int64_t imm;
+    CondCode cond;
+    std::vector<int64_t> lanes;
+    std::string symbol; // GlobalAddr: which label
+    std::vector<Instr*> operands;
+    std::vector<BasicBlock*> targets; // Phis: the same values from the same blocks
+
+    bool operator<(const ValueKey& other) const {
+        return std::tie(op, type, imm, cond, lanes, symbol, operands, targets) <
+               std::tie(other.op, other.type, other.imm, other.cond, other.lanes, other.symbol, other.operands,
+                        other.targets);
+    }
+};
+
+static bool is_commutative(const Instr* instr) {
+    switch (instr->op) {
+        case Opcode::Add:
+        case Opcode::Mul:
+        case Opcode::VAdd:
+        case Opcode::VMul:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static ValueKey make_key(const Instr* instr) {
+    ValueKey key{instr->op, instr->type, instr->imm, instr->cond, instr->lanes, instr->symbol, instr->operands,
+                 instr->targets};
+
+    // Order the operands by value number, so 'a + b' and 'b + a' match.
+    // A comparison can swap its operands too if it swaps its condition.
+    if (key.operands.size() == 2 && key.operands[0]->id > key.operands[1]->id) {
+        if (is_commutative(instr)) {
+            std::swap(key.operands[0], key.operands[1]);
+        } else if (instr->op == Opcode::Cmp) {
+            std::swap(key.operands[0], key.operands[1]);
+            key.cond = swap_cond(key.cond);
+        }
+    }
+    return key;
+}
+
+// --- Memory ---
+
+// Where an address points: 'offset' bytes past 'root', a stackaddr, a
+// globaladdr or any other pointer. The offset isn't known if an index
+// was added (then 'root' is still right if it's a slot or a global).
+struct Location {
+    Instr* root;
+    int64_t offset = 0;
+    bool known_offset = true;
+};
+
+// How many bytes a load, store or memzero reads or writes
+static int64_t bytes_accessed(const Instr* instr) {
+    switch (instr->op) {
+        case Opcode::VLoad:   return vector_bytes(instr->type);
+        case Opcode::VStore:  return vector_bytes(instr->operands[1]->type);
+        case Opcode::MemZero: return instr->imm;
+        default:              return instr->imm / 8;
+    }
+}
+
+static bool is_identified(const Instr* root) {
+    return root->op == Opcode::StackAddr || root->op == Opcode::GlobalAddr;
+}
+
+static Location locate(Instr* address) {
+    if ((address->op == Opcode::Add || address->op == Opcode::Sub) && address->operands[1]->is_const()) {
+        Location location = locate(address->operands[0]);
+        location.offset += address->op == Opcode::Add ? address->operands[1]->imm : -address->operands[1]->imm;
+        return location;
+    }
+    if (address->op == Opcode::Add) {
+        // A slot or global plus an index
+        Location left = locate(address->operands[0]);
+        Location right = locate(address->operands[1]);
+        if (is_identified(left.root) != is_identified(right.root)) {
+            return {is_identified(left.root) ? left.root : right.root, 0, false};
+        }
+    }
+    return {address};
+}
+
+// The stack slots whose address never leaves the function: it's only
+// loaded from, stored to and zeroed, through itself plus offsets and
+// indices. Nothing but those loads and stores can read or write them.
+static std::set<Instr*> private_slots(IRFunction& function) {
+    std::map<Instr*, Instr*> slot_of; // Address -> the stackaddr it points into
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto& block : function.blocks) {
+            for (auto& instr : block->instrs) {
+                Instr* slot = nullptr;
+                if (instr->op == Opcode::StackAddr) {
+                    slot = instr.get();
+                } else if (instr->op == Opcode::Add || instr->op == Opcode::Sub) {
+                    // One side derived from a slot, the other an offset or index
+                    auto left = slot_of.find(instr->operands[0]);
+                    auto right = slot_of.find(instr->operands[1]);
+                    if (left != slot_of.end() && right == slot_of.end()) slot = left->second;
+                    if (instr->op == Opcode::Add && left == slot_of.end() && right != slot_of.end()) slot = right->second;
+                }
+                if (slot && slot_of.emplace(instr.get(), slot).second) changed = true;
+            }
+        }
+    }
+    std::set<Instr*> escaped;
+    for (auto& block : function.blocks) {
+        for (auto& instr : block->instrs) {
+            for (size_t i = 0; i < instr->operands.size(); i++) {
+                auto slot = slot_of.find(instr->operands[i]);
+                if (slot == slot_of.end()) continue;
+                bool address = i == 0 && (instr->is_load() || instr->op == Opcode::Store || instr->op == Opcode::VStore ||
+                                          instr->op == Opcode::MemZero || instr->op == Opcode::Prefetch);
+                if (!address && !slot_of.count(instr.get())) escaped.insert(slot->second);
+            }
+        }
+    }
+    std::set<Instr*> slots;
+    for (const auto& entry : slot_of) {
+        if (entry.first == entry.second && !escaped.count(entry.first)) slots.insert(entry.first);
+    }
+    return slots;
+}
+
+class ValueNumbering {
+public:
+    explicit ValueNumbering(IRFunction& function)
+        : m_function(function), m_domtree(function), m_private_slots(private_slots(function)) {}
+
+    int run() {
+        visit(m_function.blocks[0].get());
+        m_function.remove_dead_instructions();
+        return m_removed;
+    }
+
+private:
+    IRFunction& m_function;
+    DominatorTree m_domtree;
+    // The values available in the block being visited: those of the
+    // blocks that dominate it
+    std::map<ValueKey, Instr*> m_available;
+    std::set<Instr*> m_private_slots;
+    int m_removed = 0;
+
+    // True if 'a_bytes' bytes at 'a' and 'b_bytes' bytes at 'b' may overlap
+    bool may_alias(Instr* a, int64_t a_bytes, Instr* b, int64_t b_bytes) const {
+        Location x = locate(a);
+        Location y = locate(b);
+        if (x.root == y.root) {
+            return !x.known_offset || !y.known_offset ||
+                   (x.offset < y.offset + b_bytes && y.offset < x.offset + a_bytes);
+        }
+        // Two slots or globals never overlap, and a private slot is only
+        // reached through its own stackaddr
+        if (is_identified(x.root) && is_identified(y.root)) return false;
+        return !m_private_slots.count(x.root) && !m_private_slots.count(y.root);
+    }
+
+    bool is_private(Instr* address) const { return m_private_slots.count(locate(address).root) > 0; }
+
+    void visit(BasicBlock* block) {
+        std::vector<ValueKey> added;
+        // The loads in this block so far, by what and where they read,
+        // until something may write there
+        std::map<std::tuple<Opcode, int64_t, ValueType, Instr*>, Instr*> loads;
+        for (auto& instr : block->instrs) {
+            if (instr->is_load()) {
+                auto key = std::make_tuple(instr->op, instr->imm, instr->type, instr->operands[0]);
+                auto it = loads.find(key);
+                if (it != loads.end()) {
+                    m_function.replace_all_uses(instr.get(), it->second);
+                    m_removed++;
+                } else {
+                    loads.emplace(key, instr.get());
+                }
+                continue;
+            }
+            if (instr->op == Opcode::Store || instr->op == Opcode::VStore || instr->op == Opcode::MemZero) {
+                for (auto it = loads.begin(); it != loads.end();) {
+                    Instr* load = it->second;
+                    bool clobbered = may_alias(instr->operands[0], bytes_accessed(instr.get()), load->operands[0],
+                                               bytes_accessed(load));
+                    it = clobbered ? loads.erase(it) : std::next(it);
+                }
+                continue;
+            }
+            if (instr->op == Opcode::Call) {
+                // It may write anything but the private slots
+                for (auto it = loads.begin(); it != loads.end();) {
+                    it = is_private(it->second->operands[0]) ? std::next(it) : loads.erase(it);
+                }
+                continue;
+            }
+            // Every stackaddr is an array of its own
+            if (instr->has_side_effects() || instr->op == Opcode::StackAddr) continue;
+            // The instructions it uses were visited already (they
+            // dominate it), so its operands point at their leaders by now.
+            // Only a phi's incoming values from back edges may not.
+            ValueKey key = make_key(instr.get());
+            auto it = m_available.find(key);
+            if (it != m_available.end()) {
+                m_function.replace_all_uses(instr.get(), it->second);
+                m_removed++;
+            } else {
+                m_available.emplace(key, instr.get());
+                added.push_back(std::move(key));
+            }
+        }
+
+        for (BasicBlock* child : m_domtree.children(block)) {
+            visit(child);
+        }
+
+        // Leaving the subtree: its values aren't available to the siblings
+        for (const ValueKey& key : added) m_available.erase(key);
+    }
+};
+
+int global_value_numbering(IRFunction& function) {
+    return ValueNumbering(function).run();
+}
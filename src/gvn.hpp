@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ir.hpp"
+
+// --- Global Value Numbering ---
+// Finds instructions that compute a value some dominating instruction
+// already computed, and replaces them with it:
+//
+//     x = a * b + a * b      ->   t = a * b; x = t + t
+//
+// Two instructions get the same number if they have the same opcode,
+// type and attributes (constant, condition, lane, ...) and the same
+// operands, up to order for commutative operations. The function is
+// walked along the dominator tree, so only values that are available on
+// every path are reused. Calls are never merged, and neither are stack
+// slots (each array needs its own).
+//
+// Loads are merged within a block: a load from the same address as an
+// earlier one reads the same value, unless something in between may have
+// written there. A store may write what it can't be told apart from:
+// two different slots or globals, or the same one at offsets that don't
+// overlap, are apart. A call may write anything but a slot whose address
+// never leaves the function (only loaded from and stored to); nothing
+// else can reach one of those, so a store through a pointer can't either.
+//
+// It doesn't fold anything itself; simplify_function (loopopt.hpp) runs
+// right after and folds what became constant.
+//
+// Returns how many instructions were removed.
+int global_value_numbering(IRFunction& function);
@@ -0,0 +1,117 @@
+#include "instcache.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+InstanceCache::InstanceCache(std::string directory, const CompilerOptions& options)
+    : m_directory(std::move(directory)) {
+    if (!enabled()) return;
+    mkdir(m_directory.c_str(), 0777); // Fine if it's there already
+
+    // A rebuilt compiler may generate different code
+    std::stringstream header;
+    struct stat compiler;
+    if (stat("/proc/self/exe", &compiler) == 0) {
+        header << "compiler " << compiler.st_size << " " << compiler.st_mtime << "\n";
+    }
+    const TargetFeatures& target = options.target;
+    header << "-O" << options.opt_level << " avx2 " << target.avx2 << " popcnt " << target.popcnt << " lzcnt "
+           << target.lzcnt << " bmi " << target.bmi << " bmi2 " << target.bmi2 << "\n";
+    m_header = header.str();
+}
+
+std::string InstanceCache::key(const IRFunction& function, const CalleeTable& callees) const {
+    std::stringstream key;
+    key << m_header << function.name << " " << function.is_exported << function.is_cold << function.is_comptime
+        << " " << function.num_params << "\n";
+    std::vector<std::string> called;
+    for (const auto& block : function.blocks) {
+        key << "bb" << block->id << " " << std::hexfloat << block->frequency << std::defaultfloat << "\n";
+        for (const auto& instr : block->instrs) {
+            key << " %" << instr->id << " " << static_cast<int>(instr->op) << " " << static_cast<int>(instr->type)
+                << " " << instr->imm << " " << static_cast<int>(instr->cond) << " " << instr->symbol;
+            for (Instr* operand : instr->operands) key << " %" << operand->id;
+            for (BasicBlock* target : instr->targets) key << " bb" << target->id;
+            for (int64_t lane : instr->lanes) key << " <" << lane;
+            for (const auto& entry : instr->cases) key << " " << entry.first << ":" << entry.second;
+            for (uint32_t weight : instr->weights) key << " w" << weight;
+            key << "\n";
+            if (instr->op == Opcode::Call) called.push_back(instr->symbol);
+        }
+    }
+    // What's known about each callee goes into the code around the call
+    for (const std::string& symbol : called) {
+        auto callee = callees.find(symbol);
+        key << "callee " << symbol;
+        if (callee != callees.end()) {
+            key << " " << static_cast<int>(callee->second.convention);
+            for (int reg : callee->second.clobbers) key << " " << reg;
+        }
+        key << "\n";
+    }
+    return key.str();
+}
+
+std::string InstanceCache::path(const std::string& key) const {
+    // 64-bit FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ull;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.inst", static_cast<unsigned long long>(hash));
+    return m_directory + name;
+}
+
+// An entry is "BOLTINST\n", then the key, the code, the cold code and the
+// constants, each as its length in bytes, '\n' and the bytes, then the
+// clobbers as a count and the registers
+bool InstanceCache::load(const std::string& key, CachedInstance& instance) const {
+    std::ifstream file(path(key), std::ios::binary);
+    if (!file.is_open()) return false;
+    std::string magic;
+    std::getline(file, magic);
+    if (magic != "BOLTINST") return false;
+    auto read_string = [&](std::string& text) {
+        size_t length = 0;
+        if (!(file >> length) || file.get() != '\n') return false;
+        text.resize(length);
+        return static_cast<bool>(file.read(&text[0], static_cast<std::streamsize>(length)));
+    };
+    std::string stored_key;
+    if (!read_string(stored_key) || stored_key != key) return false;
+    CachedInstance loaded;
+    if (!read_string(loaded.code) || !read_string(loaded.cold_code) || !read_string(loaded.constants)) return false;
+    size_t count = 0;
+    if (!(file >> count)) return false;
+    loaded.clobbers.resize(count);
+    for (int& reg : loaded.clobbers) {
+        if (!(file >> reg)) return false;
+    }
+    instance = std::move(loaded);
+    return true;
+}
+
+void InstanceCache::store(const std::string& key, const CachedInstance& instance) const {
+    std::string final_path = path(key);
+    std::string temporary = final_path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file.is_open()) return;
+        file << "BOLTINST\n";
+        for (const std::string* text : {&key, &instance.code, &instance.cold_code, &instance.constants}) {
+            file << text->size() << "\n" << *text;
+        }
+        file << instance.clobbers.size();
+        for (int reg : instance.clobbers) file << " " << reg;
+        file << "\n";
+        if (!file) {
+            file.close();
+            std::remove(temporary.c_str());
+            return;
+        }
+    }
+    if (std::rename(temporary.c_str(), final_path.c_str()) != 0) std::remove(temporary.c_str());
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ir.hpp"
+#include "isel.hpp"
+#include "options.hpp"
+#include <string>
+#include <vector>
+
+// --- Instance Cache (-finstance-cache=<dir>) ---
+// Each file is compiled on its own, so the instances of a generic that
+// many files use are compiled again in every one of them. With a cache
+// directory, the machine code of each instance is kept there, and a
+// compile that needs the same instance again takes it from there: no
+// instruction selection, register allocation or emission.
+//
+// Two instances are the same when everything their code depends on is:
+// the IR after the IR passes (block frequencies and branch weights
+// included), the target options, what each function it calls
+// overwrites, and the compiler itself. All of that, written out, is the
+// key. An entry is a file named after the key's hash, which holds the
+// key too, so keys with the same hash can't be mixed up. Entries are
+// written to a file of their own and renamed into place, so compiles
+// running at the same time only ever see whole ones.
+//
+// Instances are named after their types, and their labels after their
+// names, so the same instance in two files is the same code.
+
+// What a compiled instance adds to the assembly, and what it overwrites
+struct CachedInstance {
+    std::string code;
+    std::string cold_code;
+    std::string constants;
+    std::vector<int> clobbers;
+};
+
+class InstanceCache {
+public:
+    // An empty 'directory' turns the cache off
+    InstanceCache(std::string directory, const CompilerOptions& options);
+
+    bool enabled() const { return !m_directory.empty(); }
+
+    // The key of 'function', given what the functions it calls overwrite
+    std::string key(const IRFunction& function, const CalleeTable& callees) const;
+    // Fills in 'instance' and returns true if 'key' has an entry
+    bool load(const std::string& key, CachedInstance& instance) const;
+    // Adds an entry (quietly doing nothing if it can't be written)
+    void store(const std::string& key, const CachedInstance& instance) const;
+
+private:
+    std::string m_directory;
+    std::string m_header; // What every key starts with: the compiler and the options
+    std::string path(const std::string& key) const;
+};
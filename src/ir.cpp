@@ -0,0 +1,784 @@
+#include "ir.hpp"
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+// --- Condition Codes ---
+
+CondCode negate_cond(CondCode cc) {
+    switch (cc) {
+        case CondCode::EQ: return CondCode::NE;
+        case CondCode::NE: return CondCode::EQ;
+        case CondCode::LT: return CondCode::GE;
+        case CondCode::LE: return CondCode::GT;
+        case CondCode::GT: return CondCode::LE;
+        case CondCode::GE: return CondCode::LT;
+        case CondCode::ULT: return CondCode::UGE;
+        case CondCode::ULE: return CondCode::UGT;
+        case CondCode::UGT: return CondCode::ULE;
+        case CondCode::UGE: return CondCode::ULT;
+    }
+    return cc;
+}
+
+CondCode swap_cond(CondCode cc) {
+    switch (cc) {
+        case CondCode::LT: return CondCode::GT;
+        case CondCode::LE: return CondCode::GE;
+        case CondCode::GT: return CondCode::LT;
+        case CondCode::GE: return CondCode::LE;
+        case CondCode::ULT: return CondCode::UGT;
+        case CondCode::ULE: return CondCode::UGE;
+        case CondCode::UGT: return CondCode::ULT;
+        case CondCode::UGE: return CondCode::ULE;
+        default:           return cc; // EQ and NE don't care about order
+    }
+}
+
+bool evaluate_cond(CondCode cc, int64_t a, int64_t b) {
+    uint64_t ua = static_cast<uint64_t>(a), ub = static_cast<uint64_t>(b);
+    switch (cc) {
+        case CondCode::EQ: return a == b;
+        case CondCode::NE: return a != b;
+        case CondCode::LT: return a < b;
+        case CondCode::LE: return a <= b;
+        case CondCode::GT: return a > b;
+        case CondCode::GE: return a >= b;
+        case CondCode::ULT: return ua < ub;
+        case CondCode::ULE: return ua <= ub;
+        case CondCode::UGT: return ua > ub;
+        case CondCode::UGE: return ua >= ub;
+    }
+    return false;
+}
+
+bool fold_binary(Opcode op, int64_t lhs, int64_t rhs, int64_t& result) {
+    // We do the math on unsigned numbers so overflow wraps around like it
+    // does on the CPU
+    uint64_t a = static_cast<uint64_t>(lhs);
+    uint64_t b = static_cast<uint64_t>(rhs);
+    switch (op) {
+        case Opcode::Add: result = static_cast<int64_t>(a + b); return true;
+        case Opcode::Sub: result = static_cast<int64_t>(a - b); return true;
+        case Opcode::Mul: result = static_cast<int64_t>(a * b); return true;
+        case Opcode::SDiv:
+        case Opcode::SRem:
+            // Leave division by zero (and the one overflowing case) to run time
+            if (rhs == 0 || (lhs == INT64_MIN && rhs == -1)) return false;
+            result = op == Opcode::SDiv ? lhs / rhs : lhs % rhs;
+            return true;
+        case Opcode::UDiv:
+        case Opcode::URem:
+            if (b == 0) return false;
+            result = static_cast<int64_t>(op == Opcode::UDiv ? a / b : a % b);
+            return true;
+        case Opcode::Rotl:
+        case Opcode::Rotr: {
+            unsigned amount = static_cast<unsigned>(b & 63);
+            if (op == Opcode::Rotr) amount = (64 - amount) & 63;
+            result = static_cast<int64_t>(amount == 0 ? a : (a << amount) | (a >> (64 - amount)));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+int64_t fold_unary(Opcode op, int64_t value) {
+    uint64_t a = static_cast<uint64_t>(value);
+    switch (op) {
+        case Opcode::Popcnt: {
+            int count = 0;
+            for (; a != 0; a &= a - 1) count++;
+            return count;
+        }
+        case Opcode::Clz: {
+            int count = 0;
+            for (uint64_t bit = uint64_t(1) << 63; bit != 0 && !(a & bit); bit >>= 1) count++;
+            return count;
+        }
+        case Opcode::Ctz: {
+            int count = 0;
+            for (uint64_t bit = 1; bit != 0 && !(a & bit); bit <<= 1) count++;
+            return count;
+        }
+        case Opcode::Bswap: {
+            uint64_t swapped = 0;
+            for (int i = 0; i < 8; i++) swapped = (swapped << 8) | ((a >> (8 * i)) & 0xFF);
+            return static_cast<int64_t>(swapped);
+        }
+        default: // Neg
+            return static_cast<int64_t>(0 - a);
+    }
+}
+
+int64_t fold_extend(Opcode op, int bits, int64_t value) {
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    uint64_t low = static_cast<uint64_t>(value) & mask;
+    uint64_t sign = uint64_t(1) << (bits - 1);
+    if (op == Opcode::SExt && (low & sign)) low |= ~mask;
+    return static_cast<int64_t>(low);
+}
+
+// --- Value Types ---
+
+int lane_count(ValueType type) {
+    switch (type) {
+        case ValueType::I64:   return 1;
+        case ValueType::V2I64: return 2;
+        case ValueType::V4I64: return 4;
+        case ValueType::V4I32: return 4;
+        case ValueType::V8I32: return 8;
+        case ValueType::V8F32: return 8;
+    }
+    return 1;
+}
+
+int lane_bits(ValueType type) {
+    return type == ValueType::I64 || type == ValueType::V2I64 || type == ValueType::V4I64 ? 64 : 32;
+}
+
+int vector_bytes(ValueType type) {
+    return lane_count(type) * lane_bits(type) / 8;
+}
+
+ValueType vector_type(int lanes) {
+    return lanes == 4 ? ValueType::V4I64 : ValueType::V2I64;
+}
+
+const char* type_suffix(ValueType type) {
+    switch (type) {
+        case ValueType::I64:   return "i64";
+        case ValueType::V2I64: return "v2i64";
+        case ValueType::V4I64: return "v4i64";
+        case ValueType::V4I32: return "v4i32";
+        case ValueType::V8I32: return "v8i32";
+        case ValueType::V8F32: return "v8f32";
+    }
+    return "?";
+}
+
+std::string string_label(size_t index) {
+    // Function names can't have a '.', so this never clashes with one
+    return "__bolt_str." + std::to_string(index);
+}
+
+// --- Instr / BasicBlock ---
+
+bool Instr::is_terminator() const {
+    return op == Opcode::Ret || op == Opcode::Br || op == Opcode::CondBr || op == Opcode::Switch;
+}
+
+bool Instr::has_side_effects() const {
+    return is_terminator() || op == Opcode::Call || op == Opcode::Store || op == Opcode::VStore ||
+           op == Opcode::MemZero || op == Opcode::BoundsCheck || op == Opcode::Prefetch;
+}
+
+bool Instr::has_result() const {
+    return !is_terminator() && op != Opcode::Store && op != Opcode::VStore && op != Opcode::MemZero &&
+           op != Opcode::BoundsCheck && op != Opcode::Prefetch;
+}
+
+Instr* Instr::incoming_value(BasicBlock* block) const {
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i] == block) return operands[i];
+    }
+    return nullptr;
+}
+
+Instr* BasicBlock::terminator() const {
+    if (instrs.empty() || !instrs.back()->is_terminator()) return nullptr;
+    return instrs.back().get();
+}
+
+std::vector<BasicBlock*> BasicBlock::successors() const {
+    Instr* term = terminator();
+    return term ? term->targets : std::vector<BasicBlock*>{};
+}
+
+std::vector<Instr*> BasicBlock::phis() const {
+    std::vector<Instr*> result;
+    for (const auto& instr : instrs) {
+        if (!instr->is_phi()) break;
+        result.push_back(instr.get());
+    }
+    return result;
+}
+
+// --- IRFunction ---
+
+BasicBlock* IRFunction::create_block() {
+    blocks.push_back(std::make_unique<BasicBlock>());
+    blocks.back()->id = next_block_id++;
+    return blocks.back().get();
+}
+
+BasicBlock* IRFunction::create_block_before(BasicBlock* position) {
+    auto it = std::find_if(blocks.begin(), blocks.end(),
+        [&](const std::unique_ptr<BasicBlock>& block) { return block.get() == position; });
+    auto block = std::make_unique<BasicBlock>();
+    block->id = next_block_id++;
+    return blocks.insert(it, std::move(block))->get();
+}
+
+void IRFunction::compute_predecessors() {
+    for (auto& block : blocks) {
+        block->preds.clear();
+    }
+    for (auto& block : blocks) {
+        for (BasicBlock* succ : block->successors()) {
+            succ->preds.push_back(block.get());
+        }
+    }
+}
+
+void IRFunction::remove_unreachable_blocks() {
+    // 1. Find everything reachable from the entry block
+    std::set<BasicBlock*> reached = {blocks[0].get()};
+    std::vector<BasicBlock*> worklist = {blocks[0].get()};
+    while (!worklist.empty()) {
+        BasicBlock* block = worklist.back();
+        worklist.pop_back();
+        for (BasicBlock* succ : block->successors()) {
+            if (reached.insert(succ).second) {
+                worklist.push_back(succ);
+            }
+        }
+    }
+
+    // 2. Keep only those blocks (in their original order)
+    std::vector<std::unique_ptr<BasicBlock>> kept;
+    for (auto& block : blocks) {
+        if (reached.count(block.get())) {
+            kept.push_back(std::move(block));
+        }
+    }
+    blocks = std::move(kept);
+
+    // 3. Phis forget the edges that came from the dropped blocks
+    for (auto& block : blocks) {
+        for (Instr* phi : block->phis()) {
+            for (size_t i = phi->targets.size(); i-- > 0;) {
+                if (!reached.count(phi->targets[i])) {
+                    phi->targets.erase(phi->targets.begin() + i);
+                    phi->operands.erase(phi->operands.begin() + i);
+                }
+            }
+        }
+    }
+    compute_predecessors();
+}
+
+void IRFunction::remove_dead_instructions() {
+    // Mark and sweep: everything a side effect (transitively) depends on is
+    // live. Unlike counting uses, this also catches dead cycles such as a
+    // loop counter that only feeds its own increment.
+    std::set<Instr*> live;
+    std::vector<Instr*> worklist;
+    for (auto& block : blocks) {
+        for (auto& instr : block->instrs) {
+            if (instr->has_side_effects()) {
+                live.insert(instr.get());
+                worklist.push_back(instr.get());
+            }
+        }
+    }
+    while (!worklist.empty()) {
+        Instr* instr = worklist.back();
+        worklist.pop_back();
+        for (Instr* operand : instr->operands) {
+            if (live.insert(operand).second) {
+                worklist.push_back(operand);
+            }
+        }
+    }
+
+    for (auto& block : blocks) {
+        auto& instrs = block->instrs;
+        instrs.erase(std::remove_if(instrs.begin(), instrs.end(),
+            [&](const std::unique_ptr<Instr>& instr) { return !live.count(instr.get()); }), instrs.end());
+    }
+}
+
+void IRFunction::replace_all_uses(Instr* from, Instr* to) {
+    for (auto& block : blocks) {
+        for (auto& instr : block->instrs) {
+            for (Instr*& operand : instr->operands) {
+                if (operand == from) operand = to;
+            }
+        }
+    }
+}
+
+// --- IRBuilder ---
+
+IRBuilder::IRBuilder(IRFunction* function) : m_function(function) {}
+
+bool IRBuilder::block_terminated() const {
+    return m_block->terminator() != nullptr;
+}
+
+Instr* IRBuilder::append(Opcode op, std::vector<Instr*> operands) {
+    auto instr = std::make_unique<Instr>();
+    instr->op = op;
+    instr->id = m_function->next_value_id++;
+    instr->operands = std::move(operands);
+    instr->parent = m_block;
+    auto position = m_block->terminator() ? m_block->instrs.end() - 1 : m_block->instrs.end();
+    return m_block->instrs.insert(position, std::move(instr))->get();
+}
+
+Instr* IRBuilder::const_int(int64_t value) {
+    Instr* instr = append(Opcode::Const);
+    instr->imm = value;
+    return instr;
+}
+
+Instr* IRBuilder::binary(Opcode op, Instr* lhs, Instr* rhs) {
+    // 1. Fold constants
+    int64_t folded;
+    if (lhs->is_const() && rhs->is_const() && fold_binary(op, lhs->imm, rhs->imm, folded)) {
+        return const_int(folded);
+    }
+
+    // 2. Keep constants on the right of commutative operations, so the
+    //    instruction selector only has to look for them in one place.
+    if ((op == Opcode::Add || op == Opcode::Mul) && lhs->is_const() && !rhs->is_const()) {
+        std::swap(lhs, rhs);
+    }
+
+    // 3. Identities with a constant right-hand side
+    if (rhs->is_const()) {
+        int64_t c = rhs->imm;
+        switch (op) {
+            case Opcode::Add:
+            case Opcode::Sub:
+                if (c == 0) return lhs;
+                break;
+            case Opcode::Mul:
+                if (c == 0) return rhs;
+                if (c == 1) return lhs;
+                if (c == -1) return neg(lhs);
+                break;
+            case Opcode::SDiv:
+                if (c == 1) return lhs;
+                if (c == -1) return neg(lhs);
+                break;
+            case Opcode::UDiv:
+                if (c == 1) return lhs;
+                break;
+            case Opcode::SRem:
+                if (c == 1 || c == -1) return const_int(0);
+                break;
+            case Opcode::URem:
+                if (c == 1) return const_int(0);
+                break;
+            case Opcode::Rotl:
+            case Opcode::Rotr:
+                if ((c & 63) == 0) return lhs;
+                // Only rotate left by constants
+                if (op == Opcode::Rotr) return binary(Opcode::Rotl, lhs, const_int(64 - (c & 63)));
+                break;
+            default:
+                break;
+        }
+
+        // 4. Reassociate: '(x + 1) + 1' is 'x + 2'. Unrolled loops are
+        //    full of these chains.
+        bool is_add_sub = op == Opcode::Add || op == Opcode::Sub;
+        bool lhs_add_sub = lhs->op == Opcode::Add || lhs->op == Opcode::Sub;
+        if (is_add_sub && lhs_add_sub && lhs->operands[1]->is_const()) {
+            uint64_t inner = static_cast<uint64_t>(lhs->operands[1]->imm);
+            uint64_t outer = static_cast<uint64_t>(c);
+            if (lhs->op == Opcode::Sub) inner = 0 - inner;
+            if (op == Opcode::Sub) outer = 0 - outer;
+            return binary(Opcode::Add, lhs->operands[0], const_int(static_cast<int64_t>(inner + outer)));
+        }
+    }
+
+    return append(op, {lhs, rhs});
+}
+
+Instr* IRBuilder::neg(Instr* value) {
+    return unary(Opcode::Neg, value);
+}
+
+Instr* IRBuilder::unary(Opcode op, Instr* value) {
+    if (value->is_const()) return const_int(fold_unary(op, value->imm));
+    return append(op, {value});
+}
+
+Instr* IRBuilder::extend(Opcode op, Instr* value, int bits) {
+    if (value->is_const()) return const_int(fold_extend(op, bits, value->imm));
+    // Already extended from as few bits the same way, or a comparison's 0/1.
+    // A load extends what it reads too.
+    Opcode extended = value->op == Opcode::ZLoad ? Opcode::ZExt : value->op == Opcode::SLoad ? Opcode::SExt : value->op;
+    bool narrower = (extended == op || extended == Opcode::ZExt) && value->imm <= bits;
+    if (extended == Opcode::ZExt && op == Opcode::SExt) narrower = value->imm < bits;
+    if (narrower || value->op == Opcode::Cmp) return value;
+    Instr* instr = append(op, {value});
+    instr->imm = bits;
+    return instr;
+}
+
+Instr* IRBuilder::cmp(CondCode cond, Instr* lhs, Instr* rhs) {
+    if (lhs->is_const() && rhs->is_const()) {
+        return const_int(evaluate_cond(cond, lhs->imm, rhs->imm) ? 1 : 0);
+    }
+    // Constants go on the right here too: '5 < x' becomes 'x > 5'
+    if (lhs->is_const()) {
+        std::swap(lhs, rhs);
+        cond = swap_cond(cond);
+    }
+    Instr* instr = append(Opcode::Cmp, {lhs, rhs});
+    instr->cond = cond;
+    return instr;
+}
+
+Instr* IRBuilder::bit_test(Instr* index, uint64_t mask) {
+    if (index->is_const()) return const_int((mask >> (index->imm & 63)) & 1);
+    Instr* instr = append(Opcode::BitTest, {index});
+    instr->imm = static_cast<int64_t>(mask);
+    return instr;
+}
+
+Instr* IRBuilder::call(const std::string& callee, std::vector<Instr*> arguments) {
+    Instr* instr = append(Opcode::Call, std::move(arguments));
+    instr->symbol = callee;
+    return instr;
+}
+
+Instr* IRBuilder::param(int index) {
+    Instr* instr = append(Opcode::Param);
+    instr->imm = index;
+    return instr;
+}
+
+Instr* IRBuilder::phi(BasicBlock* block) {
+    // Phis go after the phis already in the block, before everything else
+    auto instr = std::make_unique<Instr>();
+    instr->op = Opcode::Phi;
+    instr->id = m_function->next_value_id++;
+    instr->parent = block;
+    auto it = block->instrs.begin();
+    while (it != block->instrs.end() && (*it)->is_phi()) ++it;
+    return block->instrs.insert(it, std::move(instr))->get();
+}
+
+void IRBuilder::add_phi_incoming(Instr* phi, Instr* value, BasicBlock* from) {
+    phi->operands.push_back(value);
+    phi->targets.push_back(from);
+}
+
+Instr* IRBuilder::load(Instr* address, int bits, bool is_signed) {
+    Instr* instr = append(is_signed && bits < 64 ? Opcode::SLoad : Opcode::ZLoad, {address});
+    instr->imm = bits;
+    return instr;
+}
+
+void IRBuilder::store(Instr* address, Instr* value, int bits) {
+    append(Opcode::Store, {address, value})->imm = bits;
+}
+
+Instr* IRBuilder::stack_addr(int64_t bytes) {
+    Instr* instr = append(Opcode::StackAddr);
+    instr->imm = bytes;
+    return instr;
+}
+
+Instr* IRBuilder::global_addr(const std::string& symbol) {
+    Instr* instr = append(Opcode::GlobalAddr);
+    instr->symbol = symbol;
+    return instr;
+}
+
+void IRBuilder::mem_zero(Instr* address, int64_t bytes) {
+    append(Opcode::MemZero, {address})->imm = bytes;
+}
+
+void IRBuilder::bounds_check(Instr* index, Instr* length) {
+    // One unsigned compare covers both ends: a negative index is huge
+    if (index->is_const() && length->is_const() &&
+        static_cast<uint64_t>(index->imm) < static_cast<uint64_t>(length->imm)) {
+        return;
+    }
+    append(Opcode::BoundsCheck, {index, length});
+}
+
+void IRBuilder::prefetch(Instr* address) {
+    append(Opcode::Prefetch, {address});
+}
+
+Instr* IRBuilder::splat(ValueType type, Instr* scalar) {
+    if (scalar->is_const()) {
+        return vec_const(type, std::vector<int64_t>(lane_count(type), scalar->imm));
+    }
+    Instr* instr = append(Opcode::Splat, {scalar});
+    instr->type = type;
+    return instr;
+}
+
+Instr* IRBuilder::vec_const(ValueType type, std::vector<int64_t> lanes) {
+    Instr* instr = append(Opcode::VecConst);
+    instr->type = type;
+    instr->lanes = std::move(lanes);
+    return instr;
+}
+
+Instr* IRBuilder::vector_binary(Opcode op, Instr* lhs, Instr* rhs) {
+    // Shifting by 0 and adding a vector of zeros change nothing
+    if (op == Opcode::VShl && rhs->is_const() && rhs->imm == 0) return lhs;
+    auto all_zero = [](Instr* v) {
+        return v->op == Opcode::VecConst && std::all_of(v->lanes.begin(), v->lanes.end(), [](int64_t x) { return x == 0; });
+    };
+    if ((op == Opcode::VAdd || op == Opcode::VSub) && all_zero(rhs)) return lhs;
+    if (op == Opcode::VAdd && all_zero(lhs)) return rhs;
+
+    Instr* instr = append(op, {lhs, rhs});
+    instr->type = lhs->type;
+    return instr;
+}
+
+Instr* IRBuilder::reduce_add(Instr* vector) {
+    return append(Opcode::ReduceAdd, {vector});
+}
+
+Instr* IRBuilder::extract(Instr* vector, int lane) {
+    Instr* instr = append(Opcode::Extract, {vector});
+    instr->imm = lane;
+    return instr;
+}
+
+Instr* IRBuilder::insert(Instr* vector, Instr* scalar, int lane) {
+    Instr* instr = append(Opcode::Insert, {vector, scalar});
+    instr->type = vector->type;
+    instr->imm = lane;
+    return instr;
+}
+
+Instr* IRBuilder::shuffle(Instr* vector, std::vector<int64_t> indices) {
+    // Every lane staying where it is changes nothing
+    bool identity = true;
+    for (size_t i = 0; i < indices.size(); i++) identity = identity && indices[i] == static_cast<int64_t>(i);
+    if (identity) return vector;
+
+    Instr* instr = append(Opcode::Shuffle, {vector});
+    instr->type = vector->type;
+    instr->lanes = std::move(indices);
+    return instr;
+}
+
+Instr* IRBuilder::vector_load(ValueType type, Instr* address) {
+    Instr* instr = append(Opcode::VLoad, {address});
+    instr->type = type;
+    return instr;
+}
+
+void IRBuilder::vector_store(Instr* address, Instr* vector) {
+    append(Opcode::VStore, {address, vector});
+}
+
+void IRBuilder::ret(Instr* value) {
+    append(Opcode::Ret, {value});
+}
+
+void IRBuilder::br(BasicBlock* target) {
+    append(Opcode::Br)->targets = {target};
+    target->preds.push_back(m_block);
+}
+
+void IRBuilder::cond_br(Instr* condition, BasicBlock* if_true, BasicBlock* if_false, std::vector<uint32_t> weights) {
+    // A constant condition is just a jump
+    if (condition->is_const()) {
+        br(condition->imm != 0 ? if_true : if_false);
+        return;
+    }
+    Instr* instr = append(Opcode::CondBr, {condition});
+    instr->targets = {if_true, if_false};
+    instr->weights = std::move(weights);
+    if_true->preds.push_back(m_block);
+    if (if_false != if_true) if_false->preds.push_back(m_block);
+}
+
+void IRBuilder::switch_br(Instr* value, BasicBlock* default_target,
+                          const std::vector<std::pair<int64_t, BasicBlock*>>& cases) {
+    if (value->is_const()) {
+        for (const auto& entry : cases) {
+            if (entry.first == value->imm) {
+                br(entry.second);
+                return;
+            }
+        }
+        br(default_target);
+        return;
+    }
+    Instr* instr = append(Opcode::Switch, {value});
+    instr->targets = {default_target};
+    for (const auto& entry : cases) {
+        auto it = std::find(instr->targets.begin(), instr->targets.end(), entry.second);
+        if (it == instr->targets.end()) it = instr->targets.insert(it, entry.second);
+        instr->cases.push_back({entry.first, static_cast<int>(it - instr->targets.begin())});
+    }
+    std::sort(instr->cases.begin(), instr->cases.end());
+    for (BasicBlock* target : instr->targets) {
+        target->preds.push_back(m_block);
+    }
+}
+
+// --- Printing ---
+
+static const char* opcode_name(Opcode op) {
+    switch (op) {
+        case Opcode::Const:     return "const";
+        case Opcode::Add:       return "add";
+        case Opcode::Sub:       return "sub";
+        case Opcode::Mul:       return "mul";
+        case Opcode::SDiv:      return "sdiv";
+        case Opcode::SRem:      return "srem";
+        case Opcode::UDiv:      return "udiv";
+        case Opcode::URem:      return "urem";
+        case Opcode::Neg:       return "neg";
+        case Opcode::Popcnt:    return "popcnt";
+        case Opcode::Clz:       return "clz";
+        case Opcode::Ctz:       return "ctz";
+        case Opcode::Bswap:     return "bswap";
+        case Opcode::Rotl:      return "rotl";
+        case Opcode::Rotr:      return "rotr";
+        case Opcode::SExt:      return "sext";
+        case Opcode::ZExt:      return "zext";
+        case Opcode::Cmp:       return "cmp";
+        case Opcode::BitTest:   return "bittest";
+        case Opcode::Call:      return "call";
+        case Opcode::Param:     return "param";
+        case Opcode::ZLoad:     return "zload";
+        case Opcode::SLoad:     return "sload";
+        case Opcode::Store:     return "store";
+        case Opcode::StackAddr: return "stackaddr";
+        case Opcode::GlobalAddr: return "globaladdr";
+        case Opcode::MemZero:   return "memzero";
+        case Opcode::BoundsCheck: return "boundscheck";
+        case Opcode::Prefetch:  return "prefetch";
+        case Opcode::Phi:       return "phi";
+        case Opcode::Splat:     return "splat";
+        case Opcode::VecConst:  return "vconst";
+        case Opcode::VAdd:      return "vadd";
+        case Opcode::VSub:      return "vsub";
+        case Opcode::VMul:      return "vmul";
+        case Opcode::VDiv:      return "vdiv";
+        case Opcode::VShl:      return "vshl";
+        case Opcode::ReduceAdd: return "reduce_add";
+        case Opcode::Extract:   return "extract";
+        case Opcode::Insert:    return "insert";
+        case Opcode::Shuffle:   return "shuffle";
+        case Opcode::VLoad:     return "vload";
+        case Opcode::VStore:    return "vstore";
+        case Opcode::Ret:       return "ret";
+        case Opcode::Br:        return "br";
+        case Opcode::CondBr:    return "condbr";
+        case Opcode::Switch:    return "switch";
+    }
+    return "?";
+}
+
+static const char* cond_name(CondCode cc) {
+    switch (cc) {
+        case CondCode::EQ: return "eq";
+        case CondCode::NE: return "ne";
+        case CondCode::LT: return "lt";
+        case CondCode::LE: return "le";
+        case CondCode::GT: return "gt";
+        case CondCode::GE: return "ge";
+        case CondCode::ULT: return "ult";
+        case CondCode::ULE: return "ule";
+        case CondCode::UGT: return "ugt";
+        case CondCode::UGE: return "uge";
+    }
+    return "?";
+}
+
+std::string print_ir(const IRFunction& function) {
+    std::stringstream out;
+    out << (function.is_exported ? "export " : "") << (function.is_comptime ? "comptime function " : "function ")
+        << function.name << " {\n";
+    for (const auto& block : function.blocks) {
+        out << "bb" << block->id << ":\n";
+        for (const auto& instr : block->instrs) {
+            out << "  ";
+            if (instr->has_result()) {
+                out << "%" << instr->id << " = ";
+            }
+            out << opcode_name(instr->op);
+            if (is_vector(instr->type)) out << "." << type_suffix(instr->type);
+            if (instr->op == Opcode::VecConst) {
+                // %3 = vconst.v4i64 <0, 1, 2, 3>
+                for (size_t i = 0; i < instr->lanes.size(); i++) {
+                    out << (i == 0 ? " <" : ", ") << instr->lanes[i];
+                }
+                out << ">";
+            }
+            if (instr->op == Opcode::Cmp) out << " " << cond_name(instr->cond);
+            if (instr->op == Opcode::Const) out << " " << instr->imm;
+            if (instr->op == Opcode::Param || instr->op == Opcode::StackAddr) out << " " << instr->imm;
+            // %3 = globaladdr __bolt_str.0
+            if (instr->op == Opcode::GlobalAddr) out << " " << instr->symbol;
+            if (instr->op == Opcode::Call) {
+                // %4 = call f(%2, %3)
+                out << " " << instr->symbol << "(";
+                for (size_t i = 0; i < instr->operands.size(); i++) {
+                    out << (i == 0 ? "" : ", ") << "%" << instr->operands[i]->id;
+                }
+                out << ")\n";
+                continue;
+            }
+            if (instr->is_phi()) {
+                // %5 = phi [%1, bb0], [%4, bb2]
+                for (size_t i = 0; i < instr->operands.size(); i++) {
+                    out << (i == 0 ? " " : ", ") << "[%" << instr->operands[i]->id << ", bb" << instr->targets[i]->id << "]";
+                }
+                out << "\n";
+                continue;
+            }
+            for (size_t i = 0; i < instr->operands.size(); i++) {
+                out << (i == 0 ? " " : ", ") << "%" << instr->operands[i]->id;
+            }
+            // %7 = insert.v4i32 %5, %6, lane 2
+            if (instr->op == Opcode::Extract || instr->op == Opcode::Insert) out << ", lane " << instr->imm;
+            // %9 = zext %8, i8
+            if (instr->op == Opcode::SExt || instr->op == Opcode::ZExt || instr->op == Opcode::ZLoad ||
+                instr->op == Opcode::SLoad || instr->op == Opcode::Store) {
+                out << ", i" << instr->imm;
+            }
+            // memzero %3, 80
+            if (instr->op == Opcode::MemZero) out << ", " << instr->imm;
+            // %6 = bittest %5, 0x2c
+            if (instr->op == Opcode::BitTest) out << ", 0x" << std::hex << instr->imm << std::dec;
+            if (instr->op == Opcode::Switch) {
+                // switch %3, bb1 [1: bb2, 2: bb2, 7: bb3]
+                out << ", bb" << instr->targets[0]->id;
+                for (size_t i = 0; i < instr->cases.size(); i++) {
+                    out << (i == 0 ? " [" : ", ") << instr->cases[i].first << ": bb"
+                        << instr->targets[instr->cases[i].second]->id;
+                }
+                out << (instr->cases.empty() ? "\n" : "]\n");
+                continue;
+            }
+            if (instr->op == Opcode::Shuffle) {
+                // %8 = shuffle.v4i32 %7 <3, 2, 1, 0>
+                for (size_t i = 0; i < instr->lanes.size(); i++) {
+                    out << (i == 0 ? " <" : ", ") << instr->lanes[i];
+                }
+                out << ">";
+            }
+            for (size_t i = 0; i < instr->targets.size(); i++) {
+                out << ((i == 0 && instr->operands.empty()) ? " " : ", ") << "bb" << instr->targets[i]->id;
+            }
+            // condbr %4, bb2, bb3 !weights(1, 2000)
+            for (size_t i = 0; i < instr->weights.size(); i++) {
+                out << (i == 0 ? " !weights(" : ", ") << instr->weights[i] << (i + 1 == instr->weights.size() ? ")" : "");
+            }
+            out << "\n";
+        }
+    }
+    out << "}\n";
+    return out.str();
+}
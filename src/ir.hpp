@@ -0,0 +1,324 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- Intermediate Representation (IR) ---
+// Between the AST and the assembly we keep each function in a simple SSA
+// form. A function is a list of basic blocks, a block is a list of
+// instructions, and every instruction computes at most one value.
+// An instruction *is* its value: operands point straight at the
+// instructions that computed them.
+//
+// Every block ends with exactly one terminator (ret, br or condbr).
+// Phis come first in their block, one per variable that has different
+// values on different incoming edges.
+
+enum class Opcode {
+    // A constant number ('imm')
+    Const,
+
+    // Arithmetic: two operands, except Neg
+    Add,
+    Sub,
+    Mul,
+    SDiv,   // Signed division, rounds toward zero
+    SRem,   // Signed remainder, takes the sign of the dividend
+    UDiv,   // Unsigned division
+    URem,   // Unsigned remainder
+    Neg,
+
+    // Bit manipulation (the language's builtins): one operand, except the
+    // rotates, which take the amount (mod 64) as operands[1]
+    Popcnt, // Number of 1 bits
+    Clz,    // Leading zero bits; 64 for 0
+    Ctz,    // Trailing zero bits; 64 for 0
+    Bswap,  // Byte order reversed
+    Rotl,
+    Rotr,
+
+    // The low 'imm' bits (8, 16 or 32) of operands[0], sign- or
+    // zero-extended back to 64: storing into a narrow integer type
+    SExt,
+    ZExt,
+
+    // Comparison: produces 0 or 1. 'cond' says which comparison.
+    Cmp,
+    // Bit operands[0] (0 ... 63) of the constant 'imm', 0 or 1: is the
+    // value in a set? Made by lower_switches (see switch.hpp).
+    BitTest,
+
+    // Function call: 'symbol' is the callee, the operands are the arguments
+    Call,
+
+    // Parameter number 'imm' of the function. They all sit at the top of
+    // the entry block, so they're read before anything can clobber them.
+    Param,
+
+    // Memory. Locals live in SSA values; only arrays and locals whose
+    // address is taken are in memory (a slot in the stack frame each),
+    // string literals, global variables, and whatever pointers point at.
+    ZLoad,       // 'imm' bits (8 ... 64) from address operands[0], zero-extended to 64
+    SLoad,       // The same, sign-extended
+    Store,       // The low 'imm' bits of operands[1] to address operands[0]
+    StackAddr,   // The address of a fresh 'imm'-byte slot in the stack frame
+    GlobalAddr,  // The address of data label 'symbol' (a string literal or global), RIP-relative
+    MemZero,     // Zeroes 'imm' bytes (a multiple of 8) at address operands[0]
+    BoundsCheck, // Traps unless 0 <= operands[0] < operands[1] (see bounds.hpp)
+    Prefetch,    // Brings the cache line at address operands[0] in; only a hint, but kept
+
+    // SSA merge: operands[i] is the value when we came from targets[i]
+    Phi,
+
+    // Vectors (made by the loop vectorizer, see vectorize.hpp, and by the
+    // language's vector types). Scalars going into a vector are truncated
+    // to 32-bit lanes or converted to float; lanes coming out are
+    // sign-extended, or truncated toward zero if they're floats.
+    Splat,     // Every lane is operands[0]
+    VecConst,  // Lane k is 'lanes[k]'
+    VAdd,      // Lane-wise arithmetic, wrapping like the scalar ones
+    VSub,
+    VMul,
+    VDiv,      // Float vectors only
+    VShl,      // Every lane shifted left by operands[1] (a constant)
+    ReduceAdd, // The sum of all lanes, as a scalar
+    Extract,   // Lane 'imm' of operands[0], as a scalar
+    Insert,    // operands[0] with lane 'imm' replaced by operands[1]
+    Shuffle,   // Lane k is lane 'lanes[k]' of operands[0]
+    VLoad,     // A vector from address operands[0], which needn't be aligned
+    VStore,    // Vector operands[1] to address operands[0]
+
+    // --- Terminators ---
+    Ret,    // operands[0] is the return value
+    Br,     // targets[0]
+    CondBr, // operands[0] is the condition; targets[0] if true, targets[1] if false
+    Switch, // operands[0] is the value; 'cases' maps values to targets, the
+            // rest go to targets[0]. Every target is listed once.
+};
+
+// What an instruction computes: a 64-bit integer, or a vector that fills
+// an XMM (16 bytes) or YMM (32 bytes) register
+enum class ValueType { I64, V2I64, V4I64, V4I32, V8I32, V8F32 };
+
+int lane_count(ValueType type);
+inline bool is_vector(ValueType type) { return type != ValueType::I64; }
+inline bool is_float_vector(ValueType type) { return type == ValueType::V8F32; }
+// 64 or 32
+int lane_bits(ValueType type);
+// 16 or 32 for vectors
+int vector_bytes(ValueType type);
+// The vector type with 'lanes' lanes of i64
+ValueType vector_type(int lanes);
+// "v4i32", used when printing
+const char* type_suffix(ValueType type);
+
+// Comparison kinds for Cmp: signed, then unsigned (for u64)
+enum class CondCode { EQ, NE, LT, LE, GT, GE, ULT, ULE, UGT, UGE };
+
+inline bool is_unsigned_cond(CondCode cc) { return cc >= CondCode::ULT; }
+
+// Returns the condition that is true when 'cc' is false (LT -> GE)
+CondCode negate_cond(CondCode cc);
+// Returns the condition to use when the operands are swapped (LT -> GT)
+CondCode swap_cond(CondCode cc);
+
+// Branch weights for likely()/unlikely() and calls to @cold functions:
+// the likely side is taken 2000 times out of 2001
+const uint32_t LIKELY_WEIGHT = 2000;
+const uint32_t UNLIKELY_WEIGHT = 1;
+
+// Constant folding, shared by the IRBuilder and the optimizer. Math wraps
+// around like on the CPU. Returns false if the result isn't known at
+// compile time (division by zero, INT64_MIN / -1).
+bool fold_binary(Opcode op, int64_t a, int64_t b, int64_t& result);
+// Neg and the one-operand bit operations
+int64_t fold_unary(Opcode op, int64_t a);
+// SExt or ZExt from 'bits'
+int64_t fold_extend(Opcode op, int bits, int64_t a);
+bool evaluate_cond(CondCode cc, int64_t a, int64_t b);
+
+struct BasicBlock;
+
+struct Instr {
+    Opcode op;
+    int id = -1;                        // Value number, used when printing (%3)
+    ValueType type = ValueType::I64;
+    std::vector<Instr*> operands;
+    std::vector<BasicBlock*> targets;   // Branch targets, or a Phi's incoming blocks
+    int64_t imm = 0;                    // Const, the lane of Extract/Insert, the bits of SExt/ZExt/loads/stores
+    CondCode cond = CondCode::EQ;       // Cmp
+    std::string symbol;                 // Call
+    std::vector<int64_t> lanes;         // VecConst, Shuffle
+    std::vector<std::pair<int64_t, int>> cases; // Switch: a value and its index in 'targets', by value
+    std::vector<uint32_t> weights;      // CondBr: how likely each target is, relatively; empty if unknown
+    BasicBlock* parent = nullptr;
+
+    bool is_terminator() const;
+    // Calls, stores, bounds checks and terminators have to stay exactly
+    // where they are
+    bool has_side_effects() const;
+    // False for terminators, stores and bounds checks, which compute nothing
+    bool has_result() const;
+    // A load can't move past a store or a call, so it isn't pure either
+    bool is_load() const { return op == Opcode::ZLoad || op == Opcode::SLoad || op == Opcode::VLoad; }
+    bool is_const() const { return op == Opcode::Const; }
+    bool is_phi() const { return op == Opcode::Phi; }
+
+    // Phi: the value coming in from 'block' (nullptr if there is none)
+    Instr* incoming_value(BasicBlock* block) const;
+};
+
+struct BasicBlock {
+    int id = 0;
+    std::vector<std::unique_ptr<Instr>> instrs;
+    std::vector<BasicBlock*> preds; // Filled in by IRFunction::compute_predecessors()
+    double frequency = 1.0;         // Estimated runs per call (see estimate_block_frequencies)
+    int profile_edge = -1;          // -fprofile-generate: the edge counted on entry (see number_profile_edges)
+
+    Instr* terminator() const;
+    std::vector<BasicBlock*> successors() const;
+    std::vector<Instr*> phis() const;
+};
+
+struct IRFunction {
+    std::string name;
+    bool is_comptime = false; // See comptime.hpp
+    bool is_exported = false; // 'main' and 'export' functions: System V ABI
+    bool is_cold = false;     // '@cold': not unrolled or vectorized, placed in .text.cold
+    bool is_instance = false; // Of a generic function: may share its code with another (codegen.hpp)
+    int num_params = 0;
+    std::vector<std::unique_ptr<BasicBlock>> blocks; // blocks[0] is the entry block
+    int next_value_id = 0;
+    int next_block_id = 0;
+
+    BasicBlock* create_block();
+    // Like create_block(), but placed right before 'position' in the layout
+    BasicBlock* create_block_before(BasicBlock* position);
+    void compute_predecessors();
+    // Drops blocks that can't be reached from the entry block (and their phi inputs)
+    void remove_unreachable_blocks();
+    // Drops instructions whose value is never used and that have no side effects
+    void remove_dead_instructions();
+    // Points every user of 'from' at 'to' instead
+    void replace_all_uses(Instr* from, Instr* to);
+};
+
+// String literal N is at label "__bolt_str.N", with a 0 byte after it
+std::string string_label(size_t index);
+
+// A call to "__bolt_atomic_<operation>.<bytes>" is an atomic operation on
+// memory, which the instruction selector puts in place of the call. Being
+// a call, nothing moves memory accesses across it, whatever its ordering.
+// The operations: load, store, store_seq_cst, add, exchange and cas (with
+// the operands of the builtins in irgen), and fence and fence_seq_cst.
+const char* const ATOMIC_PREFIX = "__bolt_atomic_";
+inline bool is_atomic_intrinsic(const std::string& symbol) { return symbol.compare(0, 14, ATOMIC_PREFIX) == 0; }
+
+// A global variable: 'bytes' at label 'symbol', in .data, or in .bss if
+// they're all 0, or in .rodata if it's read-only
+struct GlobalVariable {
+    std::string symbol;
+    int align;
+    bool read_only;
+    std::vector<uint8_t> bytes; // Its initial contents
+    // An address in the initial contents: 'symbol' + 'addend', 8 bytes at
+    // 'offset' (the bytes there are 0)
+    struct Relocation {
+        int64_t offset;
+        std::string symbol;
+        int64_t addend;
+    };
+    std::vector<Relocation> relocations;
+};
+
+// 'bytes' bytes at 'offset' in global 'symbol' that only comptime
+// functions can compute: 'function' (comptime, no parameters) returns them
+struct GlobalInitializer {
+    std::string symbol;
+    int64_t offset;
+    int64_t bytes;
+    std::unique_ptr<IRFunction> function;
+};
+
+struct IRModule {
+    std::vector<std::unique_ptr<IRFunction>> functions;
+    std::vector<std::string> strings; // String literals, each one once
+    std::vector<GlobalVariable> globals;
+    std::vector<GlobalInitializer> initializers; // In order; run by fold_comptime_calls
+};
+
+// --- IR Builder ---
+// Appends instructions to the end of a block (or right before its
+// terminator, if it already has one). It folds operations on constants
+// right away, so '2 + 3' never makes it into the IR, and drops the
+// trivial ones ('x + 0', 'x * 1', 'x / 1', ...).
+class IRBuilder {
+public:
+    IRBuilder(IRFunction* function);
+
+    void set_insert_point(BasicBlock* block) { m_block = block; }
+    BasicBlock* insert_block() const { return m_block; }
+    // True if the current block already ends with a ret/br
+    bool block_terminated() const;
+
+    Instr* const_int(int64_t value);
+    Instr* binary(Opcode op, Instr* lhs, Instr* rhs);
+    Instr* neg(Instr* value);
+    // Neg, Popcnt, Clz, Ctz or Bswap
+    Instr* unary(Opcode op, Instr* value);
+    // SExt or ZExt. Drops it if 'value' already fits ('zext 8' of a
+    // comparison, or of a 'zext 8').
+    Instr* extend(Opcode op, Instr* value, int bits);
+    Instr* cmp(CondCode cond, Instr* lhs, Instr* rhs);
+    Instr* bit_test(Instr* index, uint64_t mask);
+    Instr* call(const std::string& callee, std::vector<Instr*> arguments = {});
+    Instr* param(int index);
+    // An empty phi at the top of 'block'; fill it with add_phi_incoming()
+    Instr* phi(BasicBlock* block);
+    void add_phi_incoming(Instr* phi, Instr* value, BasicBlock* from);
+
+    // Memory. 'bits' is 8, 16, 32 or 64.
+    Instr* load(Instr* address, int bits, bool is_signed);
+    void store(Instr* address, Instr* value, int bits);
+    Instr* stack_addr(int64_t bytes);
+    Instr* global_addr(const std::string& symbol);
+    void mem_zero(Instr* address, int64_t bytes);
+    // Dropped if both are constants and the index is in range
+    void bounds_check(Instr* index, Instr* length);
+    void prefetch(Instr* address);
+
+    // Vectors. Splatting a constant gives a VecConst.
+    Instr* splat(ValueType type, Instr* scalar);
+    Instr* vec_const(ValueType type, std::vector<int64_t> lanes);
+    // VAdd, VSub, VMul, VDiv or VShl; the result has the type of 'lhs'
+    Instr* vector_binary(Opcode op, Instr* lhs, Instr* rhs);
+    Instr* reduce_add(Instr* vector);
+    Instr* extract(Instr* vector, int lane);
+    Instr* insert(Instr* vector, Instr* scalar, int lane);
+    Instr* shuffle(Instr* vector, std::vector<int64_t> indices);
+    Instr* vector_load(ValueType type, Instr* address);
+    void vector_store(Instr* address, Instr* vector);
+
+    // Branches also add the current block to their targets' 'preds', so
+    // the SSA construction in IRGenerator can look them up as it goes.
+    void ret(Instr* value);
+    void br(BasicBlock* target);
+    // 'weights' are the branch weights, e.g. {LIKELY_WEIGHT, UNLIKELY_WEIGHT}
+    void cond_br(Instr* condition, BasicBlock* if_true, BasicBlock* if_false, std::vector<uint32_t> weights = {});
+    // Goes to the block 'value' is paired with in 'cases', or to
+    // 'default_target'. A jump if 'value' is a constant.
+    void switch_br(Instr* value, BasicBlock* default_target,
+                   const std::vector<std::pair<int64_t, BasicBlock*>>& cases);
+
+private:
+    IRFunction* m_function;
+    BasicBlock* m_block = nullptr;
+
+    Instr* append(Opcode op, std::vector<Instr*> operands = {});
+};
+
+// Human-readable dump of a function (used by -emit-ir)
+std::string print_ir(const IRFunction& function);
@@ -0,0 +1,2415 @@
+#include "irgen.hpp"
+#include "runtime.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+IRModule IRGenerator::generate(const ProgramNode& ast) {
+    IRModule module;
+    add_program(ast, module);
+
+    // The runtime library, if the program uses it. Its calls to write()
+    // and the like are the runtime's, whatever the program calls by those
+    // names.
+    if (m_uses_runtime_library) {
+        size_t program_functions = module.functions.size();
+        ProgramNode library = parse_runtime_library();
+        add_program(library, module);
+        remove_unused_library_code(module, program_functions);
+    }
+
+    module.strings = std::move(m_strings);
+    module.globals = std::move(m_global_data);
+    module.initializers = std::move(m_global_initializers);
+    return module;
+}
+
+void IRGenerator::add_program(const ProgramNode& ast, IRModule& module) {
+    // Know every function's signature up front, so calls can be checked
+    // before the callee is seen. The program's own functions replace the
+    // runtime's.
+    for (const RuntimeFunction& function : runtime_functions()) {
+        m_signatures[function.name] = {function.return_type, function.parameters, function.symbol};
+    }
+    std::vector<GenericFunctionNode*> generics;
+    std::set<std::string> defined;
+    for (const auto& stmt : ast.statements) {
+        if (auto func_def = dynamic_cast<FunctionDefNode*>(stmt.get())) {
+            Signature& signature = m_signatures[func_def->name];
+            signature = {func_def->return_type, {}, func_def->name};
+            for (const ParameterNode& parameter : func_def->parameters) {
+                signature.parameters.push_back(parameter.type);
+            }
+            defined.insert(func_def->name);
+        } else if (auto generic = dynamic_cast<GenericFunctionNode*>(stmt.get())) {
+            if (!m_generic_functions.emplace(generic->name, generic).second) {
+                throw std::runtime_error("Generic function '" + generic->name + "' is defined twice");
+            }
+            generics.push_back(generic);
+        }
+    }
+    // Functions from elsewhere: called by their own name, with the ABI
+    for (const auto& stmt : ast.statements) {
+        auto declaration = dynamic_cast<ExternDeclNode*>(stmt.get());
+        if (!declaration) continue;
+        if (defined.count(declaration->name)) {
+            throw std::runtime_error("'" + declaration->name + "' is defined here, so it can't be extern");
+        }
+        m_signatures[declaration->name] = {declaration->return_type, declaration->parameters, declaration->name};
+    }
+    for (GenericFunctionNode* generic : generics) {
+        auto function = m_signatures.find(generic->name);
+        if (function != m_signatures.end() && function->second.symbol == generic->name) {
+            throw std::runtime_error("'" + generic->name + "' is both a function and a generic function");
+        }
+    }
+
+    // Globals next, so every function can use them. Their initializers are
+    // built in a function of their own, which the IRBuilder folds down to
+    // constants (if they are constant).
+    IRFunction initializers;
+    m_function = &initializers;
+    m_builder = std::make_unique<IRBuilder>(m_function);
+    m_builder->set_insert_point(m_function->create_block());
+    for (const auto& stmt : ast.statements) {
+        if (auto declaration = dynamic_cast<VarDeclNode*>(stmt.get())) declare_global(declaration);
+    }
+
+    // Generators aren't functions of their own. Each one that's started
+    // somewhere (not just looped over) gets a state machine, made before
+    // the functions that start it: they need the size of its frame.
+    std::vector<FunctionDefNode*> functions;
+    for (const auto& stmt : ast.statements) {
+        auto func_def = dynamic_cast<FunctionDefNode*>(stmt.get());
+        if (!func_def) continue;
+        if (!func_def->is_generator) {
+            functions.push_back(func_def);
+            continue;
+        }
+        check_generator(func_def);
+        m_generators[func_def->name] = func_def;
+    }
+    std::vector<FunctionDefNode*> state_machines;
+    std::set<FunctionDefNode*> visiting;
+    auto started_in = [&](StmtNode* body) {
+        std::vector<FunctionDefNode*> started;
+        std::set<FunctionDefNode*> copied;
+        find_started_generators(body, started, copied);
+        return started;
+    };
+    std::function<void(const std::vector<FunctionDefNode*>&)> add_state_machines =
+        [&](const std::vector<FunctionDefNode*>& started) {
+            for (FunctionDefNode* generator : started) {
+                if (std::find(state_machines.begin(), state_machines.end(), generator) != state_machines.end()) continue;
+                if (!visiting.insert(generator).second) {
+                    throw std::runtime_error("Generator '" + generator->name + "' starts itself");
+                }
+                add_state_machines(started_in(generator->body.get()));
+                visiting.erase(generator);
+                state_machines.push_back(generator);
+            }
+        };
+    for (FunctionDefNode* function : functions) add_state_machines(started_in(function->body.get()));
+    // A generic's instances come later, so what it starts is found in its
+    // tokens: a generator called anywhere but after 'in' (where the loop
+    // starts what that generator does)
+    for (GenericFunctionNode* generic : generics) {
+        const std::vector<Token>& tokens = generic->tokens;
+        for (size_t i = 1; i + 1 < tokens.size(); i++) {
+            auto generator = m_generators.find(tokens[i].value);
+            if (tokens[i].type != TokenType::IDENTIFIER || tokens[i + 1].type != TokenType::OPEN_PAREN ||
+                generator == m_generators.end()) {
+                continue;
+            }
+            if (tokens[i - 1].type == TokenType::IN) {
+                add_state_machines(started_in(generator->second->body.get()));
+            } else {
+                add_state_machines({generator->second});
+            }
+        }
+    }
+
+    // --- Visit Top-Level Statements ---
+    // Every function definition becomes one IRFunction, and so does every
+    // state machine. Then come what each one needs made: parallel for
+    // bodies (which may need more) and thread entries. The instances of
+    // generics go last, as the calls to them turn up.
+    auto generate_outlined = [&]() {
+        while (!m_outlined.empty()) {
+            Outlined outlined = std::move(m_outlined.front());
+            m_outlined.erase(m_outlined.begin());
+            begin_function(module);
+            if (outlined.loop) {
+                generate_parallel_body(outlined);
+            } else {
+                generate_thread_entry(outlined);
+            }
+        }
+    };
+    for (size_t i = 0; i < state_machines.size() + functions.size(); i++) {
+        begin_function(module);
+        if (i < state_machines.size()) {
+            generate_state_machine(state_machines[i]);
+        } else {
+            visit(functions[i - state_machines.size()]);
+        }
+        generate_outlined();
+    }
+    while (!m_pending_instances.empty()) {
+        FunctionDefNode* instance = m_pending_instances.front();
+        m_pending_instances.erase(m_pending_instances.begin());
+        begin_function(module);
+        m_function->is_instance = true;
+        visit(instance);
+        generate_outlined();
+    }
+}
+
+void IRGenerator::begin_function(IRModule& module) {
+    module.functions.push_back(std::make_unique<IRFunction>());
+    m_function = module.functions.back().get();
+    m_builder = std::make_unique<IRBuilder>(m_function);
+    m_current_def.clear();
+    m_sealed.clear();
+    m_incomplete_phis.clear();
+    m_replaced_phis.clear();
+    m_undefined_vectors.clear();
+}
+
+void IRGenerator::remove_unused_library_code(IRModule& module, size_t program_functions) {
+    // What the program's functions reach, through calls and addresses of
+    // globals. __bolt_flush stays with the output buffer: the exit paths
+    // call it.
+    std::set<std::string> used;
+    std::vector<const IRFunction*> worklist;
+    for (size_t i = 0; i < program_functions; i++) worklist.push_back(module.functions[i].get());
+    while (!worklist.empty()) {
+        const IRFunction* function = worklist.back();
+        worklist.pop_back();
+        for (const auto& block : function->blocks) {
+            for (const auto& instr : block->instrs) {
+                if (instr->op != Opcode::Call && instr->op != Opcode::GlobalAddr) continue;
+                std::vector<std::string> symbols = {instr->symbol};
+                if (instr->symbol == "__bolt_out") symbols.push_back("__bolt_flush");
+                for (const std::string& symbol : symbols) {
+                    if (!used.insert(symbol).second) continue;
+                    for (size_t i = program_functions; i < module.functions.size(); i++) {
+                        if (module.functions[i]->name == symbol) worklist.push_back(module.functions[i].get());
+                    }
+                }
+            }
+        }
+    }
+
+    auto unused_function = [&](const std::unique_ptr<IRFunction>& function) {
+        return !used.count(function->name);
+    };
+    module.functions.erase(std::remove_if(module.functions.begin() + program_functions, module.functions.end(),
+                                          unused_function),
+                           module.functions.end());
+    // The library's globals are the ones named __bolt_*. Their string
+    // literals stay: other code may share them.
+    auto unused_global = [&](const GlobalVariable& global) {
+        return global.symbol.compare(0, 7, "__bolt_") == 0 && !used.count(global.symbol);
+    };
+    m_global_data.erase(std::remove_if(m_global_data.begin(), m_global_data.end(), unused_global),
+                        m_global_data.end());
+}
+
+// --- Variables ---
+
+// The names of the locals 'body' takes the address of (defined below)
+static std::set<std::string> address_taken(StmtNode* body);
+// The calls in 'node' and the names it reads (defined below)
+static void calls_and_names(ExprNode* node, std::vector<CallExprNode*>& calls, std::vector<std::string>& names);
+
+int IRGenerator::declare_variable(const std::string& name, TypeId type) {
+    auto& scope = m_scopes.back();
+    if (scope.count(name)) {
+        throw std::runtime_error("Redefinition of variable '" + name + "'");
+    }
+    int variable = m_next_variable;
+    scope[name] = variable;
+    add_variable_ids(type);
+    if (m_address_taken.count(name) && !is_array_type(type)) {
+        m_in_memory.insert(variable);
+    }
+    if (m_state_machine) {
+        // Where it waits out the yields
+        for (int id = variable; id < m_next_variable; id++) {
+            m_state_machine->slots[id] = m_state_machine->frame_size;
+            m_state_machine->frame_size += 8;
+        }
+    }
+    return variable;
+}
+
+void IRGenerator::add_variable_ids(TypeId type) {
+    m_variable_types.push_back(type);
+    m_next_variable++;
+    for (const StructField& field : type_info(type).fields) {
+        add_variable_ids(field.type);
+    }
+}
+
+// How many variable ids a variable of 'type' takes
+static int variable_id_count(TypeId type) {
+    int count = 1;
+    for (const StructField& field : type_info(type).fields) {
+        count += variable_id_count(field.type);
+    }
+    return count;
+}
+
+int IRGenerator::field_variable(int variable, int field) const {
+    // Past the struct's own id and every earlier field's
+    const std::vector<StructField>& fields = type_info(m_variable_types[variable]).fields;
+    int id = variable + 1;
+    for (int i = 0; i < field; i++) {
+        id += variable_id_count(fields[i].type);
+    }
+    return id;
+}
+
+int IRGenerator::lookup_variable(const std::string& name) const {
+    // Innermost scope first
+    for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return it->second;
+    }
+    return -1;
+}
+
+// True if 'node' names a variable or something in memory, rather than
+// computing a temporary value
+static bool is_place(ExprNode* node) {
+    if (dynamic_cast<VariableNode*>(node) || dynamic_cast<DerefNode*>(node)) return true;
+    if (auto member = dynamic_cast<MemberNode*>(node)) return is_place(member->object.get());
+    if (auto index = dynamic_cast<IndexNode*>(node)) return is_place(index->base.get());
+    return false;
+}
+
+IRGenerator::Target IRGenerator::resolve_target(ExprNode* node) {
+    if (auto variable = dynamic_cast<VariableNode*>(node)) {
+        int id = lookup_variable(variable->name);
+        if (id < 0) {
+            auto global = m_globals.find(variable->name);
+            if (global == m_globals.end()) throw std::runtime_error("Unknown variable '" + variable->name + "'");
+            return {-1, global->second.type, -1, m_builder->global_addr(variable->name)};
+        }
+        return variable_target(id);
+    }
+    if (auto member = dynamic_cast<MemberNode*>(node)) {
+        Target object = resolve_target(member->object.get());
+        if (object.lane >= 0 || !is_struct_type(object.type)) {
+            throw std::runtime_error("'." + member->field + "' needs a struct, not " +
+                                     (object.lane >= 0 ? "an integer" : type_name(object.type)));
+        }
+        int field = find_field(object.type, member->field);
+        if (field < 0) {
+            throw std::runtime_error(type_name(object.type) + " has no field '" + member->field + "'");
+        }
+        return field_target(object, field);
+    }
+    if (auto index = dynamic_cast<IndexNode*>(node)) {
+        Value base;
+        if (is_place(index->base.get())) {
+            Target place = resolve_target(index->base.get());
+            if (place.lane < 0 && is_vector_type(place.type)) {
+                place.lane = constant_lane(index->index.get(), place.type);
+                return place;
+            }
+            if (is_array_type(place.type)) {
+                const TypeInfo& array = type_info(place.type);
+                Instr* i = expect_int(visit(index->index.get()), "An array index");
+                if (i->is_const() && static_cast<uint64_t>(i->imm) >= static_cast<uint64_t>(array.length)) {
+                    throw std::runtime_error("Index " + std::to_string(i->imm) + " is out of bounds for " + array.name);
+                }
+                if (m_bounds_checks) m_builder->bounds_check(i, m_builder->const_int(array.length));
+                const TypeInfo& element = type_info(array.element);
+                if (element.is_soa) return {-1, array.element, -1, place.address, i, place.type};
+                return {-1, array.element, -1, element_address(place.address, i, element.size)};
+            }
+            base = load(place);
+        } else {
+            base = visit(index->base.get());
+        }
+        if (!is_pointer_type(base.type)) {
+            throw std::runtime_error(is_vector_type(base.type) ? "Can't assign to a lane of a temporary vector"
+                                                               : "Only vectors, arrays and pointers can be indexed");
+        }
+        TypeId element = type_info(base.type).element;
+        Instr* i = expect_int(visit(index->index.get()), "A pointer index");
+        return {-1, element, -1, element_address(base.instr, i, type_info(element).size)};
+    }
+    if (auto deref = dynamic_cast<DerefNode*>(node)) {
+        Value pointer = visit(deref->pointer.get());
+        if (!is_pointer_type(pointer.type)) {
+            throw std::runtime_error("'*' needs a pointer, not " + type_name(pointer.type));
+        }
+        return {-1, type_info(pointer.type).element, -1, pointer.instr};
+    }
+    throw std::runtime_error("Can't assign to this expression");
+}
+
+IRGenerator::Target IRGenerator::field_target(const Target& object, int field) {
+    const StructField& info = type_info(object.type).fields[field];
+    if (object.soa_index) {
+        // Into the field's own array
+        const TypeInfo& array = type_info(object.soa_array);
+        Instr* element = element_address(object.address, object.soa_index, type_info(info.type).size);
+        return {-1, info.type, -1, m_builder->binary(Opcode::Add, element, m_builder->const_int(array.soa_offsets[field]))};
+    }
+    if (object.address) {
+        return {-1, info.type, -1, m_builder->binary(Opcode::Add, object.address, m_builder->const_int(info.offset))};
+    }
+    int id = field_variable(object.variable, field);
+    return {id, m_variable_types[id]};
+}
+
+Instr* IRGenerator::element_address(Instr* base, Instr* index, int64_t size) {
+    return m_builder->binary(Opcode::Add, base, m_builder->binary(Opcode::Mul, index, m_builder->const_int(size)));
+}
+
+IRGenerator::Value IRGenerator::load(const Target& target) {
+    if (target.lane >= 0) {
+        Instr* vector = target.address ? m_builder->vector_load(type_info(target.type).value_type, target.address)
+                                       : read_variable(target.variable, m_builder->insert_block());
+        return {m_builder->extract(vector, target.lane), TYPE_I64};
+    }
+    if (is_struct_type(target.type)) {
+        Value value = {nullptr, target.type};
+        for (size_t i = 0; i < type_info(target.type).fields.size(); i++) {
+            value.fields.push_back(load(field_target(target, static_cast<int>(i))));
+        }
+        return value;
+    }
+    if (is_array_type(target.type)) {
+        // Used as a value, an array is a pointer to its first element
+        TypeId element = type_info(target.type).element;
+        if (type_info(element).is_soa) {
+            throw std::runtime_error("An array of @soa structs can't be used as a pointer (" + type_name(target.type) + ")");
+        }
+        return {target.address, pointer_type(element)};
+    }
+    if (target.address) {
+        const TypeInfo& info = type_info(target.type);
+        if (is_vector_type(target.type)) return {m_builder->vector_load(info.value_type, target.address), target.type};
+        if (Instr* constant = read_only_value(target.address, target.type)) return {constant, target.type};
+        return {m_builder->load(target.address, info.size * 8, info.is_signed), target.type};
+    }
+    return {read_variable(target.variable, m_builder->insert_block()), target.type};
+}
+
+IRGenerator::Value IRGenerator::store(const Target& target, Value value) {
+    BasicBlock* block = m_builder->insert_block();
+    int64_t offset;
+    GlobalVariable* global = target.address ? global_at(target.address, offset) : nullptr;
+    if (global && global->read_only) {
+        throw std::runtime_error("Can't assign to '" + global->symbol + "': it's const");
+    }
+    if (target.lane >= 0) {
+        Instr* lane = expect_int(value, "A lane's new value");
+        if (target.address) {
+            // The whole vector, read, changed and written back
+            Instr* vector = m_builder->vector_load(type_info(target.type).value_type, target.address);
+            m_builder->vector_store(target.address, m_builder->insert(vector, lane, target.lane));
+            return {lane, TYPE_I64};
+        }
+        Instr* vector = read_variable(target.variable, block);
+        write_variable(target.variable, block, m_builder->insert(vector, lane, target.lane));
+        return {lane, TYPE_I64};
+    }
+    if (is_array_type(target.type)) {
+        throw std::runtime_error("Arrays can't be assigned (" + type_name(target.type) + ")");
+    }
+    if (!is_struct_type(target.type)) {
+        Instr* stored = convert(value, target.type);
+        if (target.address && is_vector_type(target.type)) {
+            m_builder->vector_store(target.address, stored);
+        } else if (target.address) {
+            // The store only writes the low bits anyway: no need to extend them first
+            Instr* bits = is_integer_type(value.type) && is_integer_type(target.type) ? value.instr : stored;
+            m_builder->store(target.address, bits, type_info(target.type).size * 8);
+        } else {
+            write_variable(target.variable, block, stored);
+        }
+        return {stored, target.type};
+    }
+    if (value.type != target.type) {
+        throw std::runtime_error("Type mismatch: expected " + type_name(target.type) + ", got " + type_name(value.type));
+    }
+    for (size_t i = 0; i < value.fields.size(); i++) {
+        store(field_target(target, static_cast<int>(i)), value.fields[i]);
+    }
+    return value;
+}
+
+IRGenerator::Target IRGenerator::variable_target(int variable) {
+    TypeId type = m_variable_types[variable];
+    // An array variable, or one in memory, holds its slot's address
+    if (is_array_type(type) || m_in_memory.count(variable)) {
+        return {-1, type, -1, read_variable(variable, m_builder->insert_block())};
+    }
+    return {variable, type};
+}
+
+void IRGenerator::define_variable(int variable, Value value) {
+    if (is_array_type(m_variable_types[variable])) {
+        // Its value is its address
+        write_variable(variable, m_builder->insert_block(), value.instr);
+        return;
+    }
+    if (m_in_memory.count(variable)) {
+        int64_t size = (type_info(m_variable_types[variable]).size + 7) / 8 * 8;
+        write_variable(variable, m_builder->insert_block(), frame_memory(size));
+    }
+    store(variable_target(variable), value);
+}
+
+// --- Global Variables ---
+
+void IRGenerator::declare_global(VarDeclNode* node) {
+    auto function = m_signatures.find(node->name);
+    if (m_globals.count(node->name) || (function != m_signatures.end() && function->second.symbol == node->name)) {
+        throw std::runtime_error("Redefinition of '" + node->name + "'");
+    }
+    const TypeInfo& info = type_info(node->type);
+    m_global_data.push_back({node->name, info.align, node->is_const, std::vector<uint8_t>(info.size, 0), {}});
+    if (node->initializer) write_constant(node->name, 0, node->type, node->initializer.get());
+    for (const auto& instr : m_function->blocks[0]->instrs) {
+        if (instr->has_side_effects()) {
+            throw std::runtime_error("The initializer of global '" + node->name + "' isn't a constant");
+        }
+    }
+    // Declared after the initializer, so it can't refer to itself
+    m_globals[node->name] = {node->type, m_global_data.size() - 1};
+}
+
+// The initializer of an array: its array literal. Throws if only one of
+// 'init' and 'type' is an array, or there are too many elements.
+static ArrayLiteralNode* array_initializer(ExprNode* init, TypeId type, const std::string& name) {
+    auto literal = dynamic_cast<ArrayLiteralNode*>(init);
+    const TypeInfo& info = type_info(type);
+    if (!info.is_array) {
+        if (literal) throw std::runtime_error("'" + name + "' isn't an array, so it can't be initialized with {...}");
+        return nullptr;
+    }
+    if (!literal) throw std::runtime_error("Array '" + name + "' can only be initialized with {...}");
+    if (type_info(info.element).is_soa) {
+        throw std::runtime_error("Array '" + name + "' of @soa structs can't have an initializer");
+    }
+    if (static_cast<int64_t>(literal->elements.size()) > info.length) {
+        throw std::runtime_error("Too many elements for '" + name + "' (" + type_name(type) + ")");
+    }
+    return literal;
+}
+
+void IRGenerator::write_constant(const std::string& name, int64_t offset, TypeId type, ExprNode* init) {
+    if (ArrayLiteralNode* literal = array_initializer(init, type, name)) {
+        TypeId element = type_info(type).element;
+        for (size_t i = 0; i < literal->elements.size(); i++) {
+            write_constant(name + "[" + std::to_string(i) + "]",
+                           offset + static_cast<int64_t>(i) * type_info(element).size, element,
+                           literal->elements[i].get());
+        }
+        return;
+    }
+    // A call to a function, or a global computed by one: the comptime
+    // evaluator works it out once it has every function
+    std::vector<CallExprNode*> calls;
+    std::vector<std::string> names;
+    calls_and_names(init, calls, names);
+    bool computed = std::any_of(calls.begin(), calls.end(), [&](CallExprNode* call) {
+        return m_signatures.count(call->callee) || m_generic_functions.count(call->callee);
+    });
+    computed = computed || std::any_of(names.begin(), names.end(),
+                                       [&](const std::string& used) { return m_computed_globals.count(used); });
+    if (computed && is_integer_type(type)) {
+        defer_constant(name, offset, type, init);
+        return;
+    }
+    write_constant_value(name, offset, type, visit(init));
+}
+
+void IRGenerator::defer_constant(const std::string& name, int64_t offset, TypeId type, ExprNode* init) {
+    GlobalVariable& global = m_global_data.back();
+    m_computed_globals.insert(global.symbol);
+    auto function = std::make_unique<IRFunction>();
+    function->name = name;
+    function->is_comptime = true;
+
+    // Generated on the side: the initializers' function stays as it is
+    IRFunction* outer_function = m_function;
+    std::unique_ptr<IRBuilder> outer_builder = std::move(m_builder);
+    m_function = function.get();
+    m_builder = std::make_unique<IRBuilder>(m_function);
+    m_builder->set_insert_point(m_function->create_block());
+    m_builder->ret(convert(visit(init), type));
+    m_function = outer_function;
+    m_builder = std::move(outer_builder);
+
+    m_global_initializers.push_back({global.symbol, offset, type_info(type).size, std::move(function)});
+}
+
+void IRGenerator::write_constant_value(const std::string& name, int64_t offset, TypeId type, const Value& value) {
+    GlobalVariable& global = m_global_data.back();
+    const TypeInfo& info = type_info(type);
+    if (is_struct_type(type)) {
+        if (value.type != type) {
+            throw std::runtime_error("Type mismatch: expected " + type_name(type) + ", got " + type_name(value.type));
+        }
+        for (size_t i = 0; i < info.fields.size(); i++) {
+            write_constant_value(name, offset + info.fields[i].offset, info.fields[i].type, value.fields[i]);
+        }
+        return;
+    }
+    Instr* constant = convert(value, type);
+    if (constant->is_const()) {
+        std::memcpy(&global.bytes[offset], &constant->imm, info.size); // Little-endian
+        return;
+    }
+    if (constant->op == Opcode::VecConst) {
+        // 32-bit lanes, as in a register
+        for (size_t i = 0; i < constant->lanes.size(); i++) {
+            uint32_t bits = static_cast<uint32_t>(constant->lanes[i]);
+            if (is_float_vector(info.value_type)) {
+                float lane = static_cast<float>(constant->lanes[i]);
+                std::memcpy(&bits, &lane, 4);
+            }
+            std::memcpy(&global.bytes[offset + 4 * static_cast<int64_t>(i)], &bits, 4);
+        }
+        return;
+    }
+    // An address: of a global or string literal, plus or minus a constant
+    int64_t addend = 0;
+    while ((constant->op == Opcode::Add || constant->op == Opcode::Sub) && constant->operands[1]->is_const()) {
+        addend += constant->op == Opcode::Add ? constant->operands[1]->imm : -constant->operands[1]->imm;
+        constant = constant->operands[0];
+    }
+    if (constant->op != Opcode::GlobalAddr || info.size != 8) {
+        throw std::runtime_error("The initializer of global '" + name + "' isn't a constant");
+    }
+    global.relocations.push_back({offset, constant->symbol, addend});
+}
+
+GlobalVariable* IRGenerator::global_at(Instr* address, int64_t& offset) {
+    offset = 0;
+    while ((address->op == Opcode::Add || address->op == Opcode::Sub) && address->operands[1]->is_const()) {
+        offset += address->op == Opcode::Add ? address->operands[1]->imm : -address->operands[1]->imm;
+        address = address->operands[0];
+    }
+    if (address->op != Opcode::GlobalAddr) return nullptr;
+    auto global = m_globals.find(address->symbol);
+    return global == m_globals.end() ? nullptr : &m_global_data[global->second.index];
+}
+
+Instr* IRGenerator::read_only_value(Instr* address, TypeId type) {
+    int64_t offset;
+    GlobalVariable* global = global_at(address, offset);
+    int64_t size = type_info(type).size;
+    // One computed at compile time isn't known until the end
+    if (!global || !global->read_only || m_computed_globals.count(global->symbol) || offset < 0 || offset + size > static_cast<int64_t>(global->bytes.size())) {
+        return nullptr;
+    }
+    for (const GlobalVariable::Relocation& relocation : global->relocations) {
+        if (relocation.offset == offset && size == 8) {
+            return m_builder->binary(Opcode::Add, m_builder->global_addr(relocation.symbol),
+                                     m_builder->const_int(relocation.addend));
+        }
+        if (relocation.offset < offset + size && offset < relocation.offset + 8) return nullptr;
+    }
+    int64_t bits = 0;
+    std::memcpy(&bits, &global->bytes[offset], size);
+    return m_builder->const_int(wrap_to_type(type, bits));
+}
+
+void IRGenerator::initialize(Instr* address, TypeId type, ExprNode* init, const std::string& name) {
+    if (ArrayLiteralNode* literal = array_initializer(init, type, name)) {
+        TypeId element = type_info(type).element;
+        for (size_t i = 0; i < literal->elements.size(); i++) {
+            Instr* element_address = m_builder->binary(
+                Opcode::Add, address, m_builder->const_int(static_cast<int64_t>(i) * type_info(element).size));
+            initialize(element_address, element, literal->elements[i].get(), name);
+        }
+        return;
+    }
+    store({-1, type, -1, address}, visit(init));
+}
+
+// --- Types ---
+
+Instr* IRGenerator::convert(Value value, TypeId type) {
+    if (is_struct_type(value.type) || is_struct_type(type)) {
+        // Structs are only ever copied whole, by store()
+        throw std::runtime_error("Type mismatch: expected " + type_name(type) + ", got " + type_name(value.type));
+    }
+    if (is_pointer_type(type) || is_pointer_type(value.type)) {
+        // Only between the same pointer types, and 0 is the null pointer
+        if (value.type == type) return value.instr;
+        bool null = is_integer_type(value.type) && value.instr->is_const() && value.instr->imm == 0;
+        if (null && is_pointer_type(type)) return value.instr;
+        throw std::runtime_error("Type mismatch: expected " + type_name(type) + ", got " + type_name(value.type));
+    }
+    if (is_integer_type(type) && is_integer_type(value.type)) {
+        if (is_free_conversion(value.type, type)) return value.instr;
+        // Keep the low bits, and extend them back to 64 the new type's way
+        const TypeInfo& info = type_info(type);
+        return m_builder->extend(info.is_signed ? Opcode::SExt : Opcode::ZExt, value.instr, info.size * 8);
+    }
+    if (value.type == type) return value.instr;
+    if (is_integer_type(value.type)) return m_builder->splat(type_info(type).value_type, value.instr);
+    throw std::runtime_error("Type mismatch: expected " + type_name(type) + ", got " + type_name(value.type));
+}
+
+Instr* IRGenerator::expect_int(Value value, const std::string& what) {
+    if (!is_integer_type(value.type)) {
+        throw std::runtime_error(what + " must be an integer, not " + type_name(value.type));
+    }
+    return value.instr;
+}
+
+Instr* IRGenerator::expect_scalar(Value value, const std::string& what) {
+    if (!is_integer_type(value.type) && !is_pointer_type(value.type)) {
+        throw std::runtime_error(what + " must be an integer or a pointer, not " + type_name(value.type));
+    }
+    return value.instr;
+}
+
+Instr* IRGenerator::zero_value(TypeId type) {
+    Instr* zero = m_builder->const_int(0);
+    return is_integer_type(type) || is_pointer_type(type) ? zero : m_builder->splat(type_info(type).value_type, zero);
+}
+
+IRGenerator::Value IRGenerator::default_value(TypeId type) {
+    if (!is_struct_type(type)) return {zero_value(type), type};
+    Value value = {nullptr, type};
+    for (const StructField& field : type_info(type).fields) {
+        value.fields.push_back(default_value(field.type));
+    }
+    return value;
+}
+
+IRGenerator::Value IRGenerator::arithmetic(TokenType op, Value lhs, Value rhs) {
+    if (is_pointer_type(lhs.type) || is_pointer_type(rhs.type)) {
+        return pointer_arithmetic(op, lhs, rhs);
+    }
+    if (is_integer_type(lhs.type) && is_integer_type(rhs.type)) {
+        // Everything is already 64 bits wide in a register; only u64
+        // needs the unsigned division and comparisons
+        TypeId type = arithmetic_type(lhs.type, rhs.type);
+        bool is_unsigned = !type_info(type).is_signed;
+        auto compare = [&](CondCode signed_cond, CondCode unsigned_cond) -> Value {
+            return {m_builder->cmp(is_unsigned ? unsigned_cond : signed_cond, lhs.instr, rhs.instr), TYPE_I64};
+        };
+        switch (op) {
+            case TokenType::PLUS:          return {m_builder->binary(Opcode::Add, lhs.instr, rhs.instr), type};
+            case TokenType::MINUS:         return {m_builder->binary(Opcode::Sub, lhs.instr, rhs.instr), type};
+            case TokenType::STAR:          return {m_builder->binary(Opcode::Mul, lhs.instr, rhs.instr), type};
+            case TokenType::SLASH:
+                return {m_builder->binary(is_unsigned ? Opcode::UDiv : Opcode::SDiv, lhs.instr, rhs.instr), type};
+            case TokenType::PERCENT:
+                return {m_builder->binary(is_unsigned ? Opcode::URem : Opcode::SRem, lhs.instr, rhs.instr), type};
+            case TokenType::EQUAL_EQUAL:   return compare(CondCode::EQ, CondCode::EQ);
+            case TokenType::BANG_EQUAL:    return compare(CondCode::NE, CondCode::NE);
+            case TokenType::OPEN_ANGLE:    return compare(CondCode::LT, CondCode::ULT);
+            case TokenType::LESS_EQUAL:    return compare(CondCode::LE, CondCode::ULE);
+            case TokenType::CLOSE_ANGLE:   return compare(CondCode::GT, CondCode::UGT);
+            case TokenType::GREATER_EQUAL: return compare(CondCode::GE, CondCode::UGE);
+            default:
+                throw std::runtime_error("Unknown binary operator!");
+        }
+    }
+
+    if (is_struct_type(lhs.type) || is_struct_type(rhs.type)) {
+        throw std::runtime_error("Can't do arithmetic on " + type_name(is_struct_type(lhs.type) ? lhs.type : rhs.type) +
+                                 " (it's a struct)");
+    }
+
+    // Lane by lane, with an integer operand splatted to match the vector
+    TypeId type = is_integer_type(lhs.type) ? rhs.type : lhs.type;
+    Instr* a = convert(lhs, type);
+    Instr* b = convert(rhs, type);
+    switch (op) {
+        case TokenType::PLUS:  return {m_builder->vector_binary(Opcode::VAdd, a, b), type};
+        case TokenType::MINUS: return {m_builder->vector_binary(Opcode::VSub, a, b), type};
+        case TokenType::STAR:  return {m_builder->vector_binary(Opcode::VMul, a, b), type};
+        case TokenType::SLASH:
+            if (type != TYPE_FLOAT32X8) {
+                throw std::runtime_error("Can't divide " + type_name(type) + " vectors (there is no instruction for it)");
+            }
+            return {m_builder->vector_binary(Opcode::VDiv, a, b), type};
+        default:
+            throw std::runtime_error("Vectors only support + - * and /");
+    }
+}
+
+IRGenerator::Value IRGenerator::pointer_arithmetic(TokenType op, Value lhs, Value rhs) {
+    TypeId pointer = is_pointer_type(lhs.type) ? lhs.type : rhs.type;
+    Instr* size = m_builder->const_int(type_info(type_info(pointer).element).size);
+    auto compare = [&](CondCode cond) -> Value {
+        // Against another pointer of the same type, or null. Addresses are unsigned.
+        Instr* a = convert(lhs, pointer);
+        Instr* b = convert(rhs, pointer);
+        return {m_builder->cmp(cond, a, b), TYPE_I64};
+    };
+    switch (op) {
+        case TokenType::PLUS:
+            // p + n and n + p step over n elements
+            if (is_integer_type(rhs.type)) std::swap(lhs, rhs);
+            if (is_integer_type(lhs.type)) {
+                return {m_builder->binary(Opcode::Add, rhs.instr, m_builder->binary(Opcode::Mul, lhs.instr, size)), pointer};
+            }
+            break;
+        case TokenType::MINUS:
+            if (is_pointer_type(lhs.type) && is_integer_type(rhs.type)) {
+                return {m_builder->binary(Opcode::Sub, lhs.instr, m_builder->binary(Opcode::Mul, rhs.instr, size)), pointer};
+            }
+            // p - q counts the elements between them
+            if (lhs.type == rhs.type) {
+                Instr* bytes = m_builder->binary(Opcode::Sub, lhs.instr, rhs.instr);
+                return {m_builder->binary(Opcode::SDiv, bytes, size), TYPE_I64};
+            }
+            break;
+        case TokenType::EQUAL_EQUAL:   return compare(CondCode::EQ);
+        case TokenType::BANG_EQUAL:    return compare(CondCode::NE);
+        case TokenType::OPEN_ANGLE:    return compare(CondCode::ULT);
+        case TokenType::LESS_EQUAL:    return compare(CondCode::ULE);
+        case TokenType::CLOSE_ANGLE:   return compare(CondCode::UGT);
+        case TokenType::GREATER_EQUAL: return compare(CondCode::UGE);
+        default:
+            break;
+    }
+    throw std::runtime_error("Can't do this arithmetic with " + type_name(lhs.type) + " and " + type_name(rhs.type));
+}
+
+int IRGenerator::constant_lane(ExprNode* node, TypeId type) {
+    Instr* lane = expect_int(visit(node), "A lane index");
+    if (!lane->is_const()) {
+        throw std::runtime_error("A lane index must be a constant");
+    }
+    if (lane->imm < 0 || lane->imm >= lane_count(type_info(type).value_type)) {
+        throw std::runtime_error("Lane " + std::to_string(lane->imm) + " is out of range for " + type_name(type));
+    }
+    return static_cast<int>(lane->imm);
+}
+
+// --- SSA Construction ---
+
+void IRGenerator::write_variable(int variable, BasicBlock* block, Instr* value) {
+    m_current_def[block][variable] = value;
+}
+
+Instr* IRGenerator::read_variable(int variable, BasicBlock* block) {
+    auto& defs = m_current_def[block];
+    auto it = defs.find(variable);
+    if (it != defs.end()) return it->second;
+    return read_variable_recursive(variable, block);
+}
+
+Instr* IRGenerator::read_variable_recursive(int variable, BasicBlock* block) {
+    Instr* value;
+    if (!m_sealed.count(block)) {
+        // More predecessors may still show up (a loop's back edge):
+        // leave a phi to fill in once they're all known
+        value = m_builder->phi(block);
+        value->type = type_info(m_variable_types[variable]).value_type;
+        m_incomplete_phis[block].push_back({variable, value});
+    } else if (block->preds.size() == 1) {
+        // No merge, so no phi. A loop body whose guard folded to false
+        // is only entered from itself: nothing is ever written there.
+        value = in_unreachable_cycle(block) ? undefined_value(type_info(m_variable_types[variable]).value_type)
+                                            : read_variable(variable, block->preds[0]);
+    } else {
+        // Write the phi first: a loop leads back here and must find it
+        Instr* phi = m_builder->phi(block);
+        phi->type = type_info(m_variable_types[variable]).value_type;
+        write_variable(variable, block, phi);
+        value = add_phi_operands(variable, phi);
+    }
+    write_variable(variable, block, value);
+    return value;
+}
+
+// True if going up single predecessors from 'block' goes round in a circle,
+// so it can never be reached
+bool IRGenerator::in_unreachable_cycle(BasicBlock* block) const {
+    std::set<BasicBlock*> seen;
+    for (BasicBlock* pred = block; m_sealed.count(pred) && pred->preds.size() == 1; pred = pred->preds[0]) {
+        if (!seen.insert(pred).second) return true;
+    }
+    return false;
+}
+
+Instr* IRGenerator::add_phi_operands(int variable, Instr* phi) {
+    for (BasicBlock* pred : phi->parent->preds) {
+        m_builder->add_phi_incoming(phi, read_variable(variable, pred), pred);
+    }
+    return try_remove_trivial_phi(phi);
+}
+
+Instr* IRGenerator::try_remove_trivial_phi(Instr* phi) {
+    // A phi that only merges one value (and maybe itself) is that value
+    Instr* same = nullptr;
+    for (Instr* operand : phi->operands) {
+        if (operand == same || operand == phi) continue;
+        if (same) return phi; // Merges at least two values: it stays
+        same = operand;
+    }
+    if (!same) same = undefined_value(phi->type); // Unreachable, or never written
+
+    std::vector<Instr*> phi_users;
+    for (auto& block : m_function->blocks) {
+        for (Instr* user : block->phis()) {
+            if (user != phi && std::count(user->operands.begin(), user->operands.end(), phi)) {
+                phi_users.push_back(user);
+            }
+        }
+    }
+
+    m_function->replace_all_uses(phi, same);
+    for (auto& block_defs : m_current_def) {
+        for (auto& def : block_defs.second) {
+            if (def.second == phi) def.second = same;
+        }
+    }
+
+    // The phi is now unused. It's swept away with the other dead code at
+    // the end of the function; deleting it here could leave dangling
+    // pointers in the recursion below.
+    phi->operands.clear();
+    phi->targets.clear();
+    m_replaced_phis[phi] = same;
+
+    // Its users may have become trivial in turn, and 'same' may be one
+    // of them: return whatever it ended up as
+    for (Instr* user : phi_users) {
+        try_remove_trivial_phi(user);
+    }
+    for (auto it = m_replaced_phis.find(same); it != m_replaced_phis.end(); it = m_replaced_phis.find(same)) {
+        same = it->second;
+    }
+    return same;
+}
+
+Instr* IRGenerator::undefined_value(ValueType type) {
+    if (!is_vector(type)) return m_undefined;
+    Instr*& zero = m_undefined_vectors[static_cast<int>(type)];
+    if (!zero) {
+        // In the entry block, like m_undefined, so it dominates every use
+        IRBuilder entry(m_function);
+        entry.set_insert_point(m_function->blocks[0].get());
+        zero = entry.vec_const(type, std::vector<int64_t>(lane_count(type), 0));
+    }
+    return zero;
+}
+
+void IRGenerator::seal_block(BasicBlock* block) {
+    // Mark it sealed first: filling in the phis can read other variables
+    // here, and those reads can now see every predecessor
+    m_sealed.insert(block);
+    std::vector<std::pair<int, Instr*>> incomplete = std::move(m_incomplete_phis[block]);
+    m_incomplete_phis.erase(block);
+    for (auto& entry : incomplete) {
+        add_phi_operands(entry.first, entry.second);
+    }
+}
+
+void IRGenerator::place_at_end(BasicBlock* block) {
+    auto& blocks = m_function->blocks;
+    auto it = std::find_if(blocks.begin(), blocks.end(),
+        [&](const std::unique_ptr<BasicBlock>& b) { return b.get() == block; });
+    std::rotate(it, it + 1, blocks.end());
+}
+
+void IRGenerator::branch_on(ExprNode* condition, BasicBlock* if_true, BasicBlock* if_false) {
+    std::vector<uint32_t> weights;
+    if (is_branch_hint(condition)) {
+        auto hint = static_cast<CallExprNode*>(condition);
+        weights = hint->callee == "likely" ? std::vector<uint32_t>{LIKELY_WEIGHT, UNLIKELY_WEIGHT}
+                                           : std::vector<uint32_t>{UNLIKELY_WEIGHT, LIKELY_WEIGHT};
+        condition = hint->arguments[0].get();
+    }
+    m_builder->cond_br(expect_int(visit(condition), "A condition"), if_true, if_false, weights);
+}
+
+// --- Statement Visitors ---
+
+// This is the main "router" for statements.
+void IRGenerator::visit(StmtNode* node) {
+    if (!node) return; // Skip null statements
+
+    // Anything after a 'return' can never run. We still lower it (into a
+    // block nobody jumps to) and let remove_unreachable_blocks() drop it.
+    if (m_builder->block_terminated()) {
+        BasicBlock* dead_block = m_function->create_block();
+        seal_block(dead_block);
+        m_builder->set_insert_point(dead_block);
+    }
+
+    if (auto return_stmt = dynamic_cast<ReturnStmtNode*>(node)) {
+        visit(return_stmt);
+    } else if (auto block_stmt = dynamic_cast<BlockStmtNode*>(node)) {
+        visit(block_stmt);
+    } else if (auto expr_stmt = dynamic_cast<ExprStmtNode*>(node)) {
+        visit(expr_stmt);
+    } else if (auto if_stmt = dynamic_cast<IfStmtNode*>(node)) {
+        visit(if_stmt);
+    } else if (auto for_stmt = dynamic_cast<ForStmtNode*>(node)) {
+        visit(for_stmt);
+    } else if (auto switch_stmt = dynamic_cast<SwitchStmtNode*>(node)) {
+        visit(switch_stmt);
+    } else if (auto parallel_for = dynamic_cast<ParallelForStmtNode*>(node)) {
+        visit(parallel_for);
+    } else if (auto for_in = dynamic_cast<ForInStmtNode*>(node)) {
+        visit(for_in);
+    } else if (auto yield = dynamic_cast<YieldStmtNode*>(node)) {
+        visit(yield);
+    } else if (auto var_decl = dynamic_cast<VarDeclNode*>(node)) {
+        visit(var_decl);
+    } else {
+        // We don't know how to compile this type of statement yet!
+        // This is fine, we'll just ignore it (like our parser does).
+    }
+}
+
+void IRGenerator::visit(FunctionDefNode* node) {
+    m_function->name = node->name;
+    m_function->is_comptime = node->is_comptime;
+    m_function->is_exported = node->is_exported || node->name == "main";
+    m_function->is_cold = node->is_cold;
+    m_function->num_params = static_cast<int>(node->parameters.size());
+    m_return_type = node->return_type;
+    if (!is_integer_type(m_return_type) && !is_pointer_type(m_return_type)) {
+        throw std::runtime_error("'" + node->name + "' must return an integer or a pointer, not " +
+                                 type_name(m_return_type));
+    }
+    if (node->is_comptime && is_pointer_type(m_return_type)) {
+        // Nothing the interpreter points to exists at run time
+        throw std::runtime_error("comptime function '" + node->name + "' can't return a pointer");
+    }
+    BasicBlock* entry = m_function->create_block();
+    seal_block(entry);
+    m_builder->set_insert_point(entry);
+    m_address_taken = address_taken(node->body.get());
+
+    // The parameters come first in the entry block, and live in a scope
+    // around the body
+    m_scopes.emplace_back();
+    for (size_t i = 0; i < node->parameters.size(); i++) {
+        const ParameterNode& parameter = node->parameters[i];
+        if (!is_integer_type(parameter.type) && !is_pointer_type(parameter.type)) {
+            throw std::runtime_error("Parameter '" + parameter.name + "' of '" + node->name +
+                                     "' must be an integer or a pointer");
+        }
+        // Our callers pass narrow integers already extended. Code from
+        // elsewhere may not (the ABI leaves the upper bits undefined).
+        Instr* value = m_builder->param(static_cast<int>(i));
+        if (m_function->is_exported && is_integer_type(parameter.type)) value = convert({value, TYPE_I64}, parameter.type);
+        define_variable(declare_variable(parameter.name, parameter.type), {value, parameter.type});
+    }
+    m_undefined = m_builder->const_int(0);
+
+    visit(node->body.get());
+    m_scopes.pop_back();
+
+    // Falling off the end of a function returns 0 (like 'main' in C)
+    if (!m_builder->block_terminated()) {
+        m_builder->ret(m_builder->const_int(0));
+    }
+
+    m_function->remove_unreachable_blocks();
+    m_function->remove_dead_instructions();
+}
+
+void IRGenerator::visit(BlockStmtNode* node) {
+    // A block is just a list of statements. We visit them in order.
+    // Variables declared inside are gone at the '}'.
+    m_scopes.emplace_back();
+    for (const auto& stmt : node->statements) {
+        visit(stmt.get());
+    }
+    m_scopes.pop_back();
+}
+
+void IRGenerator::visit(VarDeclNode* node) {
+    TypeId type = node->type;
+    if (is_array_type(type)) {
+        // A zeroed slot in the stack frame, whole qwords, and then the
+        // elements the initializer has
+        const int64_t max_stack_array = 4 << 20;
+        int64_t size = type_info(type).size;
+        if (size > max_stack_array) {
+            throw std::runtime_error("Array '" + node->name + "' is too big for the stack (" + std::to_string(size) +
+                                     " bytes)");
+        }
+        size = (size + 7) / 8 * 8;
+        Instr* address = frame_memory(size);
+        m_builder->mem_zero(address, size);
+        if (node->initializer) initialize(address, type, node->initializer.get(), node->name);
+        write_variable(declare_variable(node->name, type), m_builder->insert_block(), address);
+        return;
+    }
+    Value value = node->initializer ? visit(node->initializer.get()) : default_value(type);
+    // Declared after the initializer, so 'int x = x;' reads an outer x
+    define_variable(declare_variable(node->name, type), value);
+}
+
+void IRGenerator::visit(ExprStmtNode* node) {
+    // Evaluate the expression and throw the result away
+    visit(node->expression.get());
+}
+
+void IRGenerator::visit(ReturnStmtNode* node) {
+    if (m_expansion || m_state_machine) {
+        // The generator ends: the loop is over, or the state machine
+        // stops for good
+        if (node->expression) {
+            throw std::runtime_error("A generator can't return a value ('return;' ends it)");
+        }
+        if (m_expansion) {
+            m_builder->br(m_expansion->exit);
+        } else {
+            m_builder->store(frame_address(16), m_builder->const_int(-1), 64);
+            m_builder->ret(m_builder->const_int(0));
+        }
+        return;
+    }
+    if (!node->expression) {
+        throw std::runtime_error("'return' needs a value (only a generator's has none)");
+    }
+    Value value = visit(node->expression.get());
+    expect_scalar(value, "A return value");
+    m_builder->ret(convert(value, m_return_type));
+}
+
+void IRGenerator::visit(IfStmtNode* node) {
+    //   condbr cond, then, else
+    // then:
+    //   ...
+    //   br merge
+    // else:
+    //   ...
+    //   br merge
+    // merge:
+    BasicBlock* then_block = m_function->create_block();
+    BasicBlock* merge_block = m_function->create_block();
+    BasicBlock* else_block = node->else_branch ? m_function->create_block() : merge_block;
+
+    branch_on(node->condition.get(), then_block, else_block);
+    seal_block(then_block);
+    if (node->else_branch) seal_block(else_block);
+
+    m_builder->set_insert_point(then_block);
+    visit(node->then_branch.get());
+    if (!m_builder->block_terminated()) m_builder->br(merge_block);
+
+    if (node->else_branch) {
+        place_at_end(else_block);
+        m_builder->set_insert_point(else_block);
+        visit(node->else_branch.get());
+        if (!m_builder->block_terminated()) m_builder->br(merge_block);
+    }
+
+    place_at_end(merge_block);
+    seal_block(merge_block);
+    m_builder->set_insert_point(merge_block);
+}
+
+void IRGenerator::visit(ForStmtNode* node) {
+    // The loop is lowered already rotated: the condition is tested once
+    // up front (the guard) and then at the bottom of every iteration, so
+    // each iteration runs a single conditional branch. The guard often
+    // folds away ('i = 0; i < 10'), and a block that runs at least once
+    // is where the loop optimizer can hoist invariant code to.
+    //
+    //   init
+    //   condbr cond, body, exit
+    // body:
+    //   ...
+    //   step
+    //   condbr cond, body, exit
+    // exit:
+    m_scopes.emplace_back(); // 'for (int i = ...)' is scoped to the loop
+    visit(node->init.get());
+
+    BasicBlock* body_block = m_function->create_block();
+    BasicBlock* exit_block = m_function->create_block();
+
+    auto branch_on_condition = [&]() {
+        if (node->condition) {
+            branch_on(node->condition.get(), body_block, exit_block);
+        } else {
+            m_builder->br(body_block);
+        }
+    };
+    branch_on_condition();
+
+    // The body isn't sealed until the back edge exists
+    m_builder->set_insert_point(body_block);
+    visit(node->body.get());
+    if (!m_builder->block_terminated()) {
+        if (node->step) visit(node->step.get());
+        branch_on_condition();
+    }
+    seal_block(body_block);
+
+    place_at_end(exit_block);
+    seal_block(exit_block);
+    m_builder->set_insert_point(exit_block);
+    m_scopes.pop_back();
+}
+
+void IRGenerator::visit(SwitchStmtNode* node) {
+    // One block per case, in source order. How the switch picks one
+    // (compares, bit tests or a jump table) is decided by lower_switches
+    // (switch.hpp), once the optimizer is done with it.
+    //
+    //   switch value, default, [1: case0, 2: case0, 7: case1]
+    // case0:
+    //   ...
+    //   br exit
+    // case1:
+    //   ...
+    //   br exit
+    // default:        ('exit' if there is none)
+    //   ...
+    // exit:
+    Instr* value = expect_int(visit(node->value.get()), "A switch value");
+    BasicBlock* exit_block = m_function->create_block();
+    BasicBlock* default_block = exit_block;
+
+    std::vector<BasicBlock*> bodies;
+    std::vector<std::pair<int64_t, BasicBlock*>> cases;
+    std::set<int64_t> seen;
+    for (const auto& entry : node->cases) {
+        BasicBlock* body = m_function->create_block();
+        bodies.push_back(body);
+        if (entry.values.empty()) default_block = body;
+        for (const auto& expr : entry.values) {
+            Instr* case_value = expect_int(visit(expr.get()), "A case value");
+            if (!case_value->is_const()) {
+                throw std::runtime_error("Case values must be constants");
+            }
+            if (!seen.insert(case_value->imm).second) {
+                throw std::runtime_error("Duplicate case value " + std::to_string(case_value->imm));
+            }
+            cases.push_back({case_value->imm, body});
+        }
+    }
+    m_builder->switch_br(value, default_block, cases);
+
+    for (size_t i = 0; i < bodies.size(); i++) {
+        place_at_end(bodies[i]);
+        seal_block(bodies[i]);
+        m_builder->set_insert_point(bodies[i]);
+        visit(node->cases[i].body.get());
+        if (!m_builder->block_terminated()) m_builder->br(exit_block);
+    }
+
+    place_at_end(exit_block);
+    seal_block(exit_block);
+    m_builder->set_insert_point(exit_block);
+}
+
+namespace {
+// What a statement uses: the variables it doesn't declare itself, and
+// which of them it assigns to (what a parallel for's body needs from the
+// function around it), the functions it calls, the generators it
+// loops over and the variables it takes the address of
+struct Uses {
+    std::vector<std::set<std::string>> scopes = {{}};
+    std::vector<std::string> used; // In order of first use
+    std::set<std::string> assigned;
+    std::set<std::string> address_taken; // x in &x or &x.field, declared in it or not
+    std::vector<CallExprNode*> calls; // Not those in a for-in's head
+    std::vector<ForInStmtNode*> loops;
+    bool returns = false;
+    bool yields = false;
+
+    bool is_free(const std::string& name) const {
+        for (const auto& scope : scopes) {
+            if (scope.count(name)) return false;
+        }
+        return true;
+    }
+    void use(const std::string& name) {
+        if (is_free(name) && std::find(used.begin(), used.end(), name) == used.end()) used.push_back(name);
+    }
+    void assign(ExprNode* target) {
+        // a[i] = ... and *p = ... change memory. (A field or a lane of a
+        // struct or vector local would change the variable, but those
+        // can't be shared anyway.)
+        auto variable = dynamic_cast<VariableNode*>(target);
+        if (variable && is_free(variable->name)) assigned.insert(variable->name);
+    }
+    void expr(ExprNode* node) {
+        if (!node) return;
+        if (auto variable = dynamic_cast<VariableNode*>(node)) {
+            use(variable->name);
+        } else if (auto binary = dynamic_cast<BinaryOpNode*>(node)) {
+            expr(binary->left.get());
+            expr(binary->right.get());
+        } else if (auto unary = dynamic_cast<UnaryOpNode*>(node)) {
+            expr(unary->operand.get());
+        } else if (auto call = dynamic_cast<CallExprNode*>(node)) {
+            calls.push_back(call);
+            for (auto& argument : call->arguments) expr(argument.get());
+        } else if (auto vector = dynamic_cast<VectorLiteralNode*>(node)) {
+            for (auto& element : vector->elements) expr(element.get());
+        } else if (auto array = dynamic_cast<ArrayLiteralNode*>(node)) {
+            for (auto& element : array->elements) expr(element.get());
+        } else if (auto literal = dynamic_cast<StructLiteralNode*>(node)) {
+            for (auto& element : literal->elements) expr(element.get());
+        } else if (auto conversion = dynamic_cast<ConversionNode*>(node)) {
+            expr(conversion->value.get());
+        } else if (auto index = dynamic_cast<IndexNode*>(node)) {
+            expr(index->base.get());
+            expr(index->index.get());
+        } else if (auto deref = dynamic_cast<DerefNode*>(node)) {
+            expr(deref->pointer.get());
+        } else if (auto address_of = dynamic_cast<AddressOfNode*>(node)) {
+            ExprNode* target = address_of->target.get();
+            while (auto member = dynamic_cast<MemberNode*>(target)) target = member->object.get();
+            if (auto variable = dynamic_cast<VariableNode*>(target)) address_taken.insert(variable->name);
+            expr(address_of->target.get());
+        } else if (auto member = dynamic_cast<MemberNode*>(node)) {
+            expr(member->object.get());
+        } else if (auto assign_node = dynamic_cast<AssignNode*>(node)) {
+            assign(assign_node->target.get());
+            expr(assign_node->target.get());
+            expr(assign_node->value.get());
+        } else if (auto inc_dec = dynamic_cast<IncDecNode*>(node)) {
+            assign(inc_dec->target.get());
+            expr(inc_dec->target.get());
+        } else if (auto spawn = dynamic_cast<SpawnNode*>(node)) {
+            expr(spawn->call.get());
+        }
+    }
+    void stmt(StmtNode* node) {
+        if (!node) return;
+        if (auto block = dynamic_cast<BlockStmtNode*>(node)) {
+            scopes.emplace_back();
+            for (auto& statement : block->statements) stmt(statement.get());
+            scopes.pop_back();
+        } else if (auto return_stmt = dynamic_cast<ReturnStmtNode*>(node)) {
+            returns = true;
+            expr(return_stmt->expression.get());
+        } else if (auto expr_stmt = dynamic_cast<ExprStmtNode*>(node)) {
+            expr(expr_stmt->expression.get());
+        } else if (auto var_decl = dynamic_cast<VarDeclNode*>(node)) {
+            expr(var_decl->initializer.get());
+            scopes.back().insert(var_decl->name);
+        } else if (auto for_stmt = dynamic_cast<ForStmtNode*>(node)) {
+            scopes.emplace_back();
+            stmt(for_stmt->init.get());
+            expr(for_stmt->condition.get());
+            expr(for_stmt->step.get());
+            stmt(for_stmt->body.get());
+            scopes.pop_back();
+        } else if (auto parallel_for = dynamic_cast<ParallelForStmtNode*>(node)) {
+            expr(parallel_for->begin.get());
+            expr(parallel_for->end.get());
+            scopes.push_back({parallel_for->name});
+            stmt(parallel_for->body.get());
+            scopes.pop_back();
+        } else if (auto for_in = dynamic_cast<ForInStmtNode*>(node)) {
+            loops.push_back(for_in);
+            for (auto& argument : for_in->generator->arguments) expr(argument.get());
+            scopes.push_back({for_in->name});
+            stmt(for_in->body.get());
+            scopes.pop_back();
+        } else if (auto yield = dynamic_cast<YieldStmtNode*>(node)) {
+            yields = true;
+            expr(yield->expression.get());
+        } else if (auto if_stmt = dynamic_cast<IfStmtNode*>(node)) {
+            expr(if_stmt->condition.get());
+            stmt(if_stmt->then_branch.get());
+            stmt(if_stmt->else_branch.get());
+        } else if (auto switch_stmt = dynamic_cast<SwitchStmtNode*>(node)) {
+            expr(switch_stmt->value.get());
+            for (auto& entry : switch_stmt->cases) {
+                for (auto& value : entry.values) expr(value.get());
+                stmt(entry.body.get());
+            }
+        }
+    }
+};
+} // namespace
+
+static std::set<std::string> address_taken(StmtNode* body) {
+    Uses uses;
+    uses.stmt(body);
+    return uses.address_taken;
+}
+
+static void calls_and_names(ExprNode* node, std::vector<CallExprNode*>& calls, std::vector<std::string>& names) {
+    Uses uses;
+    uses.expr(node);
+    calls = std::move(uses.calls);
+    names = std::move(uses.used);
+}
+
+void IRGenerator::visit(ParallelForStmtNode* node) {
+    // The body becomes a function of its own (see Outlined), which the
+    // runtime calls on chunks of the iterations, from every thread of its
+    // pool. The locals it reads are copied into a context in our frame;
+    // an array's value is its address, so the body can fill the array,
+    // and so is a local's whose address is taken (atomic_add(&count, ...)).
+    if (!is_integer_type(node->type)) {
+        throw std::runtime_error("A parallel for's loop variable must be an integer, not " + type_name(node->type));
+    }
+    Value begin = visit(node->begin.get());
+    expect_int(begin, "A parallel for's start");
+    Value end = visit(node->end.get());
+    expect_int(end, "A parallel for's end");
+
+    Uses free;
+    free.stmt(node->body.get());
+    if (free.returns || free.yields) {
+        throw std::runtime_error(std::string("Can't ") + (free.returns ? "return" : "yield") +
+                                 " from inside a parallel for");
+    }
+    if (free.assigned.count(node->name)) {
+        throw std::runtime_error("A parallel for can't assign to its loop variable '" + node->name + "'");
+    }
+    Outlined outlined;
+    outlined.name = m_function->name + ".parallel" + std::to_string(m_parallel_loops++);
+    outlined.loop = node;
+    std::vector<Instr*> values;
+    for (const std::string& name : free.used) {
+        int variable = name == node->name ? -1 : lookup_variable(name);
+        if (variable < 0) continue; // A global, or not a variable at all
+        TypeId type = m_variable_types[variable];
+        if (is_struct_type(type) || is_vector_type(type)) {
+            throw std::runtime_error("A parallel for can't use '" + name + "' from outside it: only integers, "
+                                     "pointers and arrays can be shared");
+        }
+        if (free.assigned.count(name)) {
+            // Every thread has a copy, or races the others for a shared
+            // one. An array element, or what a pointer points to, can be
+            // written (atomically, if need be).
+            throw std::runtime_error("A parallel for can't assign to '" + name + "', a local from outside it");
+        }
+        // One in memory is its slot's address: every thread uses that slot
+        bool shared = m_in_memory.count(variable) > 0;
+        outlined.captures.push_back({name, type, shared});
+        values.push_back(read_variable(variable, m_builder->insert_block()));
+    }
+    Instr* context = m_builder->stack_addr(8 * std::max<int64_t>(1, static_cast<int64_t>(values.size())));
+    for (size_t i = 0; i < values.size(); i++) {
+        Instr* address = m_builder->binary(Opcode::Add, context, m_builder->const_int(8 * static_cast<int64_t>(i)));
+        m_builder->store(address, values[i], 64);
+    }
+    m_builder->call("__bolt_parallel_for", {m_builder->global_addr(outlined.name), context,
+                                           convert(begin, TYPE_I64), convert(end, TYPE_I64)});
+    m_outlined.push_back(std::move(outlined));
+    m_uses_runtime_library = true;
+}
+
+void IRGenerator::generate_parallel_body(const Outlined& outlined) {
+    // The loop is rotated like visit(ForStmtNode)'s, without the guard:
+    // the runtime never passes an empty range
+    ParallelForStmtNode* node = outlined.loop;
+    m_address_taken = address_taken(node->body.get());
+    m_function->name = outlined.name;
+    m_function->num_params = 3;
+    m_return_type = TYPE_I64;
+    BasicBlock* entry = m_function->create_block();
+    seal_block(entry);
+    m_builder->set_insert_point(entry);
+    Instr* context = m_builder->param(0);
+    Instr* begin = m_builder->param(1);
+    Instr* end = m_builder->param(2);
+
+    m_scopes.emplace_back();
+    for (size_t i = 0; i < outlined.captures.size(); i++) {
+        Instr* address = m_builder->binary(Opcode::Add, context, m_builder->const_int(8 * static_cast<int64_t>(i)));
+        const Capture& capture = outlined.captures[i];
+        int variable = declare_variable(capture.name, capture.type);
+        Instr* value = m_builder->load(address, 64, false);
+        if (capture.shared) {
+            m_in_memory.insert(variable);
+            write_variable(variable, entry, value);
+        } else {
+            define_variable(variable, {value, capture.type});
+        }
+    }
+    m_undefined = m_builder->const_int(0);
+    int counter_variable = declare_variable(node->name, node->type);
+    define_variable(counter_variable, {begin, TYPE_I64});
+    Target counter = variable_target(counter_variable);
+
+    BasicBlock* body_block = m_function->create_block();
+    BasicBlock* exit_block = m_function->create_block();
+    m_builder->br(body_block);
+    m_builder->set_insert_point(body_block);
+    visit(node->body.get());
+    if (!m_builder->block_terminated()) {
+        store(counter, arithmetic(TokenType::PLUS, load(counter), {m_builder->const_int(1), TYPE_I64}));
+        Instr* next = convert(load(counter), TYPE_I64);
+        m_builder->cond_br(m_builder->cmp(CondCode::LT, next, end), body_block, exit_block);
+    }
+    seal_block(body_block);
+
+    place_at_end(exit_block);
+    seal_block(exit_block);
+    m_builder->set_insert_point(exit_block);
+    m_builder->ret(m_builder->const_int(0));
+    m_scopes.pop_back();
+
+    m_function->remove_unreachable_blocks();
+    m_function->remove_dead_instructions();
+}
+
+void IRGenerator::generate_thread_entry(const Outlined& outlined) {
+    const Signature& signature = m_signatures.at(outlined.callee);
+    m_function->name = outlined.name;
+    m_function->num_params = 1;
+    m_return_type = TYPE_I64;
+    BasicBlock* entry = m_function->create_block();
+    seal_block(entry);
+    m_builder->set_insert_point(entry);
+
+    Instr* thread = m_builder->param(0);
+    std::vector<Instr*> arguments;
+    for (size_t i = 0; i < signature.parameters.size(); i++) {
+        Instr* address = m_builder->binary(Opcode::Add, thread, m_builder->const_int(16 + 8 * static_cast<int64_t>(i)));
+        arguments.push_back(m_builder->load(address, 64, false));
+    }
+    Instr* result = m_builder->call(signature.symbol, arguments);
+    m_builder->store(m_builder->binary(Opcode::Add, thread, m_builder->const_int(8)), result, 64);
+    m_builder->ret(m_builder->const_int(0));
+}
+
+// --- Generics ---
+
+FunctionDefNode* IRGenerator::instance(GenericFunctionNode* generic, CallExprNode* call,
+                                       const std::vector<Value>& arguments) {
+    if (generic->parameters.size() != arguments.size()) {
+        size_t count = generic->parameters.size();
+        std::string expected = std::to_string(count) + (count == 1 ? " argument" : " arguments");
+        throw std::runtime_error("'" + generic->name + "' takes " + expected + ", not " +
+                                 std::to_string(arguments.size()));
+    }
+    const std::vector<std::string>& names = generic->type_parameters;
+    std::vector<TypeId> types = call->type_arguments;
+    if (!types.empty() && types.size() != names.size()) {
+        throw std::runtime_error("'" + generic->name + "' has " + std::to_string(names.size()) +
+                                 " type parameters, not " + std::to_string(types.size()));
+    }
+    if (types.empty()) {
+        // From the arguments: a parameter 'T** p' takes T from what's two
+        // pointers deep in its argument. A number literal (an i64) only
+        // says what nothing else does.
+        types.assign(names.size(), INVALID_TYPE);
+        for (int literals = 0; literals < 2; literals++) {
+            for (size_t i = 0; i < arguments.size(); i++) {
+                const GenericFunctionNode::Pattern& pattern = generic->parameters[i];
+                bool literal = dynamic_cast<NumberLiteralNode*>(call->arguments[i].get()) != nullptr;
+                if (pattern.type_parameter < 0 || literal != (literals == 1)) continue;
+                TypeId& bound = types[pattern.type_parameter];
+                if (literal && bound != INVALID_TYPE) continue;
+                TypeId type = arguments[i].type;
+                for (int depth = 0; depth < pattern.pointer_depth; depth++) {
+                    if (!is_pointer_type(type)) {
+                        throw std::runtime_error("Argument " + std::to_string(i + 1) + " of '" + generic->name +
+                                                 "' must be a pointer, not " + type_name(arguments[i].type));
+                    }
+                    type = type_info(type).element;
+                }
+                if (bound != INVALID_TYPE && bound != type) {
+                    throw std::runtime_error("'" + generic->name + "' gets " + names[pattern.type_parameter] + " = " +
+                                             type_name(bound) + " from one argument and " + type_name(type) +
+                                             " from another: say which, as in " + generic->name + "<" +
+                                             type_name(bound) + ">(...)");
+                }
+                bound = type;
+            }
+        }
+        for (size_t i = 0; i < types.size(); i++) {
+            if (types[i] == INVALID_TYPE) {
+                throw std::runtime_error("The arguments don't say what " + names[i] + " of '" + generic->name +
+                                         "' is: say it, as in " + generic->name + "<i64>(...)");
+            }
+        }
+    }
+
+    std::string name = generic->name;
+    for (TypeId type : types) {
+        name += ".";
+        for (char c : type_name(type)) name += c == '*' ? '$' : c;
+    }
+    auto found = m_instances.find(name);
+    if (found != m_instances.end()) return found->second.get();
+    // A generic that calls itself with a new type each time would never end
+    if (m_instances.size() >= 1000) {
+        throw std::runtime_error("Too many instances of generic functions ('" + generic->name +
+                                 "' calls itself with ever new types?)");
+    }
+
+    std::unique_ptr<FunctionDefNode> definition;
+    try {
+        definition = Parser::instantiate(*generic, types);
+    } catch (const std::exception& e) {
+        throw std::runtime_error("In '" + name + "': " + e.what());
+    }
+    definition->name = name;
+    FunctionDefNode* function = definition.get();
+    m_instances[name] = std::move(definition);
+    Signature& signature = m_signatures[name];
+    signature = {function->return_type, {}, name};
+    for (const ParameterNode& parameter : function->parameters) {
+        signature.parameters.push_back(parameter.type);
+    }
+    if (function->is_generator) {
+        check_generator(function);
+        m_generators[name] = function;
+    } else {
+        m_pending_instances.push_back(function);
+    }
+    return function;
+}
+
+std::vector<IRGenerator::Value> IRGenerator::generic_arguments(CallExprNode* call) {
+    std::vector<Value> arguments;
+    for (auto& argument : call->arguments) {
+        Value value = visit(argument.get());
+        expect_scalar(value, "An argument");
+        arguments.push_back(value);
+    }
+    return arguments;
+}
+
+IRGenerator::Value IRGenerator::visit_generic_call(GenericFunctionNode* generic, CallExprNode* node) {
+    std::vector<Value> arguments = generic_arguments(node);
+    FunctionDefNode* function = instance(generic, node, arguments);
+    if (function->is_generator) {
+        // Its state machine would have to be made before this function
+        throw std::runtime_error("Generic generator '" + generic->name + "' can only be looped over with for-in");
+    }
+    std::vector<Instr*> values;
+    for (size_t i = 0; i < arguments.size(); i++) {
+        values.push_back(convert(arguments[i], function->parameters[i].type));
+    }
+    return {m_builder->call(function->name, values), function->return_type};
+}
+
+// --- Generators ---
+
+void IRGenerator::check_generator(const FunctionDefNode* node) {
+    if (node->is_comptime || node->is_exported) {
+        throw std::runtime_error("Generator '" + node->name + "' can't be comptime or export");
+    }
+    if (!is_integer_type(node->return_type) && !is_pointer_type(node->return_type)) {
+        throw std::runtime_error("Generator '" + node->name + "' must yield integers or pointers, not " +
+                                 type_name(node->return_type));
+    }
+    for (const ParameterNode& parameter : node->parameters) {
+        if (!is_integer_type(parameter.type) && !is_pointer_type(parameter.type)) {
+            throw std::runtime_error("Parameter '" + parameter.name + "' of '" + node->name +
+                                     "' must be an integer or a pointer");
+        }
+    }
+}
+
+void IRGenerator::find_started_generators(StmtNode* statement, std::vector<FunctionDefNode*>& started,
+                                          std::set<FunctionDefNode*>& copied) {
+    Uses uses;
+    uses.stmt(statement);
+    for (CallExprNode* call : uses.calls) {
+        auto generator = m_generators.find(call->callee);
+        if (generator != m_generators.end()) started.push_back(generator->second);
+    }
+    for (ForInStmtNode* loop : uses.loops) {
+        auto generator = m_generators.find(loop->generator->callee);
+        if (generator != m_generators.end() && copied.insert(generator->second).second) {
+            find_started_generators(generator->second->body.get(), started, copied);
+        }
+    }
+}
+
+Instr* IRGenerator::frame_address(int64_t offset) {
+    return m_builder->binary(Opcode::Add, m_state_machine->frame, m_builder->const_int(offset));
+}
+
+Instr* IRGenerator::frame_memory(int64_t bytes) {
+    if (!m_state_machine) return m_builder->stack_addr(bytes);
+    // A state machine's stack frame is gone at every yield
+    int64_t offset = (m_state_machine->frame_size + 15) / 16 * 16;
+    m_state_machine->frame_size = offset + bytes;
+    return frame_address(offset);
+}
+
+void IRGenerator::generate_state_machine(FunctionDefNode* node) {
+    //   entry:  switch frame[16], done, [0: start, 1: resume1, ...]
+    //   start:  the parameters from the frame, then the body
+    //   (yield n) every live variable to the frame, the value to frame[0],
+    //           frame[16] = n, ret 1
+    //   resumen: the variables back from the frame, and on
+    //   (end)   frame[16] = -1, ret 0
+    //   done:   ret 0
+    m_function->name = node->name + ".next";
+    m_function->num_params = 1;
+    m_return_type = TYPE_I64;
+    BasicBlock* entry = m_function->create_block();
+    seal_block(entry);
+    m_builder->set_insert_point(entry);
+    StateMachine machine;
+    machine.generator = node;
+    machine.frame = m_builder->param(0);
+    machine.frame_size = 24;
+    m_state_machine = &machine;
+    m_address_taken = address_taken(node->body.get());
+    Instr* state = m_builder->load(frame_address(16), 64, true);
+    m_undefined = m_builder->const_int(0);
+
+    // The only way in is the switch, which is made last, so the blocks
+    // after it are sealed from the start: every variable they can read
+    // is written at their top
+    BasicBlock* start = m_function->create_block();
+    seal_block(start);
+    m_builder->set_insert_point(start);
+    m_scopes.emplace_back();
+    // The parameters' slots come first, where start_generator() puts the
+    // arguments, and then any memory they need
+    std::vector<int> parameters;
+    for (const ParameterNode& parameter : node->parameters) {
+        parameters.push_back(declare_variable(parameter.name, parameter.type));
+    }
+    for (size_t i = 0; i < parameters.size(); i++) {
+        Instr* argument = m_builder->load(frame_address(machine.slots[parameters[i]]), 64, false);
+        define_variable(parameters[i], {argument, node->parameters[i].type});
+    }
+    visit(node->body.get());
+    if (!m_builder->block_terminated()) {
+        m_builder->store(frame_address(16), m_builder->const_int(-1), 64);
+        m_builder->ret(m_builder->const_int(0));
+    }
+    m_scopes.pop_back();
+    m_state_machine = nullptr;
+
+    BasicBlock* done = m_function->create_block();
+    seal_block(done);
+    m_builder->set_insert_point(done);
+    m_builder->ret(m_builder->const_int(0));
+
+    std::vector<std::pair<int64_t, BasicBlock*>> cases = {{0, start}};
+    cases.insert(cases.end(), machine.resumes.begin(), machine.resumes.end());
+    m_builder->set_insert_point(entry);
+    m_builder->switch_br(state, done, cases);
+    m_frame_sizes[node->name] = machine.frame_size;
+
+    m_function->remove_unreachable_blocks();
+    m_function->remove_dead_instructions();
+}
+
+IRGenerator::Value IRGenerator::start_generator(FunctionDefNode* generator, CallExprNode* node) {
+    auto frame_size = m_frame_sizes.find(generator->name);
+    if (frame_size == m_frame_sizes.end()) {
+        throw std::runtime_error("Generator '" + generator->name + "' starts itself");
+    }
+    if (generator->parameters.size() != node->arguments.size()) {
+        size_t count = generator->parameters.size();
+        std::string expected = std::to_string(count) + (count == 1 ? " argument" : " arguments");
+        throw std::runtime_error("'" + node->callee + "' takes " + expected + ", not " +
+                                 std::to_string(node->arguments.size()));
+    }
+    Instr* frame = frame_memory(frame_size->second);
+    auto at = [&](int64_t offset) { return m_builder->binary(Opcode::Add, frame, m_builder->const_int(offset)); };
+    m_builder->store(at(8), m_builder->global_addr(generator->name + ".next"), 64);
+    m_builder->store(at(16), m_builder->const_int(0), 64);
+    for (size_t i = 0; i < node->arguments.size(); i++) {
+        Value argument = visit(node->arguments[i].get());
+        expect_scalar(argument, "An argument");
+        m_builder->store(at(24 + 8 * static_cast<int64_t>(i)), convert(argument, generator->parameters[i].type), 64);
+    }
+    // *g is the value it yielded last
+    return {frame, pointer_type(generator->return_type)};
+}
+
+void IRGenerator::visit(ForInStmtNode* node) {
+    // The generator's body in place of the loop (see the class comment)
+    CallExprNode* call = node->generator.get();
+    std::vector<Value> values; // A generic's arguments, which say what instance it is
+    auto generic = m_generic_functions.find(call->callee);
+    auto found = m_generators.find(call->callee);
+    if (generic != m_generic_functions.end()) {
+        values = generic_arguments(call);
+        found = m_generators.find(instance(generic->second, call, values)->name);
+    }
+    if (found == m_generators.end()) {
+        throw std::runtime_error("A for-in loops over a generator, and '" + call->callee + "' isn't one");
+    }
+    FunctionDefNode* generator = found->second;
+    bool recursive = m_state_machine && m_state_machine->generator == generator;
+    for (Expansion* expansion = m_expansion; expansion; expansion = expansion->outer) {
+        recursive = recursive || expansion->generator == generator;
+    }
+    if (recursive) {
+        throw std::runtime_error("Generator '" + generator->name + "' can't loop over itself");
+    }
+    if (generator->parameters.size() != call->arguments.size()) {
+        size_t count = generator->parameters.size();
+        std::string expected = std::to_string(count) + (count == 1 ? " argument" : " arguments");
+        throw std::runtime_error("'" + call->callee + "' takes " + expected + ", not " +
+                                 std::to_string(call->arguments.size()));
+    }
+    std::vector<Instr*> arguments;
+    for (size_t i = 0; i < call->arguments.size(); i++) {
+        Value argument = i < values.size() ? values[i] : visit(call->arguments[i].get());
+        expect_scalar(argument, "An argument");
+        arguments.push_back(convert(argument, generator->parameters[i].type));
+    }
+
+    // The loop variable is the loop's; the parameters, and everything
+    // else the generator declares, only its own
+    m_scopes.emplace_back();
+    int variable = declare_variable(node->name, node->type);
+    if (m_in_memory.count(variable)) define_variable(variable, {zero_value(node->type), node->type});
+    Expansion expansion{generator, variable, node->body.get(), m_function->create_block(), std::move(m_scopes),
+                        m_expansion};
+    m_scopes.clear();
+    m_scopes.emplace_back();
+    // The generator's locals and the loop body's are declared from here
+    // on, so what either takes the address of
+    std::set<std::string> outer_address_taken = m_address_taken;
+    std::set<std::string> generator_address_taken = address_taken(generator->body.get());
+    m_address_taken.insert(generator_address_taken.begin(), generator_address_taken.end());
+    for (size_t i = 0; i < arguments.size(); i++) {
+        const ParameterNode& parameter = generator->parameters[i];
+        define_variable(declare_variable(parameter.name, parameter.type), {arguments[i], parameter.type});
+    }
+    m_expansion = &expansion;
+    visit(generator->body.get());
+    if (!m_builder->block_terminated()) m_builder->br(expansion.exit);
+    m_expansion = expansion.outer;
+    m_address_taken = std::move(outer_address_taken);
+    m_scopes = std::move(expansion.outer_scopes);
+
+    place_at_end(expansion.exit);
+    seal_block(expansion.exit);
+    m_builder->set_insert_point(expansion.exit);
+    m_scopes.pop_back();
+}
+
+void IRGenerator::visit(YieldStmtNode* node) {
+    Value value = visit(node->expression.get());
+    expect_scalar(value, "A yielded value");
+
+    if (m_expansion) {
+        // The loop's body runs here, in the loop's scopes
+        Expansion* expansion = m_expansion;
+        TypeId type = expansion->generator->return_type;
+        store(variable_target(expansion->variable), {convert(value, type), type});
+        m_hidden_scopes.push_back(std::move(m_scopes));
+        m_scopes = std::move(expansion->outer_scopes);
+        m_expansion = expansion->outer;
+        visit(expansion->body);
+        m_expansion = expansion;
+        expansion->outer_scopes = std::move(m_scopes);
+        m_scopes = std::move(m_hidden_scopes.back());
+        m_hidden_scopes.pop_back();
+        return;
+    }
+
+    // The state machine stops here. What's live is what's in scope, and
+    // what the generators it's looping over have in theirs.
+    StateMachine& machine = *m_state_machine;
+    Instr* result = convert(value, machine.generator->return_type);
+    std::vector<int> live;
+    auto add_live = [&](const std::vector<std::unordered_map<std::string, int>>& scopes) {
+        for (const auto& scope : scopes) {
+            for (const auto& entry : scope) {
+                if (m_in_memory.count(entry.second)) {
+                    live.push_back(entry.second); // Its slot's address
+                    continue;
+                }
+                int end = entry.second + variable_id_count(m_variable_types[entry.second]);
+                for (int id = entry.second; id < end; id++) {
+                    if (is_struct_type(m_variable_types[id])) continue; // Only its fields have values
+                    if (is_vector_type(m_variable_types[id])) {
+                        throw std::runtime_error("Vector '" + entry.first + "' can't be live across a yield");
+                    }
+                    live.push_back(id);
+                }
+            }
+        }
+    };
+    add_live(m_scopes);
+    for (const auto& scopes : m_hidden_scopes) add_live(scopes);
+
+    BasicBlock* block = m_builder->insert_block();
+    for (int id : live) {
+        m_builder->store(frame_address(machine.slots.at(id)), read_variable(id, block), 64);
+    }
+    int64_t state = static_cast<int64_t>(machine.resumes.size()) + 1;
+    m_builder->store(frame_address(0), result, 64);
+    m_builder->store(frame_address(16), m_builder->const_int(state), 64);
+    m_builder->ret(m_builder->const_int(1));
+
+    BasicBlock* resume = m_function->create_block();
+    seal_block(resume);
+    m_builder->set_insert_point(resume);
+    machine.resumes.push_back({state, resume});
+    for (int id : live) {
+        write_variable(id, resume, m_builder->load(frame_address(machine.slots.at(id)), 64, false));
+    }
+}
+
+// --- Expression Visitors ---
+
+// This is the main "router" for expressions.
+IRGenerator::Value IRGenerator::visit(ExprNode* node) {
+    if (auto num_literal = dynamic_cast<NumberLiteralNode*>(node)) {
+        return visit(num_literal);
+    } else if (auto string_literal = dynamic_cast<StringLiteralNode*>(node)) {
+        return visit(string_literal);
+    } else if (auto binary = dynamic_cast<BinaryOpNode*>(node)) {
+        return visit(binary);
+    } else if (auto unary = dynamic_cast<UnaryOpNode*>(node)) {
+        return visit(unary);
+    } else if (auto call = dynamic_cast<CallExprNode*>(node)) {
+        return visit(call);
+    } else if (auto variable = dynamic_cast<VariableNode*>(node)) {
+        return visit(variable);
+    } else if (auto assign = dynamic_cast<AssignNode*>(node)) {
+        return visit(assign);
+    } else if (auto inc_dec = dynamic_cast<IncDecNode*>(node)) {
+        return visit(inc_dec);
+    } else if (auto vector = dynamic_cast<VectorLiteralNode*>(node)) {
+        return visit(vector);
+    } else if (auto conversion = dynamic_cast<ConversionNode*>(node)) {
+        return visit(conversion);
+    } else if (auto index = dynamic_cast<IndexNode*>(node)) {
+        return visit(index);
+    } else if (auto literal = dynamic_cast<StructLiteralNode*>(node)) {
+        return visit(literal);
+    } else if (auto member = dynamic_cast<MemberNode*>(node)) {
+        return visit(member);
+    } else if (auto deref = dynamic_cast<DerefNode*>(node)) {
+        return visit(deref);
+    } else if (auto address_of = dynamic_cast<AddressOfNode*>(node)) {
+        return visit(address_of);
+    } else if (auto spawn = dynamic_cast<SpawnNode*>(node)) {
+        return visit(spawn);
+    } else if (dynamic_cast<ArrayLiteralNode*>(node)) {
+        throw std::runtime_error("An array literal {...} can only initialize an array");
+    }
+    throw std::runtime_error("Unknown expression type!");
+}
+
+IRGenerator::Value IRGenerator::visit(NumberLiteralNode* node) {
+    // Parse as unsigned so the full 64-bit range fits
+    return {m_builder->const_int(static_cast<int64_t>(std::stoull(node->value))), TYPE_I64};
+}
+
+IRGenerator::Value IRGenerator::visit(StringLiteralNode* node) {
+    // The same literal twice is the same bytes in .rodata
+    auto [it, inserted] = m_string_ids.emplace(node->value, m_strings.size());
+    if (inserted) m_strings.push_back(node->value);
+    return {m_builder->global_addr(string_label(it->second)), pointer_type(TYPE_U8)};
+}
+
+IRGenerator::Value IRGenerator::visit(BinaryOpNode* node) {
+    Value lhs = visit(node->left.get());
+    Value rhs = visit(node->right.get());
+    return arithmetic(node->op, lhs, rhs);
+}
+
+IRGenerator::Value IRGenerator::visit(UnaryOpNode* node) {
+    Value operand = visit(node->operand.get());
+    if (is_vector_type(operand.type)) {
+        return {m_builder->vector_binary(Opcode::VSub, zero_value(operand.type), operand.instr), operand.type};
+    }
+    expect_int(operand, "A negated value");
+    return {m_builder->neg(operand.instr), arithmetic_type(operand.type, operand.type)};
+}
+
+IRGenerator::Value IRGenerator::visit(CallExprNode* node) {
+    if (node->callee == "shuffle") {
+        return visit_shuffle(node);
+    }
+    if (is_branch_hint(node)) {
+        Value value = visit(node->arguments[0].get());
+        expect_int(value, node->callee + "()'s argument");
+        return value;
+    }
+    Value builtin = visit_bit_builtin(node);
+    if (builtin.instr) {
+        return builtin;
+    }
+    auto generic = m_generic_functions.find(node->callee);
+    if (generic != m_generic_functions.end()) {
+        return visit_generic_call(generic->second, node);
+    }
+    auto generator = m_generators.find(node->callee);
+    if (generator != m_generators.end()) {
+        return start_generator(generator->second, node);
+    }
+    // Functions from elsewhere are declared 'extern' (and follow the
+    // System V ABI)
+    auto known = m_signatures.find(node->callee);
+    if (known == m_signatures.end()) {
+        Value atomic = visit_atomic_builtin(node);
+        if (atomic.instr) {
+            return atomic;
+        }
+        if (node->callee == "next") {
+            // next(g): runs generator g to its next value, which is then
+            // at *g. 1 if there was one, 0 once g has ended.
+            if (node->arguments.size() != 1) throw std::runtime_error("next() takes 1 argument");
+            Value generator = visit(node->arguments[0].get());
+            if (!is_pointer_type(generator.type)) {
+                throw std::runtime_error("next() needs a generator, not " + type_name(generator.type));
+            }
+            Instr* function = m_builder->load(m_builder->binary(Opcode::Add, generator.instr, m_builder->const_int(8)),
+                                              64, false);
+            Instr* zero = m_builder->const_int(0);
+            return {m_builder->call("__bolt_invoke", {function, generator.instr, zero, zero}), TYPE_I64};
+        }
+        if (node->callee == "prefetch") {
+            // prefetch(p): asks for the cache line p is in, ahead of the
+            // loads that will need it
+            if (node->arguments.size() != 1) throw std::runtime_error("prefetch() takes 1 argument");
+            Value pointer = visit(node->arguments[0].get());
+            if (!is_pointer_type(pointer.type)) {
+                throw std::runtime_error("prefetch() needs a pointer, not " + type_name(pointer.type));
+            }
+            m_builder->prefetch(pointer.instr);
+            return {m_builder->const_int(0), TYPE_I64};
+        }
+        Value library = visit_library_builtin(node);
+        if (library.instr) {
+            return library;
+        }
+        throw std::runtime_error("Call to undefined function '" + node->callee +
+                                 "' (declare it 'extern' if it's defined elsewhere)");
+    }
+
+    const Signature& signature = known->second;
+    if (signature.parameters.size() != node->arguments.size()) {
+        size_t count = signature.parameters.size();
+        std::string expected = std::to_string(count) + (count == 1 ? " argument" : " arguments");
+        throw std::runtime_error("'" + node->callee + "' takes " + expected + ", not " +
+                                 std::to_string(node->arguments.size()));
+    }
+    std::vector<Instr*> arguments;
+    for (size_t i = 0; i < node->arguments.size(); i++) {
+        Value argument = visit(node->arguments[i].get());
+        expect_scalar(argument, "An argument");
+        arguments.push_back(convert(argument, signature.parameters[i]));
+    }
+    return {m_builder->call(signature.symbol, arguments), signature.return_type};
+}
+
+IRGenerator::Value IRGenerator::visit_library_builtin(CallExprNode* node) {
+    if (node->callee == "print") {
+        // One call per argument, to the function for its type
+        for (auto& argument : node->arguments) {
+            Value value = visit(argument.get());
+            std::string function;
+            if (value.type == pointer_type(TYPE_U8)) {
+                function = "__bolt_print_string";
+            } else if (is_integer_type(value.type)) {
+                bool is_signed = type_info(value.type).is_signed;
+                function = is_signed ? "__bolt_print_int" : "__bolt_print_uint";
+                value.instr = convert(value, is_signed ? TYPE_I64 : TYPE_U64);
+            } else {
+                throw std::runtime_error("print() can't print " + type_name(value.type) +
+                                         " (only integers and strings)");
+            }
+            m_builder->call(function, {value.instr});
+        }
+        m_uses_runtime_library = true;
+        return {m_builder->const_int(0), TYPE_I64};
+    }
+
+    // The others are plain calls to __bolt_<name>
+    struct Builtin {
+        const char* name;
+        TypeId return_type;
+        std::vector<TypeId> parameters;
+    };
+    static const Builtin builtins[] = {
+        {"flush",       TYPE_I64,              {}},
+        {"read_int",    TYPE_I64,              {}},
+        {"read_byte",   TYPE_I64,              {}},
+        {"alloc",       pointer_type(TYPE_U8), {TYPE_I64}},
+        {"dealloc",     TYPE_I64,              {pointer_type(TYPE_U8)}},
+        {"arena_new",   pointer_type(TYPE_U8), {TYPE_I64}},
+        {"arena_alloc", pointer_type(TYPE_U8), {pointer_type(TYPE_U8), TYPE_I64}},
+        {"arena_reset", TYPE_I64,              {pointer_type(TYPE_U8)}},
+        {"join",        TYPE_I64,              {TYPE_I64}},
+    };
+    for (const Builtin& builtin : builtins) {
+        if (node->callee != builtin.name) continue;
+        if (node->arguments.size() != builtin.parameters.size()) {
+            size_t count = builtin.parameters.size();
+            std::string expected = count == 0 ? "no arguments"
+                                 : std::to_string(count) + (count == 1 ? " argument" : " arguments");
+            throw std::runtime_error(node->callee + "() takes " + expected);
+        }
+        std::vector<Instr*> arguments;
+        for (size_t i = 0; i < node->arguments.size(); i++) {
+            Value argument = visit(node->arguments[i].get());
+            expect_scalar(argument, "An argument");
+            arguments.push_back(convert(argument, builtin.parameters[i]));
+        }
+        m_uses_runtime_library = true;
+        return {m_builder->call("__bolt_" + node->callee, arguments), builtin.return_type};
+    }
+    return {nullptr, TYPE_I64};
+}
+
+IRGenerator::Value IRGenerator::visit_atomic_builtin(CallExprNode* node) {
+    // How many values each takes, between the pointer and the ordering
+    static const std::unordered_map<std::string, size_t> operations = {
+        {"atomic_load", 0}, {"atomic_store", 1}, {"atomic_add", 1}, {"atomic_exchange", 1}, {"atomic_cas", 2},
+    };
+    const std::string& name = node->callee;
+    auto operation = operations.find(name);
+    if (name != "fence" && operation == operations.end()) return {nullptr, TYPE_I64};
+    size_t count = name == "fence" ? 1 : operation->second + 2;
+    if (node->arguments.size() != count) {
+        throw std::runtime_error(name + "() takes " + std::to_string(count) + (count == 1 ? " argument" : " arguments"));
+    }
+
+    // The ordering is a name, last. x86 keeps every ordering but a store
+    // followed by a load, so only seq_cst stores and fences cost anything;
+    // the others just keep the compiler from moving memory accesses across
+    // them, which a call never does.
+    static const std::set<std::string> orderings = {"relaxed", "acquire", "release", "acq_rel", "seq_cst"};
+    auto ordering_node = dynamic_cast<VariableNode*>(node->arguments.back().get());
+    if (!ordering_node || !orderings.count(ordering_node->name)) {
+        throw std::runtime_error(name + "()'s last argument must be an ordering: relaxed, acquire, release, "
+                                 "acq_rel or seq_cst");
+    }
+    const std::string& ordering = ordering_node->name;
+    if (name == "fence") {
+        m_builder->call(std::string(ATOMIC_PREFIX) + (ordering == "seq_cst" ? "fence_seq_cst" : "fence"));
+        return {m_builder->const_int(0), TYPE_I64};
+    }
+    if ((name == "atomic_load" && (ordering == "release" || ordering == "acq_rel")) ||
+        (name == "atomic_store" && (ordering == "acquire" || ordering == "acq_rel"))) {
+        throw std::runtime_error(name + "() can't be " + ordering);
+    }
+
+    Value pointer = visit(node->arguments[0].get());
+    TypeId element = is_pointer_type(pointer.type) ? type_info(pointer.type).element : INVALID_TYPE;
+    if (element == INVALID_TYPE || !is_integer_type(element)) {
+        throw std::runtime_error(name + "() needs a pointer to an integer, not " + type_name(pointer.type));
+    }
+    std::vector<Instr*> arguments = {pointer.instr};
+    for (size_t i = 1; i + 1 < count; i++) {
+        Value value = visit(node->arguments[i].get());
+        expect_int(value, name + "()'s operand");
+        arguments.push_back(convert(value, element));
+    }
+    std::string intrinsic = name.substr(std::strlen("atomic_"));
+    if (name == "atomic_store" && ordering == "seq_cst") intrinsic = "store_seq_cst";
+    Instr* result = m_builder->call(ATOMIC_PREFIX + intrinsic + "." + std::to_string(type_info(element).size), arguments);
+    if (name == "atomic_store") return {m_builder->const_int(0), TYPE_I64};
+    // The old value (what's loaded, for atomic_load)
+    return {convert({result, TYPE_I64}, element), element};
+}
+
+bool IRGenerator::is_branch_hint(ExprNode* node) {
+    auto call = dynamic_cast<CallExprNode*>(node);
+    if (!call || (call->callee != "likely" && call->callee != "unlikely")) return false;
+    if (call->arguments.size() != 1) throw std::runtime_error(call->callee + "() takes 1 argument");
+    return true;
+}
+
+IRGenerator::Value IRGenerator::visit_bit_builtin(CallExprNode* node) {
+    struct Builtin {
+        const char* name;
+        Opcode op;
+        size_t arguments;
+    };
+    static const Builtin builtins[] = {
+        {"popcount", Opcode::Popcnt, 1},
+        {"clz",      Opcode::Clz,    1},
+        {"ctz",      Opcode::Ctz,    1},
+        {"bswap",    Opcode::Bswap,  1},
+        {"rotl",     Opcode::Rotl,   2},
+        {"rotr",     Opcode::Rotr,   2},
+    };
+    for (const Builtin& builtin : builtins) {
+        if (node->callee != builtin.name) continue;
+        if (node->arguments.size() != builtin.arguments) {
+            throw std::runtime_error(node->callee + "() takes " + std::to_string(builtin.arguments) +
+                                     (builtin.arguments == 1 ? " argument" : " arguments"));
+        }
+        std::vector<Value> values;
+        for (auto& argument : node->arguments) {
+            Value value = visit(argument.get());
+            expect_int(value, node->callee + "()'s argument");
+            values.push_back(value);
+        }
+        TypeId type = values[0].type;
+        int bits = static_cast<int>(type_info(type).size) * 8;
+        Instr* x = values[0].instr;
+        if (bits == 64) {
+            if (builtin.arguments == 1) return {m_builder->unary(builtin.op, x), type};
+            return {m_builder->binary(builtin.op, x, values[1].instr), type};
+        }
+        // A narrow x is held extended to 64 bits. The operations that look
+        // at the bits above its own see them zero-extended instead.
+        Instr* low = m_builder->extend(Opcode::ZExt, x, bits);
+        Instr* result;
+        switch (builtin.op) {
+            case Opcode::Popcnt:
+                result = m_builder->unary(Opcode::Popcnt, low);
+                break;
+            case Opcode::Clz:
+                result = m_builder->binary(Opcode::Sub, m_builder->unary(Opcode::Clz, low),
+                                           m_builder->const_int(64 - bits));
+                break;
+            case Opcode::Ctz:
+                // With bit 'bits' set, 0 has 'bits' trailing zeros
+                result = m_builder->unary(Opcode::Ctz,
+                                          m_builder->binary(Opcode::Add, low, m_builder->const_int(int64_t(1) << bits)));
+                break;
+            case Opcode::Bswap:
+                // The swapped bytes end up at the top; rotating by 'bits'
+                // brings them back down
+                if (bits == 8) return {x, type};
+                result = m_builder->binary(Opcode::Rotl, m_builder->unary(Opcode::Bswap, x),
+                                           m_builder->const_int(bits));
+                break;
+            default: {
+                // Copies of x side by side all the way up: rotating those by n
+                // rotates each copy by n mod 'bits'
+                int64_t copies = bits == 8    ? 0x0101010101010101
+                                 : bits == 16 ? 0x0001000100010001
+                                              : 0x0000000100000001;
+                Instr* repeated = m_builder->binary(Opcode::Mul, low, m_builder->const_int(copies));
+                result = m_builder->binary(builtin.op, repeated, values[1].instr);
+                break;
+            }
+        }
+        return {convert({result, TYPE_I64}, type), type};
+    }
+    return {nullptr, INVALID_TYPE};
+}
+
+IRGenerator::Value IRGenerator::visit_shuffle(CallExprNode* node) {
+    if (node->arguments.empty()) {
+        throw std::runtime_error("shuffle() needs a vector and its new lane order");
+    }
+    Value vector = visit(node->arguments[0].get());
+    if (!is_vector_type(vector.type)) {
+        throw std::runtime_error("shuffle() needs a vector, not " + type_name(vector.type));
+    }
+    int lanes = lane_count(vector.instr->type);
+    if (static_cast<int>(node->arguments.size()) != lanes + 1) {
+        throw std::runtime_error("Shuffling a " + type_name(vector.type) + " takes " + std::to_string(lanes) + " lane indices");
+    }
+    std::vector<int64_t> indices;
+    for (size_t i = 1; i < node->arguments.size(); i++) {
+        indices.push_back(constant_lane(node->arguments[i].get(), vector.type));
+    }
+    return {m_builder->shuffle(vector.instr, indices), vector.type};
+}
+
+IRGenerator::Value IRGenerator::visit(VariableNode* node) {
+    return load(resolve_target(node));
+}
+
+IRGenerator::Value IRGenerator::visit(AssignNode* node) {
+    Target target = resolve_target(node->target.get());
+    TokenType op = node->op == TokenType::PLUS_EQUAL ? TokenType::PLUS : TokenType::MINUS;
+    if (target.lane >= 0) {
+        return assign_lane(node, target, op);
+    }
+
+    Value value = visit(node->value.get());
+    if (node->op != TokenType::EQUALS) {
+        value = arithmetic(op, load(target), value);
+    }
+    return store(target, value);
+}
+
+IRGenerator::Value IRGenerator::assign_lane(AssignNode* node, const Target& target, TokenType op) {
+    // v[i] = x replaces the lane; v[i] += x adds a vector that is x in
+    // lane i and 0 elsewhere, so float lanes keep their fraction
+    Value value = visit(node->value.get());
+    if (node->op == TokenType::EQUALS) {
+        return store(target, value);
+    }
+    Value addend = {m_builder->insert(zero_value(target.type), expect_int(value, "A lane's new value"), target.lane),
+                    target.type};
+    Value old = {read_variable(target.variable, m_builder->insert_block()), target.type};
+    Instr* updated = arithmetic(op, old, addend).instr;
+    write_variable(target.variable, m_builder->insert_block(), updated);
+    return {m_builder->extract(updated, target.lane), TYPE_I64};
+}
+
+IRGenerator::Value IRGenerator::visit(IncDecNode* node) {
+    Target target = resolve_target(node->target.get());
+    Value old = load(target);
+    TokenType op = node->op == TokenType::PLUS_PLUS ? TokenType::PLUS : TokenType::MINUS;
+    Value updated = store(target, arithmetic(op, old, {m_builder->const_int(1), TYPE_I64}));
+    return node->prefix ? updated : old;
+}
+
+IRGenerator::Value IRGenerator::visit(ConversionNode* node) {
+    Value value = visit(node->value.get());
+    expect_scalar(value, "A converted value");
+    // Any pointer from an integer or another pointer, and back. An
+    // address is a u64.
+    if (is_pointer_type(node->type)) return {value.instr, node->type};
+    if (is_pointer_type(value.type)) value.type = TYPE_U64;
+    return {convert(value, node->type), node->type};
+}
+
+IRGenerator::Value IRGenerator::visit(VectorLiteralNode* node) {
+    ValueType type = type_info(node->type).value_type;
+    int lanes = lane_count(type);
+    std::vector<Instr*> values;
+    for (const auto& element : node->elements) {
+        values.push_back(expect_int(visit(element.get()), "A vector element"));
+    }
+
+    if (values.size() == 1) {
+        return {m_builder->splat(type, values[0]), node->type};
+    }
+    if (static_cast<int>(values.size()) != lanes) {
+        throw std::runtime_error(type_name(node->type) + " takes 1 or " + std::to_string(lanes) + " values, not " +
+                                 std::to_string(values.size()));
+    }
+
+    // The constant lanes come from .rodata, the others are put in one by one
+    std::vector<int64_t> constants;
+    for (Instr* value : values) constants.push_back(value->is_const() ? value->imm : 0);
+    Instr* vector = m_builder->vec_const(type, constants);
+    for (int lane = 0; lane < lanes; lane++) {
+        if (!values[lane]->is_const()) vector = m_builder->insert(vector, values[lane], lane);
+    }
+    return {vector, node->type};
+}
+
+IRGenerator::Value IRGenerator::visit(IndexNode* node) {
+    if (is_place(node->base.get())) {
+        return load(resolve_target(node));
+    }
+    // A temporary: a vector's lane, or what a computed pointer points to
+    Value base = visit(node->base.get());
+    if (is_vector_type(base.type)) {
+        return {m_builder->extract(base.instr, constant_lane(node->index.get(), base.type)), TYPE_I64};
+    }
+    if (!is_pointer_type(base.type)) {
+        throw std::runtime_error("Only vectors, arrays and pointers can be indexed");
+    }
+    TypeId element = type_info(base.type).element;
+    Instr* index = expect_int(visit(node->index.get()), "A pointer index");
+    return load({-1, element, -1, element_address(base.instr, index, type_info(element).size)});
+}
+
+IRGenerator::Value IRGenerator::visit(StructLiteralNode* node) {
+    const TypeInfo& info = type_info(node->type);
+    if (node->elements.empty()) return default_value(node->type);
+    if (node->elements.size() != info.fields.size()) {
+        throw std::runtime_error(info.name + " takes " + std::to_string(info.fields.size()) + " values, not " +
+                                 std::to_string(node->elements.size()));
+    }
+    Value value = {nullptr, node->type};
+    for (size_t i = 0; i < info.fields.size(); i++) {
+        const StructField& field = info.fields[i];
+        Value element = visit(node->elements[i].get());
+        if (is_struct_type(field.type)) {
+            if (element.type != field.type) {
+                throw std::runtime_error("Field '" + field.name + "' of " + info.name + " is a " +
+                                         type_name(field.type) + ", not " + type_name(element.type));
+            }
+            value.fields.push_back(element);
+        } else {
+            expect_scalar(element, "Field '" + field.name + "' of " + info.name);
+            value.fields.push_back({convert(element, field.type), field.type});
+        }
+    }
+    return value;
+}
+
+IRGenerator::Value IRGenerator::visit(MemberNode* node) {
+    // A field of a variable, or in memory, is read on its own, without the rest
+    ExprNode* object = node->object.get();
+    if (is_place(object)) {
+        return load(resolve_target(node));
+    }
+    // Otherwise the struct is a temporary, e.g., Point(1, 2).x
+    Value value = visit(object);
+    if (!is_struct_type(value.type)) {
+        throw std::runtime_error("'." + node->field + "' needs a struct, not " + type_name(value.type));
+    }
+    int field = find_field(value.type, node->field);
+    if (field < 0) {
+        throw std::runtime_error(type_name(value.type) + " has no field '" + node->field + "'");
+    }
+    return value.fields[field];
+}
+
+IRGenerator::Value IRGenerator::visit(DerefNode* node) {
+    return load(resolve_target(node));
+}
+
+IRGenerator::Value IRGenerator::visit(AddressOfNode* node) {
+    if (!is_place(node->target.get())) {
+        throw std::runtime_error("'&' needs something in memory");
+    }
+    Target target = resolve_target(node->target.get());
+    if (target.soa_index) {
+        throw std::runtime_error("An element of an array of @soa structs has no address (its fields do)");
+    }
+    if (!target.address) {
+        // Only a lane of a vector: locals whose address is taken are in memory
+        throw std::runtime_error("A lane of a vector has no address");
+    }
+    return {target.address, pointer_type(target.type)};
+}
+
+IRGenerator::Value IRGenerator::visit(SpawnNode* node) {
+    // The arguments go in the thread's block (runtime.hpp), where the
+    // callee's thread entry finds them
+    CallExprNode* call = node->call.get();
+    std::string callee = call->callee;
+    std::vector<Value> values; // A generic's arguments, which say what instance it is
+    auto generic = m_generic_functions.find(callee);
+    if (generic != m_generic_functions.end()) {
+        values = generic_arguments(call);
+        callee = instance(generic->second, call, values)->name;
+    }
+    auto known = m_signatures.find(callee);
+    if (known == m_signatures.end() || known->second.symbol != callee || m_generators.count(callee)) {
+        throw std::runtime_error("spawn needs a function of the program, and '" + call->callee + "' isn't one");
+    }
+    const Signature& signature = known->second;
+    if (signature.parameters.size() != call->arguments.size()) {
+        size_t count = signature.parameters.size();
+        std::string expected = std::to_string(count) + (count == 1 ? " argument" : " arguments");
+        throw std::runtime_error("'" + call->callee + "' takes " + expected + ", not " +
+                                 std::to_string(call->arguments.size()));
+    }
+    if (call->arguments.size() > 14) {
+        throw std::runtime_error("A spawned function can take at most 14 arguments");
+    }
+    Instr* thread = m_builder->call("__bolt_thread_new");
+    for (size_t i = 0; i < call->arguments.size(); i++) {
+        Value argument = i < values.size() ? values[i] : visit(call->arguments[i].get());
+        expect_scalar(argument, "An argument");
+        Instr* address = m_builder->binary(Opcode::Add, thread, m_builder->const_int(16 + 8 * static_cast<int64_t>(i)));
+        m_builder->store(address, convert(argument, signature.parameters[i]), 64);
+    }
+    std::string entry = callee + ".thread";
+    if (m_thread_entries.insert(callee).second) {
+        Outlined outlined;
+        outlined.name = entry;
+        outlined.callee = callee;
+        m_outlined.push_back(std::move(outlined));
+    }
+    m_uses_runtime_library = true;
+    return {m_builder->call("__bolt_thread_start", {thread, m_builder->global_addr(entry)}), TYPE_I64};
+}
@@ -0,0 +1,376 @@
+#pragma once
+
+#include "parser.hpp" // We need the AST definitions
+#include "ir.hpp"
+#include "options.hpp"
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// This class walks the AST (from parser.hpp) and lowers it to the IR
+// (from ir.hpp), one IRFunction per function definition.
+//
+// Local variables never touch memory: the IR is built in SSA form
+// directly, with the algorithm from Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form" (CC 2013). We remember
+// each variable's current value per block, and a read in a block that
+// doesn't know it asks the predecessors, placing a phi where they merge.
+//
+// Values are integers or vectors (int32x4, int32x8, float32x8). An
+// integer used where a vector is expected is copied into every lane;
+// anything else that mixes types is an error. Integers of different
+// types mix freely: the rules are in types.hpp.
+//
+// A struct local is scalar-replaced: each field is a variable of its
+// own, so fields live in registers like any other local, and a field
+// that's never read costs nothing. Struct values can be copied, but not
+// passed to or returned from functions.
+//
+// Arrays are locals in memory: a slot in the stack frame each, zeroed
+// where the array is declared. The array variable holds the slot's
+// address. Reading an array gives a pointer to its first element.
+// Indexing one is checked against its length (unless -fno-bounds-check);
+// most of the checks in loops go away again in bounds.hpp. Indexing a
+// pointer isn't checked: there's no length to check against.
+//
+// So is a local whose address is taken: '&x' or '&x.field' anywhere in
+// its function (by name, worked out before the function is generated)
+// puts every local called x in a slot of its own. Its variable holds the
+// slot's address like an array's, and reading or assigning it is a load
+// or a store. Every other local stays an SSA value.
+//
+// Global variables are in memory too, at a label of their own name; their
+// initializers must be constants (or addresses of globals and string
+// literals), worked out here into the bytes the assembler writes out. A
+// 'const' global is read-only: reading it at a constant offset is just
+// the constant it holds, so a table of them costs nothing where the index
+// is known.
+//
+// A function with a 'yield' in it is a generator, which doesn't become a
+// function of its own. 'for (T x in g(...))' copies g's body into the
+// loop, each 'yield v' becoming 'x = v' followed by the loop's body: the
+// loop costs what the same code written out by hand would. The copy is
+// made here, as the IR is generated (there is no inliner). Calling g
+// anywhere else starts its state machine (see generate_state_machine()),
+// which next() runs a value at a time.
+//
+// A generic function gets an instance per set of type arguments it's
+// called with: its definition parsed again with the types in place of
+// the type parameters, and generated like any other function. What isn't
+// given at the call (max<u8>(a, b)) is worked out from the arguments'
+// types (max(a, b)). Each instance is made once, however many calls need
+// it; the code generator folds those whose machine code comes out the
+// same into one.
+class IRGenerator {
+public:
+    IRGenerator(const CompilerOptions& options) : m_bounds_checks(options.bounds_checks) {}
+
+    IRModule generate(const ProgramNode& ast);
+
+private:
+    // Adds the functions and globals of 'ast' to 'module'
+    void add_program(const ProgramNode& ast, IRModule& module);
+    // Drops the runtime library's functions (those from 'program_functions'
+    // on) and globals that the program doesn't reach
+    void remove_unused_library_code(IRModule& module, size_t program_functions);
+    bool m_uses_runtime_library = false; // print(), alloc() and the like (runtime.hpp)
+
+    // --- Threads ---
+    // Functions made from parts of others, generated right after the
+    // function that needs them:
+    //   <function>.parallel<N>(context, begin, end): the body of a
+    //     parallel for, run over iterations [begin, end). 'context' holds
+    //     the locals it reads.
+    //   <function>.thread(thread): the entry of a thread spawned on the
+    //     function. It calls it with the arguments in the thread's block
+    //     (runtime.hpp) and stores the result there.
+    // A local a parallel for's body reads from the function around it.
+    // One in memory there (its address is taken) is shared: the context
+    // holds its address, not a copy of its value.
+    struct Capture {
+        std::string name;
+        TypeId type;
+        bool shared = false;
+    };
+    struct Outlined {
+        std::string name;
+        ParallelForStmtNode* loop = nullptr; // The parallel for, or null for a thread entry
+        std::vector<Capture> captures;       // In the context, in order
+        std::string callee;                  // Thread entries: the function
+    };
+    std::vector<Outlined> m_outlined;
+    std::set<std::string> m_thread_entries; // The functions that have one
+    int m_parallel_loops = 0;               // Numbers the loop bodies
+
+    // Adds an empty function to 'module' and starts generating it
+    void begin_function(IRModule& module);
+    void generate_parallel_body(const Outlined& outlined);
+    void generate_thread_entry(const Outlined& outlined);
+
+    bool m_bounds_checks;
+    IRFunction* m_function = nullptr;
+    std::unique_ptr<IRBuilder> m_builder;
+
+    // An expression's IR value, and its type in the language
+    struct Value {
+        Instr* instr;
+        TypeId type;
+        std::vector<Value> fields = {}; // A struct's, in declaration order (instr is null)
+    };
+
+    // The functions defined in the program, and the runtime's (runtime.hpp)
+    struct Signature {
+        TypeId return_type;
+        std::vector<TypeId> parameters;
+        std::string symbol; // What calls go to: the name, or the runtime's label
+    };
+    std::unordered_map<std::string, Signature> m_signatures;
+    TypeId m_return_type = TYPE_I64; // Of the function being generated
+
+    // The module's string literals, each one once, and their indices
+    std::vector<std::string> m_strings;
+    std::unordered_map<std::string, size_t> m_string_ids;
+
+    // --- Global Variables ---
+    struct Global {
+        TypeId type;
+        size_t index; // In m_global_data
+    };
+    std::unordered_map<std::string, Global> m_globals; // By name, which is also the label
+    std::vector<GlobalVariable> m_global_data;
+
+    void declare_global(VarDeclNode* node);
+    // Writes 'init', the initializer of a 'type', to 'offset' in the bytes
+    // of global 'name'. Throws if it isn't a constant.
+    void write_constant(const std::string& name, int64_t offset, TypeId type, ExprNode* init);
+    void write_constant_value(const std::string& name, int64_t offset, TypeId type, const Value& value);
+    // An integer initializer that calls functions (or reads a global that
+    // does): it becomes a comptime function named 'name', which
+    // fold_comptime_calls runs (see comptime.hpp)
+    void defer_constant(const std::string& name, int64_t offset, TypeId type, ExprNode* init);
+    std::vector<GlobalInitializer> m_global_initializers;
+    std::set<std::string> m_computed_globals; // Their globals
+    // The global 'address' points into, and where in it, if that's known
+    GlobalVariable* global_at(Instr* address, int64_t& offset);
+    // The constant a read-only global holds at 'address', or null if
+    // 'address' isn't in one
+    Instr* read_only_value(Instr* address, TypeId type);
+    // Stores 'init' (an array literal, for an array) to the 'type' at 'address'
+    void initialize(Instr* address, TypeId type, ExprNode* init, const std::string& name);
+
+    // --- Variables ---
+    // Every declaration gets its own id, so shadowing just works. A
+    // struct's fields take the ids right after its own, recursively.
+    std::vector<std::unordered_map<std::string, int>> m_scopes;
+    std::vector<TypeId> m_variable_types; // Indexed by variable id
+    int m_next_variable = 0;
+
+    // The names the function being generated takes the address of, and
+    // the variables in memory because of it (see the class comment)
+    std::set<std::string> m_address_taken;
+    std::set<int> m_in_memory;
+
+    int declare_variable(const std::string& name, TypeId type);
+    int lookup_variable(const std::string& name) const;
+    void add_variable_ids(TypeId type);
+    // The id of field 'field' of struct variable 'variable'
+    int field_variable(int variable, int field) const;
+
+    // Something that can be assigned to: a variable (or field of one),
+    // one lane of a vector variable, or something in memory
+    struct Target {
+        int variable = -1;
+        TypeId type;                 // The variable's, or what's at 'address'
+        int lane = -1;               // A lane of it, if >= 0
+        Instr* address = nullptr;    // In memory, if not null
+        // An element of an array of @soa structs: 'address' is the
+        // array's, and each field is at this index of its own array
+        Instr* soa_index = nullptr;
+        TypeId soa_array = INVALID_TYPE;
+    };
+    Target resolve_target(ExprNode* node);
+    // Field 'field' of the struct 'object'
+    Target field_target(const Target& object, int field);
+    // The address of element 'index' of an array at 'base'
+    Instr* element_address(Instr* base, Instr* index, int64_t size);
+    Value load(const Target& target);
+    // Returns what was stored: 'value' converted to the target's type
+    Value store(const Target& target, Value value);
+    // A declared variable: itself, or what its address points to
+    Target variable_target(int variable);
+    // Gives a just declared variable its first value, and a slot first if
+    // it's in memory
+    void define_variable(int variable, Value value);
+
+    // --- Types ---
+    // 'value' as a 'type': an integer is narrowed (sign- or zero-extending
+    // what's left) or splatted into a vector. Throws if it can't be.
+    Instr* convert(Value value, TypeId type);
+    // Throws unless 'value' is an integer. 'what' starts the message.
+    Instr* expect_int(Value value, const std::string& what);
+    // The same, but a pointer will do too
+    Instr* expect_scalar(Value value, const std::string& what);
+    Instr* zero_value(TypeId type);
+    // What a variable of 'type' starts as: 0, or a struct of 0s
+    Value default_value(TypeId type);
+    // + - * / % and comparisons, on integers, vectors or pointers
+    Value arithmetic(TokenType op, Value lhs, Value rhs);
+    // p + n and p - n (in elements), p - q and comparisons
+    Value pointer_arithmetic(TokenType op, Value lhs, Value rhs);
+    // The lane 'node' selects in a vector of 'type': a constant, in range
+    int constant_lane(ExprNode* node, TypeId type);
+
+    // --- SSA Construction ---
+    std::unordered_map<BasicBlock*, std::unordered_map<int, Instr*>> m_current_def;
+    // A block is sealed once all its predecessors are known
+    std::set<BasicBlock*> m_sealed;
+    // Phis placed in unsealed blocks, completed when the block is sealed
+    std::unordered_map<BasicBlock*, std::vector<std::pair<int, Instr*>>> m_incomplete_phis;
+    // Trivial phis that were removed, and what replaced them
+    std::unordered_map<Instr*, Instr*> m_replaced_phis;
+    // The value of a variable read on a path where it was never written
+    Instr* m_undefined = nullptr;
+    std::unordered_map<int, Instr*> m_undefined_vectors; // By ValueType
+    Instr* undefined_value(ValueType type);
+
+    void write_variable(int variable, BasicBlock* block, Instr* value);
+    Instr* read_variable(int variable, BasicBlock* block);
+    Instr* read_variable_recursive(int variable, BasicBlock* block);
+    bool in_unreachable_cycle(BasicBlock* block) const;
+    Instr* add_phi_operands(int variable, Instr* phi);
+    Instr* try_remove_trivial_phi(Instr* phi);
+    void seal_block(BasicBlock* block);
+
+    // --- Generics ---
+    // An instance is named after the generic and its type arguments,
+    // 'max.i64' or 'swap.u8$' ('$' for '*'): the instances made so far
+    // are by that name. They're generated after the program's functions.
+    std::unordered_map<std::string, GenericFunctionNode*> m_generic_functions;
+    std::unordered_map<std::string, std::unique_ptr<FunctionDefNode>> m_instances;
+    std::vector<FunctionDefNode*> m_pending_instances; // Not generated yet
+
+    // The instance of 'generic' that 'call' needs, with 'arguments' (its
+    // arguments' values), made if it's new
+    FunctionDefNode* instance(GenericFunctionNode* generic, CallExprNode* call, const std::vector<Value>& arguments);
+    // Evaluates the arguments of 'call' (to 'generic'), which says what
+    // instance it calls
+    std::vector<Value> generic_arguments(CallExprNode* call);
+    Value visit_generic_call(GenericFunctionNode* generic, CallExprNode* node);
+
+    // --- Generators ---
+    std::unordered_map<std::string, FunctionDefNode*> m_generators;
+    std::unordered_map<std::string, int64_t> m_frame_sizes; // Of the state machines made so far
+
+    // A generator being copied into a for-in
+    struct Expansion {
+        FunctionDefNode* generator;
+        int variable;      // The loop variable
+        StmtNode* body;    // The loop's
+        BasicBlock* exit;
+        // The loop's scopes, while the generator's are in m_scopes
+        std::vector<std::unordered_map<std::string, int>> outer_scopes;
+        Expansion* outer;  // The one the loop itself is in, if any
+    };
+    Expansion* m_expansion = nullptr;
+    // The scopes of the generators whose yield is running a loop body
+    // right now: their variables are live there too
+    std::vector<std::vector<std::unordered_map<std::string, int>>> m_hidden_scopes;
+
+    // The state machine of generator g: a function g.next(frame), which
+    // runs g from where it stopped to its next yield. Its variables live
+    // in registers while it runs, and in the frame, which the code that
+    // started g provides, between runs. The frame holds:
+    //   [0]  the value it yielded last
+    //   [8]  the address of g.next, for next()
+    //   [16] where to carry on: 0 at the start, n after the nth yield,
+    //        -1 once g has ended
+    //   [24] the parameters, then a slot for every other variable, then
+    //        the arrays
+    struct StateMachine {
+        FunctionDefNode* generator;
+        Instr* frame;
+        int64_t frame_size;
+        std::unordered_map<int, int64_t> slots; // Variable id -> offset in the frame
+        std::vector<std::pair<int64_t, BasicBlock*>> resumes; // State -> where it carries on
+    };
+    StateMachine* m_state_machine = nullptr;
+
+    // Throws unless 'node' is a generator the language allows
+    void check_generator(const FunctionDefNode* node);
+
+    // Adds the generators 'statement' starts, and those that the
+    // generators it loops over start, to 'started'. 'copied' are the
+    // ones looped over.
+    void find_started_generators(StmtNode* statement, std::vector<FunctionDefNode*>& started,
+                                 std::set<FunctionDefNode*>& copied);
+    void generate_state_machine(FunctionDefNode* node);
+    // The address of 'offset' in the state machine's frame
+    Instr* frame_address(int64_t offset);
+    // 'bytes' of memory for the function being generated, for as long as
+    // it runs: a slot in its stack frame, or in a state machine's frame
+    Instr* frame_memory(int64_t bytes);
+    // Calling generator 'generator': a frame for its state machine, in ours
+    Value start_generator(FunctionDefNode* generator, CallExprNode* node);
+
+    // Moves 'block' to the end of the layout, so blocks come out in source order
+    void place_at_end(BasicBlock* block);
+    // 'condbr condition, if_true, if_false'. A condition wrapped in
+    // likely()/unlikely() gives the branch its weights.
+    void branch_on(ExprNode* condition, BasicBlock* if_true, BasicBlock* if_false);
+
+    // --- Visitor Functions ---
+    // Same shape as the old direct-to-assembly visitors: one per AST node.
+
+    // Statements
+    void visit(StmtNode* node);
+    void visit(FunctionDefNode* node);
+    void visit(ReturnStmtNode* node);
+    void visit(BlockStmtNode* node);
+    void visit(ExprStmtNode* node);
+    void visit(IfStmtNode* node);
+    void visit(ForStmtNode* node);
+    void visit(SwitchStmtNode* node);
+    void visit(ParallelForStmtNode* node);
+    void visit(ForInStmtNode* node);
+    void visit(YieldStmtNode* node);
+    void visit(VarDeclNode* node);
+
+    // Expressions return the value they computed
+    Value visit(ExprNode* node);
+    Value visit(NumberLiteralNode* node);
+    Value visit(StringLiteralNode* node);
+    Value visit(BinaryOpNode* node);
+    Value visit(UnaryOpNode* node);
+    Value visit(CallExprNode* node);
+    Value visit(VariableNode* node);
+    Value visit(AssignNode* node);
+    Value assign_lane(AssignNode* node, const Target& target, TokenType op);
+    Value visit(IncDecNode* node);
+    Value visit(VectorLiteralNode* node);
+    Value visit(ConversionNode* node);
+    Value visit(IndexNode* node);
+    Value visit(StructLiteralNode* node);
+    Value visit(MemberNode* node);
+    Value visit(DerefNode* node);
+    Value visit(AddressOfNode* node);
+    Value visit(SpawnNode* node);
+    // shuffle(v, lane0, lane1, ...)
+    Value visit_shuffle(CallExprNode* node);
+    // likely(x) and unlikely(x) are just x, except as a condition (see branch_on)
+    static bool is_branch_hint(ExprNode* node);
+    // popcount(x), clz(x), ctz(x), bswap(x), rotl(x, n) and rotr(x, n),
+    // on as many bits as x's type has, and of that type. Returns a null
+    // value if the call isn't one of them.
+    Value visit_bit_builtin(CallExprNode* node);
+    // print(), alloc() and the rest of the runtime library (runtime.hpp):
+    // calls into it. Its instr is null if 'node' is none of them.
+    Value visit_library_builtin(CallExprNode* node);
+    // atomic_load(p, ordering), atomic_store(p, value, ordering),
+    // atomic_add(), atomic_exchange(), atomic_cas(p, expected, desired,
+    // ordering) and fence(ordering): calls to the intrinsics in ir.hpp.
+    // Null if 'node' is none of them.
+    Value visit_atomic_builtin(CallExprNode* node);
+};
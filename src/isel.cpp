@@ -0,0 +1,1653 @@
+#include "isel.hpp"
+#include "strength.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+static const int INFINITE_COST = INT_MAX / 4;
+
+// --- Helpers for the emitters ---
+
+static MOperand reg(int r) { return MOperand::make_reg(r); }
+static MOperand imm(int64_t value) { return MOperand::make_imm(value); }
+
+static const char* jump_for(CondCode cc) {
+    switch (cc) {
+        case CondCode::EQ: return "je";
+        case CondCode::NE: return "jne";
+        case CondCode::LT: return "jl";
+        case CondCode::LE: return "jle";
+        case CondCode::GT: return "jg";
+        case CondCode::GE: return "jge";
+        case CondCode::ULT: return "jb";
+        case CondCode::ULE: return "jbe";
+        case CondCode::UGT: return "ja";
+        case CondCode::UGE: return "jae";
+    }
+    return "jmp";
+}
+
+static const char* set_for(CondCode cc) {
+    switch (cc) {
+        case CondCode::EQ: return "sete";
+        case CondCode::NE: return "setne";
+        case CondCode::LT: return "setl";
+        case CondCode::LE: return "setle";
+        case CondCode::GT: return "setg";
+        case CondCode::GE: return "setge";
+        case CondCode::ULT: return "setb";
+        case CondCode::ULE: return "setbe";
+        case CondCode::UGT: return "seta";
+        case CondCode::UGE: return "setae";
+    }
+    return "sete";
+}
+
+// --- Predicates on constant leaves ---
+
+static bool fits_imm32(const Instr* c) {
+    return c->imm >= INT32_MIN && c->imm <= INT32_MAX;
+}
+
+// Small enough that adding a few of them to a displacement can't overflow it
+static bool fits_disp(const Instr* c) {
+    return c->imm > -(1 << 30) && c->imm < (1 << 30);
+}
+
+static bool is_lea_scale(const Instr* c) {
+    return c->imm == 2 || c->imm == 4 || c->imm == 8;
+}
+
+// Multipliers that one or two shifts/'lea's/adds handle faster than 'imul'
+static bool is_one_step_multiplier(const Instr* c) {
+    return !find_mul_sequence(c->imm, 1).empty();
+}
+static bool is_two_step_multiplier(const Instr* c) {
+    return !find_mul_sequence(c->imm, 2).empty();
+}
+
+static uint64_t abs_value(int64_t value) {
+    uint64_t bits = static_cast<uint64_t>(value);
+    return value < 0 ? 0 - bits : bits;
+}
+
+// Divisors of the form +-2^k (k >= 1)
+static bool is_signed_pow2_divisor(const Instr* c) {
+    return abs_value(c->imm) >= 2 && is_power_of_two(abs_value(c->imm));
+}
+// Everything else except 0 and +-1 goes through a magic multiplier
+static bool is_signed_magic_divisor(const Instr* c) {
+    return abs_value(c->imm) >= 2 && !is_power_of_two(abs_value(c->imm));
+}
+static bool is_unsigned_pow2_divisor(const Instr* c) {
+    return static_cast<uint64_t>(c->imm) >= 2 && is_power_of_two(static_cast<uint64_t>(c->imm));
+}
+static bool is_unsigned_magic_divisor(const Instr* c) {
+    return c->imm != 0 && !is_power_of_two(static_cast<uint64_t>(c->imm));
+}
+
+// --- Pattern Builders ---
+// These keep the rule table below readable.
+
+static Pattern nt(Nonterm leaf) {
+    Pattern p;
+    p.leaf = leaf;
+    return p;
+}
+
+static Pattern node(Opcode op, std::vector<Pattern> kids = {}) {
+    Pattern p;
+    p.op = op;
+    p.kids = std::move(kids);
+    return p;
+}
+
+static Pattern konst(bool (*predicate)(const Instr*) = nullptr) {
+    Pattern p;
+    p.op = Opcode::Const;
+    p.predicate = predicate;
+    return p;
+}
+
+static Pattern cmp(std::vector<Pattern> kids) {
+    return node(Opcode::Cmp, std::move(kids));
+}
+
+// --- Rule Emitters ---
+// Each one gets the IR node the rule matched and the already-reduced
+// pattern leaves (left to right), and returns the rule's result.
+
+static Selected emit_const(InstructionSelector& sel, Instr* n, const std::vector<Selected>&) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    if (n->imm == 0) {
+        // 'xor eax, eax' is shorter than 'mov rax, 0' and breaks dependencies
+        sel.emit("xor", {MOperand::make_reg(out.reg, 4), MOperand::make_reg(out.reg, 4)});
+    } else if (n->imm > 0 && n->imm <= UINT32_MAX) {
+        // Writing the low half zeroes the rest, and the encoding is shorter
+        sel.emit("mov", {MOperand::make_reg(out.reg, 4), imm(n->imm)});
+    } else {
+        sel.emit("mov", {reg(out.reg), imm(n->imm)});
+    }
+    return out;
+}
+
+static Selected emit_imm(InstructionSelector&, Instr* n, const std::vector<Selected>&) {
+    Selected out;
+    out.imm = n->imm;
+    return out;
+}
+
+// Two-address form: dst = a; dst op= b
+static Selected emit_two_address(InstructionSelector& sel, const char* opcode, const Selected& a, MOperand b) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("mov", {reg(out.reg), reg(a.reg)});
+    sel.emit(opcode, {reg(out.reg), b});
+    return out;
+}
+
+static Selected emit_add_rr(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "add", k[0], reg(k[1].reg));
+}
+static Selected emit_add_ri(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "add", k[0], imm(k[1].imm));
+}
+static Selected emit_sub_rr(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "sub", k[0], reg(k[1].reg));
+}
+static Selected emit_sub_ri(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "sub", k[0], imm(k[1].imm));
+}
+static Selected emit_imul_rr(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "imul", k[0], reg(k[1].reg));
+}
+
+static Selected emit_imul_ri(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    // The three-operand form doesn't need a copy first
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("imul", {reg(out.reg), reg(k[0].reg), imm(k[1].imm)});
+    return out;
+}
+
+static Selected emit_neg(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("mov", {reg(out.reg), reg(k[0].reg)});
+    sel.emit("neg", {reg(out.reg)});
+    return out;
+}
+
+// --- Bit Manipulation ---
+// popcnt, lzcnt and tzcnt need -mpopcnt/-mlzcnt/-mbmi (or an -march that
+// has them); without those we fall back to older instructions.
+
+// 'opcode out, x' for popcnt/lzcnt/tzcnt. On many Intel CPUs these wait
+// for the old value of 'out' even though they don't read it, so zero it
+// first (the CPU knows the zero idiom doesn't depend on anything).
+static Selected emit_bit_count(InstructionSelector& sel, const char* opcode, int x) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("xor", {MOperand::make_reg(out.reg, 4), MOperand::make_reg(out.reg, 4)});
+    sel.emit(opcode, {reg(out.reg), reg(x)});
+    return out;
+}
+
+static int emit_mov_imm(InstructionSelector& sel, int64_t value) {
+    int r = sel.new_vreg();
+    sel.emit("mov", {reg(r), imm(value)});
+    return r;
+}
+
+static Selected emit_popcnt(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    if (sel.features().popcnt) return emit_bit_count(sel, "popcnt", k[0].reg);
+
+    // Add up neighbouring bits, then pairs, then nibbles; the multiply
+    // adds all the bytes up into the top one
+    Selected x = k[0];
+    int m1 = emit_mov_imm(sel, 0x5555555555555555);
+    Selected pairs = emit_two_address(sel, "shr", x, imm(1));
+    sel.emit("and", {reg(pairs.reg), reg(m1)});
+    Selected v = emit_two_address(sel, "sub", x, reg(pairs.reg));
+
+    int m2 = emit_mov_imm(sel, 0x3333333333333333);
+    Selected high = emit_two_address(sel, "shr", v, imm(2));
+    sel.emit("and", {reg(high.reg), reg(m2)});
+    sel.emit("and", {reg(v.reg), reg(m2)});
+    sel.emit("add", {reg(v.reg), reg(high.reg)});
+
+    Selected nibbles = emit_two_address(sel, "shr", v, imm(4));
+    sel.emit("add", {reg(v.reg), reg(nibbles.reg)});
+    sel.emit("and", {reg(v.reg), reg(emit_mov_imm(sel, 0x0F0F0F0F0F0F0F0F))});
+    sel.emit("imul", {reg(v.reg), reg(emit_mov_imm(sel, 0x0101010101010101))});
+    sel.emit("shr", {reg(v.reg), imm(56)});
+    return v;
+}
+
+static Selected emit_clz(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    if (sel.features().lzcnt) return emit_bit_count(sel, "lzcnt", k[0].reg);
+
+    // 63 - (index of the highest 1 bit), which is the same as ^ 63.
+    // bsr sets ZF for 0 (and leaves the result undefined): use 127, so
+    // the xor makes it 64.
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("bsr", {reg(out.reg), reg(k[0].reg)});
+    sel.emit("cmovz", {reg(out.reg), reg(emit_mov_imm(sel, 127))});
+    sel.emit("xor", {reg(out.reg), imm(63)});
+    return out;
+}
+
+static Selected emit_ctz(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    if (sel.features().bmi) return emit_bit_count(sel, "tzcnt", k[0].reg);
+
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("bsf", {reg(out.reg), reg(k[0].reg)});
+    sel.emit("cmovz", {reg(out.reg), reg(emit_mov_imm(sel, 64))});
+    return out;
+}
+
+static Selected emit_bswap(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("mov", {reg(out.reg), reg(k[0].reg)});
+    sel.emit("bswap", {reg(out.reg)});
+    return out;
+}
+
+// Narrowing a value: the low 8, 16 or 32 bits, extended back to 64.
+// Writing a 32-bit register clears the upper half, so 'movzx' only needs
+// a 32-bit destination, and 'mov r32, r32' zero-extends from 32.
+static Selected emit_sext(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    int bytes = static_cast<int>(n->imm / 8);
+    sel.emit(bytes == 4 ? "movsxd" : "movsx", {reg(out.reg), MOperand::make_reg(k[0].reg, bytes)});
+    return out;
+}
+
+static Selected emit_zext(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    int bytes = static_cast<int>(n->imm / 8);
+    sel.emit(bytes == 4 ? "mov" : "movzx", {MOperand::make_reg(out.reg, 4), MOperand::make_reg(k[0].reg, bytes)});
+    return out;
+}
+
+static Selected emit_rotl_ri(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    // The IRBuilder turns constant rotates right into rotates left
+    int amount = static_cast<int>(k[1].imm & 63);
+    if (sel.features().bmi2) {
+        Selected out;
+        out.reg = sel.new_vreg();
+        sel.emit("rorx", {reg(out.reg), reg(k[0].reg), imm((64 - amount) & 63)});
+        return out;
+    }
+    return emit_two_address(sel, "rol", k[0], imm(amount));
+}
+
+// Rotating by a register needs the amount in cl
+static Selected emit_rotate_rr(InstructionSelector& sel, const char* opcode, const std::vector<Selected>& k) {
+    sel.emit("mov", {reg(RCX), reg(k[1].reg)});
+    return emit_two_address(sel, opcode, k[0], MOperand::make_reg(RCX, 1));
+}
+
+static Selected emit_rotl_rr(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_rotate_rr(sel, "rol", k);
+}
+static Selected emit_rotr_rr(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_rotate_rr(sel, "ror", k);
+}
+
+// --- Multiply and Divide by Constants ---
+
+static Selected emit_mul_by_constant(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    // e.g. x * 10 = 'lea t, [x + x*4]; shl t, 1'
+    int x = k[0].reg;
+    Selected t = k[0];
+    for (const MulStep& step : find_mul_sequence(k[1].imm)) {
+        switch (step.kind) {
+            case MulStep::Shl:
+                t = emit_two_address(sel, "shl", t, imm(step.amount));
+                break;
+            case MulStep::LeaScale: {
+                MemRef addr;
+                addr.base = t.reg;
+                addr.index = t.reg;
+                addr.scale = step.amount;
+                t.reg = sel.new_vreg();
+                sel.emit("lea", {reg(t.reg), MOperand::make_mem(addr, 0)});
+                break;
+            }
+            case MulStep::AddX:
+                t = emit_two_address(sel, "add", t, reg(x));
+                break;
+            case MulStep::SubX:
+                t = emit_two_address(sel, "sub", t, reg(x));
+                break;
+            case MulStep::Neg: {
+                Selected negated;
+                negated.reg = sel.new_vreg();
+                sel.emit("mov", {reg(negated.reg), reg(t.reg)});
+                sel.emit("neg", {reg(negated.reg)});
+                t = negated;
+                break;
+            }
+        }
+    }
+    return t;
+}
+
+// dividend - quotient * divisor
+static Selected emit_remainder_from_quotient(InstructionSelector& sel, int dividend, int quotient, int64_t divisor) {
+    int product = sel.new_vreg();
+    if (divisor >= INT32_MIN && divisor <= INT32_MAX) {
+        sel.emit("imul", {reg(product), reg(quotient), imm(divisor)});
+    } else {
+        sel.emit("mov", {reg(product), imm(divisor)});
+        sel.emit("imul", {reg(product), reg(quotient)});
+    }
+    Selected dividend_reg;
+    dividend_reg.reg = dividend;
+    return emit_two_address(sel, "sub", dividend_reg, reg(product));
+}
+
+// x + (x < 0 ? 2^k - 1 : 0): rounds a shift toward zero like 'idiv' does
+static int emit_round_toward_zero_bias(InstructionSelector& sel, int x, int k) {
+    int biased = sel.new_vreg();
+    sel.emit("mov", {reg(biased), reg(x)});
+    if (k > 1) sel.emit("sar", {reg(biased), imm(63)});
+    sel.emit("shr", {reg(biased), imm(64 - k)});
+    sel.emit("add", {reg(biased), reg(x)});
+    return biased;
+}
+
+static Selected emit_sdiv_pow2(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    int shift = log2_exact(abs_value(k[1].imm));
+    Selected out;
+    out.reg = emit_round_toward_zero_bias(sel, k[0].reg, shift);
+    sel.emit("sar", {reg(out.reg), imm(shift)});
+    if (k[1].imm < 0) sel.emit("neg", {reg(out.reg)});
+    return out;
+}
+
+static Selected emit_srem_pow2(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    // x - ((x + bias) & -2^k); the divisor's sign doesn't matter
+    int shift = log2_exact(abs_value(k[1].imm));
+    int rounded = emit_round_toward_zero_bias(sel, k[0].reg, shift);
+    if (shift < 32) {
+        sel.emit("and", {reg(rounded), imm(-(int64_t(1) << shift))});
+    } else {
+        sel.emit("sar", {reg(rounded), imm(shift)});
+        sel.emit("shl", {reg(rounded), imm(shift)});
+    }
+    return emit_two_address(sel, "sub", k[0], reg(rounded));
+}
+
+// The high half of x * multiplier, left in rdx
+static void emit_multiply_high(InstructionSelector& sel, const char* opcode, int x, int64_t multiplier) {
+    sel.emit("mov", {reg(RAX), imm(multiplier)});
+    MInstr mul;
+    mul.opcode = opcode;
+    mul.ops = {reg(x)};
+    mul.implicit_uses = {RAX};
+    mul.implicit_defs = {RAX, RDX};
+    sel.emit(mul);
+}
+
+static int emit_sdiv_magic_quotient(InstructionSelector& sel, int x, int64_t divisor) {
+    SignedMagic magic = signed_div_magic(divisor);
+    emit_multiply_high(sel, "imul", x, magic.multiplier);
+    if (divisor > 0 && magic.multiplier < 0) sel.emit("add", {reg(RDX), reg(x)});
+    if (divisor < 0 && magic.multiplier > 0) sel.emit("sub", {reg(RDX), reg(x)});
+    if (magic.shift > 0) sel.emit("sar", {reg(RDX), imm(magic.shift)});
+
+    // Add one if the quotient is negative, so it rounds toward zero
+    int quotient = sel.new_vreg();
+    int sign = sel.new_vreg();
+    sel.emit("mov", {reg(quotient), reg(RDX)});
+    sel.emit("mov", {reg(sign), reg(RDX)});
+    sel.emit("shr", {reg(sign), imm(63)});
+    sel.emit("add", {reg(quotient), reg(sign)});
+    return quotient;
+}
+
+static Selected emit_sdiv_magic(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = emit_sdiv_magic_quotient(sel, k[0].reg, k[1].imm);
+    return out;
+}
+
+static Selected emit_srem_magic(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    int quotient = emit_sdiv_magic_quotient(sel, k[0].reg, k[1].imm);
+    return emit_remainder_from_quotient(sel, k[0].reg, quotient, k[1].imm);
+}
+
+static Selected emit_udiv_pow2(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_two_address(sel, "shr", k[0], imm(log2_exact(static_cast<uint64_t>(k[1].imm))));
+}
+
+static Selected emit_urem_pow2(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    int64_t mask = k[1].imm - 1;
+    if (mask <= INT32_MAX) {
+        return emit_two_address(sel, "and", k[0], imm(mask));
+    }
+    int mask_reg = sel.new_vreg();
+    sel.emit("mov", {reg(mask_reg), imm(mask)});
+    return emit_two_address(sel, "and", k[0], reg(mask_reg));
+}
+
+static int emit_udiv_magic_quotient(InstructionSelector& sel, int x, uint64_t divisor) {
+    UnsignedMagic magic = unsigned_div_magic(divisor);
+    emit_multiply_high(sel, "mul", x, static_cast<int64_t>(magic.multiplier));
+
+    int quotient = sel.new_vreg();
+    if (!magic.add) {
+        if (magic.shift > 0) sel.emit("shr", {reg(RDX), imm(magic.shift)});
+        sel.emit("mov", {reg(quotient), reg(RDX)});
+        return quotient;
+    }
+
+    // The multiplier needed 65 bits: q = (((x - t) >> 1) + t) >> (shift - 1)
+    sel.emit("mov", {reg(quotient), reg(x)});
+    sel.emit("sub", {reg(quotient), reg(RDX)});
+    sel.emit("shr", {reg(quotient), imm(1)});
+    sel.emit("add", {reg(quotient), reg(RDX)});
+    if (magic.shift > 1) sel.emit("shr", {reg(quotient), imm(magic.shift - 1)});
+    return quotient;
+}
+
+static Selected emit_udiv_magic(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = emit_udiv_magic_quotient(sel, k[0].reg, static_cast<uint64_t>(k[1].imm));
+    return out;
+}
+
+static Selected emit_urem_magic(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    int quotient = emit_udiv_magic_quotient(sel, k[0].reg, static_cast<uint64_t>(k[1].imm));
+    return emit_remainder_from_quotient(sel, k[0].reg, quotient, k[1].imm);
+}
+
+// --- Division by a Register ---
+
+// 'idiv'/'div' divide rdx:rax by their operand, leaving the quotient in
+// rax and the remainder in rdx
+static Selected emit_divide(InstructionSelector& sel, const std::vector<Selected>& k, bool is_signed, bool remainder) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("mov", {reg(RAX), reg(k[0].reg)});
+
+    if (is_signed) {
+        // cqo sign-extends rax into rdx
+        MInstr cqo;
+        cqo.opcode = "cqo";
+        cqo.implicit_uses = {RAX};
+        cqo.implicit_defs = {RDX};
+        sel.emit(cqo);
+    } else {
+        sel.emit("xor", {MOperand::make_reg(RDX, 4), MOperand::make_reg(RDX, 4)});
+    }
+
+    MInstr div;
+    div.opcode = is_signed ? "idiv" : "div";
+    div.ops = {reg(k[1].reg)};
+    div.implicit_uses = {RAX, RDX};
+    div.implicit_defs = {RAX, RDX};
+    sel.emit(div);
+
+    sel.emit("mov", {reg(out.reg), reg(remainder ? RDX : RAX)});
+    return out;
+}
+
+static Selected emit_sdiv(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_divide(sel, k, true, false);
+}
+static Selected emit_srem(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_divide(sel, k, true, true);
+}
+static Selected emit_udiv(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_divide(sel, k, false, false);
+}
+static Selected emit_urem(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    return emit_divide(sel, k, false, true);
+}
+
+// --- Addresses ---
+
+static Selected emit_index_reg(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.addr.index = k[0].reg;
+    out.addr.scale = 1;
+    return out;
+}
+
+static Selected emit_index_scaled(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.addr.index = k[0].reg;
+    out.addr.scale = static_cast<int>(k[1].imm);
+    return out;
+}
+
+static Selected emit_addr_index(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    return k[0];
+}
+
+static Selected emit_addr_base_index(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out = k[1];
+    out.addr.base = k[0].reg;
+    return out;
+}
+
+static Selected emit_addr_index_base(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out = k[0];
+    out.addr.base = k[1].reg;
+    return out;
+}
+
+static Selected emit_addr_plus_disp(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out = k[0];
+    out.addr.disp += k[1].imm;
+    return out;
+}
+
+static Selected emit_addr_minus_disp(InstructionSelector&, Instr*, const std::vector<Selected>& k) {
+    Selected out = k[0];
+    out.addr.disp -= k[1].imm;
+    return out;
+}
+
+// An array in the stack frame: [rbp - offset], once the frame is laid out
+static Selected emit_addr_stack(InstructionSelector& sel, Instr* n, const std::vector<Selected>&) {
+    Selected out;
+    out.addr.frame_slot = sel.frame_slot(n);
+    return out;
+}
+
+static Selected emit_addr_stack_index(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    Selected out = k[0];
+    out.addr.frame_slot = sel.frame_slot(n->operands[0]);
+    return out;
+}
+
+static Selected emit_addr_global(InstructionSelector&, Instr* n, const std::vector<Selected>&) {
+    Selected out;
+    out.addr.symbol = n->symbol;
+    return out;
+}
+
+static Selected emit_lea(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("lea", {reg(out.reg), MOperand::make_mem(k[0].addr, 0)});
+    return out;
+}
+
+// --- Memory ---
+
+static Selected emit_load(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    // Like SExt/ZExt: writing a 32-bit register clears the upper half
+    Selected out;
+    out.reg = sel.new_vreg();
+    int bytes = static_cast<int>(n->imm / 8);
+    MOperand mem = MOperand::make_mem(k[0].addr, bytes);
+    if (bytes == 8) {
+        sel.emit("mov", {reg(out.reg), mem});
+    } else if (n->op == Opcode::SLoad) {
+        sel.emit(bytes == 4 ? "movsxd" : "movsx", {reg(out.reg), mem});
+    } else {
+        sel.emit(bytes == 4 ? "mov" : "movzx", {MOperand::make_reg(out.reg, 4), mem});
+    }
+    return out;
+}
+
+static Selected emit_store_reg(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int bytes = static_cast<int>(n->imm / 8);
+    sel.emit("mov", {MOperand::make_mem(k[0].addr, bytes), MOperand::make_reg(k[1].reg, bytes)});
+    return Selected();
+}
+
+static Selected emit_store_imm(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    // Only the low bits are stored; keep the immediate in range for them
+    int bytes = static_cast<int>(n->imm / 8);
+    int64_t value = bytes == 8 ? k[1].imm : fold_extend(Opcode::SExt, bytes * 8, k[1].imm);
+    sel.emit("mov", {MOperand::make_mem(k[0].addr, bytes), imm(value)});
+    return Selected();
+}
+
+static Selected emit_mem_zero(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int64_t qwords = n->imm / 8;
+    if (qwords <= 8) {
+        int zero = sel.new_vreg();
+        sel.emit("xor", {MOperand::make_reg(zero, 4), MOperand::make_reg(zero, 4)});
+        for (int64_t i = 0; i < qwords; i++) {
+            MemRef addr = k[0].addr;
+            addr.disp += 8 * i;
+            sel.emit("mov", {MOperand::make_mem(addr, 8), reg(zero)});
+        }
+        return Selected();
+    }
+    // rep stosq stores rax to [rdi], rcx times
+    sel.emit("lea", {reg(RDI), MOperand::make_mem(k[0].addr, 0)});
+    sel.emit("mov", {reg(RCX), imm(qwords)});
+    sel.emit("xor", {MOperand::make_reg(RAX, 4), MOperand::make_reg(RAX, 4)});
+    MInstr stos;
+    stos.opcode = "rep stosq";
+    stos.implicit_uses = {RDI, RCX, RAX};
+    stos.implicit_defs = {RDI, RCX};
+    sel.emit(stos);
+    return Selected();
+}
+
+// prefetch(p): into every cache level
+static Selected emit_prefetch(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    sel.emit("prefetcht0", {MOperand::make_mem(k[0].addr, 0)});
+    return Selected();
+}
+
+// One unsigned compare: a negative index looks huge
+static Selected emit_bounds_check(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    MOperand length = n->operands[1]->is_const() ? imm(k[1].imm) : reg(k[1].reg);
+    sel.emit("cmp", {reg(k[0].reg), length});
+    sel.emit("jae", {MOperand::make_label(sel.bounds_fail_label())});
+    return Selected();
+}
+
+// --- Comparisons and Branches ---
+
+static Selected emit_cmp_rr(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    sel.emit("cmp", {reg(k[0].reg), reg(k[1].reg)});
+    Selected out;
+    out.cond = n->cond;
+    return out;
+}
+
+static Selected emit_cmp_ri(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    sel.emit("cmp", {reg(k[0].reg), imm(k[1].imm)});
+    Selected out;
+    out.cond = n->cond;
+    return out;
+}
+
+static Selected emit_test(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    // Any non-zero value counts as true
+    sel.emit("test", {reg(k[0].reg), reg(k[0].reg)});
+    Selected out;
+    out.cond = CondCode::NE;
+    return out;
+}
+
+// Bit 'index' of the constant: 'bt' copies it into the carry flag, which
+// is what 'jb' ('below') tests
+static Selected emit_bit_test(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int mask = emit_mov_imm(sel, n->imm);
+    sel.emit("bt", {reg(mask), reg(k[0].reg)});
+    Selected out;
+    out.cond = CondCode::ULT;
+    return out;
+}
+
+static Selected emit_bit_test_value(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int mask = emit_mov_imm(sel, n->imm);
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("xor", {MOperand::make_reg(out.reg, 4), MOperand::make_reg(out.reg, 4)});
+    sel.emit("bt", {reg(mask), reg(k[0].reg)});
+    sel.emit("setb", {MOperand::make_reg(out.reg, 1)});
+    return out;
+}
+
+// A comparison whose 0/1 result is needed as a value
+static Selected emit_setcc(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k, bool with_imm) {
+    Selected out;
+    out.reg = sel.new_vreg();
+    // Zero the whole register first: setcc only writes the low byte
+    sel.emit("xor", {MOperand::make_reg(out.reg, 4), MOperand::make_reg(out.reg, 4)});
+    sel.emit("cmp", {reg(k[0].reg), with_imm ? imm(k[1].imm) : reg(k[1].reg)});
+    sel.emit(set_for(n->cond), {MOperand::make_reg(out.reg, 1)});
+    return out;
+}
+static Selected emit_setcc_rr(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    return emit_setcc(sel, n, k, false);
+}
+static Selected emit_setcc_ri(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    return emit_setcc(sel, n, k, true);
+}
+
+static Selected emit_condbr(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    // Compare-and-branch: the flags were just set by the condition's tree.
+    // The final 'jmp' disappears if the false block comes next.
+    sel.emit(jump_for(k[0].cond), {MOperand::make_label(sel.block_label(n->targets[0]))});
+    sel.emit("jmp", {MOperand::make_label(sel.block_label(n->targets[1]))});
+    return Selected();
+}
+
+static Selected emit_br(InstructionSelector& sel, Instr* n, const std::vector<Selected>&) {
+    sel.emit("jmp", {MOperand::make_label(sel.block_label(n->targets[0]))});
+    return Selected();
+}
+
+// A jump table (see switch.hpp):
+//   mov t, value; sub t, lo
+//   cmp t, hi - lo; ja default        (below lo wraps around to huge)
+//   lea base, [rel table]
+//   movsxd e, dword [base + t*4]; add e, base; jmp e
+static Selected emit_switch(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int64_t lo = n->cases.front().first;
+    int64_t span = n->cases.back().first - lo;
+    std::vector<std::string> entries(span + 1, sel.block_label(n->targets[0]));
+    for (const auto& entry : n->cases) {
+        entries[entry.first - lo] = sel.block_label(n->targets[entry.second]);
+    }
+
+    int offset = sel.new_vreg();
+    sel.emit("mov", {reg(offset), reg(k[0].reg)});
+    if (lo != 0) {
+        bool small = lo >= INT32_MIN && lo <= INT32_MAX;
+        sel.emit("sub", {reg(offset), small ? imm(lo) : reg(emit_mov_imm(sel, lo))});
+    }
+    sel.emit("cmp", {reg(offset), imm(span)});
+    sel.emit("ja", {MOperand::make_label(sel.block_label(n->targets[0]))});
+
+    MemRef table;
+    table.symbol = sel.jump_table_label(entries);
+    int base = sel.new_vreg();
+    sel.emit("lea", {reg(base), MOperand::make_mem(table, 0)});
+    MemRef entry;
+    entry.base = base;
+    entry.index = offset;
+    entry.scale = 4;
+    int target = sel.new_vreg();
+    sel.emit("movsxd", {reg(target), MOperand::make_mem(entry, 4)});
+    sel.emit("add", {reg(target), reg(base)});
+    sel.emit("jmp", {reg(target)});
+    return Selected();
+}
+
+static Selected emit_ret(InstructionSelector& sel, Instr*, const std::vector<Selected>& k) {
+    sel.emit("mov", {reg(RAX), reg(k[0].reg)});
+    MInstr ret;
+    ret.opcode = "ret";
+    ret.implicit_uses = {RAX};
+    sel.emit(ret);
+    return Selected();
+}
+
+// --- Atomics ---
+// x86-64 only lets a load overtake an earlier store, so the only orderings
+// that need an instruction are a seq_cst store (an 'xchg', which is
+// locked) and a seq_cst fence. The others just keep the compiler from
+// reordering memory accesses, which the call does already. 'lock'ed
+// read-modify-writes are full barriers, whatever the ordering.
+static Selected emit_atomic(InstructionSelector& sel, Instr* n) {
+    std::string operation = n->symbol.substr(std::strlen(ATOMIC_PREFIX));
+    size_t dot = operation.find('.');
+    int bytes = dot == std::string::npos ? 8 : std::stoi(operation.substr(dot + 1));
+    operation = operation.substr(0, dot);
+    if (operation == "fence_seq_cst") {
+        sel.emit("mfence", {});
+        return Selected();
+    }
+    if (operation == "fence") return Selected();
+
+    auto operand = [&](size_t i) {
+        Instr* argument = n->operands[i];
+        return argument->is_const() ? emit_mov_imm(sel, argument->imm) : sel.reg_for(argument);
+    };
+    MemRef address;
+    address.base = operand(0);
+    MOperand memory = MOperand::make_mem(address, bytes);
+
+    // Narrow results are zero-extended, or not at all (irgen extends them)
+    Selected out;
+    out.reg = sel.new_vreg();
+    if (operation == "load") {
+        if (bytes == 8) {
+            sel.emit("mov", {reg(out.reg), memory});
+        } else {
+            sel.emit(bytes == 4 ? "mov" : "movzx", {MOperand::make_reg(out.reg, 4), memory});
+        }
+    } else if (operation == "store") {
+        sel.emit("mov", {memory, MOperand::make_reg(operand(1), bytes)});
+        return Selected();
+    } else if (operation == "store_seq_cst") {
+        sel.emit("mov", {reg(out.reg), reg(operand(1))});
+        sel.emit("xchg", {MOperand::make_reg(out.reg, bytes), memory});
+        return Selected();
+    } else if (operation == "add") {
+        // The old value comes back in the register
+        sel.emit("mov", {reg(out.reg), reg(operand(1))});
+        sel.emit("lock xadd", {memory, MOperand::make_reg(out.reg, bytes)});
+    } else if (operation == "exchange") {
+        sel.emit("mov", {reg(out.reg), reg(operand(1))});
+        sel.emit("xchg", {MOperand::make_reg(out.reg, bytes), memory});
+    } else {
+        // cas: compares rax with memory; either way rax ends up with what
+        // memory held
+        int desired = operand(2);
+        sel.emit("mov", {reg(RAX), reg(operand(1))});
+        MInstr cmpxchg;
+        cmpxchg.opcode = "lock cmpxchg";
+        cmpxchg.ops = {memory, MOperand::make_reg(desired, bytes)};
+        cmpxchg.implicit_uses = {RAX};
+        cmpxchg.implicit_defs = {RAX};
+        sel.emit(cmpxchg);
+        sel.emit("mov", {reg(out.reg), reg(RAX)});
+    }
+    return out;
+}
+
+static Selected emit_call(InstructionSelector& sel, Instr* n, const std::vector<Selected>&) {
+    if (is_atomic_intrinsic(n->symbol)) return emit_atomic(sel, n);
+
+    // The arguments aren't folded into the call: each one was computed
+    // into its register by its own tree (constants are moved in directly)
+    const CalleeInfo& callee = sel.callee(n->symbol);
+    const std::vector<int>& registers = argument_registers(callee.convention);
+    size_t num_in_registers = std::min(n->operands.size(), registers.size());
+
+    // The rest go on the stack, the first one lowest. rsp must still be
+    // 16-byte aligned at the call, so an odd number of them gets padding.
+    size_t num_on_stack = n->operands.size() - num_in_registers;
+    int64_t stack_bytes = 8 * static_cast<int64_t>(num_on_stack + num_on_stack % 2);
+    if (num_on_stack % 2) sel.emit("sub", {reg(RSP), imm(8)});
+    for (size_t i = n->operands.size(); i-- > num_in_registers;) {
+        Instr* argument = n->operands[i];
+        if (argument->is_const()) {
+            sel.emit("push", {fits_imm32(argument) ? imm(argument->imm) : reg(emit_mov_imm(sel, argument->imm))});
+        } else {
+            sel.emit("push", {reg(sel.reg_for(argument))});
+        }
+    }
+
+    MInstr call;
+    call.opcode = "call";
+    // A function from elsewhere goes through the PLT: it may be in a
+    // shared library, and a PIE can't reach that with a plain rel32 (the
+    // linker calls it directly if it turns out to be linked in)
+    call.ops = {MOperand::make_label(sel.is_external(n->symbol) ? n->symbol + " wrt ..plt" : n->symbol)};
+    for (size_t i = 0; i < num_in_registers; i++) {
+        Instr* argument = n->operands[i];
+        int target = registers[i];
+        if (argument->is_const() && argument->imm == 0) {
+            sel.emit("xor", {MOperand::make_reg(target, 4), MOperand::make_reg(target, 4)});
+        } else if (argument->is_const()) {
+            sel.emit("mov", {reg(target), imm(argument->imm)});
+        } else {
+            sel.emit("mov", {reg(target), reg(sel.reg_for(argument))});
+        }
+        call.implicit_uses.push_back(target);
+    }
+    // A callee compiled before us tells us exactly what it overwrites
+    call.implicit_defs = callee.clobbers.empty() ? caller_saved_registers(callee.convention) : callee.clobbers;
+    sel.emit(call);
+    if (stack_bytes > 0) sel.emit("add", {reg(RSP), imm(stack_bytes)});
+
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit("mov", {reg(out.reg), reg(RAX)});
+    return out;
+}
+
+// --- Vectors ---
+// SSE2 is always there, so 16-byte vectors use it (two-address, like the
+// scalar code). With -mavx2 every vector instruction uses the three-operand
+// AVX encoding instead, and 32-byte vectors fill a YMM register; those
+// need it (the selector checks).
+
+static int vector_size(const Instr* n) { return vector_bytes(n->type); }
+
+static MOperand vreg(int r, int size) { return MOperand::make_reg(r, size); }
+
+// dst = a OP b, where 'b' is a register or an immediate
+static Selected emit_vector_op(InstructionSelector& sel, Instr* n, const char* sse, const char* avx, int a, MOperand b) {
+    int size = vector_size(n);
+    Selected out;
+    out.reg = sel.new_vreg(register_class(n->type));
+    if (sel.features().avx2) {
+        sel.emit(avx, {vreg(out.reg, size), vreg(a, size), b});
+    } else {
+        sel.emit(make_copy(register_class(n->type), out.reg, a, false));
+        sel.emit(sse, {vreg(out.reg, size), b});
+    }
+    return out;
+}
+
+// The SSE2 and AVX forms of a lane-wise operation on vectors of 'type'.
+// Float vectors are 32 bytes, so they never need an SSE2 form.
+static void lanewise_opcodes(Opcode op, ValueType type, const char*& sse, const char*& avx) {
+    bool wide = lane_bits(type) == 64;
+    bool is_float = is_float_vector(type);
+    switch (op) {
+        case Opcode::VAdd:
+            sse = wide ? "paddq" : "paddd";
+            avx = is_float ? "vaddps" : wide ? "vpaddq" : "vpaddd";
+            return;
+        case Opcode::VSub:
+            sse = wide ? "psubq" : "psubd";
+            avx = is_float ? "vsubps" : wide ? "vpsubq" : "vpsubd";
+            return;
+        case Opcode::VShl:
+            sse = wide ? "psllq" : "pslld";
+            avx = wide ? "vpsllq" : "vpslld";
+            return;
+        case Opcode::VMul:
+            sse = nullptr; // See emit_vmul
+            avx = is_float ? "vmulps" : "vpmulld";
+            return;
+        default: // VDiv
+            sse = nullptr;
+            avx = "vdivps";
+            return;
+    }
+}
+
+static Selected emit_lanewise(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    const char* sse;
+    const char* avx;
+    lanewise_opcodes(n->op, n->type, sse, avx);
+    MOperand b = n->op == Opcode::VShl ? imm(k[1].imm) : vreg(k[1].reg, vector_size(n));
+    return emit_vector_op(sel, n, sse, avx, k[0].reg, b);
+}
+
+static Selected emit_vmul(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    if (lane_bits(n->type) == 64) {
+        throw std::runtime_error("Multiplying 64-bit lanes needs AVX-512");
+    }
+    if (sel.features().avx2) return emit_lanewise(sel, n, k);
+
+    // SSE2 only multiplies lanes 0 and 2 (pmuludq, into 64-bit products;
+    // pmulld is SSE4.1). Do the odd lanes the same way after moving them
+    // down, then interleave the low halves of the products.
+    int even = sel.new_vreg(RegClass::VEC128);
+    sel.emit("movdqa", {vreg(even, 16), vreg(k[0].reg, 16)});
+    sel.emit("pmuludq", {vreg(even, 16), vreg(k[1].reg, 16)});
+    int odd = sel.new_vreg(RegClass::VEC128);
+    int odd_b = sel.new_vreg(RegClass::VEC128);
+    sel.emit("pshufd", {vreg(odd, 16), vreg(k[0].reg, 16), imm(0xF5)});
+    sel.emit("pshufd", {vreg(odd_b, 16), vreg(k[1].reg, 16), imm(0xF5)});
+    sel.emit("pmuludq", {vreg(odd, 16), vreg(odd_b, 16)});
+
+    Selected out;
+    out.reg = sel.new_vreg(RegClass::VEC128);
+    int odd_low = sel.new_vreg(RegClass::VEC128);
+    sel.emit("pshufd", {vreg(out.reg, 16), vreg(even, 16), imm(0x08)});
+    sel.emit("pshufd", {vreg(odd_low, 16), vreg(odd, 16), imm(0x08)});
+    sel.emit("punpckldq", {vreg(out.reg, 16), vreg(odd_low, 16)});
+    return out;
+}
+
+// A vector of 'type' with 'scalar' (a GPR) in every lane
+static int emit_broadcast(InstructionSelector& sel, ValueType type, int scalar) {
+    int size = vector_bytes(type);
+    int out = sel.new_vreg(register_class(type));
+    bool avx = sel.features().avx2;
+    if (is_float_vector(type)) {
+        // Zero it first: cvtsi2ss only writes the low lane
+        int low = sel.new_vreg(RegClass::VEC128);
+        sel.emit("vpxor", {vreg(low, 16), vreg(low, 16), vreg(low, 16)});
+        sel.emit("vcvtsi2ss", {vreg(low, 16), vreg(low, 16), reg(scalar)});
+        sel.emit("vbroadcastss", {vreg(out, size), vreg(low, 16)});
+    } else if (lane_bits(type) == 32) {
+        if (avx) {
+            int low = sel.new_vreg(RegClass::VEC128);
+            sel.emit("vmovd", {vreg(low, 16), MOperand::make_reg(scalar, 4)});
+            sel.emit("vpbroadcastd", {vreg(out, size), vreg(low, 16)});
+        } else {
+            int low = sel.new_vreg(RegClass::VEC128);
+            sel.emit("movd", {vreg(low, 16), MOperand::make_reg(scalar, 4)});
+            sel.emit("pshufd", {vreg(out, 16), vreg(low, 16), imm(0)});
+        }
+    } else if (avx) {
+        int low = sel.new_vreg(RegClass::VEC128);
+        sel.emit("vmovq", {vreg(low, 16), reg(scalar)});
+        sel.emit("vpbroadcastq", {vreg(out, size), vreg(low, 16)});
+    } else {
+        sel.emit("movq", {vreg(out, 16), reg(scalar)});
+        sel.emit("punpcklqdq", {vreg(out, 16), vreg(out, 16)});
+    }
+    return out;
+}
+
+static Selected emit_splat(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = emit_broadcast(sel, n->type, k[0].reg);
+    return out;
+}
+
+// The bytes of a constant vector of 'type', as qwords for .rodata
+static std::vector<int64_t> constant_qwords(ValueType type, const std::vector<int64_t>& lanes) {
+    if (lane_bits(type) == 64) return lanes;
+    std::vector<int64_t> qwords;
+    for (size_t i = 0; i < lanes.size(); i += 2) {
+        uint32_t halves[2];
+        for (int h = 0; h < 2; h++) {
+            if (is_float_vector(type)) {
+                float value = static_cast<float>(lanes[i + h]);
+                std::memcpy(&halves[h], &value, 4);
+            } else {
+                halves[h] = static_cast<uint32_t>(lanes[i + h]);
+            }
+        }
+        qwords.push_back(static_cast<int64_t>(halves[0] | static_cast<uint64_t>(halves[1]) << 32));
+    }
+    return qwords;
+}
+
+// Loads a constant vector from .rodata (or zeroes the register)
+static int emit_load_constant(InstructionSelector& sel, ValueType type, const std::vector<int64_t>& lanes) {
+    int size = vector_bytes(type);
+    int out = sel.new_vreg(register_class(type));
+    if (std::all_of(lanes.begin(), lanes.end(), [](int64_t lane) { return lane == 0; })) {
+        if (sel.features().avx2) {
+            sel.emit("vpxor", {vreg(out, size), vreg(out, size), vreg(out, size)});
+        } else {
+            sel.emit("pxor", {vreg(out, size), vreg(out, size)});
+        }
+        return out;
+    }
+    MemRef constant;
+    constant.symbol = sel.constant_label(constant_qwords(type, lanes));
+    sel.emit(sel.features().avx2 ? "vmovdqa" : "movdqa", {vreg(out, size), MOperand::make_mem(constant, 0)});
+    return out;
+}
+
+static Selected emit_vec_const(InstructionSelector& sel, Instr* n, const std::vector<Selected>&) {
+    Selected out;
+    out.reg = emit_load_constant(sel, n->type, n->lanes);
+    return out;
+}
+
+// The vectorizer's loads and stores: arrays are only 8-byte aligned
+static Selected emit_vector_load(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    Selected out;
+    out.reg = sel.new_vreg(register_class(n->type));
+    sel.emit(sel.features().avx2 ? "vmovdqu" : "movdqu",
+             {vreg(out.reg, vector_size(n)), MOperand::make_mem(k[0].addr, 0)});
+    return out;
+}
+
+static Selected emit_vector_store(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int size = vector_bytes(n->operands[1]->type);
+    sel.emit(sel.features().avx2 ? "vmovdqu" : "movdqu", {MOperand::make_mem(k[0].addr, 0), vreg(k[1].reg, size)});
+    return Selected();
+}
+
+static Selected emit_extract(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    ValueType type = n->operands[0]->type;
+    int lane = static_cast<int>(n->imm);
+    int lanes_per_half = lane_count(type) * 16 / vector_bytes(type);
+    bool avx = sel.features().avx2;
+    Selected out;
+    out.reg = sel.new_vreg();
+
+    // 1. The 16-byte half that has the lane
+    int half = k[0].reg;
+    if (lane >= lanes_per_half) {
+        half = sel.new_vreg(RegClass::VEC128);
+        sel.emit(is_float_vector(type) ? "vextractf128" : "vextracti128", {vreg(half, 16), vreg(k[0].reg, 32), imm(1)});
+        lane -= lanes_per_half;
+    }
+
+    // 2. Move the lane down to lane 0, and out to a GPR
+    if (lane_bits(type) == 64) {
+        if (lane == 1) {
+            int moved = sel.new_vreg(RegClass::VEC128);
+            sel.emit(avx ? "vpshufd" : "pshufd", {vreg(moved, 16), vreg(half, 16), imm(0x4E)});
+            half = moved;
+        }
+        sel.emit(avx ? "vmovq" : "movq", {reg(out.reg), vreg(half, 16)});
+    } else if (is_float_vector(type)) {
+        if (lane > 0) {
+            int moved = sel.new_vreg(RegClass::VEC128);
+            sel.emit("vpshufd", {vreg(moved, 16), vreg(half, 16), imm(lane)});
+            half = moved;
+        }
+        sel.emit("vcvttss2si", {reg(out.reg), vreg(half, 16)});
+    } else {
+        int low = sel.new_vreg();
+        if (avx) {
+            sel.emit("vpextrd", {MOperand::make_reg(low, 4), vreg(half, 16), imm(lane)});
+        } else {
+            if (lane > 0) {
+                int moved = sel.new_vreg(RegClass::VEC128);
+                sel.emit("pshufd", {vreg(moved, 16), vreg(half, 16), imm(lane)});
+                half = moved;
+            }
+            sel.emit("movd", {MOperand::make_reg(low, 4), vreg(half, 16)});
+        }
+        sel.emit("movsxd", {reg(out.reg), MOperand::make_reg(low, 4)});
+    }
+    return out;
+}
+
+static Selected emit_insert(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    // Broadcast the scalar, then blend the one lane in
+    int size = vector_size(n);
+    int lane = static_cast<int>(n->imm);
+    int spread = emit_broadcast(sel, n->type, k[1].reg);
+    Selected out;
+    if (sel.features().avx2) {
+        out.reg = sel.new_vreg(register_class(n->type));
+        // vpblendd picks dwords, so a 64-bit lane takes two bits
+        int mask = lane_bits(n->type) == 64 ? 3 << (2 * lane) : 1 << lane;
+        sel.emit(is_float_vector(n->type) ? "vblendps" : "vpblendd",
+                 {vreg(out.reg, size), vreg(k[0].reg, size), vreg(spread, size), imm(mask)});
+        return out;
+    }
+
+    // SSE2 has no blend: (vector & ~mask) | (spread & mask)
+    std::vector<int64_t> mask_lanes(lane_count(n->type), 0);
+    mask_lanes[lane] = -1;
+    int mask = emit_load_constant(sel, n->type, mask_lanes);
+    int kept = sel.new_vreg(RegClass::VEC128);
+    sel.emit("movdqa", {vreg(kept, 16), vreg(mask, 16)});
+    sel.emit("pandn", {vreg(kept, 16), vreg(k[0].reg, 16)});
+    sel.emit("pand", {vreg(spread, 16), vreg(mask, 16)});
+    sel.emit("por", {vreg(spread, 16), vreg(kept, 16)});
+    out.reg = spread;
+    return out;
+}
+
+static Selected emit_shuffle(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    int size = vector_size(n);
+    Selected out;
+    out.reg = sel.new_vreg(register_class(n->type));
+    if (lane_bits(n->type) == 64) {
+        throw std::runtime_error("Shuffles of 64-bit lanes aren't supported");
+    }
+    if (lane_count(n->type) == 4) {
+        // pshufd: two bits of the immediate per lane
+        int order = 0;
+        for (int lane = 0; lane < 4; lane++) order |= static_cast<int>(n->lanes[lane]) << (2 * lane);
+        sel.emit(sel.features().avx2 ? "vpshufd" : "pshufd", {vreg(out.reg, 16), vreg(k[0].reg, 16), imm(order)});
+        return out;
+    }
+    // Across both halves: vpermd/vpermps take the lane order as a vector
+    int order = emit_load_constant(sel, ValueType::V8I32, n->lanes);
+    sel.emit(is_float_vector(n->type) ? "vpermps" : "vpermd",
+             {vreg(out.reg, size), vreg(order, size), vreg(k[0].reg, size)});
+    return out;
+}
+
+static Selected emit_reduce_add(InstructionSelector& sel, Instr* n, const std::vector<Selected>& k) {
+    // Fold the vector in half until one lane is left:
+    //   [a b c d] -> [a+c b+d] -> [a+c+b+d]
+    int lanes = lane_count(n->operands[0]->type);
+    int v = k[0].reg;
+    bool avx = sel.features().avx2;
+    if (lanes == 4) {
+        int high = sel.new_vreg(RegClass::VEC128);
+        sel.emit("vextracti128", {vreg(high, 16), vreg(v, 32), imm(1)});
+        int sum = sel.new_vreg(RegClass::VEC128);
+        sel.emit("vpaddq", {vreg(sum, 16), vreg(high, 16), vreg(v, 16)});
+        v = sum;
+    }
+    // pshufd with 0x4E swaps the two 64-bit halves
+    int swapped = sel.new_vreg(RegClass::VEC128);
+    sel.emit(avx ? "vpshufd" : "pshufd", {vreg(swapped, 16), vreg(v, 16), imm(0x4E)});
+    int total = sel.new_vreg(RegClass::VEC128);
+    if (avx) {
+        sel.emit("vpaddq", {vreg(total, 16), vreg(swapped, 16), vreg(v, 16)});
+    } else {
+        sel.emit("movdqa", {vreg(total, 16), vreg(swapped, 16)});
+        sel.emit("paddq", {vreg(total, 16), vreg(v, 16)});
+    }
+    Selected out;
+    out.reg = sel.new_vreg();
+    sel.emit(avx ? "vmovq" : "movq", {reg(out.reg), vreg(total, 16)});
+    return out;
+}
+
+// --- The Rule Table ---
+// Costs are roughly "instructions executed", with multiply and divide
+// weighted by their latency. When two rules tie, the earlier one wins.
+
+static const std::vector<Rule>& rules() {
+    static const std::vector<Rule> table = {
+        // Constants
+        {"imm: Const",                 NT_IMM,   konst(fits_imm32), 0, emit_imm},
+        {"reg: Const",                 NT_REG,   konst(), 1, emit_const},
+
+        // Arithmetic
+        {"reg: Add(reg, reg)",         NT_REG,   node(Opcode::Add, {nt(NT_REG), nt(NT_REG)}), 1, emit_add_rr},
+        {"reg: Add(reg, imm)",         NT_REG,   node(Opcode::Add, {nt(NT_REG), nt(NT_IMM)}), 1, emit_add_ri},
+        {"reg: Sub(reg, reg)",         NT_REG,   node(Opcode::Sub, {nt(NT_REG), nt(NT_REG)}), 1, emit_sub_rr},
+        {"reg: Sub(reg, imm)",         NT_REG,   node(Opcode::Sub, {nt(NT_REG), nt(NT_IMM)}), 1, emit_sub_ri},
+        {"reg: Mul(reg, reg)",         NT_REG,   node(Opcode::Mul, {nt(NT_REG), nt(NT_REG)}), 3, emit_imul_rr},
+        {"reg: Mul(reg, imm)",         NT_REG,   node(Opcode::Mul, {nt(NT_REG), nt(NT_IMM)}), 3, emit_imul_ri},
+        {"reg: SDiv(reg, reg)",        NT_REG,   node(Opcode::SDiv, {nt(NT_REG), nt(NT_REG)}), 25, emit_sdiv},
+        {"reg: SRem(reg, reg)",        NT_REG,   node(Opcode::SRem, {nt(NT_REG), nt(NT_REG)}), 25, emit_srem},
+        {"reg: UDiv(reg, reg)",        NT_REG,   node(Opcode::UDiv, {nt(NT_REG), nt(NT_REG)}), 25, emit_udiv},
+        {"reg: URem(reg, reg)",        NT_REG,   node(Opcode::URem, {nt(NT_REG), nt(NT_REG)}), 25, emit_urem},
+        {"reg: Neg(reg)",              NT_REG,   node(Opcode::Neg, {nt(NT_REG)}), 1, emit_neg},
+        {"reg: Popcnt(reg)",           NT_REG,   node(Opcode::Popcnt, {nt(NT_REG)}), 1, emit_popcnt},
+        {"reg: Clz(reg)",              NT_REG,   node(Opcode::Clz, {nt(NT_REG)}), 1, emit_clz},
+        {"reg: Ctz(reg)",              NT_REG,   node(Opcode::Ctz, {nt(NT_REG)}), 1, emit_ctz},
+        {"reg: Bswap(reg)",            NT_REG,   node(Opcode::Bswap, {nt(NT_REG)}), 1, emit_bswap},
+        {"reg: SExt(reg)",             NT_REG,   node(Opcode::SExt, {nt(NT_REG)}), 1, emit_sext},
+        {"reg: ZExt(reg)",             NT_REG,   node(Opcode::ZExt, {nt(NT_REG)}), 1, emit_zext},
+        {"reg: Rotl(reg, Const)",      NT_REG,   node(Opcode::Rotl, {nt(NT_REG), konst()}), 1, emit_rotl_ri},
+        {"reg: Rotl(reg, reg)",        NT_REG,   node(Opcode::Rotl, {nt(NT_REG), nt(NT_REG)}), 2, emit_rotl_rr},
+        {"reg: Rotr(reg, reg)",        NT_REG,   node(Opcode::Rotr, {nt(NT_REG), nt(NT_REG)}), 2, emit_rotr_rr},
+
+        // Strength reduction: multiply and divide by constants without imul/idiv
+        {"reg: Mul(reg, Const)",       NT_REG,   node(Opcode::Mul, {nt(NT_REG), konst(is_one_step_multiplier)}), 1, emit_mul_by_constant},
+        {"reg: Mul(reg, Const)",       NT_REG,   node(Opcode::Mul, {nt(NT_REG), konst(is_two_step_multiplier)}), 2, emit_mul_by_constant},
+        {"reg: SDiv(reg, Const)",      NT_REG,   node(Opcode::SDiv, {nt(NT_REG), konst(is_signed_pow2_divisor)}), 4, emit_sdiv_pow2},
+        {"reg: SDiv(reg, Const)",      NT_REG,   node(Opcode::SDiv, {nt(NT_REG), konst(is_signed_magic_divisor)}), 7, emit_sdiv_magic},
+        {"reg: SRem(reg, Const)",      NT_REG,   node(Opcode::SRem, {nt(NT_REG), konst(is_signed_pow2_divisor)}), 5, emit_srem_pow2},
+        {"reg: SRem(reg, Const)",      NT_REG,   node(Opcode::SRem, {nt(NT_REG), konst(is_signed_magic_divisor)}), 10, emit_srem_magic},
+        {"reg: UDiv(reg, Const)",      NT_REG,   node(Opcode::UDiv, {nt(NT_REG), konst(is_unsigned_pow2_divisor)}), 1, emit_udiv_pow2},
+        {"reg: UDiv(reg, Const)",      NT_REG,   node(Opcode::UDiv, {nt(NT_REG), konst(is_unsigned_magic_divisor)}), 6, emit_udiv_magic},
+        {"reg: URem(reg, Const)",      NT_REG,   node(Opcode::URem, {nt(NT_REG), konst(is_unsigned_pow2_divisor)}), 1, emit_urem_pow2},
+        {"reg: URem(reg, Const)",      NT_REG,   node(Opcode::URem, {nt(NT_REG), konst(is_unsigned_magic_divisor)}), 9, emit_urem_magic},
+
+        // Addressing modes: base + index*scale + disp
+        {"index: reg",                 NT_INDEX, nt(NT_REG), 0, emit_index_reg},
+        {"index: Mul(reg, Const)",     NT_INDEX, node(Opcode::Mul, {nt(NT_REG), konst(is_lea_scale)}), 0, emit_index_scaled},
+        {"addr: index",                NT_ADDR,  nt(NT_INDEX), 0, emit_addr_index},
+        {"addr: Add(reg, index)",      NT_ADDR,  node(Opcode::Add, {nt(NT_REG), nt(NT_INDEX)}), 0, emit_addr_base_index},
+        {"addr: Add(index, reg)",      NT_ADDR,  node(Opcode::Add, {nt(NT_INDEX), nt(NT_REG)}), 0, emit_addr_index_base},
+        {"addr: Add(addr, Const)",     NT_ADDR,  node(Opcode::Add, {nt(NT_ADDR), konst(fits_disp)}), 0, emit_addr_plus_disp},
+        {"addr: Sub(addr, Const)",     NT_ADDR,  node(Opcode::Sub, {nt(NT_ADDR), konst(fits_disp)}), 0, emit_addr_minus_disp},
+        {"addr: StackAddr",            NT_ADDR,  node(Opcode::StackAddr), 0, emit_addr_stack},
+        {"addr: Add(StackAddr, index)", NT_ADDR, node(Opcode::Add, {node(Opcode::StackAddr), nt(NT_INDEX)}), 0, emit_addr_stack_index},
+        {"addr: GlobalAddr",           NT_ADDR,  node(Opcode::GlobalAddr), 0, emit_addr_global},
+        {"reg: addr",                  NT_REG,   nt(NT_ADDR), 1, emit_lea},
+
+        // Memory
+        {"reg: ZLoad(addr)",           NT_REG,   node(Opcode::ZLoad, {nt(NT_ADDR)}), 1, emit_load},
+        {"reg: SLoad(addr)",           NT_REG,   node(Opcode::SLoad, {nt(NT_ADDR)}), 1, emit_load},
+        {"stmt: Store(addr, reg)",     NT_STMT,  node(Opcode::Store, {nt(NT_ADDR), nt(NT_REG)}), 1, emit_store_reg},
+        {"stmt: Store(addr, imm)",     NT_STMT,  node(Opcode::Store, {nt(NT_ADDR), nt(NT_IMM)}), 1, emit_store_imm},
+        {"stmt: MemZero(addr)",        NT_STMT,  node(Opcode::MemZero, {nt(NT_ADDR)}), 4, emit_mem_zero},
+        {"stmt: BoundsCheck(reg, reg)", NT_STMT, node(Opcode::BoundsCheck, {nt(NT_REG), nt(NT_REG)}), 2, emit_bounds_check},
+        {"stmt: BoundsCheck(reg, imm)", NT_STMT, node(Opcode::BoundsCheck, {nt(NT_REG), nt(NT_IMM)}), 2, emit_bounds_check},
+        {"stmt: Prefetch(addr)",       NT_STMT,  node(Opcode::Prefetch, {nt(NT_ADDR)}), 1, emit_prefetch},
+
+        // Comparisons
+        {"flags: Cmp(reg, reg)",       NT_FLAGS, cmp({nt(NT_REG), nt(NT_REG)}), 1, emit_cmp_rr},
+        {"flags: Cmp(reg, imm)",       NT_FLAGS, cmp({nt(NT_REG), nt(NT_IMM)}), 1, emit_cmp_ri},
+        {"flags: reg",                 NT_FLAGS, nt(NT_REG), 1, emit_test},
+        {"reg: Cmp(reg, reg)",         NT_REG,   cmp({nt(NT_REG), nt(NT_REG)}), 3, emit_setcc_rr},
+        {"reg: Cmp(reg, imm)",         NT_REG,   cmp({nt(NT_REG), nt(NT_IMM)}), 3, emit_setcc_ri},
+        {"flags: BitTest(reg)",        NT_FLAGS, node(Opcode::BitTest, {nt(NT_REG)}), 2, emit_bit_test},
+        {"reg: BitTest(reg)",          NT_REG,   node(Opcode::BitTest, {nt(NT_REG)}), 4, emit_bit_test_value},
+
+        // Control flow and calls
+        {"stmt: CondBr(flags)",        NT_STMT,  node(Opcode::CondBr, {nt(NT_FLAGS)}), 1, emit_condbr},
+        {"stmt: Br",                   NT_STMT,  node(Opcode::Br), 1, emit_br},
+        {"stmt: Switch(reg)",          NT_STMT,  node(Opcode::Switch, {nt(NT_REG)}), 7, emit_switch},
+        {"stmt: Ret(reg)",             NT_STMT,  node(Opcode::Ret, {nt(NT_REG)}), 1, emit_ret},
+        {"reg: Call",                  NT_REG,   node(Opcode::Call), 5, emit_call},
+
+        // Vectors
+        {"reg: Splat(reg)",            NT_REG,   node(Opcode::Splat, {nt(NT_REG)}), 2, emit_splat},
+        {"reg: VecConst",              NT_REG,   node(Opcode::VecConst), 1, emit_vec_const},
+        {"reg: VAdd(reg, reg)",        NT_REG,   node(Opcode::VAdd, {nt(NT_REG), nt(NT_REG)}), 1, emit_lanewise},
+        {"reg: VSub(reg, reg)",        NT_REG,   node(Opcode::VSub, {nt(NT_REG), nt(NT_REG)}), 1, emit_lanewise},
+        {"reg: VMul(reg, reg)",        NT_REG,   node(Opcode::VMul, {nt(NT_REG), nt(NT_REG)}), 2, emit_vmul},
+        {"reg: VDiv(reg, reg)",        NT_REG,   node(Opcode::VDiv, {nt(NT_REG), nt(NT_REG)}), 10, emit_lanewise},
+        {"reg: VShl(reg, Const)",      NT_REG,   node(Opcode::VShl, {nt(NT_REG), konst()}), 1, emit_lanewise},
+        {"reg: ReduceAdd(reg)",        NT_REG,   node(Opcode::ReduceAdd, {nt(NT_REG)}), 4, emit_reduce_add},
+        {"reg: Extract(reg)",          NT_REG,   node(Opcode::Extract, {nt(NT_REG)}), 2, emit_extract},
+        {"reg: Insert(reg, reg)",      NT_REG,   node(Opcode::Insert, {nt(NT_REG), nt(NT_REG)}), 3, emit_insert},
+        {"reg: Shuffle(reg)",          NT_REG,   node(Opcode::Shuffle, {nt(NT_REG)}), 1, emit_shuffle},
+        {"reg: VLoad(addr)",           NT_REG,   node(Opcode::VLoad, {nt(NT_ADDR)}), 1, emit_vector_load},
+        {"stmt: VStore(addr, reg)",    NT_STMT,  node(Opcode::VStore, {nt(NT_ADDR), nt(NT_REG)}), 1, emit_vector_store},
+    };
+    return table;
+}
+
+// --- InstructionSelector ---
+
+RegClass register_class(ValueType type) {
+    if (!is_vector(type)) return RegClass::GPR;
+    return vector_bytes(type) == 32 ? RegClass::VEC256 : RegClass::VEC128;
+}
+
+InstructionSelector::InstructionSelector(IRFunction& function, const TargetFeatures& features,
+                                         CalleeTable callees)
+    : m_function(function), m_features(features), m_callees(std::move(callees)) {
+    m_mfunction.vex = features.avx2;
+    m_mfunction.convention = function.is_exported ? CallingConvention::SysV : CallingConvention::Internal;
+    for (int i = 0; i < NUM_NONTERMS; i++) {
+        m_in_register.cost[i] = INFINITE_COST;
+        m_in_register.rule[i] = nullptr;
+    }
+    m_in_register.cost[NT_REG] = 0;
+    close_chains(m_in_register);
+}
+
+void InstructionSelector::emit(MInstr instr) {
+    m_current->instrs.push_back(std::move(instr));
+}
+
+void InstructionSelector::emit(const std::string& opcode, std::vector<MOperand> ops) {
+    MInstr instr;
+    instr.opcode = opcode;
+    instr.ops = std::move(ops);
+    emit(std::move(instr));
+}
+
+std::string InstructionSelector::constant_label(const std::vector<int64_t>& qwords) {
+    for (const MConstant& constant : m_mfunction.constants) {
+        if (constant.jump_targets.empty() && constant.qwords == qwords) return constant.label;
+    }
+    std::string label = m_function.name + ".c" + std::to_string(m_mfunction.constants.size());
+    m_mfunction.constants.push_back({label, qwords});
+    return label;
+}
+
+std::string InstructionSelector::jump_table_label(const std::vector<std::string>& targets) {
+    std::string label = m_function.name + ".c" + std::to_string(m_mfunction.constants.size());
+    m_mfunction.constants.push_back({label, {}, targets});
+    return label;
+}
+
+std::string InstructionSelector::block_label(BasicBlock* block) const {
+    // Labels have a '.' in them so they can never clash with a function name
+    return m_function.name + ".bb" + std::to_string(block->id);
+}
+
+const CalleeInfo& InstructionSelector::callee(const std::string& name) const {
+    // Anything we don't compile ourselves is defined elsewhere, so it
+    // follows the ABI
+    static const CalleeInfo external;
+    auto it = m_callees.find(name);
+    return it != m_callees.end() ? it->second : external;
+}
+
+int InstructionSelector::reg_for(Instr* value) {
+    // A value can be asked for before its tree is emitted (e.g. from a
+    // block we happened to visit first), so hand out its vreg on demand
+    auto it = m_value_reg.find(value);
+    if (it != m_value_reg.end()) return it->second;
+    int vreg = new_vreg(register_class(value->type));
+    m_value_reg[value] = vreg;
+    return vreg;
+}
+
+int InstructionSelector::frame_slot(Instr* stack_addr) {
+    auto it = m_frame_slots.find(stack_addr);
+    if (it != m_frame_slots.end()) return it->second;
+    // Aligned for vector code, if it's big enough to hold a vector
+    int size = static_cast<int>(stack_addr->imm);
+    int slot = m_mfunction.new_slot(size, size >= 16 ? 16 : 8);
+    m_frame_slots[stack_addr] = slot;
+    return slot;
+}
+
+std::string InstructionSelector::bounds_fail_label() {
+    m_needs_bounds_fail = true;
+    return m_function.name + ".bounds_fail";
+}
+
+bool InstructionSelector::is_folded(Instr* node) const {
+    // Constants are cheap to rematerialize, so they're folded into every
+    // user. So is a stack address: it's just rbp minus a constant, and
+    // the address of a string literal, which is rip plus one.
+    if (node->is_const()) return true;
+    if (node->op == Opcode::StackAddr || node->op == Opcode::GlobalAddr) return !m_call_arguments.count(node);
+    // A load has to happen where it is, before any later store
+    if (node->has_side_effects() || node->is_phi() || node->is_load()) return false;
+    // Calls read their arguments from registers, and parameters are read
+    // at the function entry, before anything overwrites them
+    if (m_call_arguments.count(node) || node->op == Opcode::Param) return false;
+
+    auto it = m_use_count.find(node);
+    return it != m_use_count.end() && it->second == 1 && !m_used_in_other_block.count(node);
+}
+
+bool InstructionSelector::is_tree_root(Instr* node) const {
+    if (is_folded(node)) return false;
+    auto it = m_use_count.find(node);
+    return node->has_side_effects() || (it != m_use_count.end() && it->second > 0);
+}
+
+void InstructionSelector::close_chains(Label& label) {
+    // Apply "nonterminal <- nonterminal" rules until nothing gets cheaper
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const Rule& rule : rules()) {
+            if (rule.pattern.leaf == NT_NONE) continue;
+            int cost = label.cost[rule.pattern.leaf] + rule.cost;
+            if (cost < label.cost[rule.lhs]) {
+                label.cost[rule.lhs] = cost;
+                label.rule[rule.lhs] = &rule;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool InstructionSelector::match(const Pattern& pattern, Instr* n, bool is_root, int& cost) {
+    if (pattern.leaf != NT_NONE) {
+        int leaf_cost = operand_label(n).cost[pattern.leaf];
+        if (leaf_cost >= INFINITE_COST) return false;
+        cost += leaf_cost;
+        return true;
+    }
+
+    // We can only look inside values that are folded into this tree
+    if (!is_root && !is_folded(n)) return false;
+    if (n->op != pattern.op) return false;
+    if (pattern.predicate && !pattern.predicate(n)) return false;
+    // A call takes any number of arguments; its emitter reads them itself
+    if (n->op != Opcode::Call && pattern.kids.size() != n->operands.size()) return false;
+
+    for (size_t i = 0; i < pattern.kids.size(); i++) {
+        if (!match(pattern.kids[i], n->operands[i], false, cost)) return false;
+    }
+    return true;
+}
+
+const InstructionSelector::Label& InstructionSelector::tree_label(Instr* n) {
+    auto it = m_tree_labels.find(n);
+    if (it != m_tree_labels.end()) return it->second;
+
+    // Try every rule whose pattern starts at this node
+    Label result;
+    for (int i = 0; i < NUM_NONTERMS; i++) {
+        result.cost[i] = INFINITE_COST;
+        result.rule[i] = nullptr;
+    }
+    for (const Rule& rule : rules()) {
+        if (rule.pattern.leaf != NT_NONE) continue;
+        int cost = rule.cost;
+        if (match(rule.pattern, n, true, cost) && cost < result.cost[rule.lhs]) {
+            result.cost[rule.lhs] = cost;
+            result.rule[rule.lhs] = &rule;
+        }
+    }
+    close_chains(result);
+
+    return m_tree_labels[n] = result;
+}
+
+const InstructionSelector::Label& InstructionSelector::operand_label(Instr* n) {
+    if (is_folded(n)) {
+        return tree_label(n);
+    }
+
+    // Computed by another tree: it's simply sitting in a register
+    return m_in_register;
+}
+
+Selected InstructionSelector::reduce(Instr* n, Nonterm nt, bool is_root) {
+    // A value from another tree starts out in its register
+    if (!is_root && !is_folded(n)) {
+        Selected in_register;
+        in_register.reg = reg_for(n);
+        if (nt == NT_REG) return in_register;
+
+        const Rule* rule = operand_label(n).rule[nt];
+        Selected kid = reduce(n, rule->pattern.leaf, false);
+        return rule->emit(*this, n, {kid});
+    }
+
+    const Rule* rule = tree_label(n).rule[nt];
+    if (!rule) {
+        throw std::runtime_error("Instruction selection failed: no rule covers this IR");
+    }
+
+    std::vector<Selected> kids;
+    if (rule->pattern.leaf != NT_NONE) {
+        // Chain rule: first reduce this same node to the other nonterminal
+        kids.push_back(reduce(n, rule->pattern.leaf, is_root));
+    } else {
+        collect_kids(rule->pattern, n, kids);
+    }
+    return rule->emit(*this, n, kids);
+}
+
+void InstructionSelector::collect_kids(const Pattern& pattern, Instr* n, std::vector<Selected>& kids) {
+    for (size_t i = 0; i < pattern.kids.size(); i++) {
+        const Pattern& kid = pattern.kids[i];
+        Instr* operand = n->operands[i];
+
+        if (kid.leaf != NT_NONE) {
+            kids.push_back(reduce(operand, kid.leaf, false));
+        } else if (kid.op == Opcode::Const) {
+            Selected constant;
+            constant.imm = operand->imm;
+            kids.push_back(constant);
+        } else {
+            collect_kids(kid, operand, kids);
+        }
+    }
+}
+
+void InstructionSelector::emit_phi_copies(BasicBlock* block, BasicBlock* succ) {
+    // The copies happen "at the same time": a phi may read another phi of
+    // the same block (a swap, say), so every value goes through a temp
+    // first. The allocator's copy hints usually make the temps free.
+    std::vector<std::pair<Instr*, int>> temps;
+    for (Instr* phi : succ->phis()) {
+        Instr* value = phi->incoming_value(block);
+        if (!value) continue;
+        RegClass cls = register_class(phi->type);
+        int temp = new_vreg(cls);
+        emit(make_copy(cls, temp, reduce(value, NT_REG, false).reg, m_features.avx2));
+        temps.push_back({phi, temp});
+    }
+    for (auto& copy : temps) {
+        emit(make_copy(register_class(copy.first->type), reg_for(copy.first), copy.second, m_features.avx2));
+    }
+}
+
+void InstructionSelector::emit_parameter_moves(BasicBlock* entry) {
+    // The first parameters arrive in registers, the rest on the stack,
+    // above the return address and the saved rbp
+    const std::vector<int>& registers = argument_registers(m_mfunction.convention);
+    for (auto& instr : entry->instrs) {
+        if (instr->op != Opcode::Param || !m_use_count.count(instr.get())) continue;
+        size_t index = static_cast<size_t>(instr->imm);
+        int value = reg_for(instr.get());
+        if (index < registers.size()) {
+            emit("mov", {reg(value), reg(registers[index])});
+        } else {
+            MemRef mem;
+            mem.base = RBP;
+            mem.disp = 16 + 8 * static_cast<int64_t>(index - registers.size());
+            emit("mov", {reg(value), MOperand::make_mem(mem, 8)});
+        }
+    }
+}
+
+MFunction InstructionSelector::select() {
+    m_mfunction.name = m_function.name;
+
+    // YMM registers are AVX; we only use them with -mavx2
+    if (!m_features.avx2) {
+        for (auto& block : m_function.blocks) {
+            for (auto& instr : block->instrs) {
+                if (is_vector(instr->type) && vector_bytes(instr->type) == 32) {
+                    throw std::runtime_error("32-byte vectors (int32x8, float32x8) need -mavx2 (in '" + m_function.name + "')");
+                }
+            }
+        }
+    }
+
+    // 1. Count the uses of every value
+    for (auto& block : m_function.blocks) {
+        for (auto& instr : block->instrs) {
+            for (Instr* operand : instr->operands) {
+                m_use_count[operand]++;
+                if (instr->op == Opcode::Call) m_call_arguments.insert(operand);
+            }
+        }
+    }
+
+    // A value can only be folded into a user in the same block
+    for (auto& block : m_function.blocks) {
+        for (auto& instr : block->instrs) {
+            for (Instr* operand : instr->operands) {
+                // A phi's operands are read on the incoming edge, at the
+                // end of the predecessor, never where the phi is
+                if (operand->parent != block.get() || instr->is_phi()) {
+                    m_used_in_other_block.insert(operand);
+                }
+            }
+        }
+    }
+
+    // 2. One machine block per IR block, in the same order
+    std::unordered_map<BasicBlock*, int> index_of;
+    for (auto& block : m_function.blocks) {
+        index_of[block.get()] = static_cast<int>(m_mfunction.blocks.size());
+        MBlock mblock;
+        mblock.label = block_label(block.get());
+        mblock.frequency = block->frequency;
+        mblock.profile_edge = block->profile_edge;
+        m_mfunction.blocks.push_back(mblock);
+    }
+
+    // 3. Cover every tree, root by root, in program order
+    for (size_t b = 0; b < m_function.blocks.size(); b++) {
+        BasicBlock* block = m_function.blocks[b].get();
+        m_current = &m_mfunction.blocks[b];
+        for (BasicBlock* succ : block->successors()) {
+            m_current->succs.push_back(index_of[succ]);
+        }
+
+        if (b == 0) emit_parameter_moves(block);
+
+        for (auto& instr : block->instrs) {
+            Instr* root = instr.get();
+            if (!is_tree_root(root) || root->is_phi() || root->op == Opcode::Param) continue;
+
+            if (root->op == Opcode::Br) {
+                emit_phi_copies(block, root->targets[0]);
+            }
+            if (!root->has_result()) {
+                reduce(root, NT_STMT, true);
+                continue;
+            }
+
+            Selected result = reduce(root, NT_REG, true);
+            auto it = m_value_reg.find(root);
+            if (it == m_value_reg.end()) {
+                m_value_reg[root] = result.reg;
+            } else {
+                // Someone already asked for this value's register
+                emit(make_copy(register_class(root->type), it->second, result.reg, m_features.avx2));
+            }
+        }
+    }
+
+    // 4. Failed bounds checks all land here, out of the way
+    if (m_needs_bounds_fail) {
+        MBlock fail;
+        fail.label = bounds_fail_label();
+        fail.frequency = 0;
+        fail.instrs.push_back({"ud2", {}, {}, {}});
+        m_mfunction.blocks.push_back(fail);
+    }
+
+    return std::move(m_mfunction);
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "ir.hpp"
+#include "mir.hpp"
+#include "options.hpp"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// --- Instruction Selection ---
+// Turns an IRFunction into an MFunction by tree pattern matching (BURS
+// style, like lcc's 'lburg' selectors).
+//
+// 1. Inside a block, a pure instruction with exactly one use (in the
+//    same block) is folded into its user, so each block becomes a forest
+//    of expression trees. Constants are folded into every user.
+// 2. Each tree is labeled bottom-up: for every node and every nonterminal
+//    ("this value in a register", "this value as an address", ...) we
+//    find the cheapest rule from the table in isel.cpp.
+// 3. The cheapest cover is then emitted top-down.
+//
+// Adding an instruction pattern means adding one line to the rule table.
+
+// What a subtree can be turned into
+enum Nonterm {
+    NT_REG,   // A value in a register
+    NT_IMM,   // A constant that fits in a 32-bit immediate
+    NT_INDEX, // reg*scale, the index half of an address
+    NT_ADDR,  // base + index*scale + disp
+    NT_FLAGS, // A comparison whose result is left in the CPU flags
+    NT_STMT,  // A tree root that produces no value (ret, br, ...)
+    NUM_NONTERMS,
+    NT_NONE = NUM_NONTERMS
+};
+
+// The result of reducing a subtree to a nonterminal
+struct Selected {
+    int reg = -1;                   // NT_REG
+    int64_t imm = 0;                // NT_IMM (and constant pattern leaves)
+    MemRef addr;                    // NT_INDEX / NT_ADDR
+    CondCode cond = CondCode::NE;   // NT_FLAGS: branch on this condition
+};
+
+// The registers a value of this type lives in
+RegClass register_class(ValueType type);
+
+// What a caller needs to know about a function it calls
+struct CalleeInfo {
+    CallingConvention convention = CallingConvention::SysV;
+    // The registers a call to it overwrites, once it's been compiled
+    // (clobbered_registers). Until then, every caller-saved one.
+    std::vector<int> clobbers;
+};
+typedef std::map<std::string, CalleeInfo> CalleeTable;
+
+class InstructionSelector;
+typedef Selected (*RuleEmitter)(InstructionSelector& sel, Instr* node, const std::vector<Selected>& kids);
+
+// A pattern is a small tree of IR opcodes whose leaves are nonterminals
+// (or constants that satisfy a predicate)
+struct Pattern {
+    Nonterm leaf = NT_NONE;             // If set, this node is a nonterminal leaf
+    Opcode op = Opcode::Const;
+    bool (*predicate)(const Instr*) = nullptr;
+    std::vector<Pattern> kids;
+};
+
+// "lhs <- pattern" costs 'cost', and 'emit' generates the code for it
+struct Rule {
+    const char* text; // e.g. "addr: Add(reg, index)", for debugging
+    Nonterm lhs;
+    Pattern pattern;
+    int cost;
+    RuleEmitter emit;
+};
+
+class InstructionSelector {
+public:
+    // 'callees' has the functions of this program; calls to any other
+    // function follow the System V ABI
+    InstructionSelector(IRFunction& function, const TargetFeatures& features = {}, CalleeTable callees = {});
+
+    MFunction select();
+
+    // --- Used by the rule emitters ---
+    const TargetFeatures& features() const { return m_features; }
+    int new_vreg(RegClass cls = RegClass::GPR) { return m_mfunction.new_vreg(cls); }
+    void emit(MInstr instr);
+    void emit(const std::string& opcode, std::vector<MOperand> ops = {});
+    std::string block_label(BasicBlock* block) const;
+    // A label for 'qwords' in .rodata (one per distinct constant)
+    std::string constant_label(const std::vector<int64_t>& qwords);
+    // A jump table in .rodata, with an entry for each of these block labels
+    std::string jump_table_label(const std::vector<std::string>& targets);
+    // The register holding a value computed by an earlier tree
+    int reg_for(Instr* value);
+    const CalleeInfo& callee(const std::string& name) const;
+    // True if 'name' isn't one of this program's functions (or the
+    // runtime's): it's defined elsewhere, maybe in a shared library
+    bool is_external(const std::string& name) const { return !m_callees.count(name); }
+    // The frame slot a StackAddr stands for
+    int frame_slot(Instr* stack_addr);
+    // Where a failed bounds check jumps: a 'ud2' at the end of the function
+    std::string bounds_fail_label();
+
+private:
+    IRFunction& m_function;
+    TargetFeatures m_features;
+    MFunction m_mfunction;
+    CalleeTable m_callees;
+    MBlock* m_current = nullptr;
+
+    std::unordered_map<Instr*, int> m_use_count;
+    std::unordered_set<Instr*> m_used_in_other_block;
+    std::unordered_set<Instr*> m_call_arguments;
+    std::unordered_map<Instr*, int> m_value_reg; // Values that live in a vreg
+    std::unordered_map<Instr*, int> m_frame_slots;
+    bool m_needs_bounds_fail = false;
+
+    // Labeling results: the cheapest cost/rule for each nonterminal
+    struct Label {
+        int cost[NUM_NONTERMS];
+        const Rule* rule[NUM_NONTERMS];
+    };
+    std::unordered_map<Instr*, Label> m_tree_labels;
+    Label m_in_register; // The label of a value that is already in a register
+
+    bool is_folded(Instr* node) const;
+    bool is_tree_root(Instr* node) const;
+
+    // How to cover a tree rooted at 'node'
+    const Label& tree_label(Instr* node);
+    // How to cover 'node' when it appears as an operand: folded values are
+    // covered with their tree, others are already in a register
+    const Label& operand_label(Instr* node);
+    bool match(const Pattern& pattern, Instr* node, bool is_root, int& cost);
+    void close_chains(Label& label);
+
+    Selected reduce(Instr* node, Nonterm nt, bool is_root);
+    // SSA has no copies: phis in 'succ' become moves at the end of 'block'.
+    // Critical edges are split before selection, so 'block' always ends
+    // in an unconditional jump to 'succ'.
+    void emit_phi_copies(BasicBlock* block, BasicBlock* succ);
+    // Copies the parameters to their vregs, first thing in the function
+    void emit_parameter_moves(BasicBlock* entry);
+    void collect_kids(const Pattern& pattern, Instr* node, std::vector<Selected>& kids);
+};
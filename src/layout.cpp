@@ -0,0 +1,294 @@
+#include "layout.hpp"
+#include "cfg.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+// --- CallGraph ---
+
+void CallGraph::add_function(const std::string& name) {
+    if (!has_function(name)) {
+        m_functions.push_back(name);
+    }
+}
+
+void CallGraph::add_call(const std::string& caller, const std::string& callee, uint64_t weight) {
+    m_edges[{caller, callee}] += weight;
+}
+
+bool CallGraph::has_function(const std::string& name) const {
+    return std::find(m_functions.begin(), m_functions.end(), name) != m_functions.end();
+}
+
+uint64_t CallGraph::weight(const std::string& caller, const std::string& callee) const {
+    auto it = m_edges.find({caller, callee});
+    return it == m_edges.end() ? 0 : it->second;
+}
+
+std::vector<std::string> CallGraph::callees(const std::string& caller) const {
+    std::vector<std::string> result;
+    for (const auto& edge : m_edges) {
+        if (edge.first.first == caller) {
+            result.push_back(edge.first.second);
+        }
+    }
+    return result;
+}
+
+CallGraph CallGraph::with_profile(const ProfileData& profile) const {
+    CallGraph result;
+    result.m_functions = m_functions;
+    result.m_entry_points = m_entry_points;
+    for (const auto& edge : m_edges) {
+        result.m_edges[edge.first] = edge.second * profile.function_count(edge.first.first);
+    }
+    return result;
+}
+
+// --- Hot/Cold Splitting ---
+
+std::set<std::string> find_cold_functions(const CallGraph& graph, const ProfileData& profile,
+                                          const std::set<std::string>& declared) {
+    // 1. Anything the profile says never ran, or that says it's cold, is cold
+    std::set<std::string> cold;
+    for (const auto& name : graph.functions()) {
+        if (profile.is_cold(name) || declared.count(name)) {
+            cold.insert(name);
+        }
+    }
+
+    // 2. Walk the call graph from the entry points, but don't walk
+    //    *through* cold functions: whatever is only reachable from them is
+    //    cold too. Without entry points we can't tell who the callers are,
+    //    so stop here.
+    if (graph.entry_points().empty()) {
+        return cold;
+    }
+
+    std::set<std::string> reached;
+    std::vector<std::string> worklist;
+    for (const auto& name : graph.entry_points()) {
+        if (cold.count(name) || !graph.has_function(name)) continue;
+        reached.insert(name);
+        worklist.push_back(name);
+    }
+    if (worklist.empty()) {
+        return cold;
+    }
+    while (!worklist.empty()) {
+        std::string caller = worklist.back();
+        worklist.pop_back();
+        for (const auto& callee : graph.callees(caller)) {
+            if (cold.count(callee) || reached.count(callee)) continue;
+            reached.insert(callee);
+            worklist.push_back(callee);
+        }
+    }
+
+    for (const auto& name : graph.functions()) {
+        if (!reached.count(name)) {
+            cold.insert(name);
+        }
+    }
+    return cold;
+}
+
+// --- Function Ordering (Pettis-Hansen) ---
+
+std::vector<std::string> order_functions(const CallGraph& graph, const ProfileData& profile,
+                                         const std::set<std::string>& exclude) {
+    const auto& functions = graph.functions();
+
+    // Source position of every function, used to break ties the same way every time
+    std::unordered_map<std::string, size_t> source_index;
+    for (size_t i = 0; i < functions.size(); i++) {
+        source_index[functions[i]] = i;
+    }
+
+    // 1. Build the undirected edge list: a->b and b->a count together.
+    struct Edge {
+        std::string a, b;
+        uint64_t weight;
+    };
+    std::map<std::pair<std::string, std::string>, uint64_t> combined;
+    for (const auto& caller : functions) {
+        if (exclude.count(caller)) continue;
+        for (const auto& callee : graph.callees(caller)) {
+            if (callee == caller || exclude.count(callee) || !source_index.count(callee)) continue;
+            auto key = source_index[caller] < source_index[callee] ? std::make_pair(caller, callee)
+                                                                     : std::make_pair(callee, caller);
+            combined[key] += graph.weight(caller, callee);
+        }
+    }
+
+    std::vector<Edge> edges;
+    for (const auto& entry : combined) {
+        if (entry.second > 0) {
+            edges.push_back({entry.first.first, entry.first.second, entry.second});
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(),
+        [](const Edge& x, const Edge& y) { return x.weight > y.weight; });
+
+    // 2. Every function starts out in its own chain
+    std::vector<std::vector<std::string>> chains;
+    std::unordered_map<std::string, size_t> chain_of;
+    for (const auto& name : functions) {
+        if (exclude.count(name)) continue;
+        chain_of[name] = chains.size();
+        chains.push_back({name});
+    }
+
+    // 3. Heaviest edge first: glue the two chains together, flipping them
+    //    so the caller and callee end up as close as possible.
+    auto position = [](const std::vector<std::string>& chain, const std::string& name) {
+        return static_cast<size_t>(std::find(chain.begin(), chain.end(), name) - chain.begin());
+    };
+
+    for (const auto& edge : edges) {
+        size_t ca = chain_of[edge.a];
+        size_t cb = chain_of[edge.b];
+        if (ca == cb) continue;
+
+        std::vector<std::string> best;
+        size_t best_distance = SIZE_MAX;
+        for (int flip_a = 0; flip_a < 2; flip_a++) {
+            for (int flip_b = 0; flip_b < 2; flip_b++) {
+                std::vector<std::string> first = chains[ca];
+                std::vector<std::string> second = chains[cb];
+                if (flip_a) std::reverse(first.begin(), first.end());
+                if (flip_b) std::reverse(second.begin(), second.end());
+
+                size_t distance = (first.size() - position(first, edge.a)) + position(second, edge.b);
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = first;
+                    best.insert(best.end(), second.begin(), second.end());
+                }
+            }
+        }
+
+        for (const auto& name : chains[cb]) {
+            chain_of[name] = ca;
+        }
+        chains[ca] = std::move(best);
+        chains[cb].clear();
+    }
+
+    // 4. Order the chains: hottest first with a profile, otherwise the chain
+    //    holding 'main' first and the rest in source order.
+    auto chain_heat = [&](const std::vector<std::string>& chain) {
+        uint64_t heat = 0;
+        for (const auto& name : chain) {
+            heat = std::max(heat, profile.function_count(name));
+        }
+        return heat;
+    };
+    auto chain_start = [&](const std::vector<std::string>& chain) {
+        size_t first = SIZE_MAX;
+        for (const auto& name : chain) {
+            first = std::min(first, source_index[name]);
+        }
+        return first;
+    };
+    auto has_main = [](const std::vector<std::string>& chain) {
+        return std::find(chain.begin(), chain.end(), "main") != chain.end();
+    };
+
+    std::vector<std::vector<std::string>> ordered;
+    for (auto& chain : chains) {
+        if (!chain.empty()) ordered.push_back(std::move(chain));
+    }
+    std::stable_sort(ordered.begin(), ordered.end(),
+        [&](const std::vector<std::string>& x, const std::vector<std::string>& y) {
+            if (!profile.empty() && chain_heat(x) != chain_heat(y)) {
+                return chain_heat(x) > chain_heat(y);
+            }
+            if (has_main(x) != has_main(y)) {
+                return has_main(x);
+            }
+            return chain_start(x) < chain_start(y);
+        });
+
+    std::vector<std::string> result;
+    for (const auto& chain : ordered) {
+        result.insert(result.end(), chain.begin(), chain.end());
+    }
+    return result;
+}
+
+// --- Block Placement ---
+
+void place_blocks(IRFunction& function) {
+    BasicBlock* entry = function.blocks[0].get();
+    std::unordered_map<BasicBlock*, size_t> source_index;
+    for (size_t i = 0; i < function.blocks.size(); i++) {
+        source_index[function.blocks[i].get()] = i;
+    }
+
+    // 1. Every edge, weighted by how often it's taken. Nothing jumps
+    //    back to the entry block, so it's never the target.
+    struct Edge {
+        BasicBlock* from;
+        BasicBlock* to;
+        double weight;
+    };
+    std::vector<Edge> edges;
+    for (auto& block : function.blocks) {
+        std::vector<BasicBlock*> succs = block->successors();
+        std::vector<double> probabilities = branch_probabilities(block.get());
+        for (size_t i = 0; i < succs.size(); i++) {
+            if (succs[i] == block.get() || succs[i] == entry) continue;
+            edges.push_back({block.get(), succs[i], block->frequency * probabilities[i]});
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(),
+        [](const Edge& x, const Edge& y) { return x.weight > y.weight; });
+
+    // 2. Every block starts out in its own chain
+    std::vector<std::vector<BasicBlock*>> chains;
+    std::unordered_map<BasicBlock*, size_t> chain_of;
+    for (auto& block : function.blocks) {
+        chain_of[block.get()] = chains.size();
+        chains.push_back({block.get()});
+    }
+
+    // 3. Heaviest edge first: if it goes from the end of one chain to the
+    //    start of another, it can fall through, so join them. Hot code
+    //    never falls through into cold code.
+    auto is_cold_block = [](BasicBlock* block) { return block->frequency < COLD_BLOCK_FREQUENCY; };
+    for (const Edge& edge : edges) {
+        size_t from = chain_of[edge.from];
+        size_t to = chain_of[edge.to];
+        if (from == to || chains[from].back() != edge.from || chains[to].front() != edge.to) continue;
+        if (is_cold_block(edge.to) && !is_cold_block(edge.from)) continue;
+        for (BasicBlock* block : chains[to]) {
+            chain_of[block] = from;
+        }
+        chains[from].insert(chains[from].end(), chains[to].begin(), chains[to].end());
+        chains[to].clear();
+    }
+
+    // 4. The entry's chain first, then the others in source order, the
+    //    cold ones last
+    auto is_cold = [&](const std::vector<BasicBlock*>& chain) {
+        return std::all_of(chain.begin(), chain.end(), is_cold_block);
+    };
+    std::vector<std::vector<BasicBlock*>> ordered;
+    for (auto& chain : chains) {
+        if (!chain.empty()) ordered.push_back(std::move(chain));
+    }
+    std::stable_sort(ordered.begin(), ordered.end(),
+        [&](const std::vector<BasicBlock*>& x, const std::vector<BasicBlock*>& y) {
+            if ((x.front() == entry) != (y.front() == entry)) return x.front() == entry;
+            if (is_cold(x) != is_cold(y)) return is_cold(y);
+            return source_index[x.front()] < source_index[y.front()];
+        });
+
+    std::vector<std::unique_ptr<BasicBlock>> blocks;
+    for (const auto& chain : ordered) {
+        for (BasicBlock* block : chain) {
+            blocks.push_back(std::move(function.blocks[source_index[block]]));
+        }
+    }
+    function.blocks = std::move(blocks);
+}
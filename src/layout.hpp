@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ir.hpp"
+#include "profile.hpp"
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- Call Graph ---
+// Who calls whom, and how often. The code generator fills this in while
+// it walks the program, and the layout functions below use it to decide
+// where each function ends up in the final binary. Taking a function's
+// address counts as calling it: parallel for bodies and thread entries
+// are only ever called through one.
+class CallGraph {
+public:
+    // Functions are remembered in the order they are added (source order)
+    void add_function(const std::string& name);
+    void add_call(const std::string& caller, const std::string& callee, uint64_t weight = 1);
+    // A function called from outside the module: 'main', the 'export'
+    // functions, .fini_array's
+    void add_entry_point(const std::string& name) { m_entry_points.insert(name); }
+
+    const std::vector<std::string>& functions() const { return m_functions; }
+    bool has_function(const std::string& name) const;
+    const std::set<std::string>& entry_points() const { return m_entry_points; }
+
+    // How many times 'caller' calls 'callee' (call sites, or profile counts)
+    uint64_t weight(const std::string& caller, const std::string& callee) const;
+    std::vector<std::string> callees(const std::string& caller) const;
+
+    // Returns a copy where every edge weight is replaced using the profile:
+    // call sites * number of times the caller ran.
+    CallGraph with_profile(const ProfileData& profile) const;
+
+private:
+    std::vector<std::string> m_functions;
+    std::set<std::string> m_entry_points;
+    std::map<std::pair<std::string, std::string>, uint64_t> m_edges;
+};
+
+// --- Hot/Cold Splitting ---
+// Picks the functions that should go to .text.cold:
+//  * functions the profile says never ran,
+//  * the ones declared @cold ('declared'),
+//  * functions that can't be reached from an entry point through hot
+//    code (e.g. only ever called from a cold error path).
+std::set<std::string> find_cold_functions(const CallGraph& graph, const ProfileData& profile,
+                                          const std::set<std::string>& declared = {});
+
+// --- Function Ordering ---
+// Orders functions with the Pettis-Hansen algorithm: functions that call
+// each other a lot are placed next to each other, so hot call chains share
+// i-cache lines and pages. Functions in 'exclude' are left out.
+std::vector<std::string> order_functions(const CallGraph& graph, const ProfileData& profile,
+                                         const std::set<std::string>& exclude);
+
+// --- Block Placement ---
+// Blocks expected to run less than once per 1000 calls (behind an
+// unlikely() branch, calling a @cold function) are cold. With -O1 they
+// go to .text.cold, out of the way of the hot code.
+const double COLD_BLOCK_FREQUENCY = 0.001;
+
+// Orders the blocks of a function so each branch falls through to its
+// likeliest target: the same chaining as order_functions, but on the
+// edges between blocks, weighted by how often they are taken (see
+// estimate_block_frequencies), and only joining the end of one chain to
+// the start of another. The entry block stays first and cold blocks go last.
+void place_blocks(IRFunction& function);
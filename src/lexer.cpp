@@ -1,4 +1,5 @@
 #include "lexer.hpp"
+#include <cctype>
 #include <iostream>
 #include <unordered_map>
 
@@ -6,8 +7,34 @@
 std::unordered_map<std::string, TokenType> keywords = {
     {"int",    TokenType::INT},
     {"char",   TokenType::CHAR},
+    {"i8",     TokenType::I8},
+    {"i16",    TokenType::I16},
+    {"i32",    TokenType::I32},
+    {"i64",    TokenType::I64},
+    {"u8",     TokenType::U8},
+    {"u16",    TokenType::U16},
+    {"u32",    TokenType::U32},
+    {"u64",    TokenType::U64},
+    {"int32x4",   TokenType::INT32X4},
+    {"int32x8",   TokenType::INT32X8},
+    {"float32x8", TokenType::FLOAT32X8},
     {"return", TokenType::RETURN},
-    {"for",    TokenType::FOR}
+    {"for",    TokenType::FOR},
+    {"if",     TokenType::IF},
+    {"else",   TokenType::ELSE},
+    {"switch", TokenType::SWITCH},
+    {"case",   TokenType::CASE},
+    {"default", TokenType::DEFAULT},
+    {"comptime", TokenType::COMPTIME},
+    {"export", TokenType::EXPORT},
+    {"extern", TokenType::EXTERN},
+    {"const", TokenType::CONST},
+    {"spawn", TokenType::SPAWN},
+    {"parallel", TokenType::PARALLEL},
+    {"yield", TokenType::YIELD},
+    {"in", TokenType::IN},
+    {"struct", TokenType::STRUCT},
+    {"sizeof", TokenType::SIZEOF}
 };
 
 // --- Token::to_string() ---
@@ -17,8 +44,34 @@ std::string Token::to_string() const {
     switch (type) {
         case TokenType::INT:            type_str = "INT"; break;
         case TokenType::CHAR:           type_str = "CHAR"; break;
+        case TokenType::I8:             type_str = "I8"; break;
+        case TokenType::I16:            type_str = "I16"; break;
+        case TokenType::I32:            type_str = "I32"; break;
+        case TokenType::I64:            type_str = "I64"; break;
+        case TokenType::U8:             type_str = "U8"; break;
+        case TokenType::U16:            type_str = "U16"; break;
+        case TokenType::U32:            type_str = "U32"; break;
+        case TokenType::U64:            type_str = "U64"; break;
+        case TokenType::INT32X4:        type_str = "INT32X4"; break;
+        case TokenType::INT32X8:        type_str = "INT32X8"; break;
+        case TokenType::FLOAT32X8:      type_str = "FLOAT32X8"; break;
         case TokenType::RETURN:         type_str = "RETURN"; break;
         case TokenType::FOR:            type_str = "FOR"; break;
+        case TokenType::IF:             type_str = "IF"; break;
+        case TokenType::ELSE:           type_str = "ELSE"; break;
+        case TokenType::SWITCH:         type_str = "SWITCH"; break;
+        case TokenType::CASE:           type_str = "CASE"; break;
+        case TokenType::DEFAULT:        type_str = "DEFAULT"; break;
+        case TokenType::COMPTIME:       type_str = "COMPTIME"; break;
+        case TokenType::EXPORT:         type_str = "EXPORT"; break;
+        case TokenType::EXTERN:         type_str = "EXTERN"; break;
+        case TokenType::CONST:          type_str = "CONST"; break;
+        case TokenType::SPAWN:          type_str = "SPAWN"; break;
+        case TokenType::PARALLEL:       type_str = "PARALLEL"; break;
+        case TokenType::YIELD:          type_str = "YIELD"; break;
+        case TokenType::IN:             type_str = "IN"; break;
+        case TokenType::STRUCT:         type_str = "STRUCT"; break;
+        case TokenType::SIZEOF:         type_str = "SIZEOF"; break;
         case TokenType::IDENTIFIER:     type_str = "IDENTIFIER"; break;
         case TokenType::NUMBER_LITERAL: type_str = "NUMBER_LITERAL"; break;
         case TokenType::STRING_LITERAL: type_str = "STRING_LITERAL"; break;
@@ -27,6 +80,12 @@ std::string Token::to_string() const {
         case TokenType::CLOSE_PAREN:    type_str = "CLOSE_PAREN"; break;
         case TokenType::OPEN_BRACE:     type_str = "OPEN_BRACE"; break;
         case TokenType::CLOSE_BRACE:    type_str = "CLOSE_BRACE"; break;
+        case TokenType::OPEN_BRACKET:   type_str = "OPEN_BRACKET"; break;
+        case TokenType::CLOSE_BRACKET:  type_str = "CLOSE_BRACKET"; break;
+        case TokenType::COMMA:          type_str = "COMMA"; break;
+        case TokenType::DOT:            type_str = "DOT"; break;
+        case TokenType::COLON:          type_str = "COLON"; break;
+        case TokenType::AT:             type_str = "AT"; break;
         case TokenType::OPEN_ANGLE:     type_str = "OPEN_ANGLE"; break;
         case TokenType::CLOSE_ANGLE:    type_str = "CLOSE_ANGLE"; break;
         case TokenType::EQUALS:         type_str = "EQUALS"; break;
@@ -34,6 +93,17 @@ std::string Token::to_string() const {
         case TokenType::MINUS:          type_str = "MINUS"; break;
         case TokenType::STAR:           type_str = "STAR"; break;
         case TokenType::SLASH:          type_str = "SLASH"; break;
+        case TokenType::PERCENT:        type_str = "PERCENT"; break;
+        case TokenType::EQUAL_EQUAL:    type_str = "EQUAL_EQUAL"; break;
+        case TokenType::BANG_EQUAL:     type_str = "BANG_EQUAL"; break;
+        case TokenType::LESS_EQUAL:     type_str = "LESS_EQUAL"; break;
+        case TokenType::GREATER_EQUAL:  type_str = "GREATER_EQUAL"; break;
+        case TokenType::PLUS_EQUAL:     type_str = "PLUS_EQUAL"; break;
+        case TokenType::MINUS_EQUAL:    type_str = "MINUS_EQUAL"; break;
+        case TokenType::PLUS_PLUS:      type_str = "PLUS_PLUS"; break;
+        case TokenType::MINUS_MINUS:    type_str = "MINUS_MINUS"; break;
+        case TokenType::AMPERSAND:      type_str = "AMPERSAND"; break;
+        case TokenType::ARROW:          type_str = "ARROW"; break;
         case TokenType::INCLUDE:        type_str = "INCLUDE"; break;
         case TokenType::END_OF_FILE:    type_str = "END_OF_FILE"; break;
         default:                        type_str = "UNKNOWN"; break;
@@ -62,13 +132,46 @@ std::vector<Token> Lexer::tokenize() {
             case ')': tokens.push_back(make_token(TokenType::CLOSE_PAREN)); break;
             case '{': tokens.push_back(make_token(TokenType::OPEN_BRACE)); break;
             case '}': tokens.push_back(make_token(TokenType::CLOSE_BRACE)); break;
-            case '<': tokens.push_back(make_token(TokenType::OPEN_ANGLE)); break;
-            case '>': tokens.push_back(make_token(TokenType::CLOSE_ANGLE)); break;
-            case '=': tokens.push_back(make_token(TokenType::EQUALS)); break;
-            case '+': tokens.push_back(make_token(TokenType::PLUS)); break;
-            case '-': tokens.push_back(make_token(TokenType::MINUS)); break;
+            case '[': tokens.push_back(make_token(TokenType::OPEN_BRACKET)); break;
+            case ']': tokens.push_back(make_token(TokenType::CLOSE_BRACKET)); break;
+            case ',': tokens.push_back(make_token(TokenType::COMMA)); break;
+            case '.': tokens.push_back(make_token(TokenType::DOT)); break;
+            case ':': tokens.push_back(make_token(TokenType::COLON)); break;
+            case '@': tokens.push_back(make_token(TokenType::AT)); break;
             case '*': tokens.push_back(make_token(TokenType::STAR)); break;
-            // Note: We'll handle '/' in skip_whitespace for comments
+            case '&': tokens.push_back(make_token(TokenType::AMPERSAND)); break;
+            // Note: skip_whitespace already ate '//' comments, so this is a divide
+            case '/': tokens.push_back(make_token(TokenType::SLASH)); break;
+            case '%': tokens.push_back(make_token(TokenType::PERCENT)); break;
+
+            // One or two characters: +, +=, ++, -, -=, --, ->, <, <=, >, >=, =, ==, !=
+            case '+':
+                if (match('=')) tokens.push_back(make_token(TokenType::PLUS_EQUAL, "+="));
+                else if (match('+')) tokens.push_back(make_token(TokenType::PLUS_PLUS, "++"));
+                else tokens.push_back(make_token(TokenType::PLUS));
+                break;
+            case '-':
+                if (match('=')) tokens.push_back(make_token(TokenType::MINUS_EQUAL, "-="));
+                else if (match('-')) tokens.push_back(make_token(TokenType::MINUS_MINUS, "--"));
+                else if (match('>')) tokens.push_back(make_token(TokenType::ARROW, "->"));
+                else tokens.push_back(make_token(TokenType::MINUS));
+                break;
+            case '<':
+                tokens.push_back(match('=') ? make_token(TokenType::LESS_EQUAL, "<=") : make_token(TokenType::OPEN_ANGLE));
+                break;
+            case '>':
+                tokens.push_back(match('=') ? make_token(TokenType::GREATER_EQUAL, ">=") : make_token(TokenType::CLOSE_ANGLE));
+                break;
+            case '=':
+                tokens.push_back(match('=') ? make_token(TokenType::EQUAL_EQUAL, "==") : make_token(TokenType::EQUALS));
+                break;
+            case '!':
+                if (match('=')) {
+                    tokens.push_back(make_token(TokenType::BANG_EQUAL, "!="));
+                } else {
+                    std::cerr << "Lexer Error: Unknown character '!' on line " << m_line << std::endl;
+                }
+                break;
 
             // Handle multi-character tokens
             case '#':
@@ -103,7 +206,7 @@ std::vector<Token> Lexer::tokenize() {
 }
 
 bool Lexer::is_at_end() {
-    return m_current_pos >= m_source.length();
+    return static_cast<size_t>(m_current_pos) >= m_source.length();
 }
 
 char Lexer::advance() {
@@ -115,6 +218,13 @@ char Lexer::peek() {
     return m_source[m_current_pos];
 }
 
+// Consumes the next character only if it's the one we expect
+bool Lexer::match(char expected) {
+    if (peek() != expected) return false;
+    m_current_pos++;
+    return true;
+}
+
 Token Lexer::make_token(TokenType type, std::string value) {
     return Token{type, std::move(value), m_line};
 }
@@ -137,7 +247,7 @@ void Lexer::skip_whitespace_and_comments() {
                 advance();
                 break;
             case '/':
-                if (m_current_pos + 1 < m_source.length() && m_source[m_current_pos + 1] == '/') {
+                if (static_cast<size_t>(m_current_pos) + 1 < m_source.length() && m_source[m_current_pos + 1] == '/') {
                     // It's a single-line comment
                     while (peek() != '\n' && !is_at_end()) {
                         advance();
@@ -178,10 +288,41 @@ Token Lexer::handle_number() {
 }
 
 Token Lexer::handle_string() {
-    int start = m_current_pos; // The position *after* the opening "
+    // We're *after* the opening ". The token's value is the string's
+    // bytes, with the escapes (\n, \t, \0, \\, \", \xHH) already decoded.
+    std::string value;
     while (peek() != '"' && !is_at_end()) {
-        if (peek() == '\n') m_line++;
-        advance();
+        char c = advance();
+        if (c == '\n') m_line++;
+        if (c != '\\' || is_at_end()) {
+            value += c;
+            continue;
+        }
+        char escape = advance();
+        switch (escape) {
+            case 'n':  value += '\n'; break;
+            case 't':  value += '\t'; break;
+            case 'r':  value += '\r'; break;
+            case '0':  value += '\0'; break;
+            case '\\': value += '\\'; break;
+            case '"':  value += '"'; break;
+            case 'x': {
+                int byte = 0;
+                int digits = 0;
+                while (digits < 2 && std::isxdigit(peek())) {
+                    char digit = advance();
+                    byte = byte * 16 + (std::isdigit(digit) ? digit - '0' : std::tolower(digit) - 'a' + 10);
+                    digits++;
+                }
+                if (digits == 0) std::cerr << "Lexer Error: '\\x' without hex digits on line " << m_line << std::endl;
+                value += static_cast<char>(byte);
+                break;
+            }
+            default:
+                std::cerr << "Lexer Error: Unknown escape '\\" << escape << "' on line " << m_line << std::endl;
+                value += escape;
+                break;
+        }
     }
 
     if (is_at_end()) {
@@ -189,7 +330,6 @@ Token Lexer::handle_string() {
         return make_token(TokenType::END_OF_FILE, "ERROR"); // Improvise
     }
 
-    std::string value = m_source.substr(start, m_current_pos - start);
     advance(); // Consume the closing "
     return make_token(TokenType::STRING_LITERAL, value);
 }
\ No newline at end of file
@@ -8,8 +8,34 @@ enum class TokenType {
     // Keywords
     INT,
     CHAR,
+    I8,        // Fixed-width integer types
+    I16,
+    I32,
+    I64,
+    U8,
+    U16,
+    U32,
+    U64,
+    INT32X4,   // Vector types
+    INT32X8,
+    FLOAT32X8,
     RETURN,
     FOR,
+    IF,
+    ELSE,
+    SWITCH,
+    CASE,
+    DEFAULT,
+    COMPTIME,  // Function qualifier: calls are evaluated while compiling
+    EXPORT,    // Function qualifier: visible to the linker, System V ABI
+    EXTERN,    // Declares a function defined elsewhere (System V ABI)
+    CONST,     // Global variable qualifier: read-only
+    SPAWN,     // spawn f(x): runs a call in a new thread
+    PARALLEL,  // parallel for (...): spreads a loop over threads
+    YIELD,     // yield x: makes the function a generator
+    IN,        // for (int x in g()): loops over what a generator yields
+    STRUCT,
+    SIZEOF,
 
     // Identifiers
     IDENTIFIER,
@@ -24,6 +50,12 @@ enum class TokenType {
     CLOSE_PAREN,
     OPEN_BRACE,
     CLOSE_BRACE,
+    OPEN_BRACKET,   // [
+    CLOSE_BRACKET,  // ]
+    COMMA,
+    DOT,            // .
+    COLON,          // :, after a case label
+    AT,             // @, starts an attribute
     OPEN_ANGLE,     // <
     CLOSE_ANGLE,    // >
     EQUALS,         // =
@@ -31,6 +63,17 @@ enum class TokenType {
     MINUS,          // -
     STAR,           // *
     SLASH,          // /
+    PERCENT,        // %
+    EQUAL_EQUAL,    // ==
+    BANG_EQUAL,     // !=
+    LESS_EQUAL,     // <=
+    GREATER_EQUAL,  // >=
+    PLUS_EQUAL,     // +=
+    MINUS_EQUAL,    // -=
+    PLUS_PLUS,      // ++
+    MINUS_MINUS,    // --
+    AMPERSAND,      // &, takes an address
+    ARROW,          // ->
 
     // Misc
     INCLUDE,        // #include
@@ -65,6 +108,7 @@ private:
     bool is_at_end();
     char advance();
     char peek();
+    bool match(char expected);
     Token make_token(TokenType type, std::string value);
     Token make_token(TokenType type); // For single-char tokens
 
@@ -0,0 +1,696 @@
+#include "loopopt.hpp"
+#include "bounds.hpp"
+#include "cfg.hpp"
+#include "gvn.hpp"
+#include "strength.hpp"
+#include "vectorize.hpp"
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+// How big a loop may get from unrolling, in instructions
+static const int64_t FULL_UNROLL_BUDGET = 128;
+static const int64_t PARTIAL_UNROLL_BUDGET = 64;
+
+// --- Helpers ---
+
+// A new constant at the top of the entry block, where it dominates everything
+static Instr* make_const(IRFunction& function, int64_t value) {
+    BasicBlock* entry = function.blocks[0].get();
+    auto instr = std::make_unique<Instr>();
+    instr->op = Opcode::Const;
+    instr->id = function.next_value_id++;
+    instr->imm = value;
+    instr->parent = entry;
+    auto it = entry->instrs.begin();
+    while (it != entry->instrs.end() && (*it)->is_phi()) ++it;
+    return entry->instrs.insert(it, std::move(instr))->get();
+}
+
+static bool same_value(Instr* a, Instr* b) {
+    return a == b || (a->is_const() && b->is_const() && a->imm == b->imm);
+}
+
+// Blocks of 'loop' in layout order (a std::set of pointers has no stable order)
+static std::vector<BasicBlock*> loop_blocks(IRFunction& function, const Loop& loop) {
+    std::vector<BasicBlock*> blocks;
+    for (auto& block : function.blocks) {
+        if (loop.contains(block.get())) blocks.push_back(block.get());
+    }
+    return blocks;
+}
+
+// Replaces the uses of 'from' in every block 'keep' says no to
+template <typename Predicate>
+static bool replace_uses_outside(IRFunction& function, Instr* from, Instr* to, Predicate keep) {
+    bool changed = false;
+    for (auto& block : function.blocks) {
+        if (keep(block.get())) continue;
+        for (auto& instr : block->instrs) {
+            for (Instr*& operand : instr->operands) {
+                if (operand == from) {
+                    operand = to;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+// --- Simplification ---
+
+// What 'instr' can be replaced with, or nullptr
+static Instr* fold_instruction(IRFunction& function, Instr* instr) {
+    const auto& ops = instr->operands;
+    switch (instr->op) {
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::SDiv:
+        case Opcode::SRem:
+        case Opcode::UDiv:
+        case Opcode::URem:
+        case Opcode::Rotl:
+        case Opcode::Rotr: {
+            int64_t result;
+            if (ops[0]->is_const() && ops[1]->is_const() && fold_binary(instr->op, ops[0]->imm, ops[1]->imm, result)) {
+                return make_const(function, result);
+            }
+            return nullptr;
+        }
+        case Opcode::Neg:
+        case Opcode::Popcnt:
+        case Opcode::Clz:
+        case Opcode::Ctz:
+        case Opcode::Bswap:
+            if (ops[0]->is_const()) return make_const(function, fold_unary(instr->op, ops[0]->imm));
+            return nullptr;
+        case Opcode::SExt:
+        case Opcode::ZExt:
+            if (ops[0]->is_const()) return make_const(function, fold_extend(instr->op, static_cast<int>(instr->imm), ops[0]->imm));
+            return nullptr;
+        case Opcode::Cmp:
+            if (ops[0]->is_const() && ops[1]->is_const()) {
+                return make_const(function, evaluate_cond(instr->cond, ops[0]->imm, ops[1]->imm) ? 1 : 0);
+            }
+            return nullptr;
+        case Opcode::BitTest:
+            if (ops[0]->is_const()) return make_const(function, (static_cast<uint64_t>(instr->imm) >> (ops[0]->imm & 63)) & 1);
+            return nullptr;
+        case Opcode::Phi: {
+            // All incoming values the same (ignoring the phi itself)?
+            Instr* same = nullptr;
+            for (Instr* operand : ops) {
+                if (operand == instr) continue;
+                if (same && !same_value(same, operand)) return nullptr;
+                same = operand;
+            }
+            return same;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+void simplify_function(IRFunction& function) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        function.remove_unreachable_blocks();
+
+        // 1. Fold. Replaced instructions are left for the dead code pass.
+        std::vector<Instr*> all;
+        for (auto& block : function.blocks) {
+            for (auto& instr : block->instrs) all.push_back(instr.get());
+        }
+        for (Instr* instr : all) {
+            Instr* replacement = fold_instruction(function, instr);
+            if (replacement && replacement != instr) {
+                function.replace_all_uses(instr, replacement);
+                changed = true;
+            }
+        }
+
+        // 2. Branches that always go the same way become jumps
+        for (auto& block : function.blocks) {
+            Instr* term = block->terminator();
+            if (!term || term->op != Opcode::CondBr) continue;
+            Instr* condition = term->operands[0];
+            if (!condition->is_const() && term->targets[0] != term->targets[1]) continue;
+
+            BasicBlock* taken = (!condition->is_const() || condition->imm != 0) ? term->targets[0] : term->targets[1];
+            BasicBlock* dropped = taken == term->targets[0] ? term->targets[1] : term->targets[0];
+            if (dropped != taken) {
+                for (Instr* phi : dropped->phis()) {
+                    for (size_t i = phi->targets.size(); i-- > 0;) {
+                        if (phi->targets[i] == block.get()) {
+                            phi->targets.erase(phi->targets.begin() + i);
+                            phi->operands.erase(phi->operands.begin() + i);
+                        }
+                    }
+                }
+            }
+            term->op = Opcode::Br;
+            term->operands.clear();
+            term->targets = {taken};
+            term->weights.clear();
+            changed = true;
+        }
+
+        // ... and so do switches on constants, or with nothing but a default
+        for (auto& block : function.blocks) {
+            Instr* term = block->terminator();
+            if (!term || term->op != Opcode::Switch) continue;
+            Instr* value = term->operands[0];
+            if (!value->is_const() && term->targets.size() > 1) continue;
+
+            BasicBlock* taken = term->targets[0];
+            for (const auto& entry : term->cases) {
+                if (value->is_const() && entry.first == value->imm) taken = term->targets[entry.second];
+            }
+            for (BasicBlock* dropped : term->targets) {
+                if (dropped == taken) continue;
+                for (Instr* phi : dropped->phis()) {
+                    for (size_t i = phi->targets.size(); i-- > 0;) {
+                        if (phi->targets[i] == block.get()) {
+                            phi->targets.erase(phi->targets.begin() + i);
+                            phi->operands.erase(phi->operands.begin() + i);
+                        }
+                    }
+                }
+            }
+            term->op = Opcode::Br;
+            term->operands.clear();
+            term->targets = {taken};
+            term->cases.clear();
+            changed = true;
+        }
+
+        // 3. A block whose only predecessor always jumps to it joins that predecessor
+        function.compute_predecessors();
+        for (size_t i = 1; i < function.blocks.size(); i++) {
+            BasicBlock* block = function.blocks[i].get();
+            if (block->preds.size() != 1 || !block->phis().empty()) continue;
+            BasicBlock* pred = block->preds[0];
+            Instr* pred_term = pred->terminator();
+            if (pred == block || !pred_term || pred_term->op != Opcode::Br) continue;
+
+            pred->instrs.pop_back();
+            for (auto& instr : block->instrs) {
+                instr->parent = pred;
+                pred->instrs.push_back(std::move(instr));
+            }
+            for (BasicBlock* succ : pred->successors()) {
+                for (Instr* phi : succ->phis()) {
+                    std::replace(phi->targets.begin(), phi->targets.end(), block, pred);
+                }
+            }
+            function.blocks.erase(function.blocks.begin() + i);
+            function.compute_predecessors();
+            i--;
+            changed = true;
+        }
+
+        function.remove_dead_instructions();
+    }
+}
+
+// --- Preheaders ---
+
+static void ensure_preheader(IRFunction& function, const Loop& loop) {
+    if (loop.preheader()) return;
+
+    std::vector<BasicBlock*> outside;
+    for (BasicBlock* pred : loop.header->preds) {
+        if (!loop.contains(pred)) outside.push_back(pred);
+    }
+    if (outside.empty()) return; // The entry block loops to itself
+
+    IRBuilder builder(&function);
+    BasicBlock* preheader = function.create_block_before(loop.header);
+
+    // The header's phis now see one incoming edge from outside. If there
+    // were several, their values merge in the preheader first.
+    for (Instr* phi : loop.header->phis()) {
+        Instr* merged;
+        if (outside.size() == 1) {
+            merged = phi->incoming_value(outside[0]);
+        } else {
+            merged = builder.phi(preheader);
+            merged->type = phi->type;
+            for (BasicBlock* pred : outside) {
+                builder.add_phi_incoming(merged, phi->incoming_value(pred), pred);
+            }
+        }
+        for (size_t i = phi->targets.size(); i-- > 0;) {
+            if (!loop.contains(phi->targets[i])) {
+                phi->targets.erase(phi->targets.begin() + i);
+                phi->operands.erase(phi->operands.begin() + i);
+            }
+        }
+        builder.add_phi_incoming(phi, merged, preheader);
+    }
+
+    builder.set_insert_point(preheader);
+    builder.br(loop.header);
+    for (BasicBlock* pred : outside) {
+        auto& targets = pred->terminator()->targets;
+        std::replace(targets.begin(), targets.end(), loop.header, preheader);
+    }
+    function.compute_predecessors();
+}
+
+// --- Loop-Invariant Code Motion ---
+
+static bool is_invariant(const Loop& loop, Instr* value) {
+    return value->is_const() || !loop.contains(value);
+}
+
+static bool can_hoist(const Instr* instr) {
+    switch (instr->op) {
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::Neg:
+        case Opcode::Popcnt:
+        case Opcode::Clz:
+        case Opcode::Ctz:
+        case Opcode::Bswap:
+        case Opcode::Rotl:
+        case Opcode::Rotr:
+        case Opcode::SExt:
+        case Opcode::ZExt:
+            return true;
+        case Opcode::SDiv:
+        case Opcode::SRem: {
+            // Only if it can't trap: the loop might not have run it
+            const Instr* divisor = instr->operands[1];
+            return divisor->is_const() && divisor->imm != 0 && divisor->imm != -1;
+        }
+        case Opcode::UDiv:
+        case Opcode::URem:
+            return instr->operands[1]->is_const() && instr->operands[1]->imm != 0;
+        default:
+            // Cmp stays next to its branch so they still fuse into cmp+jcc.
+            // Calls, phis and terminators can't move.
+            return false;
+    }
+}
+
+static void hoist_invariants(const Loop& loop, BasicBlock* preheader, const DominatorTree& domtree) {
+    // Dominators first, so a chain of invariant instructions moves in one go
+    for (BasicBlock* block : domtree.reverse_post_order()) {
+        if (!loop.contains(block)) continue;
+        auto& instrs = block->instrs;
+        for (size_t i = 0; i < instrs.size();) {
+            Instr* instr = instrs[i].get();
+            bool invariant = can_hoist(instr) &&
+                std::all_of(instr->operands.begin(), instr->operands.end(),
+                    [&](Instr* operand) { return is_invariant(loop, operand); });
+            if (!invariant) {
+                i++;
+                continue;
+            }
+            std::unique_ptr<Instr> moved = std::move(instrs[i]);
+            instrs.erase(instrs.begin() + i);
+            moved->parent = preheader;
+            preheader->instrs.insert(preheader->instrs.end() - 1, std::move(moved));
+        }
+    }
+}
+
+// --- Induction Variables ---
+
+static void strength_reduce(IRFunction& function, const Loop& loop, BasicBlock* preheader) {
+    BasicBlock* latch = loop.latches[0];
+    IRBuilder builder(&function);
+
+    for (Instr* phi : loop.header->phis()) {
+        InductionVariable iv;
+        if (!find_induction_variable(loop, preheader, phi, iv)) continue;
+
+        // Every 'i * c' in the loop. One shl/lea is as cheap as the add
+        // that would replace it, so those stay.
+        std::vector<Instr*> products;
+        for (BasicBlock* block : loop_blocks(function, loop)) {
+            for (auto& instr : block->instrs) {
+                if (instr->op == Opcode::Mul && instr->operands[0] == phi && instr->operands[1]->is_const() &&
+                    find_mul_sequence(instr->operands[1]->imm, 1).empty()) {
+                    products.push_back(instr.get());
+                }
+            }
+        }
+
+        // i * c = init * c + n * (step * c): a new induction variable
+        std::unordered_map<int64_t, Instr*> scaled_by;
+        for (Instr* product : products) {
+            int64_t factor = product->operands[1]->imm;
+            Instr*& scaled = scaled_by[factor];
+            if (!scaled) {
+                builder.set_insert_point(preheader);
+                Instr* start = builder.binary(Opcode::Mul, iv.init, builder.const_int(factor));
+
+                scaled = builder.phi(loop.header);
+                builder.set_insert_point(latch);
+                uint64_t stride = static_cast<uint64_t>(iv.step) * static_cast<uint64_t>(factor);
+                Instr* bumped = builder.binary(Opcode::Add, scaled, builder.const_int(static_cast<int64_t>(stride)));
+
+                builder.add_phi_incoming(scaled, start, preheader);
+                builder.add_phi_incoming(scaled, bumped, latch);
+            }
+            function.replace_all_uses(product, scaled);
+        }
+    }
+}
+
+// --- Exit Values ---
+
+// After 'trips' iterations, every induction variable with a constant
+// start has a known final value: use it instead of the loop's
+static void replace_exit_values(IRFunction& function, const Loop& loop, BasicBlock* preheader, int64_t trips) {
+    auto outside = [&](BasicBlock* block) { return loop.contains(block); };
+    for (Instr* phi : loop.header->phis()) {
+        InductionVariable iv;
+        if (!find_induction_variable(loop, preheader, phi, iv) || !iv.init->is_const()) continue;
+
+        uint64_t init = static_cast<uint64_t>(iv.init->imm);
+        uint64_t step = static_cast<uint64_t>(iv.step);
+        uint64_t last = init + static_cast<uint64_t>(trips - 1) * step;
+
+        // Only make the constants if something after the loop wants them
+        for (auto& pair : {std::make_pair(phi, last), std::make_pair(iv.next, last + step)}) {
+            bool used_outside = false;
+            for (auto& block : function.blocks) {
+                if (loop.contains(block.get())) continue;
+                for (auto& instr : block->instrs) {
+                    used_outside |= std::count(instr->operands.begin(), instr->operands.end(), pair.first) > 0;
+                }
+            }
+            if (used_outside) {
+                replace_uses_outside(function, pair.first, make_const(function, static_cast<int64_t>(pair.second)), outside);
+            }
+        }
+    }
+}
+
+// --- Loop Deletion ---
+
+// A loop that finishes (its trip count is known), calls nothing, stores
+// nothing, checks no bounds, and computes nothing used afterwards can go
+static bool is_removable(IRFunction& function, const Loop& loop) {
+    if (loop.exit_blocks().size() != 1) return false;
+    for (BasicBlock* block : loop.blocks) {
+        for (auto& instr : block->instrs) {
+            if (instr->has_side_effects() && !instr->is_terminator()) return false;
+        }
+    }
+    for (auto& block : function.blocks) {
+        if (loop.contains(block.get())) continue;
+        for (auto& instr : block->instrs) {
+            for (Instr* operand : instr->operands) {
+                if (loop.contains(operand)) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void delete_loop(const Loop& loop, BasicBlock* preheader) {
+    BasicBlock* exit = loop.exit_blocks()[0];
+    preheader->terminator()->targets = {exit};
+    for (Instr* phi : exit->phis()) {
+        for (BasicBlock*& from : phi->targets) {
+            if (loop.contains(from)) from = preheader;
+        }
+    }
+    // The loop's blocks are unreachable now; simplify_function drops them
+}
+
+// --- Unrolling ---
+
+static Instr* clone_instruction(IRBuilder& builder, Instr* instr, const std::unordered_map<Instr*, Instr*>& values) {
+    auto map = [&](Instr* value) {
+        auto it = values.find(value);
+        return it != values.end() ? it->second : value;
+    };
+    switch (instr->op) {
+        case Opcode::Const:     return builder.const_int(instr->imm);
+        case Opcode::Neg:
+        case Opcode::Popcnt:
+        case Opcode::Clz:
+        case Opcode::Ctz:
+        case Opcode::Bswap:     return builder.unary(instr->op, map(instr->operands[0]));
+        case Opcode::SExt:
+        case Opcode::ZExt:      return builder.extend(instr->op, map(instr->operands[0]), static_cast<int>(instr->imm));
+        case Opcode::Cmp:       return builder.cmp(instr->cond, map(instr->operands[0]), map(instr->operands[1]));
+        case Opcode::BitTest:   return builder.bit_test(map(instr->operands[0]), static_cast<uint64_t>(instr->imm));
+        case Opcode::Call: {
+            std::vector<Instr*> arguments;
+            for (Instr* argument : instr->operands) arguments.push_back(map(argument));
+            return builder.call(instr->symbol, arguments);
+        }
+        case Opcode::ZLoad:
+        case Opcode::SLoad:     return builder.load(map(instr->operands[0]), static_cast<int>(instr->imm), instr->op == Opcode::SLoad);
+        case Opcode::StackAddr: return builder.stack_addr(instr->imm);
+        case Opcode::GlobalAddr: return builder.global_addr(instr->symbol);
+        // These have no value for anything to use
+        case Opcode::Store:
+            builder.store(map(instr->operands[0]), map(instr->operands[1]), static_cast<int>(instr->imm));
+            return nullptr;
+        case Opcode::MemZero:
+            builder.mem_zero(map(instr->operands[0]), instr->imm);
+            return nullptr;
+        case Opcode::BoundsCheck:
+            builder.bounds_check(map(instr->operands[0]), map(instr->operands[1]));
+            return nullptr;
+        case Opcode::Prefetch:
+            builder.prefetch(map(instr->operands[0]));
+            return nullptr;
+        case Opcode::Splat:     return builder.splat(instr->type, map(instr->operands[0]));
+        case Opcode::VecConst:  return builder.vec_const(instr->type, instr->lanes);
+        case Opcode::ReduceAdd: return builder.reduce_add(map(instr->operands[0]));
+        case Opcode::Extract:   return builder.extract(map(instr->operands[0]), static_cast<int>(instr->imm));
+        case Opcode::Insert:    return builder.insert(map(instr->operands[0]), map(instr->operands[1]), static_cast<int>(instr->imm));
+        case Opcode::Shuffle:   return builder.shuffle(map(instr->operands[0]), instr->lanes);
+        case Opcode::VLoad:     return builder.vector_load(instr->type, map(instr->operands[0]));
+        case Opcode::VStore:
+            builder.vector_store(map(instr->operands[0]), map(instr->operands[1]));
+            return nullptr;
+        case Opcode::VAdd:
+        case Opcode::VSub:
+        case Opcode::VMul:
+        case Opcode::VDiv:
+        case Opcode::VShl:      return builder.vector_binary(instr->op, map(instr->operands[0]), map(instr->operands[1]));
+        default:                return builder.binary(instr->op, map(instr->operands[0]), map(instr->operands[1]));
+    }
+}
+
+// What unrolling counts: the instructions that aren't phis, constants or
+// the terminator
+static int64_t body_size(BasicBlock* block) {
+    int64_t size = std::count_if(block->instrs.begin(), block->instrs.end(), [](const std::unique_ptr<Instr>& instr) {
+        return !instr->is_phi() && !instr->is_const() && !instr->is_terminator();
+    });
+    return std::max<int64_t>(1, size);
+}
+
+// True if unroll_loop() would get rid of the loop altogether
+static bool fully_unrollable(const Loop& loop, BasicBlock* preheader, int64_t& trips) {
+    return loop.blocks.size() == 1 && compute_trip_count(loop, preheader, trips) &&
+           trips <= FULL_UNROLL_BUDGET / body_size(loop.header);
+}
+
+static void unroll_loop(IRFunction& function, const Loop& loop, BasicBlock* preheader, int64_t trips) {
+    BasicBlock* block = loop.header;
+    Instr* term = block->terminator();
+    bool continue_if_true = term->targets[0] == block;
+    BasicBlock* exit = continue_if_true ? term->targets[1] : term->targets[0];
+
+    // 1. How far?
+    std::vector<Instr*> phis, body;
+    for (auto& instr : block->instrs) {
+        if (instr->is_phi()) phis.push_back(instr.get());
+        else if (!instr->is_terminator()) body.push_back(instr.get());
+    }
+    int64_t factor = 0;
+    int64_t size = body_size(block);
+    bool full = trips <= FULL_UNROLL_BUDGET / size;
+    if (full) {
+        factor = trips;
+    } else {
+        for (int64_t candidate : {8, 4, 2}) {
+            if (trips % candidate == 0 && candidate * size <= PARTIAL_UNROLL_BUDGET) {
+                factor = candidate;
+                break;
+            }
+        }
+        if (factor == 0) return;
+    }
+
+    // 2. Rebuild the block: 'factor' copies of the body, each reading the
+    //    values the previous one left behind. The builder folds as it goes.
+    std::vector<std::unique_ptr<Instr>> old = std::move(block->instrs);
+    block->instrs.clear();
+    if (!full) {
+        for (auto& instr : old) {
+            if (instr->is_phi()) block->instrs.push_back(std::move(instr));
+        }
+    }
+
+    std::unordered_map<Instr*, Instr*> values;
+    for (Instr* phi : phis) {
+        values[phi] = full ? phi->incoming_value(preheader) : phi;
+    }
+    auto current = [&](Instr* value) {
+        auto it = values.find(value);
+        return it != values.end() ? it->second : value;
+    };
+
+    IRBuilder builder(&function);
+    builder.set_insert_point(block);
+    for (int64_t copy = 0; copy < factor; copy++) {
+        if (copy > 0) {
+            std::vector<Instr*> carried;
+            for (Instr* phi : phis) carried.push_back(current(phi->incoming_value(block)));
+            for (size_t i = 0; i < phis.size(); i++) values[phis[i]] = carried[i];
+        }
+        for (Instr* instr : body) {
+            values[instr] = clone_instruction(builder, instr, values);
+        }
+    }
+
+    // 3. Close the loop (or don't, if it's gone)
+    if (full) {
+        builder.br(exit);
+    } else {
+        for (Instr* phi : phis) {
+            for (size_t i = 0; i < phi->targets.size(); i++) {
+                if (phi->targets[i] == block) phi->operands[i] = current(phi->operands[i]);
+            }
+        }
+        Instr* condition = current(term->operands[0]);
+        builder.cond_br(condition, continue_if_true ? block : exit, continue_if_true ? exit : block, term->weights);
+    }
+
+    // 4. Code after the loop sees the values from the last copy
+    auto inside = [&](BasicBlock* b) { return b == block; };
+    for (Instr* instr : phis) replace_uses_outside(function, instr, current(instr), inside);
+    for (Instr* instr : body) replace_uses_outside(function, instr, current(instr), inside);
+    function.compute_predecessors();
+}
+
+// --- Vectorization ---
+
+static void vectorize_loops(IRFunction& function, const CompilerOptions& options) {
+    DominatorTree domtree(function);
+    LoopInfo loops(function, domtree);
+    int lanes = options.target.avx2 ? 4 : 2;
+    for (Loop* loop : loops.loops()) {
+        if (!loop->children.empty()) continue;
+
+        // Loops that load or store may need to compare their pointers
+        // first (see vectorize.hpp); the remark says how many pairs
+        std::string reason;
+        int64_t trips;
+        int overlap_checks = 0;
+        bool vectorized = false;
+        if (loop->preheader() && fully_unrollable(*loop, loop->preheader(), trips)) {
+            reason = "it runs " + std::to_string(trips) + " times and is unrolled instead";
+        } else {
+            vectorized = vectorize_loop(function, *loop, lanes, reason, overlap_checks);
+        }
+
+        if (options.report_vectorize) {
+            std::cerr << "remark: " << function.name << ": loop at bb" << loop->header->id;
+            if (vectorized) {
+                std::cerr << " vectorized (" << lanes << " x i64, " << (options.target.avx2 ? "AVX2" : "SSE2") << ")";
+                if (overlap_checks) std::cerr << " with " << overlap_checks << " overlap checks";
+                std::cerr << "\n";
+            } else {
+                std::cerr << " not vectorized: " << reason << "\n";
+            }
+        }
+    }
+}
+
+// --- The Pipeline ---
+
+void optimize_loops(IRFunction& function, const CompilerOptions& options) {
+    simplify_function(function);
+
+    // 0. Common subexpressions, so the loop passes don't see them twice
+    int redundant = global_value_numbering(function);
+    simplify_function(function);
+
+    // 1. Preheaders. This changes the CFG, so the analysis is redone after.
+    {
+        DominatorTree domtree(function);
+        LoopInfo loops(function, domtree);
+        for (Loop* loop : loops.loops()) {
+            ensure_preheader(function, *loop);
+        }
+    }
+
+    // 2. Hoisting and induction variables, innermost loops first
+    {
+        DominatorTree domtree(function);
+        LoopInfo loops(function, domtree);
+        std::vector<std::pair<Loop*, BasicBlock*>> dead;
+        for (Loop* loop : loops.loops()) {
+            BasicBlock* preheader = loop->preheader();
+            if (!preheader) continue;
+
+            hoist_invariants(*loop, preheader, domtree);
+            if (loop->latches.size() == 1) strength_reduce(function, *loop, preheader);
+
+            int64_t trips;
+            if (compute_trip_count(*loop, preheader, trips)) {
+                replace_exit_values(function, *loop, preheader, trips);
+                if (is_removable(function, *loop)) dead.push_back({loop, preheader});
+            }
+        }
+        for (auto& entry : dead) {
+            delete_loop(*entry.first, entry.second);
+        }
+    }
+    simplify_function(function);
+
+    // 3. Bounds checks, now that loops have preheaders and their
+    //    invariants are out of the way
+    BoundsCheckStats checks = eliminate_bounds_checks(function);
+    simplify_function(function);
+
+    // 4. Vectorize innermost loops. Not in @cold functions: both this
+    //    and unrolling trade code size for speed.
+    if (!function.is_cold) vectorize_loops(function, options);
+    simplify_function(function);
+
+    // 5. Unroll innermost single-block loops
+    if (!function.is_cold) {
+        DominatorTree domtree(function);
+        LoopInfo loops(function, domtree);
+        for (Loop* loop : loops.loops()) {
+            if (!loop->children.empty() || loop->blocks.size() != 1) continue;
+            BasicBlock* preheader = loop->preheader();
+            int64_t trips;
+            if (preheader && compute_trip_count(*loop, preheader, trips)) {
+                unroll_loop(function, *loop, preheader, trips);
+            }
+        }
+    }
+    simplify_function(function);
+
+    // 6. The unrolled copies of a loop often compute the same things
+    redundant += global_value_numbering(function);
+    simplify_function(function);
+
+    if (options.print_stats) {
+        std::cerr << "stats: " << function.name << ": gvn removed " << redundant << " redundant instructions\n";
+    }
+    if ((options.report_bounds_checks || options.print_stats) && checks.total > 0) {
+        std::cerr << (options.report_bounds_checks ? "remark: " : "stats: ") << function.name << ": "
+                  << checks.total << " bounds checks: " << checks.removed << " removed, " << checks.hoisted
+                  << " hoisted out of loops, " << count_bounds_checks(function) << " left\n";
+    }
+}
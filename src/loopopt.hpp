@@ -0,0 +1,44 @@
+#pragma once
+
+#include "ir.hpp"
+#include "options.hpp"
+
+// --- IR Optimizations ---
+// These run on each function's SSA IR between IRGenerator and the
+// instruction selector.
+
+// Cleanup: folds instructions whose operands became constants, removes
+// trivial phis, turns branches on constants into jumps, merges a block
+// into its predecessor when that's the only way in, and drops dead code.
+// Cheap enough to run after every other pass.
+void simplify_function(IRFunction& function);
+
+// The -O1 pipeline. Global value numbering (gvn.hpp) runs first and
+// last; in between come the loop passes, innermost loops first:
+//  1. Every loop gets a preheader: a block that runs once, right before
+//     the loop, where code can be hoisted to.
+//  2. Loop-invariant code motion: pure instructions whose operands are all
+//     computed outside the loop move to the preheader.
+//  3. Induction variable simplification:
+//     - 'i * c' (with i += step) becomes its own variable, bumped by
+//       'step * c' every iteration: a multiply turns into an add.
+//     - For loops whose trip count is known, values used after the loop
+//       are replaced with their final values ('init + trips * step'),
+//       and loops left with nothing to do are deleted.
+//  4. Bounds check elimination (see bounds.hpp): checks that can't fail
+//     are removed, and checks in loops are done once, before the loop,
+//     where possible. -Rpass=bounds-check reports how many are left.
+//  5. Vectorization of innermost loops that sum something up or fill an
+//     array (see vectorize.hpp), 2 lanes wide with SSE2 or 4 with -mavx2. Loops that
+//     are about to be unrolled completely are left alone. -Rpass=vectorize
+//     reports what happened to every loop.
+//  6. Unrolling, for single-block loops with a known trip count: fully if
+//     the result is small, otherwise by 8, 4 or 2 when that divides the
+//     trip count (so no leftover iterations need handling).
+//
+// Loop rotation (one conditional branch per iteration, at the bottom) is
+// done when 'for' is lowered, see IRGenerator::visit(ForStmtNode*).
+//
+// -stats reports how many instructions value numbering removed, and what
+// happened to the bounds checks.
+void optimize_loops(IRFunction& function, const CompilerOptions& options);
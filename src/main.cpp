@@ -18,6 +18,8 @@
 #include "lexer.hpp"  // Step 1
 #include "parser.hpp" // Step 2
 #include "codegen.hpp" // Step 3
+#include "options.hpp"
+#include "profile.hpp"
 
 // Helper function to read a file into a string
 std::string read_file(const std::string& filepath) {
@@ -34,9 +36,95 @@ std::string read_file(const std::string& filepath) {
 // --- AST Pretty Printer ---
 // (We'll keep this for debugging)
 
+std::string operator_text(TokenType op) {
+    switch (op) {
+        case TokenType::PLUS:          return "+";
+        case TokenType::MINUS:         return "-";
+        case TokenType::STAR:          return "*";
+        case TokenType::SLASH:         return "/";
+        case TokenType::PERCENT:       return "%";
+        case TokenType::EQUAL_EQUAL:   return "==";
+        case TokenType::BANG_EQUAL:    return "!=";
+        case TokenType::OPEN_ANGLE:    return "<";
+        case TokenType::LESS_EQUAL:    return "<=";
+        case TokenType::CLOSE_ANGLE:   return ">";
+        case TokenType::GREATER_EQUAL: return ">=";
+        case TokenType::EQUALS:        return "=";
+        case TokenType::PLUS_EQUAL:    return "+=";
+        case TokenType::MINUS_EQUAL:   return "-=";
+        case TokenType::PLUS_PLUS:     return "++";
+        case TokenType::MINUS_MINUS:   return "--";
+        default:                       return "?";
+    }
+}
+
 void print_ast(const std::unique_ptr<ExprNode>& node, std::string indent = "") {
     if (auto num_node = dynamic_cast<NumberLiteralNode*>(node.get())) {
         std::cout << indent << "NumberLiteral(" << num_node->value << ")" << std::endl;
+    } else if (auto string_node = dynamic_cast<StringLiteralNode*>(node.get())) {
+        std::cout << indent << "StringLiteral(" << string_node->value.size() << " bytes)" << std::endl;
+    } else if (auto call_node = dynamic_cast<CallExprNode*>(node.get())) {
+        std::cout << indent << "Call(" << call_node->callee;
+        for (size_t i = 0; i < call_node->type_arguments.size(); i++) {
+            std::cout << (i == 0 ? "<" : ", ") << type_name(call_node->type_arguments[i]);
+        }
+        std::cout << (call_node->type_arguments.empty() ? ")" : ">)") << std::endl;
+        for (const auto& argument : call_node->arguments) {
+            print_ast(argument, indent + "  ");
+        }
+    } else if (auto vector_node = dynamic_cast<VectorLiteralNode*>(node.get())) {
+        std::cout << indent << "VectorLiteral(" << type_name(vector_node->type) << ")" << std::endl;
+        for (const auto& element : vector_node->elements) {
+            print_ast(element, indent + "  ");
+        }
+    } else if (auto conversion_node = dynamic_cast<ConversionNode*>(node.get())) {
+        std::cout << indent << "Conversion(" << type_name(conversion_node->type) << ")" << std::endl;
+        print_ast(conversion_node->value, indent + "  ");
+    } else if (auto index_node = dynamic_cast<IndexNode*>(node.get())) {
+        std::cout << indent << "Index:" << std::endl;
+        print_ast(index_node->base, indent + "  ");
+        print_ast(index_node->index, indent + "  ");
+    } else if (auto deref_node = dynamic_cast<DerefNode*>(node.get())) {
+        std::cout << indent << "Deref:" << std::endl;
+        print_ast(deref_node->pointer, indent + "  ");
+    } else if (auto address_node = dynamic_cast<AddressOfNode*>(node.get())) {
+        std::cout << indent << "AddressOf:" << std::endl;
+        print_ast(address_node->target, indent + "  ");
+    } else if (auto spawn_node = dynamic_cast<SpawnNode*>(node.get())) {
+        std::cout << indent << "Spawn(" << spawn_node->call->callee << ")" << std::endl;
+        for (const auto& argument : spawn_node->call->arguments) {
+            print_ast(argument, indent + "  ");
+        }
+    } else if (auto binary_node = dynamic_cast<BinaryOpNode*>(node.get())) {
+        std::cout << indent << "BinaryOp(" << operator_text(binary_node->op) << ")" << std::endl;
+        print_ast(binary_node->left, indent + "  ");
+        print_ast(binary_node->right, indent + "  ");
+    } else if (auto unary_node = dynamic_cast<UnaryOpNode*>(node.get())) {
+        std::cout << indent << "UnaryOp(-)" << std::endl;
+        print_ast(unary_node->operand, indent + "  ");
+    } else if (auto var_node = dynamic_cast<VariableNode*>(node.get())) {
+        std::cout << indent << "Variable(" << var_node->name << ")" << std::endl;
+    } else if (auto literal_node = dynamic_cast<StructLiteralNode*>(node.get())) {
+        std::cout << indent << "StructLiteral(" << type_name(literal_node->type) << ")" << std::endl;
+        for (const auto& element : literal_node->elements) {
+            print_ast(element, indent + "  ");
+        }
+    } else if (auto array_node = dynamic_cast<ArrayLiteralNode*>(node.get())) {
+        std::cout << indent << "ArrayLiteral" << std::endl;
+        for (const auto& element : array_node->elements) {
+            print_ast(element, indent + "  ");
+        }
+    } else if (auto member_node = dynamic_cast<MemberNode*>(node.get())) {
+        std::cout << indent << "Member(." << member_node->field << ")" << std::endl;
+        print_ast(member_node->object, indent + "  ");
+    } else if (auto assign_node = dynamic_cast<AssignNode*>(node.get())) {
+        std::cout << indent << "Assign(" << operator_text(assign_node->op) << ")" << std::endl;
+        print_ast(assign_node->target, indent + "  ");
+        print_ast(assign_node->value, indent + "  ");
+    } else if (auto incdec_node = dynamic_cast<IncDecNode*>(node.get())) {
+        std::string op = operator_text(incdec_node->op);
+        std::cout << indent << "IncDec(" << (incdec_node->prefix ? op + "x" : "x" + op) << ")" << std::endl;
+        print_ast(incdec_node->target, indent + "  ");
     } else {
         std::cout << indent << "Unknown ExprNode" << std::endl;
     }
@@ -58,31 +146,243 @@ void print_ast(const std::unique_ptr<StmtNode>& node, std::string indent) {
     }
     
     if (auto func_node = dynamic_cast<FunctionDefNode*>(node.get())) {
-        std::cout << indent << "FunctionDef(" << func_node->return_type << " " << func_node->name << ")" << std::endl;
+        std::cout << indent << "FunctionDef(" << (func_node->is_cold ? "@cold " : "") << (func_node->is_exported ? "export " : "")
+                  << (func_node->is_comptime ? "comptime " : "") << (func_node->is_generator ? "generator " : "")
+                  << type_name(func_node->return_type) << " " << func_node->name << "(";
+        for (size_t i = 0; i < func_node->parameters.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << type_name(func_node->parameters[i].type) << " " << func_node->parameters[i].name;
+        }
+        std::cout << "))" << std::endl;
         print_ast(func_node->body.get(), indent + "  ");
     } 
+    else if (auto generic_node = dynamic_cast<GenericFunctionNode*>(node.get())) {
+        std::cout << indent << "GenericFunctionDef(" << (generic_node->is_cold ? "@cold " : "")
+                  << (generic_node->is_comptime ? "comptime " : "") << generic_node->name << "<";
+        for (size_t i = 0; i < generic_node->type_parameters.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << generic_node->type_parameters[i];
+        }
+        std::cout << ">, " << generic_node->tokens.size() - 1 << " tokens)" << std::endl;
+    }
+    else if (auto extern_node = dynamic_cast<ExternDeclNode*>(node.get())) {
+        std::cout << indent << "ExternDecl(" << type_name(extern_node->return_type) << " " << extern_node->name << "(";
+        for (size_t i = 0; i < extern_node->parameters.size(); i++) {
+            std::cout << (i == 0 ? "" : ", ") << type_name(extern_node->parameters[i]);
+        }
+        std::cout << "))" << std::endl;
+    }
+    else if (auto struct_node = dynamic_cast<StructDefNode*>(node.get())) {
+        const TypeInfo& info = type_info(struct_node->type);
+        std::cout << indent << "StructDef(" << (info.is_soa ? "@soa " : "") << (info.is_ordered ? "@ordered " : "")
+                  << info.name << ", " << info.size << " bytes)" << std::endl;
+        for (const StructField& field : info.fields) {
+            std::cout << indent << "  Field(" << type_name(field.type) << " " << field.name << " @" << field.offset << ")" << std::endl;
+        }
+    }
     else if (auto return_node = dynamic_cast<ReturnStmtNode*>(node.get())) {
         std::cout << indent << "ReturnStmt:" << std::endl;
-        print_ast(return_node->expression, indent + "  ");
+        if (return_node->expression) {
+            print_ast(return_node->expression, indent + "  ");
+        }
+    }
+    else if (auto expr_node = dynamic_cast<ExprStmtNode*>(node.get())) {
+        std::cout << indent << "ExprStmt:" << std::endl;
+        print_ast(expr_node->expression, indent + "  ");
+    }
+    else if (auto if_node = dynamic_cast<IfStmtNode*>(node.get())) {
+        std::cout << indent << "IfStmt:" << std::endl;
+        print_ast(if_node->condition, indent + "  ");
+        print_ast(if_node->then_branch, indent + "  ");
+        if (if_node->else_branch) {
+            print_ast(if_node->else_branch, indent + "  ");
+        }
     }
     else if (auto block_node = dynamic_cast<BlockStmtNode*>(node.get())) {
         print_ast(block_node, indent);
     }
+    else if (auto decl_node = dynamic_cast<VarDeclNode*>(node.get())) {
+        std::cout << indent << "VarDecl(" << (decl_node->is_const ? "const " : "") << type_name(decl_node->type) << " "
+                  << decl_node->name << ")" << std::endl;
+        if (decl_node->initializer) {
+            print_ast(decl_node->initializer, indent + "  ");
+        }
+    }
+    else if (auto for_node = dynamic_cast<ForStmtNode*>(node.get())) {
+        std::cout << indent << "ForStmt:" << std::endl;
+        if (for_node->init) {
+            print_ast(for_node->init, indent + "  ");
+        }
+        if (for_node->condition) {
+            print_ast(for_node->condition, indent + "  ");
+        }
+        if (for_node->step) {
+            print_ast(for_node->step, indent + "  ");
+        }
+        print_ast(for_node->body, indent + "  ");
+    }
+    else if (auto for_in_node = dynamic_cast<ForInStmtNode*>(node.get())) {
+        std::cout << indent << "ForIn(" << type_name(for_in_node->type) << " " << for_in_node->name << " in "
+                  << for_in_node->generator->callee << ")" << std::endl;
+        for (const auto& argument : for_in_node->generator->arguments) {
+            print_ast(argument, indent + "  ");
+        }
+        print_ast(for_in_node->body, indent + "  ");
+    }
+    else if (auto yield_node = dynamic_cast<YieldStmtNode*>(node.get())) {
+        std::cout << indent << "YieldStmt:" << std::endl;
+        print_ast(yield_node->expression, indent + "  ");
+    }
+    else if (auto parallel_node = dynamic_cast<ParallelForStmtNode*>(node.get())) {
+        std::cout << indent << "ParallelFor(" << type_name(parallel_node->type) << " " << parallel_node->name << ")"
+                  << std::endl;
+        print_ast(parallel_node->begin, indent + "  ");
+        print_ast(parallel_node->end, indent + "  ");
+        print_ast(parallel_node->body, indent + "  ");
+    }
+    else if (auto switch_node = dynamic_cast<SwitchStmtNode*>(node.get())) {
+        std::cout << indent << "SwitchStmt:" << std::endl;
+        print_ast(switch_node->value, indent + "  ");
+        for (const auto& entry : switch_node->cases) {
+            std::cout << indent << "  " << (entry.values.empty() ? "Default:" : "Case:") << std::endl;
+            for (const auto& value : entry.values) {
+                print_ast(value, indent + "    ");
+            }
+            print_ast(entry.body.get(), indent + "    ");
+        }
+    }
     else {
         std::cout << indent << "Unknown StmtNode" << std::endl;
     }
 }
 
+// --- Command-Line Parsing ---
+
+void print_usage() {
+    std::cerr << "Usage: bolt-compiler [options] <source-file>" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -o <file>                 Write the assembly to <file> (default: output.asm)" << std::endl;
+    std::cerr << "  -O0, -O1                  Disable/enable the IR optimizations (default: -O1)" << std::endl;
+    std::cerr << "  -mavx2                    Use AVX2 instructions (4-lane vector loops)" << std::endl;
+    std::cerr << "  -mpopcnt, -mlzcnt, -mbmi, -mbmi2  Use these bit manipulation instructions" << std::endl;
+    std::cerr << "  -march=<cpu>              Use everything <cpu> has: x86-64, x86-64-v2, x86-64-v3," << std::endl;
+    std::cerr << "                            haswell or native (this machine)" << std::endl;
+    std::cerr << "  -Rpass=vectorize          Report which loops were vectorized, and why not" << std::endl;
+    std::cerr << "  -Rpass=bounds-check       Report how many array bounds checks are left" << std::endl;
+    std::cerr << "  -fno-bounds-check         Don't check array indices" << std::endl;
+    std::cerr << "  -stats                    Report what the optimizations did" << std::endl;
+    std::cerr << "  -emit-ir                  Print the IR of every function" << std::endl;
+    std::cerr << "  -ffreestanding            Don't use the C library: bring our own _start, link with 'ld -static'" << std::endl;
+    std::cerr << "  -fprofile-generate[=<file>] Instrument the program to write a profile on exit" << std::endl;
+    std::cerr << "  -fprofile-use=<file>      Optimize using a profile from an instrumented run" << std::endl;
+    std::cerr << "  -finstance-cache=<dir>    Reuse the generics' instances compiled by earlier runs" << std::endl;
+}
+
+// The features of the CPU named by -march. Returns false for a name we
+// don't know.
+bool features_for_cpu(const std::string& cpu, TargetFeatures& features) {
+    if (cpu == "native") {
+        __builtin_cpu_init();
+        features.avx2 = __builtin_cpu_supports("avx2");
+        features.popcnt = __builtin_cpu_supports("popcnt");
+        features.lzcnt = __builtin_cpu_supports("abm"); // ABM is the LZCNT bit
+        features.bmi = __builtin_cpu_supports("bmi");
+        features.bmi2 = __builtin_cpu_supports("bmi2");
+        return true;
+    }
+    // The x86-64 "microarchitecture levels"
+    if (cpu == "x86-64") {
+        features = TargetFeatures{};
+        return true;
+    }
+    if (cpu == "x86-64-v2") {
+        features = TargetFeatures{};
+        features.popcnt = true;
+        return true;
+    }
+    if (cpu == "x86-64-v3" || cpu == "haswell") {
+        features.avx2 = features.popcnt = features.lzcnt = features.bmi = features.bmi2 = true;
+        return true;
+    }
+    return false;
+}
+
+// Fills in 'options' from argv. Returns false if the arguments are invalid.
+bool parse_arguments(int argc, char* argv[], CompilerOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-o") {
+            if (i + 1 >= argc) {
+                std::cerr << "❌ Error: '-o' needs a file name" << std::endl;
+                return false;
+            }
+            options.output_file = argv[++i];
+        } else if (arg == "-O0" || arg == "-O1") {
+            options.opt_level = arg[2] - '0';
+        } else if (arg == "-mavx2") {
+            options.target.avx2 = true;
+        } else if (arg == "-mpopcnt") {
+            options.target.popcnt = true;
+        } else if (arg == "-mlzcnt") {
+            options.target.lzcnt = true;
+        } else if (arg == "-mbmi") {
+            options.target.bmi = true;
+        } else if (arg == "-mbmi2") {
+            options.target.bmi2 = true;
+        } else if (arg.rfind("-march=", 0) == 0) {
+            if (!features_for_cpu(arg.substr(7), options.target)) {
+                std::cerr << "❌ Error: Unknown CPU: " << arg.substr(7) << std::endl;
+                return false;
+            }
+        } else if (arg == "-Rpass=vectorize") {
+            options.report_vectorize = true;
+        } else if (arg == "-Rpass=bounds-check") {
+            options.report_bounds_checks = true;
+        } else if (arg == "-fno-bounds-check") {
+            options.bounds_checks = false;
+        } else if (arg == "-stats") {
+            options.print_stats = true;
+        } else if (arg == "-emit-ir") {
+            options.emit_ir = true;
+        } else if (arg == "-ffreestanding") {
+            options.freestanding = true;
+        } else if (arg == "-fprofile-generate") {
+            options.profile_generate = true;
+        } else if (arg.rfind("-fprofile-generate=", 0) == 0) {
+            options.profile_generate = true;
+            options.profile_generate_path = arg.substr(std::string("-fprofile-generate=").length());
+        } else if (arg.rfind("-finstance-cache=", 0) == 0) {
+            options.instance_cache = arg.substr(std::string("-finstance-cache=").length());
+        } else if (arg.rfind("-fprofile-use=", 0) == 0) {
+            options.profile_use_path = arg.substr(std::string("-fprofile-use=").length());
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "❌ Error: Unknown option: " << arg << std::endl;
+            return false;
+        } else {
+            options.input_file = arg;
+        }
+    }
+
+    if (options.input_file.empty()) {
+        return false;
+    }
+    if (options.profile_generate && !options.profile_use_path.empty()) {
+        std::cerr << "❌ Error: -fprofile-generate and -fprofile-use can't be used together" << std::endl;
+        return false;
+    }
+    return true;
+}
+
 // --- Main Compiler Driver ---
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: bolt-compiler <source-file>" << std::endl;
+    CompilerOptions options;
+    if (!parse_arguments(argc, argv, options)) {
+        print_usage();
         return 1;
     }
 
-    std::string source_file = argv[1];
-    std::string output_file = "output.asm";
+    std::string source_file = options.input_file;
+    std::string output_file = options.output_file;
     std::cout << "Compiling " << source_file << "..." << std::endl;
 
     std::string source_code = read_file(source_file);
@@ -103,6 +403,9 @@ int main(int argc, char* argv[]) {
     std::cout << "--- [Parser] ---" << std::endl;
     Parser parser(tokens);
     ProgramNode ast = parser.parse();
+    if (parser.had_error()) {
+        return 1;
+    }
     
     // (We'll hide the verbose output for now)
     // std::cout << "\n--- [Abstract Syntax Tree] ---" << std::endl;
@@ -110,10 +413,25 @@ int main(int argc, char* argv[]) {
     //     print_ast(stmt, "");
     // }
 
+    // --- Load the profile (-fprofile-use) ---
+    ProfileData profile;
+    if (!options.profile_use_path.empty()) {
+        if (!profile.load(options.profile_use_path)) {
+            return 1;
+        }
+        std::cout << "Using profile " << options.profile_use_path << std::endl;
+    }
+
     // --- 3. CODEGEN STAGE ---
     std::cout << "\n--- [CodeGenerator] ---" << std::endl;
-    CodeGenerator generator(std::move(ast)); // <-- CHANGED: Pass 'ast' by move
-    std::string asm_code = generator.generate();
+    CodeGenerator generator(std::move(ast), options, std::move(profile));
+    std::string asm_code;
+    try {
+        asm_code = generator.generate();
+    } catch (const std::exception& e) {
+        std::cerr << "CodeGen Error: " << e.what() << std::endl;
+        return 1;
+    }
     
     std::cout << "Generated " << asm_code.length() << " bytes of assembly." << std::endl;
 
@@ -127,6 +445,10 @@ int main(int argc, char* argv[]) {
     out.close();
 
     std::cout << "\n✅ Build finished. Assembly written to " << output_file << std::endl;
-    std::cout << "   Run 'nasm -f elf64 " << output_file << "' to assemble." << std::endl;
+    std::cout << "   Run 'nasm -f elf64 " << output_file << "' to assemble";
+    if (options.freestanding) {
+        std::cout << ", and 'ld -static' to link (no C library needed)";
+    }
+    std::cout << "." << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "mir.hpp"
+#include <sstream>
+
+// --- Calling Conventions ---
+
+const std::vector<int>& argument_registers(CallingConvention convention) {
+    static const std::vector<int> sysv = {RDI, RSI, RDX, RCX, R8, R9};
+    static const std::vector<int> internal = {RDI, RSI, RDX, RCX, R8, R9, R10, R11};
+    return convention == CallingConvention::SysV ? sysv : internal;
+}
+
+const std::vector<int>& caller_saved_registers(CallingConvention convention) {
+    // No vector register survives a call
+    static const std::vector<int> sysv = {
+        RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11,
+        XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+        XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+    };
+    static const std::vector<int> internal = {
+        RAX, RCX, RDX, RSI, RDI, R8, R9, R10, R11, R14, R15,
+        XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+        XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+    };
+    return convention == CallingConvention::SysV ? sysv : internal;
+}
+
+const std::vector<int>& callee_saved_registers(CallingConvention convention) {
+    static const std::vector<int> sysv = {RBX, R12, R13, R14, R15};
+    static const std::vector<int> internal = {RBX, R12, R13};
+    return convention == CallingConvention::SysV ? sysv : internal;
+}
+
+// --- MOperand ---
+
+MOperand MOperand::make_reg(int reg, int size) {
+    MOperand op;
+    op.kind = Kind::Reg;
+    op.reg = reg;
+    op.size = size;
+    return op;
+}
+
+MOperand MOperand::make_imm(int64_t value) {
+    MOperand op;
+    op.kind = Kind::Imm;
+    op.imm = value;
+    return op;
+}
+
+MOperand MOperand::make_mem(const MemRef& mem, int size) {
+    MOperand op;
+    op.kind = Kind::Mem;
+    op.mem = mem;
+    op.size = size;
+    return op;
+}
+
+MOperand MOperand::make_label(const std::string& label) {
+    MOperand op;
+    op.kind = Kind::Label;
+    op.label = label;
+    return op;
+}
+
+int MFunction::new_vreg(RegClass cls) {
+    vreg_classes.push_back(cls);
+    if (cls == RegClass::VEC256) uses_ymm = true;
+    return next_vreg++;
+}
+
+RegClass MFunction::reg_class(int reg) const {
+    if (is_vreg(reg)) return vreg_classes[reg - FIRST_VREG];
+    return reg < NUM_GPRS ? RegClass::GPR : RegClass::VEC128;
+}
+
+int MFunction::new_slot(int size, int align) {
+    slots.push_back({size, 0, align ? align : size});
+    return static_cast<int>(slots.size()) - 1;
+}
+
+// --- Uses and Defs ---
+
+// What an instruction does with its first operand. Every other explicit
+// operand is only read, except the second one of 'xadd'.
+enum class FirstOperand { Use, Def, UseDef };
+
+static FirstOperand first_operand_role(const MInstr& instr) {
+    const std::string& op = instr.opcode;
+
+    // Write-only: the old value doesn't matter
+    if (op == "mov" || op == "movzx" || op == "movsx" || op == "movsxd" || op == "lea" || op == "pop") {
+        return FirstOperand::Def;
+    }
+    // Bit counts and rorx. (bsr/bsf leave it alone for 0, but we always
+    // overwrite it with a cmovz then.)
+    if (op == "popcnt" || op == "lzcnt" || op == "tzcnt" || op == "bsr" || op == "bsf" || op == "rorx") {
+        return FirstOperand::Def;
+    }
+    // Vector moves and shuffles, and every AVX instruction we use (their
+    // destination is a separate operand)
+    if (op == "movq" || op == "movd" || op == "movdqa" || op == "movdqu" || op == "pshufd" || op[0] == 'v') {
+        return FirstOperand::Def;
+    }
+    // 'imul dst, src, imm' doesn't read dst
+    if (op == "imul" && instr.ops.size() == 3) {
+        return FirstOperand::Def;
+    }
+    // Read-only. One-operand 'imul'/'mul' multiply rax by it into rdx:rax.
+    if (op == "cmp" || op == "test" || op == "bt" || op == "push" || op == "idiv" || op == "div" || op == "call" ||
+        op == "ret" || op[0] == 'j' || ((op == "imul" || op == "mul") && instr.ops.size() == 1)) {
+        return FirstOperand::Use;
+    }
+    // Everything else reads and writes it: add, sub, imul, neg, setcc
+    // (which only writes the low byte), ...
+    return FirstOperand::UseDef;
+}
+
+void get_uses_defs(const MInstr& instr, std::vector<int>& uses, std::vector<int>& defs) {
+    uses.clear();
+    defs.clear();
+
+    // 'xor r, r' is the usual way to zero a register: it doesn't read 'r'.
+    // Same for 'pxor x, x' and 'vpxor x, x, x'.
+    bool zero_idiom = (instr.opcode == "xor" || instr.opcode == "pxor" || instr.opcode == "vpxor") &&
+                      instr.ops.size() >= 2;
+    for (const MOperand& op : instr.ops) {
+        zero_idiom = zero_idiom && op.is_reg() && op.reg == instr.ops[0].reg;
+    }
+
+    for (size_t i = 0; i < instr.ops.size(); i++) {
+        const MOperand& op = instr.ops[i];
+        if (op.is_mem()) {
+            // Registers inside an address are always read
+            if (op.mem.base >= 0) uses.push_back(op.mem.base);
+            if (op.mem.index >= 0) uses.push_back(op.mem.index);
+        } else if (op.is_reg()) {
+            FirstOperand role = i == 0 ? first_operand_role(instr) : FirstOperand::Use;
+            if (i == 1 && instr.opcode == "lock xadd") role = FirstOperand::UseDef;
+            if (zero_idiom) role = FirstOperand::Def;
+            if (i >= 1 && zero_idiom) continue;
+
+            if (role != FirstOperand::Def) uses.push_back(op.reg);
+            if (role != FirstOperand::Use) defs.push_back(op.reg);
+        }
+    }
+
+    uses.insert(uses.end(), instr.implicit_uses.begin(), instr.implicit_uses.end());
+    defs.insert(defs.end(), instr.implicit_defs.begin(), instr.implicit_defs.end());
+}
+
+std::vector<int> clobbered_registers(const MFunction& function) {
+    std::set<int> clobbered = {RAX};
+    for (int r = XMM0; r < NUM_PHYS_REGS; r++) clobbered.insert(r);
+
+    std::vector<int> uses, defs;
+    for (const MBlock& block : function.blocks) {
+        for (const MInstr& instr : block.instrs) {
+            get_uses_defs(instr, uses, defs);
+            for (int r : defs) {
+                if (r == RSP || r == RBP || function.used_callee_saved.count(r)) continue;
+                clobbered.insert(r);
+            }
+        }
+    }
+    return std::vector<int>(clobbered.begin(), clobbered.end());
+}
+
+// --- Copies ---
+
+bool is_register_copy(const MInstr& instr) {
+    if (instr.ops.size() != 2 || !instr.ops[0].is_reg() || !instr.ops[1].is_reg()) return false;
+    if (instr.opcode == "mov") return instr.ops[0].size == 8 && instr.ops[1].size == 8;
+    return instr.opcode == "movdqa" || instr.opcode == "vmovdqa";
+}
+
+MInstr make_copy(RegClass cls, int dst, int src, bool vex) {
+    MInstr copy;
+    if (cls == RegClass::GPR) {
+        copy.opcode = "mov";
+        copy.ops = {MOperand::make_reg(dst), MOperand::make_reg(src)};
+    } else {
+        int size = cls == RegClass::VEC256 ? 32 : 16;
+        copy.opcode = vex ? "vmovdqa" : "movdqa";
+        copy.ops = {MOperand::make_reg(dst, size), MOperand::make_reg(src, size)};
+    }
+    return copy;
+}
+
+// --- Printing ---
+
+std::string reg_name(int reg, int size) {
+    if (is_vreg(reg)) {
+        return "v" + std::to_string(reg);
+    }
+    if (reg >= XMM0) {
+        return (size == 32 ? "ymm" : "xmm") + std::to_string(reg - XMM0);
+    }
+
+    static const char* names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+    static const char* names32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+    static const char* names16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+    static const char* names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                   "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+    switch (size) {
+        case 1:  return names8[reg];
+        case 2:  return names16[reg];
+        case 4:  return names32[reg];
+        default: return names64[reg];
+    }
+}
+
+static std::string format_mem(const MOperand& op, const MFunction& function) {
+    std::stringstream out;
+    switch (op.size) {
+        case 1: out << "byte "; break;
+        case 2: out << "word "; break;
+        case 4: out << "dword "; break;
+        case 8: out << "qword "; break;
+        default: break; // size 0: no size keyword (e.g. for 'lea')
+    }
+
+    const MemRef& mem = op.mem;
+    if (!mem.symbol.empty()) {
+        out << "[rel " << mem.symbol;
+        if (mem.disp != 0) out << (mem.disp < 0 ? " - " : " + ") << (mem.disp < 0 ? -mem.disp : mem.disp);
+        out << "]";
+        return out.str();
+    }
+    // A stack slot is at rbp - offset; an array in one may have an index too
+    int base = mem.frame_slot >= 0 ? RBP : mem.base;
+    int64_t disp = mem.frame_slot >= 0 ? mem.disp - function.slots[mem.frame_slot].offset : mem.disp;
+
+    out << "[";
+    bool first = true;
+    if (base >= 0) {
+        out << reg_name(base);
+        first = false;
+    }
+    if (mem.index >= 0) {
+        out << (first ? "" : " + ") << reg_name(mem.index);
+        if (mem.scale != 1) out << "*" << mem.scale;
+        first = false;
+    }
+    if (disp != 0 || first) {
+        if (first) {
+            out << disp;
+        } else {
+            out << (disp < 0 ? " - " : " + ") << (disp < 0 ? -disp : disp);
+        }
+    }
+    out << "]";
+    return out.str();
+}
+
+std::string format_instr(const MInstr& instr, const MFunction& function) {
+    std::stringstream out;
+    out << instr.opcode;
+    for (size_t i = 0; i < instr.ops.size(); i++) {
+        const MOperand& op = instr.ops[i];
+        out << (i == 0 ? " " : ", ");
+        switch (op.kind) {
+            case MOperand::Kind::Reg:   out << reg_name(op.reg, op.size); break;
+            case MOperand::Kind::Imm:   out << op.imm; break;
+            case MOperand::Kind::Mem:   out << format_mem(op, function); break;
+            case MOperand::Kind::Label: out << op.label; break;
+        }
+    }
+    return out.str();
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+// --- Machine IR (MIR) ---
+// After instruction selection a function is a list of real x86-64
+// instructions, but their register operands may still be *virtual*
+// registers. The register allocator replaces those with physical ones,
+// and then each instruction prints as one line of NASM assembly.
+
+// Physical registers, numbered like the x86-64 encoding numbers them.
+// The vector registers come after the general-purpose ones: XMM0 is 16.
+enum PhysReg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    NUM_GPRS,
+    XMM0 = NUM_GPRS, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+    XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+    NUM_PHYS_REGS
+};
+
+// Which registers a virtual register can live in. Both vector classes use
+// XMM0-15; a VEC256 value fills the whole YMM register.
+enum class RegClass { GPR, VEC128, VEC256 };
+
+// Register numbers from here on are virtual registers
+const int FIRST_VREG = 64;
+
+inline bool is_vreg(int reg) { return reg >= FIRST_VREG; }
+
+// --- Calling Conventions ---
+// Functions other object files can see ('main', 'export' functions) and
+// calls to functions defined elsewhere follow the System V x86-64 ABI:
+// six argument registers, rbx and r12-r15 preserved.
+//
+// Calls inside the program use an internal convention instead, with two
+// more argument registers (r10, r11) and only rbx, r12 and r13 preserved:
+// leaf functions get more scratch registers without saving anything.
+// On top of that, a function compiled before its callers tells them
+// which registers it really overwrites (see CalleeInfo in isel.hpp).
+//
+// Both return in rax, pass extra arguments on the stack (the first one
+// lowest, at [rsp] when the call happens), and preserve no vector
+// registers.
+enum class CallingConvention { SysV, Internal };
+
+const std::vector<int>& argument_registers(CallingConvention convention);
+// The registers a call may overwrite, and the ones it must preserve
+const std::vector<int>& caller_saved_registers(CallingConvention convention);
+const std::vector<int>& callee_saved_registers(CallingConvention convention);
+
+// A memory operand: [base + index*scale + disp], or one in a stack slot
+// ([rbp - offset + index*scale + disp], resolved once the frame is laid out)
+struct MemRef {
+    int base = -1;
+    int index = -1;
+    int scale = 1;
+    int64_t disp = 0;
+    int frame_slot = -1;
+    std::string symbol; // If set: [rel symbol + disp], RIP-relative
+};
+
+struct MOperand {
+    enum class Kind { Reg, Imm, Mem, Label };
+
+    Kind kind = Kind::Imm;
+    int reg = -1;
+    int64_t imm = 0;
+    MemRef mem;
+    std::string label;
+    int size = 8; // Width in bytes: picks 'rax'/'eax'/'al' or qword/dword/byte,
+                  // and 'xmm0' (16) or 'ymm0' (32) for vector registers
+
+    static MOperand make_reg(int reg, int size = 8);
+    static MOperand make_imm(int64_t value);
+    static MOperand make_mem(const MemRef& mem, int size = 8);
+    static MOperand make_label(const std::string& label);
+
+    bool is_reg() const { return kind == Kind::Reg; }
+    bool is_mem() const { return kind == Kind::Mem; }
+};
+
+struct MInstr {
+    std::string opcode; // "mov", "add", "jl", ...
+    std::vector<MOperand> ops;
+
+    // Registers the instruction reads/writes without naming them,
+    // e.g. 'idiv' uses rax:rdx and a call clobbers every caller-saved register
+    std::vector<int> implicit_uses;
+    std::vector<int> implicit_defs;
+};
+
+struct MBlock {
+    std::string label;
+    std::vector<MInstr> instrs;
+    std::vector<int> succs;  // Indices into MFunction::blocks
+    double frequency = 1.0;  // How often we expect this block to run
+    int profile_edge = -1;   // The edge counter to bump on entry, if any
+};
+
+// Read-only data a function refers to (vector constants), emitted to .rodata
+struct MConstant {
+    std::string label;
+    std::vector<int64_t> qwords;
+    std::vector<std::string> jump_targets = {}; // A jump table: 32-bit offsets of these block labels from its start
+};
+
+struct StackSlot {
+    int size = 8;
+    int offset = 0; // Distance below rbp, set by the frame layout
+    int align = 8;
+};
+
+struct MFunction {
+    std::string name;
+    CallingConvention convention = CallingConvention::SysV;
+    std::vector<MBlock> blocks; // blocks[0] is the entry block
+    std::vector<StackSlot> slots;
+    std::vector<MConstant> constants;
+    int next_vreg = FIRST_VREG;
+    std::vector<RegClass> vreg_classes; // Indexed by vreg - FIRST_VREG
+
+    // Vector code uses the AVX (VEX) encodings. If any YMM register is used,
+    // 'vzeroupper' goes before calls and returns.
+    bool vex = false;
+    bool uses_ymm = false;
+
+    // Callee-saved registers the allocator handed out; the prologue saves them
+    std::set<int> used_callee_saved;
+
+    int new_vreg(RegClass cls = RegClass::GPR);
+    RegClass reg_class(int reg) const;
+    // 'align' 0 means aligned to its size
+    int new_slot(int size = 8, int align = 0);
+};
+
+// Fills in the registers 'instr' reads (uses) and writes (defs),
+// including registers used inside memory operands.
+void get_uses_defs(const MInstr& instr, std::vector<int>& uses, std::vector<int>& defs);
+
+// The registers a call to an allocated function may overwrite: whatever it
+// writes (its calls included) and doesn't restore, rax, and every vector
+// register ('vzeroupper' alone touches all of them)
+std::vector<int> clobbered_registers(const MFunction& function);
+
+// True for a plain register-to-register copy of a whole value
+// ('mov rax, rcx', 'movdqa xmm0, xmm1'): the allocator tries to give both
+// sides the same register and then drops it
+bool is_register_copy(const MInstr& instr);
+
+// The instruction that copies a whole register of class 'cls'
+MInstr make_copy(RegClass cls, int dst, int src, bool vex);
+
+// "rax", "eax", "ax", "al" ... for physical registers; "v65" for virtual ones
+std::string reg_name(int reg, int size = 8);
+
+// One line of NASM assembly (without indentation or newline).
+// Stack slots print as [rbp - offset].
+std::string format_instr(const MInstr& instr, const MFunction& function);
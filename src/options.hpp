@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+
+// Instruction set extensions the generated code may use, on top of the
+// x86-64 baseline (which includes SSE2). Set one by one with -m<feature>,
+// or all at once with -march=<cpu>.
+struct TargetFeatures {
+    bool avx2 = false;   // -mavx2
+    bool popcnt = false; // -mpopcnt: popcount() in one instruction
+    bool lzcnt = false;  // -mlzcnt: clz() in one instruction
+    bool bmi = false;    // -mbmi: tzcnt, for ctz()
+    bool bmi2 = false;   // -mbmi2: rorx, a rotate that doesn't overwrite its input
+};
+
+// Everything the user can configure from the command line.
+// main.cpp fills this in and hands it to the later compiler stages.
+struct CompilerOptions {
+    std::string input_file;
+    std::string output_file = "output.asm";
+
+    // -O0 / -O1: whether to run the IR optimizations (loopopt.hpp)
+    int opt_level = 1;
+
+    TargetFeatures target;
+
+    // -Rpass=vectorize: say which loops were vectorized, and why the
+    // others weren't
+    bool report_vectorize = false;
+
+    // Check every array index against the array's length, and trap
+    // (ud2) if it's out of bounds. -fno-bounds-check turns it off.
+    bool bounds_checks = true;
+
+    // -Rpass=bounds-check: say how many bounds checks each function has,
+    // and how many the optimizer removed or moved out of loops
+    bool report_bounds_checks = false;
+
+    // -stats: say how much the optimizations did, per function
+    bool print_stats = false;
+
+    // -emit-ir: print every function's IR while compiling (for debugging)
+    bool emit_ir = false;
+
+    // -ffreestanding: don't need the C library. The program starts at the
+    // runtime's own _start (runtime.hpp) and can be linked with
+    // 'ld -static', for the fastest possible startup.
+    bool freestanding = false;
+
+    // -fprofile-generate[=<file>]
+    // Insert counters into the generated code. The instrumented program
+    // writes them to 'profile_generate_path' when it exits.
+    bool profile_generate = false;
+    std::string profile_generate_path = "bolt.profdata";
+
+    // -finstance-cache=<dir>: keep the compiled instances of generic
+    // functions in <dir>, for the next compile that needs them (see
+    // instcache.hpp)
+    std::string instance_cache;
+
+    // -fprofile-use=<file>
+    // Read counts from an earlier instrumented run and use them to
+    // drive code layout.
+    std::string profile_use_path;
+};
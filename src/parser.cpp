@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include <algorithm>
 #include <iostream>
 
 Parser::Parser(std::vector<Token> tokens) : m_tokens(std::move(tokens)) {}
@@ -9,8 +10,9 @@ ProgramNode Parser::parse() {
         try {
             program.statements.push_back(parse_declaration());
         } catch (const std::exception& e) {
-            std::cerr << "Parse Error: " << e.what() << std::endl;
+            std::cerr << "Parse Error (line " << peek().line << "): " << e.what() << std::endl;
             // For now, we'll stop at the first error.
+            m_had_error = true;
             break;
         }
     }
@@ -44,41 +46,308 @@ Token Parser::expect(TokenType type, const std::string& error_message) {
     throw std::runtime_error(error_message);
 }
 
+bool Parser::check_type_name() {
+    static const TokenType type_keywords[] = {
+        TokenType::INT, TokenType::CHAR,
+        TokenType::I8, TokenType::I16, TokenType::I32, TokenType::I64,
+        TokenType::U8, TokenType::U16, TokenType::U32, TokenType::U64,
+        TokenType::INT32X4, TokenType::INT32X8, TokenType::FLOAT32X8,
+    };
+    for (TokenType keyword : type_keywords) {
+        if (check(keyword)) return true;
+    }
+    // Struct names are identifiers, known once their definition is parsed
+    if (check(TokenType::IDENTIFIER) && m_type_arguments.count(peek().value)) return true;
+    return check(TokenType::IDENTIFIER) && find_type(peek().value) != INVALID_TYPE;
+}
+
+TypeId Parser::parse_type() {
+    // The keywords are exactly the built-in names in the type table
+    Token name = advance();
+    auto argument = m_type_arguments.find(name.value);
+    TypeId type = argument != m_type_arguments.end() ? argument->second : find_type(name.value);
+    while (check(TokenType::STAR)) {
+        advance();
+        type = pointer_type(type);
+    }
+    return type;
+}
+
+// Something that can be assigned to: a variable, or a field or lane of
+// one, or something in memory. Whether a[i] is a vector's lane or an
+// element in memory, only the IR generator knows.
+static bool is_assignable(ExprNode* node) {
+    if (dynamic_cast<VariableNode*>(node) || dynamic_cast<IndexNode*>(node) || dynamic_cast<DerefNode*>(node)) {
+        return true;
+    }
+    if (auto member = dynamic_cast<MemberNode*>(node)) return is_assignable(member->object.get());
+    return false;
+}
+
 // --- Grammar Parsing Functions ---
 
 std::unique_ptr<StmtNode> Parser::parse_declaration() {
-    // A C-like program is a list of declarations.
-    // For now, we only know one kind: function definitions.
-    
-    // Look for: int main ...
-    if (check(TokenType::INT) && m_tokens[m_current_pos + 1].type == TokenType::IDENTIFIER) {
-        return parse_function_definition();
+    // A C-like program is a list of declarations: functions, structs and
+    // global variables.
+
+    // Look for: struct Point { ... }, @soa struct Particle { ... }
+    size_t after_attributes = m_current_pos;
+    while (after_attributes + 2 < m_tokens.size() && m_tokens[after_attributes].type == TokenType::AT) {
+        after_attributes += 2;
     }
-    
-    // We'll skip over other things for now
-    std::cerr << "Parser Warning: Skipping unknown top-level token: " << advance().to_string() << std::endl;
-    return nullptr;
+    if (m_tokens[after_attributes].type == TokenType::STRUCT) {
+        return parse_struct_definition();
+    }
+
+    // Look for: T max<T>(..., before the type could be taken for a global's
+    if (check_generic_definition()) {
+        return parse_generic_definition();
+    }
+
+    // Look for: int main(..., u8* find(..., or a global: int count = 0;
+    if (check_type_name()) {
+        size_t next = m_current_pos + 1;
+        while (m_tokens[next].type == TokenType::STAR) next++;
+        if (m_tokens[next].type == TokenType::IDENTIFIER) {
+            if (m_tokens[next + 1].type == TokenType::OPEN_PAREN) return parse_function_definition();
+            return parse_var_declaration();
+        }
+    }
+
+    // A function from elsewhere: extern int puts(u8* s);
+    if (check(TokenType::EXTERN)) {
+        return parse_extern_declaration();
+    }
+
+    // A read-only global: const i32 primes[4] = {2, 3, 5, 7};
+    if (check(TokenType::CONST)) {
+        advance();
+        if (!check_type_name()) throw std::runtime_error("Expected a type after 'const'.");
+        std::unique_ptr<StmtNode> declaration = parse_var_declaration();
+        static_cast<VarDeclNode*>(declaration.get())->is_const = true;
+        return declaration;
+    }
+
+    // ... or with qualifiers: comptime int table_size ..., export int hash ...,
+    // @cold int report_error ...
+    if (check(TokenType::COMPTIME) || check(TokenType::EXPORT) || check(TokenType::AT)) {
+        bool is_comptime = false;
+        bool is_exported = false;
+        bool is_cold = false;
+        while (check(TokenType::COMPTIME) || check(TokenType::EXPORT) || check(TokenType::AT)) {
+            Token qualifier = advance();
+            if (qualifier.type != TokenType::AT) {
+                (qualifier.type == TokenType::COMPTIME ? is_comptime : is_exported) = true;
+                continue;
+            }
+            Token attribute = expect(TokenType::IDENTIFIER, "Expected an attribute name after '@'.");
+            if (attribute.value != "cold") {
+                throw std::runtime_error("Unknown function attribute '@" + attribute.value + "'.");
+            }
+            is_cold = true;
+        }
+        if (check_generic_definition()) {
+            std::unique_ptr<GenericFunctionNode> generic = parse_generic_definition();
+            if (is_exported) {
+                // There's no one function to export
+                throw std::runtime_error("Generic function '" + generic->name + "' can't be export.");
+            }
+            generic->is_comptime = is_comptime;
+            generic->is_cold = is_cold;
+            return generic;
+        }
+        if (!check_type_name()) {
+            throw std::runtime_error("Expected a function definition after 'comptime'/'export'/'@cold'.");
+        }
+        std::unique_ptr<StmtNode> function = parse_function_definition();
+        auto definition = static_cast<FunctionDefNode*>(function.get());
+        definition->is_comptime = is_comptime;
+        definition->is_exported = is_exported;
+        definition->is_cold = is_cold;
+        return function;
+    }
+
+    throw std::runtime_error("Expected a function, struct or global variable, not '" + peek().value + "'.");
+}
+
+std::unique_ptr<StmtNode> Parser::parse_extern_declaration() {
+    // extern int puts(u8* s); (the parameter names are optional)
+    advance();
+    auto declaration = std::make_unique<ExternDeclNode>();
+    if (!check_type_name()) throw std::runtime_error("Expected a return type after 'extern'.");
+    declaration->return_type = parse_type();
+    declaration->name = expect(TokenType::IDENTIFIER, "Expected function name.").value;
+    expect(TokenType::OPEN_PAREN, "Expected '(' after function name.");
+    while (!check(TokenType::CLOSE_PAREN)) {
+        if (!declaration->parameters.empty()) expect(TokenType::COMMA, "Expected ',' between parameters.");
+        if (!check_type_name()) throw std::runtime_error("Expected a parameter type.");
+        declaration->parameters.push_back(parse_type());
+        if (check(TokenType::IDENTIFIER)) advance();
+    }
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after parameters.");
+    expect(TokenType::SEMICOLON, "Expected ';' after an extern declaration.");
+    return declaration;
 }
 
 std::unique_ptr<StmtNode> Parser::parse_function_definition() {
     // 1. Consume the return type (e.g., "int")
-    Token type = advance();
+    TypeId return_type = parse_type();
     
-    // 2. Consume the name (e.g., "main")
+    // 2. Consume the name (e.g., "main"), and in an instance, the type
+    //    parameters after it (they're in m_type_arguments already)
     Token name = expect(TokenType::IDENTIFIER, "Expected function name.");
+    if (!m_type_arguments.empty()) parse_type_parameters();
 
     // 3. Consume the open parenthesis
     expect(TokenType::OPEN_PAREN, "Expected '(' after function name.");
     
-    // TODO: Parse parameters here
-    
-    // 4. Consume the close parenthesis
+    // 4. The parameters: int a, int b
+    std::vector<ParameterNode> parameters;
+    while (!check(TokenType::CLOSE_PAREN)) {
+        if (!parameters.empty()) expect(TokenType::COMMA, "Expected ',' between parameters.");
+        if (!check_type_name()) throw std::runtime_error("Expected a parameter type.");
+        ParameterNode parameter;
+        parameter.type = parse_type();
+        parameter.name = expect(TokenType::IDENTIFIER, "Expected a parameter name.").value;
+        parameters.push_back(parameter);
+    }
+
+    // 5. Consume the close parenthesis
     expect(TokenType::CLOSE_PAREN, "Expected ')' after parameters.");
     
-    // 5. Parse the function body (a block statement)
+    // 6. Parse the function body (a block statement)
+    m_saw_yield = false;
     std::unique_ptr<BlockStmtNode> body = parse_block_statement();
     
-    return std::make_unique<FunctionDefNode>(type.value, name.value, std::move(body));
+    auto function = std::make_unique<FunctionDefNode>(return_type, name.value, std::move(parameters), std::move(body));
+    function->is_generator = m_saw_yield;
+    return function;
+}
+
+bool Parser::check_generic_definition() {
+    if (!check_type_name() && !check(TokenType::IDENTIFIER)) return false;
+    size_t next = m_current_pos + 1;
+    while (m_tokens[next].type == TokenType::STAR) next++;
+    return m_tokens[next].type == TokenType::IDENTIFIER && m_tokens[next + 1].type == TokenType::OPEN_ANGLE;
+}
+
+std::unique_ptr<GenericFunctionNode> Parser::parse_generic_definition() {
+    auto generic = std::make_unique<GenericFunctionNode>();
+    size_t start = m_current_pos;
+
+    // 1. The return type (checked in each instance), the name and <T, U>
+    advance();
+    while (check(TokenType::STAR)) advance();
+    generic->name = expect(TokenType::IDENTIFIER, "Expected function name.").value;
+    generic->type_parameters = parse_type_parameters();
+
+    // 2. The parameters, for now only for what they say about the type
+    //    parameters
+    expect(TokenType::OPEN_PAREN, "Expected '(' after the type parameters.");
+    while (!check(TokenType::CLOSE_PAREN)) {
+        if (!generic->parameters.empty()) expect(TokenType::COMMA, "Expected ',' between parameters.");
+        if (!check_type_name() && !check(TokenType::IDENTIFIER)) throw std::runtime_error("Expected a parameter type.");
+        Token type = advance();
+        GenericFunctionNode::Pattern pattern;
+        const auto& names = generic->type_parameters;
+        auto found = std::find(names.begin(), names.end(), type.value);
+        if (type.type == TokenType::IDENTIFIER && found != names.end()) {
+            pattern.type_parameter = static_cast<int>(found - names.begin());
+        }
+        while (check(TokenType::STAR)) {
+            advance();
+            pattern.pointer_depth++;
+        }
+        expect(TokenType::IDENTIFIER, "Expected a parameter name.");
+        generic->parameters.push_back(pattern);
+    }
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after parameters.");
+
+    // 3. The body, up to its '}': parsed in each instance
+    if (!check(TokenType::OPEN_BRACE)) throw std::runtime_error("Expected '{' to begin a block.");
+    int depth = 0;
+    do {
+        if (is_at_end()) throw std::runtime_error("Expected '}' at the end of '" + generic->name + "'.");
+        TokenType type = advance().type;
+        if (type == TokenType::OPEN_BRACE) depth++;
+        if (type == TokenType::CLOSE_BRACE) depth--;
+    } while (depth > 0);
+    generic->tokens.assign(m_tokens.begin() + start, m_tokens.begin() + m_current_pos);
+    generic->tokens.push_back({TokenType::END_OF_FILE, "", m_tokens[m_current_pos - 1].line});
+
+    m_generics.insert(generic->name);
+    generic->generics = m_generics;
+    return generic;
+}
+
+std::vector<std::string> Parser::parse_type_parameters() {
+    expect(TokenType::OPEN_ANGLE, "Expected '<' after the generic's name.");
+    std::vector<std::string> names;
+    while (true) {
+        Token name = expect(TokenType::IDENTIFIER, "Expected a type parameter name.");
+        if (find_type(name.value) != INVALID_TYPE) {
+            throw std::runtime_error("Type parameter '" + name.value + "' has the name of a type.");
+        }
+        if (std::find(names.begin(), names.end(), name.value) != names.end()) {
+            throw std::runtime_error("Type parameter '" + name.value + "' is there twice.");
+        }
+        names.push_back(name.value);
+        if (!check(TokenType::COMMA)) break;
+        advance();
+    }
+    expect(TokenType::CLOSE_ANGLE, "Expected '>' after the type parameters.");
+    return names;
+}
+
+std::unique_ptr<FunctionDefNode> Parser::instantiate(const GenericFunctionNode& generic,
+                                                     const std::vector<TypeId>& type_arguments) {
+    Parser parser(generic.tokens);
+    parser.m_generics = generic.generics;
+    for (size_t i = 0; i < generic.type_parameters.size(); i++) {
+        parser.m_type_arguments[generic.type_parameters[i]] = type_arguments[i];
+    }
+    std::unique_ptr<StmtNode> function = parser.parse_function_definition();
+    auto instance = std::unique_ptr<FunctionDefNode>(static_cast<FunctionDefNode*>(function.release()));
+    instance->is_comptime = generic.is_comptime;
+    instance->is_cold = generic.is_cold;
+    return instance;
+}
+
+std::unique_ptr<StmtNode> Parser::parse_struct_definition() {
+    // 1. The attributes: @soa, @ordered
+    bool is_ordered = false;
+    bool is_soa = false;
+    while (check(TokenType::AT)) {
+        advance();
+        Token attribute = expect(TokenType::IDENTIFIER, "Expected an attribute name after '@'.");
+        if (attribute.value == "ordered") {
+            is_ordered = true;
+        } else if (attribute.value == "soa") {
+            is_soa = true;
+        } else {
+            throw std::runtime_error("Unknown attribute '@" + attribute.value + "'.");
+        }
+    }
+    expect(TokenType::STRUCT, "Expected 'struct' after attributes.");
+    Token name = expect(TokenType::IDENTIFIER, "Expected struct name.");
+
+    // 2. The fields: { i64 x; u8 alive; }
+    expect(TokenType::OPEN_BRACE, "Expected '{' after struct name.");
+    std::vector<StructField> fields;
+    while (!check(TokenType::CLOSE_BRACE)) {
+        if (!check_type_name()) throw std::runtime_error("Expected a field type.");
+        StructField field;
+        field.type = parse_type();
+        field.name = expect(TokenType::IDENTIFIER, "Expected a field name.").value;
+        expect(TokenType::SEMICOLON, "Expected ';' after field.");
+        fields.push_back(field);
+    }
+    expect(TokenType::CLOSE_BRACE, "Expected '}' after fields.");
+    // C's ';' after the '}' is allowed, but not needed
+    if (check(TokenType::SEMICOLON)) advance();
+
+    // Declared right away, so the rest of the program can use the name
+    return std::make_unique<StructDefNode>(declare_struct(name.value, std::move(fields), is_ordered, is_soa));
 }
 
 std::unique_ptr<BlockStmtNode> Parser::parse_block_statement() {
@@ -100,29 +369,74 @@ std::unique_ptr<BlockStmtNode> Parser::parse_block_statement() {
     
     return block;
 }
-/*
-stdSuch as:
-* **Variable Declarations:** `int x = 10;`
-* **Return Statements:** `return 0;`
-*/
+// One statement inside a block:
+//   int x = 10;           a local variable, scoped to the enclosing block
+//   x = 5;  x++;  f();    an expression
+//   return x;
+//   if (...) ... else ...
+//   for (...; ...; ...) ...
+//   for (int x in g(...)) ...   over what generator g yields
+//   parallel for (int i = a; i < b; i++) ...
+//   yield x;              in a generator
+//   switch (...) { case 1: ... default: ... }
+//   { ... }               a nested block, which opens a new scope
 std::unique_ptr<StmtNode> Parser::parse_statement() {
     // This is where we decide what *kind* of statement we're looking at.
+    if (check(TokenType::SEMICOLON)) {
+        advance(); // An empty statement
+        return nullptr;
+    }
+
     if (check(TokenType::RETURN)) {
         return parse_return_statement();
     }
+
+    if (check(TokenType::IF)) {
+        return parse_if_statement();
+    }
+
+    if (check(TokenType::FOR)) {
+        return parse_for_statement();
+    }
+
+    if (check(TokenType::PARALLEL)) {
+        return parse_parallel_for_statement();
+    }
+
+    if (check(TokenType::YIELD)) {
+        return parse_yield_statement();
+    }
+
+    if (check(TokenType::SWITCH)) {
+        return parse_switch_statement();
+    }
+
+    // A local variable: int x = 10;
+    if (check_type_name()) {
+        return parse_var_declaration();
+    }
+
+    // A nested block: { ... }
+    if (check(TokenType::OPEN_BRACE)) {
+        return parse_block_statement();
+    }
+
+    // An expression on its own, e.g., helper(); x = 5; i++; *p = 1; spawn f();
+    if (check(TokenType::IDENTIFIER) || check(TokenType::PLUS_PLUS) || check(TokenType::MINUS_MINUS) ||
+        check(TokenType::STAR) || check(TokenType::SPAWN)) {
+        return parse_expression_statement();
+    }
     
-    // If it's not a known statement, we'll just advance and ignore it for now.
-    // This is a very simple (and bad) error recovery.
-    std::cerr << "Parser Warning: Skipping unknown token in block: " << advance().to_string() << std::endl;
-    return nullptr; // Skipped token
+    throw std::runtime_error("Expected a statement, not '" + peek().value + "'.");
 }
 
 std::unique_ptr<StmtNode> Parser::parse_return_statement() {
     // Consume the 'return' token
     advance(); 
 
-    // Parse the expression that follows
-    std::unique_ptr<ExprNode> expr = parse_expression();
+    // Parse the expression that follows, if any (generators have none)
+    std::unique_ptr<ExprNode> expr;
+    if (!check(TokenType::SEMICOLON)) expr = parse_expression();
 
     // Consume the semicolon
     expect(TokenType::SEMICOLON, "Expected ';' after return value.");
@@ -130,14 +444,415 @@ std::unique_ptr<StmtNode> Parser::parse_return_statement() {
     return std::make_unique<ReturnStmtNode>(std::move(expr));
 }
 
+std::unique_ptr<StmtNode> Parser::parse_yield_statement() {
+    // Consume the 'yield' token
+    advance();
+    m_saw_yield = true;
+    std::unique_ptr<ExprNode> expr = parse_expression();
+    expect(TokenType::SEMICOLON, "Expected ';' after yield value.");
+    return std::make_unique<YieldStmtNode>(std::move(expr));
+}
+
+std::unique_ptr<StmtNode> Parser::parse_expression_statement() {
+    std::unique_ptr<ExprNode> expr = parse_expression();
+    expect(TokenType::SEMICOLON, "Expected ';' after expression.");
+    return std::make_unique<ExprStmtNode>(std::move(expr));
+}
+
+std::unique_ptr<StmtNode> Parser::parse_if_statement() {
+    // Consume the 'if' token
+    advance();
+
+    expect(TokenType::OPEN_PAREN, "Expected '(' after 'if'.");
+    std::unique_ptr<ExprNode> condition = parse_expression();
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after if condition.");
+
+    std::unique_ptr<StmtNode> then_branch = parse_statement();
+    std::unique_ptr<StmtNode> else_branch;
+    if (check(TokenType::ELSE)) {
+        advance();
+        else_branch = parse_statement();
+    }
+
+    return std::make_unique<IfStmtNode>(std::move(condition), std::move(then_branch), std::move(else_branch));
+}
+
+std::unique_ptr<StmtNode> Parser::parse_for_statement() {
+    // Consume the 'for' token
+    advance();
+    expect(TokenType::OPEN_PAREN, "Expected '(' after 'for'.");
+
+    // for (T x in g(...))
+    if (check_type_name()) {
+        int start = m_current_pos;
+        TypeId type = parse_type();
+        if (check(TokenType::IDENTIFIER) && m_tokens[m_current_pos + 1].type == TokenType::IN) {
+            std::string name = advance().value;
+            advance();
+            std::unique_ptr<ExprNode> expr = parse_expression();
+            if (!dynamic_cast<CallExprNode*>(expr.get())) {
+                throw std::runtime_error("Expected a call to a generator after 'in'.");
+            }
+            std::unique_ptr<CallExprNode> generator(static_cast<CallExprNode*>(expr.release()));
+            expect(TokenType::CLOSE_PAREN, "Expected ')' after the generator.");
+            std::unique_ptr<StmtNode> body = parse_statement();
+            return std::make_unique<ForInStmtNode>(type, name, std::move(generator), std::move(body));
+        }
+        m_current_pos = start;
+    }
+
+    // Each of the three parts can be left out: for (;;)
+    std::unique_ptr<StmtNode> init;
+    if (check_type_name()) {
+        init = parse_var_declaration();
+    } else if (!check(TokenType::SEMICOLON)) {
+        init = parse_expression_statement();
+    } else {
+        advance();
+    }
+
+    std::unique_ptr<ExprNode> condition;
+    if (!check(TokenType::SEMICOLON)) {
+        condition = parse_expression();
+    }
+    expect(TokenType::SEMICOLON, "Expected ';' after for condition.");
+
+    std::unique_ptr<ExprNode> step;
+    if (!check(TokenType::CLOSE_PAREN)) {
+        step = parse_expression();
+    }
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after for clauses.");
+
+    std::unique_ptr<StmtNode> body = parse_statement();
+    return std::make_unique<ForStmtNode>(std::move(init), std::move(condition), std::move(step), std::move(body));
+}
+
+std::unique_ptr<StmtNode> Parser::parse_parallel_for_statement() {
+    // Consume 'parallel for'
+    advance();
+    expect(TokenType::FOR, "Expected 'for' after 'parallel'.");
+    expect(TokenType::OPEN_PAREN, "Expected '(' after 'for'.");
+
+    // The loop has to count up by one, so the iterations can be split up
+    // before any of them runs: T i = begin; i < end; i++
+    const std::string form = "A parallel for must look like 'parallel for (int i = begin; i < end; i++)'.";
+    if (!check_type_name()) throw std::runtime_error(form);
+    TypeId type = parse_type();
+    std::string name = expect(TokenType::IDENTIFIER, form).value;
+    expect(TokenType::EQUALS, form);
+    std::unique_ptr<ExprNode> begin = parse_expression();
+    expect(TokenType::SEMICOLON, form);
+
+    if (!check(TokenType::IDENTIFIER) || peek().value != name) throw std::runtime_error(form);
+    advance();
+    expect(TokenType::OPEN_ANGLE, form);
+    std::unique_ptr<ExprNode> end = parse_expression();
+    expect(TokenType::SEMICOLON, form);
+
+    bool prefix = check(TokenType::PLUS_PLUS);
+    if (prefix) advance();
+    if (!check(TokenType::IDENTIFIER) || peek().value != name) throw std::runtime_error(form);
+    advance();
+    if (!prefix) expect(TokenType::PLUS_PLUS, form);
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after for clauses.");
+
+    std::unique_ptr<StmtNode> body = parse_statement();
+    return std::make_unique<ParallelForStmtNode>(type, name, std::move(begin), std::move(end), std::move(body));
+}
+
+std::unique_ptr<StmtNode> Parser::parse_switch_statement() {
+    // Consume the 'switch' token
+    advance();
+    expect(TokenType::OPEN_PAREN, "Expected '(' after 'switch'.");
+    auto node = std::make_unique<SwitchStmtNode>(parse_expression());
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after switch value.");
+    expect(TokenType::OPEN_BRACE, "Expected '{' to begin the switch cases.");
+
+    bool has_default = false;
+    while (!check(TokenType::CLOSE_BRACE) && !is_at_end()) {
+        SwitchStmtNode::Case entry;
+        if (check(TokenType::DEFAULT)) {
+            if (has_default) throw std::runtime_error("A switch can only have one 'default'");
+            has_default = true;
+            advance();
+        } else {
+            // case 1, 2, 3:
+            expect(TokenType::CASE, "Expected 'case' or 'default' in switch.");
+            entry.values.push_back(parse_expression());
+            while (check(TokenType::COMMA)) {
+                advance();
+                entry.values.push_back(parse_expression());
+            }
+        }
+        expect(TokenType::COLON, "Expected ':' after case label.");
+
+        // Everything up to the next label
+        entry.body = std::make_unique<BlockStmtNode>();
+        while (!check(TokenType::CASE) && !check(TokenType::DEFAULT) && !check(TokenType::CLOSE_BRACE) &&
+               !is_at_end()) {
+            auto stmt = parse_statement();
+            if (stmt) entry.body->statements.push_back(std::move(stmt));
+        }
+        // Cases don't fall through, so 'case 14: case 21: ...' would
+        // quietly do nothing for 14
+        if (entry.body->statements.empty() && (check(TokenType::CASE) || check(TokenType::DEFAULT))) {
+            throw std::runtime_error("An empty case can't be followed by another label: cases don't fall through. "
+                                     "Give them one label ('case 14, 21:'), or an empty body ('{}').");
+        }
+        node->cases.push_back(std::move(entry));
+    }
+    expect(TokenType::CLOSE_BRACE, "Expected '}' after the switch cases.");
+    return node;
+}
+
+std::unique_ptr<StmtNode> Parser::parse_var_declaration() {
+    TypeId type = parse_type();
+    Token name = expect(TokenType::IDENTIFIER, "Expected variable name.");
+
+    // An array: i32 a[4][8] is 4 arrays of 8 i32s. The lengths are
+    // constants (a number, or sizeof).
+    std::vector<int64_t> lengths;
+    while (check(TokenType::OPEN_BRACKET)) {
+        advance();
+        std::unique_ptr<ExprNode> length = parse_expression();
+        auto number = dynamic_cast<NumberLiteralNode*>(length.get());
+        if (!number) throw std::runtime_error("The length of array '" + name.value + "' must be a number.");
+        lengths.push_back(static_cast<int64_t>(std::stoull(number->value)));
+        expect(TokenType::CLOSE_BRACKET, "Expected ']' after array length.");
+    }
+    for (size_t i = lengths.size(); i-- > 0;) {
+        type = array_type(type, lengths[i]);
+    }
+
+    std::unique_ptr<ExprNode> initializer;
+    if (check(TokenType::EQUALS)) {
+        advance();
+        initializer = check(TokenType::OPEN_BRACE) ? parse_array_literal() : parse_expression();
+    }
+    expect(TokenType::SEMICOLON, "Expected ';' after variable declaration.");
+
+    return std::make_unique<VarDeclNode>(type, name.value, std::move(initializer));
+}
+
+std::unique_ptr<ExprNode> Parser::parse_array_literal() {
+    expect(TokenType::OPEN_BRACE, "Expected '{'.");
+    std::vector<std::unique_ptr<ExprNode>> elements;
+    while (!check(TokenType::CLOSE_BRACE)) {
+        elements.push_back(check(TokenType::OPEN_BRACE) ? parse_array_literal() : parse_expression());
+        if (!check(TokenType::COMMA)) break;
+        advance(); // A trailing comma is fine
+    }
+    expect(TokenType::CLOSE_BRACE, "Expected '}' after the array's elements.");
+    return std::make_unique<ArrayLiteralNode>(std::move(elements));
+}
+
 std::unique_ptr<ExprNode> Parser::parse_expression() {
-    // This is a *very* simple expression parser.
-    // It only handles number literals for now.
+    return parse_assignment();
+}
+
+std::unique_ptr<ExprNode> Parser::parse_assignment() {
+    // x = value, x += value, x -= value (right associative: a = b = 1).
+    // The target may also be v[i], p.x or *p: we only know it's not a
+    // read of one once we see the '=', so back up if there isn't one.
+    auto is_assignment = [](TokenType type) {
+        return type == TokenType::EQUALS || type == TokenType::PLUS_EQUAL || type == TokenType::MINUS_EQUAL;
+    };
+    if ((check(TokenType::IDENTIFIER) && !check_type_name()) || check(TokenType::STAR)) {
+        int start = m_current_pos;
+        std::unique_ptr<ExprNode> target = check(TokenType::STAR) ? parse_unary() : parse_postfix();
+        if (is_assignment(peek().type)) {
+            if (!is_assignable(target.get())) throw std::runtime_error("Can't assign to this expression.");
+            TokenType op = advance().type;
+            return std::make_unique<AssignNode>(std::move(target), op, parse_assignment());
+        }
+        m_current_pos = start;
+    }
+    return parse_equality();
+}
+
+std::unique_ptr<ExprNode> Parser::parse_equality() {
+    std::unique_ptr<ExprNode> expr = parse_comparison();
+    while (check(TokenType::EQUAL_EQUAL) || check(TokenType::BANG_EQUAL)) {
+        TokenType op = advance().type;
+        expr = std::make_unique<BinaryOpNode>(op, std::move(expr), parse_comparison());
+    }
+    return expr;
+}
+
+std::unique_ptr<ExprNode> Parser::parse_comparison() {
+    std::unique_ptr<ExprNode> expr = parse_term();
+    while (check(TokenType::OPEN_ANGLE) || check(TokenType::CLOSE_ANGLE) ||
+           check(TokenType::LESS_EQUAL) || check(TokenType::GREATER_EQUAL)) {
+        TokenType op = advance().type;
+        expr = std::make_unique<BinaryOpNode>(op, std::move(expr), parse_term());
+    }
+    return expr;
+}
+
+std::unique_ptr<ExprNode> Parser::parse_term() {
+    std::unique_ptr<ExprNode> expr = parse_factor();
+    while (check(TokenType::PLUS) || check(TokenType::MINUS)) {
+        TokenType op = advance().type;
+        expr = std::make_unique<BinaryOpNode>(op, std::move(expr), parse_factor());
+    }
+    return expr;
+}
+
+std::unique_ptr<ExprNode> Parser::parse_factor() {
+    std::unique_ptr<ExprNode> expr = parse_unary();
+    while (check(TokenType::STAR) || check(TokenType::SLASH) || check(TokenType::PERCENT)) {
+        TokenType op = advance().type;
+        expr = std::make_unique<BinaryOpNode>(op, std::move(expr), parse_unary());
+    }
+    return expr;
+}
+
+std::unique_ptr<ExprNode> Parser::parse_unary() {
+    if (check(TokenType::MINUS)) {
+        TokenType op = advance().type;
+        return std::make_unique<UnaryOpNode>(op, parse_unary());
+    }
+    if (check(TokenType::PLUS_PLUS) || check(TokenType::MINUS_MINUS)) {
+        TokenType op = advance().type;
+        std::unique_ptr<ExprNode> target = parse_postfix();
+        if (!is_assignable(target.get())) throw std::runtime_error("Expected a variable after '++'/'--'.");
+        return std::make_unique<IncDecNode>(std::move(target), op, true);
+    }
+    if (check(TokenType::STAR)) {
+        advance();
+        return std::make_unique<DerefNode>(parse_unary());
+    }
+    if (check(TokenType::AMPERSAND)) {
+        advance();
+        return std::make_unique<AddressOfNode>(parse_unary());
+    }
+    if (check(TokenType::SPAWN)) {
+        advance();
+        std::unique_ptr<ExprNode> call = parse_postfix();
+        if (!dynamic_cast<CallExprNode*>(call.get())) throw std::runtime_error("Expected a call after 'spawn'.");
+        return std::make_unique<SpawnNode>(std::unique_ptr<CallExprNode>(static_cast<CallExprNode*>(call.release())));
+    }
+    return parse_postfix();
+}
+
+std::unique_ptr<ExprNode> Parser::parse_postfix() {
+    std::unique_ptr<ExprNode> expr = parse_primary();
+    while (true) {
+        if (check(TokenType::OPEN_BRACKET)) {
+            advance();
+            std::unique_ptr<ExprNode> index = parse_expression();
+            expect(TokenType::CLOSE_BRACKET, "Expected ']' after index.");
+            expr = std::make_unique<IndexNode>(std::move(expr), std::move(index));
+        } else if (check(TokenType::DOT)) {
+            advance();
+            Token field = expect(TokenType::IDENTIFIER, "Expected a field name after '.'.");
+            expr = std::make_unique<MemberNode>(std::move(expr), field.value);
+        } else if (check(TokenType::ARROW)) {
+            advance();
+            Token field = expect(TokenType::IDENTIFIER, "Expected a field name after '->'.");
+            expr = std::make_unique<MemberNode>(std::make_unique<DerefNode>(std::move(expr)), field.value);
+        } else if (check(TokenType::PLUS_PLUS) || check(TokenType::MINUS_MINUS)) {
+            if (!is_assignable(expr.get())) throw std::runtime_error("Expected a variable before '++'/'--'.");
+            // x++ isn't a variable any more, so nothing can follow it
+            return std::make_unique<IncDecNode>(std::move(expr), advance().type, false);
+        } else {
+            return expr;
+        }
+    }
+}
+
+std::vector<std::unique_ptr<ExprNode>> Parser::parse_arguments() {
+    expect(TokenType::OPEN_PAREN, "Expected '('.");
+    std::vector<std::unique_ptr<ExprNode>> arguments;
+    if (!check(TokenType::CLOSE_PAREN)) {
+        arguments.push_back(parse_expression());
+        while (check(TokenType::COMMA)) {
+            advance();
+            arguments.push_back(parse_expression());
+        }
+    }
+    expect(TokenType::CLOSE_PAREN, "Expected ')' after arguments.");
+    return arguments;
+}
+
+std::unique_ptr<ExprNode> Parser::parse_primary() {
     if (check(TokenType::NUMBER_LITERAL)) {
         Token num = advance();
         return std::make_unique<NumberLiteralNode>(num.value);
     }
 
+    if (check(TokenType::STRING_LITERAL)) {
+        std::string value = advance().value;
+        while (check(TokenType::STRING_LITERAL)) value += advance().value;
+        return std::make_unique<StringLiteralNode>(std::move(value));
+    }
+
+    // sizeof(Point): a constant, since every type's layout is known by now
+    if (check(TokenType::SIZEOF)) {
+        advance();
+        expect(TokenType::OPEN_PAREN, "Expected '(' after 'sizeof'.");
+        if (!check_type_name()) throw std::runtime_error("Expected a type in 'sizeof'.");
+        TypeId type = parse_type();
+        expect(TokenType::CLOSE_PAREN, "Expected ')' after type.");
+        return std::make_unique<NumberLiteralNode>(std::to_string(type_info(type).size));
+    }
+
+    // A vector: int32x4(1, 2, 3, 4), a struct: Point(1, 2), or a
+    // conversion: u8(x), u8*(address). Before calls, since a struct's
+    // name is an identifier too.
+    if (check_type_name()) {
+        TypeId type = parse_type();
+        std::vector<std::unique_ptr<ExprNode>> arguments = parse_arguments();
+        if (is_struct_type(type)) {
+            return std::make_unique<StructLiteralNode>(type, std::move(arguments));
+        }
+        if (!is_integer_type(type) && !is_pointer_type(type)) {
+            return std::make_unique<VectorLiteralNode>(type, std::move(arguments));
+        }
+        if (arguments.size() != 1) {
+            throw std::runtime_error("Converting to " + type_name(type) + " takes one value.");
+        }
+        return std::make_unique<ConversionNode>(type, std::move(arguments[0]));
+    }
+
+    // A call to a generic, with its type arguments: max<u8>(a, b)
+    if (check(TokenType::IDENTIFIER) && m_generics.count(peek().value) &&
+        m_tokens[m_current_pos + 1].type == TokenType::OPEN_ANGLE) {
+        Token name = advance();
+        advance();
+        std::vector<TypeId> type_arguments;
+        while (true) {
+            if (!check_type_name()) throw std::runtime_error("Expected a type argument for '" + name.value + "'.");
+            type_arguments.push_back(parse_type());
+            if (!check(TokenType::COMMA)) break;
+            advance();
+        }
+        expect(TokenType::CLOSE_ANGLE, "Expected '>' after the type arguments.");
+        auto call = std::make_unique<CallExprNode>(name.value, parse_arguments());
+        call->type_arguments = std::move(type_arguments);
+        return call;
+    }
+
+    // A call: name(), name(a, b)
+    if (check(TokenType::IDENTIFIER) && m_tokens[m_current_pos + 1].type == TokenType::OPEN_PAREN) {
+        Token name = advance();
+        return std::make_unique<CallExprNode>(name.value, parse_arguments());
+    }
+
+    // A variable: x
+    if (check(TokenType::IDENTIFIER)) {
+        Token name = advance();
+        return std::make_unique<VariableNode>(name.value);
+    }
+
+    // A parenthesized expression: (a + b)
+    if (check(TokenType::OPEN_PAREN)) {
+        advance();
+        std::unique_ptr<ExprNode> expr = parse_expression();
+        expect(TokenType::CLOSE_PAREN, "Expected ')' after expression.");
+        return expr;
+    }
+
     // Default case
     throw std::runtime_error("Expected an expression (e.g., a number).");
 }
\ No newline at end of file
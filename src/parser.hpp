@@ -1,6 +1,9 @@
 #pragma once
 
 #include "lexer.hpp"
+#include "types.hpp"
+#include <set>
+#include <unordered_map>
 #include <vector>
 #include <memory> // For std::unique_ptr
 
@@ -30,6 +33,135 @@ struct NumberLiteralNode : public ExprNode {
     NumberLiteralNode(std::string val) : value(std::move(val)) {}
 };
 
+// Represents a string literal, e.g., "hi\n": a u8* to its bytes in
+// .rodata, followed by a 0. 'value' has the escapes already decoded;
+// adjacent literals ("a" "b") are one.
+struct StringLiteralNode : public ExprNode {
+    std::string value;
+    StringLiteralNode(std::string val) : value(std::move(val)) {}
+};
+
+// Represents a binary operation, e.g., a + b, a < b
+struct BinaryOpNode : public ExprNode {
+    TokenType op; // PLUS, MINUS, STAR, SLASH, PERCENT, OPEN_ANGLE (<), EQUAL_EQUAL, ...
+    std::unique_ptr<ExprNode> left;
+    std::unique_ptr<ExprNode> right;
+    BinaryOpNode(TokenType o, std::unique_ptr<ExprNode> l, std::unique_ptr<ExprNode> r)
+        : op(o), left(std::move(l)), right(std::move(r)) {}
+};
+
+// Represents a unary operation, e.g., -a
+struct UnaryOpNode : public ExprNode {
+    TokenType op; // MINUS
+    std::unique_ptr<ExprNode> operand;
+    UnaryOpNode(TokenType o, std::unique_ptr<ExprNode> e) : op(o), operand(std::move(e)) {}
+};
+
+// Represents a function call, e.g., helper(), or a builtin like shuffle(v, 1, 0, 3, 2)
+struct CallExprNode : public ExprNode {
+    std::string callee;
+    std::vector<std::unique_ptr<ExprNode>> arguments;
+    // A generic's, given: max<u8>(a, b). Empty if they're to be worked
+    // out from the arguments.
+    std::vector<TypeId> type_arguments;
+    CallExprNode(std::string name, std::vector<std::unique_ptr<ExprNode>> args = {})
+        : callee(std::move(name)), arguments(std::move(args)) {}
+};
+
+// Represents a vector built from its lanes, e.g., int32x4(1, 2, 3, 4),
+// or from one value for every lane, e.g., int32x4(0)
+struct VectorLiteralNode : public ExprNode {
+    TypeId type; // TYPE_INT32X4, TYPE_INT32X8 or TYPE_FLOAT32X8
+    std::vector<std::unique_ptr<ExprNode>> elements;
+    VectorLiteralNode(TypeId t, std::vector<std::unique_ptr<ExprNode>> e)
+        : type(t), elements(std::move(e)) {}
+};
+
+// Represents an array's initial elements, e.g., {1, 2, 3}. Only allowed
+// as the initializer of an array; the elements it leaves out are 0.
+struct ArrayLiteralNode : public ExprNode {
+    std::vector<std::unique_ptr<ExprNode>> elements; // Nested arrays are ArrayLiteralNodes too
+    ArrayLiteralNode(std::vector<std::unique_ptr<ExprNode>> e) : elements(std::move(e)) {}
+};
+
+// Represents converting a value to an integer type, e.g., u8(x). Like a
+// C cast, it keeps the low bits. A pointer type converts to and from
+// integers, e.g., u8*(address).
+struct ConversionNode : public ExprNode {
+    TypeId type;
+    std::unique_ptr<ExprNode> value;
+    ConversionNode(TypeId t, std::unique_ptr<ExprNode> v) : type(t), value(std::move(v)) {}
+};
+
+// Represents one lane of a vector, e.g., v[2], or one element of an
+// array or of what a pointer points to, e.g., a[i], p[i]
+struct IndexNode : public ExprNode {
+    std::unique_ptr<ExprNode> base;
+    std::unique_ptr<ExprNode> index;
+    IndexNode(std::unique_ptr<ExprNode> b, std::unique_ptr<ExprNode> i) : base(std::move(b)), index(std::move(i)) {}
+};
+
+// Represents what a pointer points to, e.g., *p (p->x is (*p).x)
+struct DerefNode : public ExprNode {
+    std::unique_ptr<ExprNode> pointer;
+    DerefNode(std::unique_ptr<ExprNode> p) : pointer(std::move(p)) {}
+};
+
+// Represents the address of something in memory, e.g., &a[3], &p->x, or
+// of a local, which is then kept in memory, e.g., &x, &point.y
+struct AddressOfNode : public ExprNode {
+    std::unique_ptr<ExprNode> target;
+    AddressOfNode(std::unique_ptr<ExprNode> t) : target(std::move(t)) {}
+};
+
+// Represents 'spawn f(a, b)': the call runs in a thread of its own. Its
+// value is the thread, for join().
+struct SpawnNode : public ExprNode {
+    std::unique_ptr<CallExprNode> call;
+    SpawnNode(std::unique_ptr<CallExprNode> c) : call(std::move(c)) {}
+};
+
+// Represents reading a variable, e.g., x
+struct VariableNode : public ExprNode {
+    std::string name;
+    VariableNode(std::string n) : name(std::move(n)) {}
+};
+
+// Represents building a struct from its fields, in declaration order,
+// e.g., Point(1, 2). Point() is all zeros.
+struct StructLiteralNode : public ExprNode {
+    TypeId type;
+    std::vector<std::unique_ptr<ExprNode>> elements;
+    StructLiteralNode(TypeId t, std::vector<std::unique_ptr<ExprNode>> e)
+        : type(t), elements(std::move(e)) {}
+};
+
+// Represents reading a field of a struct, e.g., p.x
+struct MemberNode : public ExprNode {
+    std::unique_ptr<ExprNode> object;
+    std::string field;
+    MemberNode(std::unique_ptr<ExprNode> o, std::string f) : object(std::move(o)), field(std::move(f)) {}
+};
+
+// Represents an assignment, e.g., x = 5, x += 2, v[1] = 7, p.x = 3,
+// a[i] = 1, *p = 2. The target is a variable, or a field or lane of one,
+// or something in memory. Its value is the new value of the target.
+struct AssignNode : public ExprNode {
+    std::unique_ptr<ExprNode> target; // VariableNode, MemberNode, IndexNode or DerefNode
+    TokenType op; // EQUALS, PLUS_EQUAL, MINUS_EQUAL
+    std::unique_ptr<ExprNode> value;
+    AssignNode(std::unique_ptr<ExprNode> t, TokenType o, std::unique_ptr<ExprNode> v)
+        : target(std::move(t)), op(o), value(std::move(v)) {}
+};
+
+// Represents ++x, x++, --x or x-- (or ++p.count, ...)
+struct IncDecNode : public ExprNode {
+    std::unique_ptr<ExprNode> target; // As for AssignNode
+    TokenType op; // PLUS_PLUS, MINUS_MINUS
+    bool prefix;  // ++x gives the new value, x++ the old one
+    IncDecNode(std::unique_ptr<ExprNode> t, TokenType o, bool pre) : target(std::move(t)), op(o), prefix(pre) {}
+};
+
 // --- Statement Nodes ---
 
 // Represents a block of statements: { ... }
@@ -38,20 +170,165 @@ struct BlockStmtNode : public StmtNode {
 };
 
 // Represents a 'return' statement, e.g., return 0;
+// A generator's is just 'return;': it has nothing more to yield.
 struct ReturnStmtNode : public StmtNode {
-    std::unique_ptr<ExprNode> expression;
+    std::unique_ptr<ExprNode> expression; // nullptr for 'return;'
     ReturnStmtNode(std::unique_ptr<ExprNode> expr) : expression(std::move(expr)) {}
 };
 
+// Represents an expression used as a statement, e.g., helper();
+struct ExprStmtNode : public StmtNode {
+    std::unique_ptr<ExprNode> expression;
+    ExprStmtNode(std::unique_ptr<ExprNode> expr) : expression(std::move(expr)) {}
+};
+
+// Represents a variable declaration, e.g., int x = 10; or i32 a[4][8];
+// At the top level, it declares a global variable.
+struct VarDeclNode : public StmtNode {
+    TypeId type; // Any type; i32[4][8] for the array above
+    std::string name;
+    std::unique_ptr<ExprNode> initializer; // nullptr if there is none (the variable starts at 0)
+    bool is_const = false; // Globals only: 'const', read-only
+    VarDeclNode(TypeId t, std::string n, std::unique_ptr<ExprNode> init)
+        : type(t), name(std::move(n)), initializer(std::move(init)) {}
+};
+
+// Represents: for (init; condition; step) { ... }
+struct ForStmtNode : public StmtNode {
+    std::unique_ptr<StmtNode> init;      // VarDeclNode, ExprStmtNode or nullptr
+    std::unique_ptr<ExprNode> condition; // nullptr loops forever
+    std::unique_ptr<ExprNode> step;      // nullptr if there is none
+    std::unique_ptr<StmtNode> body;
+    ForStmtNode(std::unique_ptr<StmtNode> i, std::unique_ptr<ExprNode> cond, std::unique_ptr<ExprNode> s,
+                std::unique_ptr<StmtNode> b)
+        : init(std::move(i)), condition(std::move(cond)), step(std::move(s)), body(std::move(b)) {}
+};
+
+// Represents: parallel for (int i = begin; i < end; i++) { ... }
+// The iterations may run in any order, on any number of threads. Only
+// this form of loop can be parallel.
+struct ParallelForStmtNode : public StmtNode {
+    TypeId type;      // The loop variable's
+    std::string name;
+    std::unique_ptr<ExprNode> begin;
+    std::unique_ptr<ExprNode> end;
+    std::unique_ptr<StmtNode> body;
+    ParallelForStmtNode(TypeId t, std::string n, std::unique_ptr<ExprNode> b, std::unique_ptr<ExprNode> e,
+                        std::unique_ptr<StmtNode> s)
+        : type(t), name(std::move(n)), begin(std::move(b)), end(std::move(e)), body(std::move(s)) {}
+};
+
+// Represents: for (int x in numbers(10)) { ... }
+// The body runs once for each value the generator yields.
+struct ForInStmtNode : public StmtNode {
+    TypeId type;      // The loop variable's
+    std::string name;
+    std::unique_ptr<CallExprNode> generator;
+    std::unique_ptr<StmtNode> body;
+    ForInStmtNode(TypeId t, std::string n, std::unique_ptr<CallExprNode> g, std::unique_ptr<StmtNode> b)
+        : type(t), name(std::move(n)), generator(std::move(g)), body(std::move(b)) {}
+};
+
+// Represents: yield x;
+// A function with one is a generator: it produces a value here, and
+// carries on from here when the next one is wanted.
+struct YieldStmtNode : public StmtNode {
+    std::unique_ptr<ExprNode> expression;
+    YieldStmtNode(std::unique_ptr<ExprNode> expr) : expression(std::move(expr)) {}
+};
+
+// Represents: if (condition) { ... } else { ... }
+struct IfStmtNode : public StmtNode {
+    std::unique_ptr<ExprNode> condition;
+    std::unique_ptr<StmtNode> then_branch;
+    std::unique_ptr<StmtNode> else_branch; // nullptr if there is no 'else'
+    IfStmtNode(std::unique_ptr<ExprNode> cond, std::unique_ptr<StmtNode> then_b, std::unique_ptr<StmtNode> else_b)
+        : condition(std::move(cond)), then_branch(std::move(then_b)), else_branch(std::move(else_b)) {}
+};
+
+// Represents: switch (value) { case 1, 2: ... case 7: ... default: ... }
+// There is no fallthrough: a case ends where the next label starts. So
+// a label can't be followed straight by another ('case 1: case 2:'); a
+// case that does nothing says so with '{}'.
+struct SwitchStmtNode : public StmtNode {
+    struct Case {
+        std::vector<std::unique_ptr<ExprNode>> values; // Constants; empty for 'default'
+        std::unique_ptr<BlockStmtNode> body;           // Its own scope
+    };
+    std::unique_ptr<ExprNode> value;
+    std::vector<Case> cases; // In source order, 'default' wherever it was
+    SwitchStmtNode(std::unique_ptr<ExprNode> v) : value(std::move(v)) {}
+};
+
+// Represents: @soa struct Particle { i64 x; u8 alive; };
+// The parser has already interned the type (see types.hpp): this only
+// keeps the declaration in the AST.
+struct StructDefNode : public StmtNode {
+    TypeId type;
+    StructDefNode(TypeId t) : type(t) {}
+};
+
+// One parameter of a function: 'int count'
+struct ParameterNode {
+    TypeId type;
+    std::string name;
+};
+
 // Represents: int main() { ... }
 struct FunctionDefNode : public StmtNode {
-    std::string return_type; // "int"
+    TypeId return_type;      // TYPE_I64 for 'int'
     std::string name;        // "main"
-    // We will add parameters later
+    std::vector<ParameterNode> parameters;
     std::unique_ptr<BlockStmtNode> body;
+    // 'comptime int f() { ... }': calls to it are evaluated by the
+    // compiler (see comptime.hpp)
+    bool is_comptime = false;
+    // 'export int f() { ... }': other object files may call it, so it
+    // follows the System V ABI ('main' always does)
+    bool is_exported = false;
+    // '@cold int f() { ... }': rarely called (error handling), so it goes
+    // to .text.cold, its loops aren't unrolled or vectorized, and the
+    // branches leading to calls to it are unlikely
+    bool is_cold = false;
+    // It has a 'yield': calling it gives a generator (see irgen.hpp),
+    // whose values are of 'return_type'
+    bool is_generator = false;
 
-    FunctionDefNode(std::string ret_type, std::string n, std::unique_ptr<BlockStmtNode> b)
-        : return_type(std::move(ret_type)), name(std::move(n)), body(std::move(b)) {}
+    FunctionDefNode(TypeId ret_type, std::string n, std::vector<ParameterNode> params, std::unique_ptr<BlockStmtNode> b)
+        : return_type(ret_type), name(std::move(n)), parameters(std::move(params)), body(std::move(b)) {}
+};
+
+// Represents: extern int puts(u8* s);
+// A function defined in another object file or library, called with the
+// System V ABI. Calling a function that's neither defined nor declared
+// is an error.
+struct ExternDeclNode : public StmtNode {
+    TypeId return_type;
+    std::string name;
+    std::vector<TypeId> parameters;
+};
+
+// Represents: T max<T>(T a, T b) { ... }
+// A generic function isn't a function itself: each set of types it's
+// called with gets an instance, a FunctionDefNode parsed from its tokens
+// with the type parameters standing for those types (see
+// Parser::instantiate()). The IR generator makes them as calls need them.
+struct GenericFunctionNode : public StmtNode {
+    std::string name;
+    std::vector<std::string> type_parameters;
+    // What each parameter's type says about the type parameters, to work
+    // them out from the arguments: 'T** p' is {0, 2}. -1 if it has none.
+    struct Pattern {
+        int type_parameter = -1;
+        int pointer_depth = 0;
+    };
+    std::vector<Pattern> parameters;
+    std::vector<Token> tokens; // The definition, from the return type on
+    // The generics it can call with type arguments: those declared before
+    // it, and itself
+    std::set<std::string> generics;
+    bool is_comptime = false;
+    bool is_cold = false;
 };
 
 
@@ -61,12 +338,25 @@ class Parser {
 public:
     Parser(std::vector<Token> tokens);
 
-    // The main function that builds the AST
+    // The main function that builds the AST. It stops at the first
+    // syntax error, which it prints (see had_error()).
     ProgramNode parse();
+    bool had_error() const { return m_had_error; }
+
+    // The instance of 'generic' for 'type_arguments' (one per type
+    // parameter), named like the generic. Throws on a syntax error.
+    static std::unique_ptr<FunctionDefNode> instantiate(const GenericFunctionNode& generic,
+                                                        const std::vector<TypeId>& type_arguments);
 
 private:
     std::vector<Token> m_tokens;
     int m_current_pos = 0;
+    bool m_had_error = false;
+    bool m_saw_yield = false; // In the function being parsed
+    // The generics declared so far, whose calls can give type arguments
+    std::set<std::string> m_generics;
+    // In an instance: what each type parameter stands for
+    std::unordered_map<std::string, TypeId> m_type_arguments;
 
     // Helper functions
     bool is_at_end();
@@ -74,14 +364,45 @@ private:
     Token peek();
     bool check(TokenType type);
     Token expect(TokenType type, const std::string& error_message);
+    // 'int', 'u8', ..., one of the vector types, a struct's name, or in
+    // an instance, a type parameter
+    bool check_type_name();
+    // Consumes a type name, and the '*'s of a pointer type after it
+    TypeId parse_type();
 
     // Functions to parse different parts of the grammar
     std::unique_ptr<StmtNode> parse_declaration();
     std::unique_ptr<StmtNode> parse_statement();
 
     std::unique_ptr<StmtNode> parse_function_definition();
+    // At 'T max<T>(': a type (or a name), '*'s, a name and '<'
+    bool check_generic_definition();
+    std::unique_ptr<GenericFunctionNode> parse_generic_definition();
+    // <T, U> after a generic's name, in its definition
+    std::vector<std::string> parse_type_parameters();
+    std::unique_ptr<StmtNode> parse_struct_definition();
+    std::unique_ptr<StmtNode> parse_extern_declaration();
     std::unique_ptr<BlockStmtNode> parse_block_statement();
     std::unique_ptr<StmtNode> parse_return_statement();
+    std::unique_ptr<StmtNode> parse_expression_statement();
+    std::unique_ptr<StmtNode> parse_if_statement();
+    std::unique_ptr<StmtNode> parse_for_statement();
+    std::unique_ptr<StmtNode> parse_parallel_for_statement();
+    std::unique_ptr<StmtNode> parse_yield_statement();
+    std::unique_ptr<StmtNode> parse_switch_statement();
+    std::unique_ptr<StmtNode> parse_var_declaration();
+    std::unique_ptr<ExprNode> parse_array_literal(); // {1, 2, 3}, {{1, 2}, {3}}
     
+    // Expressions, from lowest to highest precedence
     std::unique_ptr<ExprNode> parse_expression();
+    std::unique_ptr<ExprNode> parse_assignment(); // = += -=
+    std::unique_ptr<ExprNode> parse_equality();   // == !=
+    std::unique_ptr<ExprNode> parse_comparison(); // < > <= >=
+    std::unique_ptr<ExprNode> parse_term();       // + -
+    std::unique_ptr<ExprNode> parse_factor();     // * / %
+    std::unique_ptr<ExprNode> parse_unary();      // -x ++x --x *p &x
+    std::unique_ptr<ExprNode> parse_postfix();    // v[i] p.x p->x x++ x--
+    std::unique_ptr<ExprNode> parse_primary();    // 10, x, f(), int32x4(...), Point(...), sizeof(T), (expr)
+    // (a, b, ...), after the callee or vector type
+    std::vector<std::unique_ptr<ExprNode>> parse_arguments();
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "profile.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+const char* const PROFILE_MAGIC = "BOLTPROF";
+
+std::string profile_edge_key(const std::string& function, int edge) {
+    return function + ":" + std::to_string(edge);
+}
+
+// Reads one little-endian 64-bit integer at 'pos' and moves past it.
+static bool read_u64(const std::vector<char>& data, size_t& pos, uint64_t& out) {
+    if (pos + 8 > data.size()) return false;
+    out = 0;
+    for (int i = 7; i >= 0; i--) {
+        out = (out << 8) | static_cast<unsigned char>(data[pos + i]);
+    }
+    pos += 8;
+    return true;
+}
+
+bool ProfileData::load(const std::string& filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "❌ Error: Could not open profile: " << filepath << std::endl;
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // 1. Check the magic
+    size_t pos = 0;
+    if (data.size() < 8 || std::memcmp(data.data(), PROFILE_MAGIC, 8) != 0) {
+        std::cerr << "❌ Error: Not a Bolt profile: " << filepath << std::endl;
+        return false;
+    }
+    pos += 8;
+
+    // 2. Read the counter names
+    uint64_t num_counters = 0;
+    if (!read_u64(data, pos, num_counters)) {
+        std::cerr << "❌ Error: Truncated profile: " << filepath << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> names;
+    for (uint64_t i = 0; i < num_counters; i++) {
+        size_t end = pos;
+        while (end < data.size() && data[end] != '\0') end++;
+        if (end >= data.size()) {
+            std::cerr << "❌ Error: Truncated profile: " << filepath << std::endl;
+            return false;
+        }
+        names.emplace_back(data.data() + pos, end - pos);
+        pos = end + 1;
+    }
+    pos = (pos + 7) & ~static_cast<size_t>(7); // Names are padded to 8 bytes
+
+    // 3. Read the counters themselves
+    for (const auto& name : names) {
+        uint64_t value = 0;
+        if (!read_u64(data, pos, value)) {
+            std::cerr << "❌ Error: Truncated profile: " << filepath << std::endl;
+            return false;
+        }
+        m_counts[name] += value;
+    }
+    return true;
+}
+
+uint64_t ProfileData::count(const std::string& key) const {
+    auto it = m_counts.find(key);
+    return it == m_counts.end() ? 0 : it->second;
+}
+
+uint64_t ProfileData::function_count(const std::string& function) const {
+    return count(function);
+}
+
+uint64_t ProfileData::edge_count(const std::string& function, int edge) const {
+    return count(profile_edge_key(function, edge));
+}
+
+bool ProfileData::is_cold(const std::string& function) const {
+    // Functions missing from the profile are new code: we know nothing about them.
+    auto it = m_counts.find(function);
+    return it != m_counts.end() && it->second == 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// --- Profile Data ---
+// Instrumented programs (built with -fprofile-generate) count how often
+// each function is entered and how often each branch edge is taken (see
+// number_profile_edges), with atomic increments, so threads don't lose
+// counts. When they exit, they write those counts to a profile file.
+//
+// Every counter has a name:
+//   "main"    -> number of times 'main' was entered
+//   "main:2"  -> number of times edge #2 inside 'main' was taken
+//
+// -fprofile-use orders and splits the functions by their entry counts
+// (see layout.hpp), and makes the edge counts branch weights, which the
+// block placement, the hot/cold block split and the register
+// allocator's spill weights go by. There is no inliner, so nothing is
+// inlined by the counts.
+//
+// The file layout is (all integers are 64-bit little endian):
+//   "BOLTPROF"                 8-byte magic
+//   num_counters
+//   names                      NUL-terminated, padded to 8 bytes
+//   counters[num_counters]
+
+// The magic string at the start of every profile file.
+extern const char* const PROFILE_MAGIC;
+
+// Builds the counter name for an edge inside a function.
+std::string profile_edge_key(const std::string& function, int edge);
+
+// The counts read back with -fprofile-use.
+class ProfileData {
+public:
+    // Reads a profile file. Returns false (and prints why) on failure.
+    bool load(const std::string& filepath);
+
+    bool empty() const { return m_counts.empty(); }
+
+    // Returns 0 for counters that are not in the profile.
+    uint64_t count(const std::string& key) const;
+    uint64_t function_count(const std::string& function) const;
+    uint64_t edge_count(const std::string& function, int edge) const;
+
+    // A function is "cold" if it never ran at all
+    bool is_cold(const std::string& function) const;
+
+private:
+    std::unordered_map<std::string, uint64_t> m_counts;
+};
@@ -0,0 +1,350 @@
+#include "regalloc.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+// General-purpose registers handed out by the allocator, in order of
+// preference. Caller-saved come first: they don't need saving in the
+// prologue. Values that live across a call can't use them anyway (the
+// call clobbers them), so those end up in the callee-saved ones.
+static std::vector<int> allocation_order(CallingConvention convention) {
+    std::vector<int> order;
+    for (int preg : caller_saved_registers(convention)) {
+        if (preg < XMM0) order.push_back(preg);
+    }
+    for (int preg : callee_saved_registers(convention)) order.push_back(preg);
+    return order;
+}
+
+// Vector registers are all caller-saved, so the order doesn't matter
+static const std::vector<int> VECTOR_ALLOCATION_ORDER = {
+    XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+    XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+};
+
+RegisterAllocator::RegisterAllocator(MFunction& function)
+    : m_function(function), m_allocation_order(allocation_order(function.convention)) {}
+
+bool RegisterAllocator::is_unspillable(int vreg) const {
+    size_t index = static_cast<size_t>(vreg - FIRST_VREG);
+    return index < m_unspillable.size() && m_unspillable[index];
+}
+
+void RegisterAllocator::run() {
+    // Every round either succeeds or spills at least one interval, and
+    // spill temps never spill again, so this always finishes.
+    while (!try_allocate()) {
+        insert_spill_code();
+    }
+    rewrite_registers();
+}
+
+bool RegisterAllocator::try_allocate() {
+    auto& blocks = m_function.blocks;
+    int num_vregs = m_function.next_vreg - FIRST_VREG;
+
+    // --- 1. Number the instructions ---
+    // Instruction k reads its operands at position 2k and writes its
+    // results at 2k+1, so "last use" and "next def" never collide.
+    std::vector<int> block_start(blocks.size()), block_end(blocks.size());
+    int k = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        block_start[b] = 2 * k;
+        k += static_cast<int>(blocks[b].instrs.size());
+        block_end[b] = 2 * k;
+    }
+
+    // --- 2. Liveness of virtual registers across blocks ---
+    std::vector<std::set<int>> live_in(blocks.size()), live_out(blocks.size());
+    std::vector<std::set<int>> upward_uses(blocks.size()), block_defs(blocks.size());
+    std::vector<int> uses, defs;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (const MInstr& instr : blocks[b].instrs) {
+            get_uses_defs(instr, uses, defs);
+            for (int r : uses) {
+                if (is_vreg(r) && !block_defs[b].count(r)) upward_uses[b].insert(r);
+            }
+            for (int r : defs) {
+                if (is_vreg(r)) block_defs[b].insert(r);
+            }
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            std::set<int> out;
+            for (int succ : blocks[b].succs) {
+                out.insert(live_in[succ].begin(), live_in[succ].end());
+            }
+            std::set<int> in = upward_uses[b];
+            for (int r : out) {
+                if (!block_defs[b].count(r)) in.insert(r);
+            }
+            if (in != live_in[b] || out != live_out[b]) {
+                live_in[b] = std::move(in);
+                live_out[b] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+
+    // --- 3. Build the intervals ---
+    std::vector<Interval> intervals(num_vregs);
+    for (int v = 0; v < num_vregs; v++) {
+        intervals[v].vreg = v + FIRST_VREG;
+        intervals[v].spillable = !is_unspillable(v + FIRST_VREG);
+    }
+    auto extend = [&](int vreg, int pos) {
+        Interval& interval = intervals[vreg - FIRST_VREG];
+        if (interval.start < 0 || pos < interval.start) interval.start = pos;
+        if (pos > interval.end) interval.end = pos;
+    };
+
+    std::vector<std::vector<FixedRange>> fixed(NUM_PHYS_REGS);
+    k = 0;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        for (int r : live_in[b]) extend(r, block_start[b]);
+        for (int r : live_out[b]) extend(r, block_end[b]);
+
+        // Physical registers only ever live inside one block: from the
+        // def to its last use (or from the block start, for incoming values)
+        std::vector<int> open_def(NUM_PHYS_REGS, -1);
+        std::vector<int> last_use(NUM_PHYS_REGS, -1);
+        auto close_range = [&](int r) {
+            if (open_def[r] >= 0) {
+                fixed[r].push_back({open_def[r], std::max(open_def[r], last_use[r])});
+            }
+            open_def[r] = -1;
+            last_use[r] = -1;
+        };
+
+        for (const MInstr& instr : blocks[b].instrs) {
+            get_uses_defs(instr, uses, defs);
+            for (int r : uses) {
+                if (is_vreg(r)) {
+                    extend(r, 2 * k);
+                    intervals[r - FIRST_VREG].weight += blocks[b].frequency;
+                } else if (r < NUM_PHYS_REGS) {
+                    if (open_def[r] < 0) open_def[r] = block_start[b];
+                    last_use[r] = 2 * k;
+                }
+            }
+            for (int r : defs) {
+                if (is_vreg(r)) {
+                    extend(r, 2 * k + 1);
+                    intervals[r - FIRST_VREG].weight += blocks[b].frequency;
+                } else if (r < NUM_PHYS_REGS) {
+                    close_range(r);
+                    open_def[r] = 2 * k + 1;
+                }
+            }
+
+            // Copies are hints: try to give both sides the same register,
+            // so the copy disappears
+            if (is_register_copy(instr)) {
+                int dst = instr.ops[0].reg, src = instr.ops[1].reg;
+                if (is_vreg(dst)) intervals[dst - FIRST_VREG].hints.push_back(src);
+                if (is_vreg(src)) intervals[src - FIRST_VREG].hints.push_back(dst);
+            }
+            k++;
+        }
+        for (int r = 0; r < NUM_PHYS_REGS; r++) close_range(r);
+    }
+
+    auto conflicts_with_fixed = [&](int preg, const Interval& interval) {
+        for (const FixedRange& range : fixed[preg]) {
+            if (range.start <= interval.end && interval.start <= range.end) return true;
+        }
+        return false;
+    };
+
+    // --- 4. Linear scan ---
+    std::vector<Interval*> order;
+    for (Interval& interval : intervals) {
+        if (interval.start >= 0) order.push_back(&interval);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const Interval* a, const Interval* b) { return a->start < b->start; });
+
+    m_assignment.assign(num_vregs, -1);
+    m_spilled.clear();
+    std::vector<Interval*> active;
+
+    for (Interval* current : order) {
+        // Expire intervals that ended before this one starts
+        active.erase(std::remove_if(active.begin(), active.end(),
+            [&](Interval* other) { return other->end < current->start; }), active.end());
+
+        std::set<int> busy;
+        for (Interval* other : active) {
+            busy.insert(m_assignment[other->vreg - FIRST_VREG]);
+        }
+        auto usable = [&](int preg) { return !conflicts_with_fixed(preg, *current); };
+        const std::vector<int>& allocation_order =
+            m_function.reg_class(current->vreg) == RegClass::GPR ? m_allocation_order : VECTOR_ALLOCATION_ORDER;
+        auto in_class = [&](int preg) {
+            return std::find(allocation_order.begin(), allocation_order.end(), preg) != allocation_order.end();
+        };
+
+        // Prefer a hinted register, then the normal order
+        int chosen = -1;
+        for (int hint : current->hints) {
+            int preg = is_vreg(hint) ? m_assignment[hint - FIRST_VREG] : hint;
+            if (preg >= 0 && in_class(preg) && !busy.count(preg) && usable(preg)) {
+                chosen = preg;
+                break;
+            }
+        }
+        for (size_t i = 0; chosen < 0 && i < allocation_order.size(); i++) {
+            int preg = allocation_order[i];
+            if (!busy.count(preg) && usable(preg)) chosen = preg;
+        }
+
+        if (chosen >= 0) {
+            m_assignment[current->vreg - FIRST_VREG] = chosen;
+            active.push_back(current);
+            continue;
+        }
+
+        // Nothing free: spill whichever interval is cheapest to spill,
+        // either this one or an active one whose register we could use
+        Interval* victim = current->spillable ? current : nullptr;
+        double victim_cost = current->spillable ? current->weight / (current->end - current->start + 1) : 0;
+        for (Interval* other : active) {
+            int preg = m_assignment[other->vreg - FIRST_VREG];
+            if (!other->spillable || !in_class(preg) || !usable(preg)) continue;
+            double cost = other->weight / (other->end - other->start + 1);
+            if (!victim || cost < victim_cost) {
+                victim = other;
+                victim_cost = cost;
+            }
+        }
+        if (!victim) {
+            throw std::runtime_error("Register allocation failed in '" + m_function.name + "'");
+        }
+
+        m_spilled.push_back(victim->vreg);
+        if (victim != current) {
+            m_assignment[current->vreg - FIRST_VREG] = m_assignment[victim->vreg - FIRST_VREG];
+            m_assignment[victim->vreg - FIRST_VREG] = -1;
+            active.erase(std::find(active.begin(), active.end(), victim));
+            active.push_back(current);
+        }
+    }
+
+    return m_spilled.empty();
+}
+
+void RegisterAllocator::insert_spill_code() {
+    // Give every spilled vreg a stack slot
+    std::map<int, int> slot_of;
+    for (int vreg : m_spilled) {
+        slot_of[vreg] = m_function.new_slot(spill_size(vreg));
+    }
+
+    std::vector<int> uses, defs;
+    for (MBlock& block : m_function.blocks) {
+        std::vector<MInstr> rewritten;
+        for (MInstr& instr : block.instrs) {
+            get_uses_defs(instr, uses, defs);
+
+            // One fresh temp per spilled vreg in this instruction
+            std::map<int, int> temp_of;
+            auto temp_for = [&](int vreg) {
+                auto it = temp_of.find(vreg);
+                if (it != temp_of.end()) return it->second;
+                int temp = m_function.new_vreg(m_function.reg_class(vreg));
+                m_unspillable.resize(m_function.next_vreg - FIRST_VREG, false);
+                m_unspillable[temp - FIRST_VREG] = true;
+                temp_of[vreg] = temp;
+                return temp;
+            };
+
+            std::vector<MInstr> after;
+            for (int r : uses) {
+                if (!slot_of.count(r)) continue;
+                rewritten.push_back(spill_move(temp_for(r), slot_of[r], true));
+            }
+            for (int r : defs) {
+                if (!slot_of.count(r)) continue;
+                after.push_back(spill_move(temp_for(r), slot_of[r], false));
+            }
+
+            // Point the instruction at the temps
+            for (MOperand& op : instr.ops) {
+                if (op.is_reg() && slot_of.count(op.reg)) op.reg = temp_for(op.reg);
+                if (op.is_mem() && slot_of.count(op.mem.base)) op.mem.base = temp_for(op.mem.base);
+                if (op.is_mem() && slot_of.count(op.mem.index)) op.mem.index = temp_for(op.mem.index);
+            }
+
+            rewritten.push_back(std::move(instr));
+            rewritten.insert(rewritten.end(), after.begin(), after.end());
+        }
+        block.instrs = std::move(rewritten);
+    }
+}
+
+int RegisterAllocator::spill_size(int vreg) const {
+    switch (m_function.reg_class(vreg)) {
+        case RegClass::VEC128: return 16;
+        case RegClass::VEC256: return 32;
+        default:               return 8;
+    }
+}
+
+MInstr RegisterAllocator::spill_move(int temp, int slot, bool reload) const {
+    // Vector slots are only 16-byte aligned (the frame is), so they use
+    // unaligned moves
+    int size = spill_size(temp);
+    MemRef mem;
+    mem.frame_slot = slot;
+    MOperand reg = MOperand::make_reg(temp, size);
+    MOperand memory = MOperand::make_mem(mem, size == 8 ? 8 : 0);
+    const char* opcode = size == 8 ? "mov" : (m_function.vex ? "vmovdqu" : "movdqu");
+    if (reload) return {opcode, {reg, memory}, {}, {}};
+    return {opcode, {memory, reg}, {}, {}};
+}
+
+void RegisterAllocator::rewrite_registers() {
+    auto physical = [&](int r) {
+        return is_vreg(r) ? m_assignment[r - FIRST_VREG] : r;
+    };
+
+    // The prologue has to save any callee-saved register we handed out,
+    // or that a call overwrites (an internal callee may use r14 and r15)
+    const std::vector<int>& callee_saved = callee_saved_registers(m_function.convention);
+    auto is_callee_saved = [&](int preg) {
+        return std::find(callee_saved.begin(), callee_saved.end(), preg) != callee_saved.end();
+    };
+    for (int preg : m_assignment) {
+        if (is_callee_saved(preg)) m_function.used_callee_saved.insert(preg);
+    }
+    for (const MBlock& block : m_function.blocks) {
+        for (const MInstr& instr : block.instrs) {
+            for (int preg : instr.implicit_defs) {
+                if (is_callee_saved(preg)) m_function.used_callee_saved.insert(preg);
+            }
+        }
+    }
+
+    for (MBlock& block : m_function.blocks) {
+        std::vector<MInstr> rewritten;
+        for (MInstr& instr : block.instrs) {
+            for (MOperand& op : instr.ops) {
+                if (op.is_reg()) op.reg = physical(op.reg);
+                if (op.is_mem() && op.mem.base >= 0) op.mem.base = physical(op.mem.base);
+                if (op.is_mem() && op.mem.index >= 0) op.mem.index = physical(op.mem.index);
+            }
+
+            // Coalesced copies are now 'mov rax, rax': drop them
+            bool self_copy = is_register_copy(instr) && instr.ops[0].reg == instr.ops[1].reg;
+            if (!self_copy) {
+                rewritten.push_back(std::move(instr));
+            }
+        }
+        block.instrs = std::move(rewritten);
+    }
+}
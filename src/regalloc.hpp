@@ -0,0 +1,61 @@
+#pragma once
+
+#include "mir.hpp"
+#include <vector>
+
+// --- Register Allocation ---
+// Linear scan (Poletto & Sarkar): every virtual register gets one live
+// interval [first position, last position], intervals are walked in order
+// of their start, and each one takes a free physical register.
+//
+// Vector values go through the same scan, but only take XMM registers
+// (and general-purpose values only take general-purpose ones).
+//
+// Physical registers that instructions name directly (rax for 'ret' and
+// 'idiv', everything a call clobbers, ...) are "fixed": a virtual register
+// can't take one of those while it's busy.
+//
+// When we run out of registers, the interval used least often (weighted
+// by block frequency) is spilled to a stack slot: it's reloaded into a
+// tiny new interval right before every use and stored right after every
+// def, and the whole allocation starts over.
+class RegisterAllocator {
+public:
+    RegisterAllocator(MFunction& function);
+
+    void run();
+
+private:
+    struct Interval {
+        int vreg;
+        int start = -1;
+        int end = -1;
+        double weight = 0;       // Spill cost: higher means "keep in a register"
+        bool spillable = true;   // Spill reload/store temps must not spill again
+        std::vector<int> hints;  // Registers (physical or virtual) it's copied to/from
+    };
+
+    // A stretch of positions where a physical register is busy
+    struct FixedRange {
+        int start;
+        int end;
+    };
+
+    MFunction& m_function;
+    std::vector<int> m_allocation_order; // General-purpose registers, for the function's convention
+    std::vector<bool> m_unspillable; // Indexed by vreg - FIRST_VREG
+
+    // Results of the last allocation attempt
+    std::vector<int> m_assignment;   // Indexed by vreg - FIRST_VREG; -1 if none
+    std::vector<int> m_spilled;      // Vregs that didn't get a register
+
+    // Returns true if every vreg got a register
+    bool try_allocate();
+    void insert_spill_code();
+    void rewrite_registers();
+
+    bool is_unspillable(int vreg) const;
+    // Stack slot size for a spilled vreg, and the load/store to it
+    int spill_size(int vreg) const;
+    MInstr spill_move(int temp, int slot, bool reload) const;
+};
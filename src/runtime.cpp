@@ -0,0 +1,715 @@
+#include "runtime.hpp"
+#include "lexer.hpp"
+#include "mir.hpp"
+#include <sstream>
+
+const std::vector<RuntimeFunction>& runtime_functions() {
+    // The pointer parameters are u8*, so a string literal can be passed
+    // as it is (and 0 is the null pointer)
+    static const std::vector<RuntimeFunction> functions = {
+        {"read",  "__bolt_read",  0,   TYPE_I64, {TYPE_I64, pointer_type(TYPE_U8), TYPE_I64}},
+        {"write", "__bolt_write", 1,   TYPE_I64, {TYPE_I64, pointer_type(TYPE_U8), TYPE_I64}},
+        {"mmap",  "__bolt_mmap",  9,   pointer_type(TYPE_U8),
+         {pointer_type(TYPE_U8), TYPE_I64, TYPE_I64, TYPE_I64, TYPE_I64, TYPE_I64}},
+        {"munmap", "__bolt_munmap", 11, TYPE_I64, {pointer_type(TYPE_U8), TYPE_I64}},
+        {"futex", "__bolt_futex", 202, TYPE_I64,
+         {pointer_type(TYPE_U8), TYPE_I64, TYPE_I64, pointer_type(TYPE_U8), pointer_type(TYPE_U8), TYPE_I64}},
+        {"sched_getaffinity", "__bolt_sched_getaffinity", 204, TYPE_I64, {TYPE_I64, TYPE_I64, pointer_type(TYPE_U8)}},
+        {"exit",  "__bolt_exit",  231, TYPE_I64, {TYPE_I64}}, // exit_group: every thread
+    };
+    return functions;
+}
+
+const std::vector<RuntimeHelper>& runtime_helpers() {
+    static const std::vector<RuntimeHelper> helpers = {
+        {"__bolt_spawn", CallingConvention::SysV, {RAX, RCX, RDX, RSI, RDI, R8, R10, R11}},
+        {"__bolt_invoke", CallingConvention::Internal, {}},
+    };
+    return helpers;
+}
+
+bool is_runtime_symbol(const std::string& symbol) {
+    if (find_runtime_symbol(symbol)) return true;
+    for (const RuntimeHelper& helper : runtime_helpers()) {
+        if (helper.symbol == symbol) return true;
+    }
+    return false;
+}
+
+const RuntimeFunction* find_runtime_symbol(const std::string& symbol) {
+    for (const RuntimeFunction& function : runtime_functions()) {
+        if (function.symbol == symbol) return &function;
+    }
+    return nullptr;
+}
+
+std::vector<int> runtime_clobbers(const RuntimeFunction& function) {
+    // The kernel returns in rax and overwrites rcx and r11. A fourth
+    // argument goes in r10, not rcx.
+    std::vector<int> clobbers = {RAX, RCX, R11};
+    if (function.parameters.size() > 3) clobbers.push_back(R10);
+    return clobbers;
+}
+
+std::string emit_runtime(const std::set<std::string>& used, bool buffered_output, const CompilerOptions& options) {
+    std::stringstream out;
+    for (const RuntimeFunction& function : runtime_functions()) {
+        if (!used.count(function.symbol)) continue;
+        out << function.symbol << ":\n";
+        if (function.name == "exit" && (options.profile_generate || buffered_output)) {
+            out << "  push rdi\n";
+            if (buffered_output) out << "  call __bolt_flush\n";
+            if (options.profile_generate) out << "  call __bolt_prof_dump\n";
+            out << "  pop rdi\n";
+        }
+        if (function.parameters.size() > 3) out << "  mov r10, rcx\n";
+        out << "  mov eax, " << function.syscall << "\n";
+        out << "  syscall\n";
+        if (function.name != "exit") out << "  ret\n";
+    }
+
+    if (used.count("__bolt_spawn")) {
+        // clone() with the thread's stack: the child comes back from the
+        // system call on it, takes the entry point and its argument off it
+        // and calls it. The flags share everything a thread shares, store
+        // its id at 'id' and, once it has exited, clear it and wake a
+        // futex wait on it.
+        out << "__bolt_spawn:\n";
+        out << "  sub rdx, 16\n";
+        out << "  mov [rdx], rdi\n";
+        out << "  mov [rdx + 8], rsi\n";
+        out << "  mov rsi, rdx\n";
+        out << "  mov rdx, rcx\n";
+        out << "  mov r10, rcx\n";
+        out << "  xor r8d, r8d\n";
+        out << "  mov edi, 0x350f00\n"; // VM FS FILES SIGHAND THREAD SYSVSEM PARENT_SETTID CHILD_CLEARTID
+        out << "  mov eax, 56\n";
+        out << "  syscall\n";
+        out << "  test rax, rax\n";
+        out << "  jz __bolt_spawn_child\n";
+        out << "  ret\n";
+        out << "__bolt_spawn_child:\n";
+        out << "  xor ebp, ebp\n";
+        out << "  pop rax\n";
+        out << "  pop rdi\n";
+        out << "  call rax\n";
+        out << "  xor edi, edi\n";
+        out << "  mov eax, 60\n"; // exit: this thread only
+        out << "  syscall\n";
+    }
+    if (used.count("__bolt_invoke")) {
+        // The function comes first, its arguments after it
+        out << "__bolt_invoke:\n";
+        out << "  mov rax, rdi\n";
+        out << "  mov rdi, rsi\n";
+        out << "  mov rsi, rdx\n";
+        out << "  mov rdx, rcx\n";
+        out << "  jmp rax\n";
+    }
+
+    if (options.freestanding) {
+        // The kernel starts us with rsp 16-byte aligned, pointing at argc.
+        // rbp = 0 marks the outermost frame for debuggers.
+        out << "global _start\n";
+        out << "_start:\n";
+        out << "  xor ebp, ebp\n";
+        out << "  call main\n";
+        if (options.profile_generate || buffered_output) {
+            out << "  mov ebx, eax\n";
+            if (buffered_output) out << "  call __bolt_flush\n";
+            if (options.profile_generate) out << "  call __bolt_prof_dump\n";
+            out << "  mov eax, ebx\n";
+        }
+        out << "  mov edi, eax\n";
+        out << "  mov eax, 231\n";
+        out << "  syscall\n";
+    }
+    return out.str();
+}
+
+// The runtime library. Its state is in globals; the functions keep what
+// they use in locals while they work, since every access to a global is
+// a load or a store.
+static const char* const RUNTIME_LIBRARY_SOURCE = R"(
+// --- Locks ---
+// Until the program starts a thread there's nothing to lock, and print()
+// and the heap don't
+int __bolt_threaded;
+
+// A futex: 0 free, 1 locked, 2 locked with threads waiting for it (which
+// unlocking then has to wake)
+int __bolt_lock(i32* lock) {
+    int state = atomic_cas(lock, 0, 1, acquire);
+    if (state == 0) return 0;
+    if (state != 2) state = atomic_exchange(lock, 2, acquire);
+    for (; state != 0;) {
+        futex(u8*(lock), 128, 2, 0, 0, 0); // FUTEX_WAIT_PRIVATE, while it's 2
+        state = atomic_exchange(lock, 2, acquire);
+    }
+    return 0;
+}
+
+int __bolt_unlock(i32* lock) {
+    if (atomic_add(lock, -1, release) != 1) {
+        atomic_store(lock, 0, release);
+        futex(u8*(lock), 129, 1, 0, 0, 0); // FUTEX_WAKE_PRIVATE, one of them
+    }
+    return 0;
+}
+
+// --- Buffered I/O ---
+// One thread at a time prints; reading is for one thread only
+i32 __bolt_out_lock;
+u8 __bolt_out[4096];
+int __bolt_out_length;
+u8 __bolt_in[4096];
+int __bolt_in_position;
+int __bolt_in_length;
+
+// "00", "01", ... "99": two digits at a time halves the divisions
+const u8* __bolt_digit_pairs = "0001020304050607080910111213141516171819"
+                               "2021222324252627282930313233343536373839"
+                               "4041424344454647484950515253545556575859"
+                               "6061626364656667686970717273747576777879"
+                               "8081828384858687888990919293949596979899";
+
+int __bolt_write_all(u8* bytes, int length) {
+    int done = 0;
+    for (; done < length;) {
+        int written = write(1, bytes + done, length - done);
+        if (written <= 0) return -1;
+        done += written;
+    }
+    return 0;
+}
+
+int __bolt_flush_unlocked() {
+    int length = __bolt_out_length;
+    __bolt_out_length = 0;
+    return __bolt_write_all(__bolt_out, length);
+}
+
+export int __bolt_flush() {
+    if (__bolt_threaded == 0) return __bolt_flush_unlocked();
+    __bolt_lock(&__bolt_out_lock);
+    int result = __bolt_flush_unlocked();
+    __bolt_unlock(&__bolt_out_lock);
+    return result;
+}
+
+int __bolt_buffer_bytes(u8* bytes, int length) {
+    int used = __bolt_out_length;
+    if (used + length > 4096) {
+        __bolt_flush_unlocked();
+        used = 0;
+        // Too big to buffer: straight out
+        if (length > 4096) return __bolt_write_all(bytes, length);
+    }
+    u8* out = __bolt_out;
+    for (int i = 0; i < length; i++) {
+        out[used + i] = bytes[i];
+    }
+    __bolt_out_length = used + length;
+    return 0;
+}
+
+int __bolt_print_bytes(u8* bytes, int length) {
+    if (__bolt_threaded == 0) return __bolt_buffer_bytes(bytes, length);
+    __bolt_lock(&__bolt_out_lock);
+    int result = __bolt_buffer_bytes(bytes, length);
+    __bolt_unlock(&__bolt_out_lock);
+    return result;
+}
+
+int __bolt_print_string(u8* string) {
+    int length = 0;
+    for (; string[length] != 0; length++) {
+    }
+    return __bolt_print_bytes(string, length);
+}
+
+int __bolt_print_uint(u64 value) {
+    u8 buffer[20];
+    u8* end = buffer + 20;
+    u8* digits = end;
+    for (; value >= 100;) {
+        u64 pair = value % 100 * 2;
+        value = value / 100;
+        digits = digits - 2;
+        digits[0] = __bolt_digit_pairs[pair];
+        digits[1] = __bolt_digit_pairs[pair + 1];
+    }
+    if (value >= 10) {
+        digits = digits - 2;
+        digits[0] = __bolt_digit_pairs[value * 2];
+        digits[1] = __bolt_digit_pairs[value * 2 + 1];
+    } else {
+        digits = digits - 1;
+        digits[0] = 48 + value;
+    }
+    return __bolt_print_bytes(digits, end - digits);
+}
+
+int __bolt_print_int(int value) {
+    if (value < 0) {
+        __bolt_print_bytes("-", 1);
+        // As a u64, so -9223372036854775808 works too
+        return __bolt_print_uint(0 - u64(value));
+    }
+    return __bolt_print_uint(value);
+}
+
+int __bolt_read_byte() {
+    if (__bolt_in_position == __bolt_in_length) {
+        int length = read(0, __bolt_in, 4096);
+        __bolt_in_position = 0;
+        __bolt_in_length = 0;
+        if (length <= 0) return -1;
+        __bolt_in_length = length;
+    }
+    u8* input = __bolt_in;
+    int byte = input[__bolt_in_position];
+    __bolt_in_position++;
+    return byte;
+}
+
+// The rest of a number that starts with 'c'. The byte after it is
+// left to be read again.
+int __bolt_parse_int(int c) {
+    int sign = 1;
+    if (c == 45) {
+        sign = -1;
+        c = __bolt_read_byte();
+    }
+    int value = 0;
+    for (; c >= 48;) {
+        if (c > 57) {
+            __bolt_in_position--;
+            return value * sign;
+        }
+        value = value * 10 + c - 48;
+        c = __bolt_read_byte();
+    }
+    if (c >= 0) __bolt_in_position--;
+    return value * sign;
+}
+
+int __bolt_read_int() {
+    // Whitespace is anything up to ' '
+    int c = __bolt_read_byte();
+    for (; c >= 0;) {
+        if (c > 32) return __bolt_parse_int(c);
+        c = __bolt_read_byte();
+    }
+    return 0;
+}
+
+// --- Heap ---
+// Memory comes from the kernel in 4 MB chunks, cut into 64 KB spans
+// aligned to 64 KB. A span holds blocks of one size class (16, 32, ...
+// 2048 bytes) after a 16-byte header with that size, so dealloc() finds
+// the size by rounding the address down. Freed blocks go on a list per
+// class, linked through their first 8 bytes; new ones are bumped off the
+// class's current span. Anything bigger gets a mapping of its own,
+// aligned the same way, whose header holds minus its length. Once there
+// are threads, one lock guards all of it.
+i32 __bolt_heap_lock;
+u64 __bolt_free_lists[8];
+u64 __bolt_bump[8];
+u64 __bolt_bump_end[8];
+u64 __bolt_spans;
+u64 __bolt_spans_end;
+
+// The block size of the size class for 'bytes' (1 to 2048)
+int __bolt_size_class(int bytes) {
+    if (bytes <= 16) return 0;
+    return 60 - clz(u64(bytes - 1));
+}
+
+// 'bytes' of fresh memory aligned to 64 KB, or 0
+u64 __bolt_map_aligned(int bytes, u64* mapping) {
+    // PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+    u64 start = u64(mmap(0, bytes + 65536, 3, 34, -1, 0));
+    if (start > u64(0) - 4096) return 0; // -errno
+    mapping[0] = start;
+    return start + (65536 - start % 65536) % 65536;
+}
+
+u64 __bolt_new_span(int block) {
+    if (__bolt_spans == __bolt_spans_end) {
+        u64 mapping[1];
+        u64 chunk = __bolt_map_aligned(4194304, mapping);
+        if (chunk == 0) return 0;
+        __bolt_spans = chunk;
+        __bolt_spans_end = chunk + 4194304;
+    }
+    u64 span = __bolt_spans;
+    __bolt_spans = span + 65536;
+    u64* header = u64*(span);
+    header[0] = block;
+    return span;
+}
+
+u8* __bolt_alloc_large(int bytes) {
+    u64 mapping[1];
+    int length = bytes + 16;
+    u64 span = __bolt_map_aligned(length, mapping);
+    if (span == 0) return 0;
+    u64* header = u64*(span);
+    header[0] = 0 - (length + 65536);
+    header[1] = mapping[0];
+    return u8*(span + 16);
+}
+
+u8* __bolt_heap_alloc(int bytes) {
+    // No size class fits 0 or fewer bytes (and bytes - 1 would wrap)
+    if (bytes <= 0) return 0;
+    if (bytes > 2048) return __bolt_alloc_large(bytes);
+    int size_class = __bolt_size_class(bytes);
+    u64 block = __bolt_free_lists[size_class];
+    if (block != 0) {
+        u64* next = u64*(block);
+        __bolt_free_lists[size_class] = next[0];
+        return u8*(block);
+    }
+    int size = 16;
+    for (int i = 0; i < size_class; i++) size = size * 2;
+    block = __bolt_bump[size_class];
+    if (block + size > __bolt_bump_end[size_class]) {
+        u64 span = __bolt_new_span(size);
+        if (span == 0) return 0;
+        block = span + 16;
+        __bolt_bump_end[size_class] = span + 65536;
+    }
+    __bolt_bump[size_class] = block + size;
+    return u8*(block);
+}
+
+int __bolt_heap_dealloc(u8* pointer) {
+    u64 block = u64(pointer);
+    if (block == 0) return 0;
+    u64* header = u64*(block - block % 65536);
+    int size = header[0];
+    if (size < 0) return munmap(u8*(header[1]), 0 - size);
+    int size_class = __bolt_size_class(size);
+    u64* next = u64*(block);
+    next[0] = __bolt_free_lists[size_class];
+    __bolt_free_lists[size_class] = block;
+    return 0;
+}
+
+u8* __bolt_alloc(int bytes) {
+    if (__bolt_threaded == 0) return __bolt_heap_alloc(bytes);
+    __bolt_lock(&__bolt_heap_lock);
+    u8* block = __bolt_heap_alloc(bytes);
+    __bolt_unlock(&__bolt_heap_lock);
+    return block;
+}
+
+int __bolt_dealloc(u8* pointer) {
+    if (__bolt_threaded == 0) return __bolt_heap_dealloc(pointer);
+    __bolt_lock(&__bolt_heap_lock);
+    int result = __bolt_heap_dealloc(pointer);
+    __bolt_unlock(&__bolt_heap_lock);
+    return result;
+}
+
+// --- Arenas ---
+// An arena is a chain of mappings, each starting with the address of the
+// next one (or 0) and its own end. The arena itself lives in the first:
+// [2] the mapping it allocates from, [3] the next free byte there, [4]
+// where that mapping ends. Blocks are 16-byte aligned. arena_reset()
+// starts over in the first mapping and keeps the others for reuse.
+u8* __bolt_arena_new(int bytes) {
+    if (bytes < 4096) bytes = 4096;
+    u64 start = u64(mmap(0, bytes, 3, 34, -1, 0));
+    if (start > u64(0) - 4096) return 0;
+    u64* arena = u64*(start);
+    arena[0] = 0;
+    arena[1] = start + bytes;
+    arena[2] = start;
+    arena[3] = start + 48;
+    arena[4] = start + bytes;
+    return u8*(start);
+}
+
+u8* __bolt_arena_grow(u64* arena, int bytes) {
+    u64* current = u64*(arena[2]);
+    u64 next = current[0];
+    // A mapping from before the last reset, if it's big enough
+    if (next != 0) {
+        u64* mapping = u64*(next);
+        if (mapping[1] - next - 16 < bytes) next = 0;
+    }
+    if (next == 0) {
+        int length = (current[1] - arena[2]) * 2;
+        if (length < bytes + 16) length = bytes + 16;
+        next = u64(mmap(0, length, 3, 34, -1, 0));
+        if (next > u64(0) - 4096) return 0;
+        u64* mapping = u64*(next);
+        mapping[0] = current[0]; // Keep the rest of the chain
+        mapping[1] = next + length;
+        current[0] = next;
+    }
+    u64* mapping = u64*(next);
+    arena[2] = next;
+    arena[3] = next + 16 + bytes;
+    arena[4] = mapping[1];
+    return u8*(next + 16);
+}
+
+u8* __bolt_arena_alloc(u8* handle, int bytes) {
+    u64* arena = u64*(handle);
+    if (bytes <= 0) return 0;
+    bytes = (bytes + 15) / 16 * 16;
+    u64 block = arena[3];
+    if (block + bytes > arena[4]) return __bolt_arena_grow(arena, bytes);
+    arena[3] = block + bytes;
+    return u8*(block);
+}
+
+int __bolt_arena_reset(u8* handle) {
+    u64* arena = u64*(handle);
+    arena[2] = u64(handle);
+    arena[3] = u64(handle) + 48;
+    arena[4] = arena[1];
+    return 0;
+}
+
+// --- Threads ---
+// A thread's stack is a mapping of its own, 8 MB like the C library's,
+// whose lowest bytes describe the thread: [0] its id while it runs (the
+// kernel clears it when the thread exits, and wakes join()), [1] what its
+// function returned, [2...] the arguments, which the function's thread
+// entry (made by the compiler for spawn) passes on.
+u64 __bolt_no_thread[16]; // Where the arguments go when there's no memory for a thread
+
+// Written by the compiler: clone()s a thread that calls entry(argument)
+// on 'stack' and keeps its id at 'id'
+extern int __bolt_spawn(u8* entry, u8* argument, u8* stack, u8* id);
+
+u8* __bolt_thread_new() {
+    // PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK
+    u8* thread = mmap(0, 8388608, 3, 131106, -1, 0);
+    if (u64(thread) > u64(0) - 4096) return u8*(__bolt_no_thread);
+    return thread;
+}
+
+// Starts 'thread' running at 'entry'. Returns it, for join(), or 0 if it
+// couldn't start.
+int __bolt_thread_start(u8* thread, u8* entry) {
+    if (thread == u8*(__bolt_no_thread)) return 0;
+    __bolt_threaded = 1;
+    if (__bolt_spawn(entry, thread, thread + 8388608, thread) < 0) {
+        munmap(thread, 8388608);
+        return 0;
+    }
+    return int(thread);
+}
+
+int __bolt_join(int handle) {
+    if (handle == 0) return 0;
+    u8* thread = u8*(handle);
+    i32* id = i32*(thread);
+    int running = atomic_load(id, acquire);
+    for (; running != 0;) {
+        // Not FUTEX_WAIT_PRIVATE: the kernel's wake-up at exit is shared
+        futex(thread, 0, running, 0, 0, 0);
+        running = atomic_load(id, acquire);
+    }
+    u64* fields = u64*(thread);
+    int result = fields[1];
+    munmap(thread, 8388608);
+    return result;
+}
+
+// --- Parallel for ---
+// A pool of a thread per CPU (the one running the parallel for is one of
+// them), started by the first parallel for. Each worker owns a range of
+// the iterations, packed into a u64 as start * 2^32 + end (counted from
+// the loop's first iteration) on a cache line of its own. It takes
+// chunks off the front of its range; one that has run out steals the
+// back half of another's. Idle workers sleep on a futex.
+//
+// __bolt_pool[0] is the state: the job's number * 2^32, plus 2^31 while
+// it's open to workers, plus how many are working on it. A worker only
+// reads the job while it's counted there, and the next job only starts
+// once no one is. Idle workers sleep on __bolt_pool[3], which goes up by
+// one every time a job opens: the state's low half can be back where it
+// was by then (the job closed and the next one opened), so it can't be
+// the futex they wait on.
+u64 __bolt_pool[8];     // [0] the state, [1] workers (0 until started), [2] 1 while a parallel for runs, [3] jobs opened
+u64 __bolt_job[8];      // [0] the loop body, [1] its context, [2] the first iteration, [3] the chunk size
+u64 __bolt_job_left[8]; // [0] iterations not done, [1] 1 once there are none (a futex)
+u64 __bolt_ranges[512]; // Worker w's range is at [8 * w]
+
+// Written by the compiler: calls body(context, first, end)
+extern int __bolt_invoke(u8* body, u8* context, int first, int end);
+
+int __bolt_cpu_count() {
+    u64 mask[16];
+    int bytes = sched_getaffinity(0, 128, u8*(mask));
+    int count = 0;
+    for (int i = 0; i < bytes / 8; i++) {
+        count += popcount(mask[i]);
+    }
+    if (count < 1) return 1;
+    if (count > 64) return 64;
+    return count;
+}
+
+// Moves the back half of another worker's range to 'mine'. 0 if there's
+// nothing left worth stealing.
+int __bolt_steal(u64* mine, int worker, int workers) {
+    u64* ranges = __bolt_ranges;
+    for (int i = 1; i < workers; i++) {
+        u64* theirs = ranges + 8 * ((worker + i) % workers);
+        u64 range = atomic_load(theirs, acquire);
+        u64 start = range / 4294967296;
+        u64 end = range % 4294967296;
+        if (start + 1 < end) {
+            u64 middle = start + (end - start) / 2;
+            if (atomic_cas(theirs, range, start * 4294967296 + middle, acq_rel) == range) {
+                atomic_store(mine, middle * 4294967296 + end, release);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int __bolt_parallel_work(int worker) {
+    u64* job = __bolt_job;
+    u64* left = __bolt_job_left;
+    u8* body = u8*(job[0]);
+    u8* context = u8*(job[1]);
+    int first = job[2];
+    u64 chunk = job[3];
+    u64* pool = __bolt_pool;
+    int workers = pool[1];
+    u64* ranges = __bolt_ranges;
+    u64* mine = ranges + 8 * worker;
+    for (;;) {
+        u64 range = atomic_load(mine, acquire);
+        u64 start = range / 4294967296;
+        u64 end = range % 4294967296;
+        if (start < end) {
+            u64 count = end - start;
+            if (count > chunk) count = chunk;
+            if (atomic_cas(mine, range, range + count * 4294967296, acq_rel) == range) {
+                __bolt_invoke(body, context, first + start, first + start + count);
+                // Whoever finishes the last iteration tells the caller
+                if (atomic_add(left, 0 - count, acq_rel) == count) {
+                    atomic_store(left + 1, 1, release);
+                    futex(u8*(left + 1), 129, 1, 0, 0, 0);
+                }
+            }
+        } else {
+            if (__bolt_steal(mine, worker, workers) == 0) return 0;
+        }
+    }
+    return 0;
+}
+
+int __bolt_pool_worker(int worker) {
+    u64* pool = __bolt_pool;
+    u64 seen = 0; // The last job this worker took part in
+    for (;;) {
+        // Read first: a job that opens after this changes it, so the
+        // futex doesn't sleep through it
+        u64 opened = atomic_load(pool + 3, acquire);
+        u64 state = atomic_load(pool, acquire);
+        u64 low = state % 4294967296;
+        int wait = 1;
+        if (low >= 2147483648) {
+            if (state / 4294967296 != seen) {
+                wait = 0;
+                if (atomic_cas(pool, state, state + 1, acq_rel) == state) {
+                    seen = state / 4294967296;
+                    __bolt_parallel_work(worker);
+                    // The last one out of a closed job wakes its caller
+                    if ((atomic_add(pool, -1, acq_rel) - 1) % 4294967296 == 0) {
+                        futex(u8*(pool), 129, 2147483647, 0, 0, 0);
+                    }
+                }
+            }
+        }
+        if (wait == 1) futex(u8*(pool + 3), 128, opened % 4294967296, 0, 0, 0);
+    }
+    return 0;
+}
+
+int __bolt_pool_start() {
+    u64* pool = __bolt_pool;
+    int workers = 1;
+    int cpus = __bolt_cpu_count();
+    for (int i = 1; i < cpus; i++) {
+        if (spawn __bolt_pool_worker(workers) != 0) workers++;
+    }
+    pool[1] = workers;
+    return workers;
+}
+
+// Runs body(context, i, j) over [first, end), in chunks
+int __bolt_parallel_for(u8* body, u8* context, int first, int end) {
+    if (first >= end) return 0;
+    u64* pool = __bolt_pool;
+    // One parallel for at a time has the pool; one inside it, or in
+    // another thread meanwhile, runs on its own
+    if (atomic_cas(pool + 2, 0, 1, acquire) != 0) return __bolt_invoke(body, context, first, end);
+    int workers = pool[1];
+    if (workers == 0) workers = __bolt_pool_start();
+    if (workers == 1) {
+        __bolt_invoke(body, context, first, end);
+        atomic_store(pool + 2, 0, release);
+        return 0;
+    }
+    u64* job = __bolt_job;
+    u64* left = __bolt_job_left;
+    u64* ranges = __bolt_ranges;
+    job[0] = u64(body);
+    job[1] = u64(context);
+    for (; first < end;) {
+        // Up to 2^31 iterations at a time, so a range fits in 32 bits
+        int count = end - first;
+        if (count > 2147483648) count = 2147483648;
+        u64 chunk = count / (workers * 16);
+        if (chunk < 1) chunk = 1;
+        job[2] = first;
+        job[3] = chunk;
+        left[0] = count;
+        left[1] = 0;
+        for (int w = 0; w < workers; w++) {
+            u64 start = count * w / workers;
+            u64 stop = count * (w + 1) / workers;
+            ranges[8 * w] = start * 4294967296 + stop;
+        }
+        // Open it, wake the workers, and work on it too
+        u64 state = atomic_load(pool, relaxed);
+        atomic_store(pool, (state / 4294967296 + 1) * 4294967296 + 2147483648, release);
+        atomic_add(pool + 3, 1, release);
+        futex(u8*(pool + 3), 129, 2147483647, 0, 0, 0);
+        __bolt_parallel_work(0);
+        for (; atomic_load(left + 1, acquire) == 0;) {
+            futex(u8*(left + 1), 128, 0, 0, 0, 0);
+        }
+        // Close it, and wait for the workers still in it to leave
+        state = atomic_add(pool, -2147483648, acq_rel) - 2147483648;
+        for (; state % 4294967296 != 0;) {
+            futex(u8*(pool), 128, state % 4294967296, 0, 0, 0);
+            state = atomic_load(pool, acquire);
+        }
+        first += count;
+    }
+    atomic_store(pool + 2, 0, release);
+    return 0;
+}
+)";
+
+ProgramNode parse_runtime_library() {
+    Lexer lexer(RUNTIME_LIBRARY_SOURCE);
+    Parser parser(lexer.tokenize());
+    ProgramNode program = parser.parse();
+    if (parser.had_error()) throw std::runtime_error("The runtime library doesn't parse");
+    return program;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "mir.hpp"
+#include "options.hpp"
+#include "parser.hpp"
+#include "types.hpp"
+#include <set>
+#include <string>
+#include <vector>
+
+// --- Runtime ---
+// What Bolt programs get without declaring it: write(), read(), exit(),
+// mmap(), munmap(), futex() and sched_getaffinity(), each a raw Linux system call in a wrapper of a few
+// instructions. They follow the System V ABI, but a call to one only
+// overwrites what 'syscall' does (rax, rcx, r11), so the caller's values
+// stay in their registers around it. exit() ends the process right away:
+// nothing registered with atexit() runs, but a -fprofile-generate
+// program still writes its profile.
+//
+// A program may define a function with one of these names; then that's
+// the one its calls go to.
+//
+// With -ffreestanding the program doesn't need the C library at all:
+// the runtime brings its own entry point, _start, which calls main() and
+// exits with what it returns. Linked statically ('ld -static'), such a
+// program has no dynamic loader and no libc to initialize, and starts in
+// microseconds (bench/startup.sh measures it).
+//
+// On top of those sits a library written in Bolt itself, compiled along
+// with the program when it uses any of it (and only what it uses). First,
+// buffered I/O:
+//
+//     print(x, ...)  each argument: an integer in decimal, or a string (u8*)
+//     flush()        writes out what print() has buffered
+//     read_int()     skips whitespace, reads an integer; 0 if there is none
+//     read_byte()    the next byte of standard input, or -1 at its end
+//
+// print() fills a 4 KB buffer and only makes a system call when it's
+// full, on flush(), and when the program ends (returning from main, or
+// exit()). Something written with write() in between overtakes it. Input
+// is read 4 KB at a time too. Being Bolt code, the library is optimized
+// with the program, but print() and read_int() stay calls (there is no
+// inliner). They use the internal convention, so they only overwrite the
+// registers the library really uses.
+//
+// Then, a heap:
+//
+//     alloc(n)             n bytes, 16-byte aligned; 0 if there's no memory
+//                          (or n isn't positive)
+//     dealloc(p)           gives back what alloc() returned (or 0)
+//     arena_new(n)         an arena, starting with about n bytes
+//     arena_alloc(a, n)    n bytes from arena 'a', 16-byte aligned (0 if n
+//                          isn't positive)
+//     arena_reset(a)       frees everything allocated from 'a' at once
+//
+// alloc() rounds small sizes up to a power of two and takes a block from
+// that size's free list, or off the end of the last 64 KB it got for it;
+// dealloc() puts it back on the list. Both are a few instructions without
+// a system call. Sizes above 2 KB get memory straight from mmap(), which
+// dealloc() unmaps. An arena only bumps a pointer, and arena_reset() sets
+// it back, in O(1); its memory stays with it for the next round.
+//
+// Then, threads:
+//
+//     spawn f(a, b)    runs f(a, b) in a thread of its own; the thread,
+//                      or 0 if it couldn't start
+//     join(t)          waits for thread t to end; what f returned
+//     parallel for (int i = a; i < b; i++) { ... }
+//                      the iterations, split over a pool of threads
+//
+// A thread's stack is an 8 MB mapping, which join() unmaps. parallel for
+// runs the loop's body as a function of its own (see irgen.hpp) on a
+// pool of a thread per CPU, started by the first one. Each thread of
+// the pool works through a range of the iterations a chunk at a time,
+// and steals half of another's range when it runs out, so uneven
+// iterations still spread evenly. A parallel for inside another (or one
+// in another thread at the same time) runs in the thread that gets to it.
+//
+// Threads share memory through atomics, builtins on a pointer to an
+// integer (like C++'s atomic_ref):
+//
+//     atomic_load(p, order)                 atomic_store(p, v, order)
+//     atomic_add(p, v, order)               atomic_exchange(p, v, order)
+//     atomic_cas(p, expected, desired, order)
+//     fence(order)
+//
+// 'order' is relaxed, acquire, release, acq_rel or seq_cst. The others
+// return what *p held before. print() and the heap take a lock once a
+// thread has started; arenas don't, so an arena belongs to one thread.
+// Reading input is for one thread too. There's no thread-local storage,
+// so threads mustn't call into the C library.
+
+struct RuntimeFunction {
+    std::string name;   // What the program calls: write(1, "hi\n", 3)
+    std::string symbol; // Its label in the assembly
+    int syscall;        // The Linux x86-64 system call number
+    TypeId return_type;
+    std::vector<TypeId> parameters;
+};
+
+const std::vector<RuntimeFunction>& runtime_functions();
+// The runtime function with label 'symbol', or null
+const RuntimeFunction* find_runtime_symbol(const std::string& symbol);
+
+// The registers a call to runtime function 'function' overwrites
+std::vector<int> runtime_clobbers(const RuntimeFunction& function);
+
+// Assembly the runtime library calls for what Bolt can't say:
+//   __bolt_spawn(entry, argument, stack top, id address) starts a thread
+//     that runs entry(argument) and exits; returns its id or -errno
+//   __bolt_invoke(function, a, b, c) calls function(a, b, c) (internal
+//     convention), which is how parallel for runs its loop bodies, and
+//     next() a generator's state machine
+struct RuntimeHelper {
+    std::string symbol;
+    CallingConvention convention;
+    std::vector<int> clobbers; // Empty: every caller-saved register
+};
+const std::vector<RuntimeHelper>& runtime_helpers();
+// A runtime function or helper: emit_runtime() brings it
+bool is_runtime_symbol(const std::string& symbol);
+
+// The assembly of the runtime functions and helpers whose labels are in
+// 'used', and of _start with -ffreestanding. Goes in .text.
+// 'buffered_output' says the program uses print(), so the buffer must be
+// flushed before exiting.
+std::string emit_runtime(const std::set<std::string>& used, bool buffered_output, const CompilerOptions& options);
+
+// The runtime library, parsed. Its functions and globals are named
+// __bolt_*; __bolt_flush follows the System V ABI, for exit paths outside
+// Bolt code to call it.
+ProgramNode parse_runtime_library();
@@ -0,0 +1,141 @@
+#include "strength.hpp"
+
+// --- Multiplication ---
+
+// What one step does to the running multiplier (t = m * x)
+static uint64_t apply_step(const MulStep& step, uint64_t m) {
+    switch (step.kind) {
+        case MulStep::Shl:      return m << step.amount;
+        case MulStep::LeaScale: return m + m * static_cast<uint64_t>(step.amount);
+        case MulStep::AddX:     return m + 1;
+        case MulStep::SubX:     return m - 1;
+        case MulStep::Neg:      return 0 - m;
+    }
+    return m;
+}
+
+static std::vector<MulStep> all_steps() {
+    std::vector<MulStep> steps;
+    // Single 'lea's first: they don't need a copy of x
+    for (int scale : {2, 4, 8}) steps.push_back({MulStep::LeaScale, scale});
+    for (int amount = 1; amount < 64; amount++) steps.push_back({MulStep::Shl, amount});
+    steps.push_back({MulStep::AddX});
+    steps.push_back({MulStep::SubX});
+    steps.push_back({MulStep::Neg});
+    return steps;
+}
+
+// Depth-first search for exactly 'depth' more steps that turn 'm' into 'target'
+static bool search(uint64_t m, uint64_t target, int depth, std::vector<MulStep>& sequence) {
+    if (depth == 0) return m == target;
+
+    static const std::vector<MulStep> steps = all_steps();
+    for (const MulStep& step : steps) {
+        sequence.push_back(step);
+        if (search(apply_step(step, m), target, depth - 1, sequence)) return true;
+        sequence.pop_back();
+    }
+    return false;
+}
+
+std::vector<MulStep> find_mul_sequence(int64_t c, int max_steps) {
+    // Wrapping math: the low 64 bits of x * c are the same signed or not
+    uint64_t target = static_cast<uint64_t>(c);
+    std::vector<MulStep> sequence;
+    for (int depth = 1; depth <= max_steps; depth++) {
+        if (search(1, target, depth, sequence)) return sequence;
+    }
+    return {};
+}
+
+// --- Division ---
+
+bool is_power_of_two(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+int log2_exact(uint64_t power_of_two) {
+    int log = 0;
+    while (power_of_two > 1) {
+        power_of_two >>= 1;
+        log++;
+    }
+    return log;
+}
+
+SignedMagic signed_div_magic(int64_t divisor) {
+    // Hacker's Delight, figure 10-1, widened to 64 bits. Everything is
+    // unsigned so the intermediate doublings can't overflow.
+    const uint64_t two63 = 1ULL << 63;
+    uint64_t d = static_cast<uint64_t>(divisor);
+    uint64_t ad = divisor < 0 ? 0 - d : d;
+    uint64_t t = two63 + (d >> 63);
+    uint64_t anc = t - 1 - t % ad; // |nc|, the largest "critical" dividend
+
+    int p = 63;
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc; // 2^p / |nc|
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;   // 2^p / |d|
+    uint64_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    SignedMagic magic;
+    uint64_t multiplier = q2 + 1;
+    magic.multiplier = static_cast<int64_t>(divisor < 0 ? 0 - multiplier : multiplier);
+    magic.shift = p - 64;
+    return magic;
+}
+
+UnsignedMagic unsigned_div_magic(uint64_t d) {
+    // Hacker's Delight, figure 10-2 ('magicu2'), widened to 64 bits.
+    // If the multiplier needs 65 bits, 'add' is set and the caller uses
+    // the add-and-halve sequence instead.
+    const uint64_t two63 = 1ULL << 63;
+    bool add = false;
+    uint64_t nc = UINT64_MAX - (0 - d) % d;
+
+    int p = 63;
+    uint64_t q1 = two63 / nc, r1 = two63 - q1 * nc;                 // 2^p / nc
+    uint64_t q2 = (two63 - 1) / d, r2 = (two63 - 1) - q2 * d;       // (2^p - 1) / d
+    uint64_t delta;
+    do {
+        p++;
+        if (r1 >= nc - r1) {
+            q1 = 2 * q1 + 1;
+            r1 = 2 * r1 - nc;
+        } else {
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+        }
+        if (r2 + 1 >= d - r2) {
+            if (q2 >= two63 - 1) add = true;
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - d;
+        } else {
+            if (q2 >= two63) add = true;
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+        delta = d - 1 - r2;
+    } while (p < 128 && (q1 < delta || (q1 == delta && r1 == 0)));
+
+    UnsignedMagic magic;
+    magic.multiplier = q2 + 1;
+    magic.shift = p - 64;
+    magic.add = add;
+    return magic;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// --- Strength Reduction Helpers ---
+// Multiplying or dividing by a constant doesn't need 'imul' or 'idiv':
+//  * x * c can be a couple of shifts, adds and 'lea's,
+//  * x / c can be a multiply by a "magic" number and a shift
+//    (Granlund & Montgomery, "Division by Invariant Integers using
+//    Multiplication", and Hacker's Delight chapter 10).
+// The instruction selector uses these to emit the cheap sequences.
+
+// --- Multiplication ---
+
+// One step of a multiply-by-constant sequence. 't' starts as 'x'.
+struct MulStep {
+    enum Kind {
+        Shl,      // t = t << amount
+        LeaScale, // t = t + t * amount   (amount is 2, 4 or 8: one 'lea')
+        AddX,     // t = t + x
+        SubX,     // t = t - x
+        Neg,      // t = -t
+    };
+    Kind kind;
+    int amount = 0;
+};
+
+// Finds a sequence of at most 'max_steps' steps that computes x * c.
+// Returns an empty vector if there isn't one (then 'imul' is the better choice).
+std::vector<MulStep> find_mul_sequence(int64_t c, int max_steps = 2);
+
+// --- Division ---
+
+bool is_power_of_two(uint64_t value);
+int log2_exact(uint64_t power_of_two);
+
+// Signed: q = (mulhi(x, multiplier) [+/- x]) >> shift, plus one for negative q
+struct SignedMagic {
+    int64_t multiplier;
+    int shift;
+};
+// 'divisor' must not be 0, 1, -1 or a power of two (those have cheaper tricks)
+SignedMagic signed_div_magic(int64_t divisor);
+
+// Unsigned: q = mulhi(x, multiplier) >> shift, or when 'add' is set
+//           q = (((x - t) >> 1) + t) >> (shift - 1) with t = mulhi(x, multiplier)
+struct UnsignedMagic {
+    uint64_t multiplier;
+    int shift;
+    bool add;
+};
+// 'divisor' must not be 0 or a power of two
+UnsignedMagic unsigned_div_magic(uint64_t divisor);
@@ -0,0 +1,304 @@
+#include "switch.hpp"
+#include <algorithm>
+#include <map>
+#include <set>
+
+// Jump tables: enough cases, dense enough, and not too big
+static const int MIN_JUMP_TABLE_CASES = 4;
+static const int MIN_JUMP_TABLE_DENSITY = 40; // Percent of the entries that aren't the default
+static const int64_t MAX_JUMP_TABLE_SIZE = 4096;
+
+// Bit tests: how many compares a cluster with 1, 2 or 3 targets has to
+// replace to be worth its range check
+static const int MIN_BIT_TEST_COMPARES[] = {0, 3, 5, 6};
+
+// This many clusters or fewer are tested one by one
+static const size_t MAX_LINEAR_CLUSTERS = 3;
+
+typedef __int128 wide;
+typedef std::vector<std::pair<int64_t, BasicBlock*>> CaseList;
+
+// A piece of a switch: the values lo ... hi, and where they go
+struct Cluster {
+    enum class Kind { Range, JumpTable, BitTest };
+    Kind kind;
+    int64_t lo;
+    int64_t hi;
+    BasicBlock* target; // Range: every value in it goes here
+    CaseList cases;     // JumpTable, BitTest: the values it handles (the rest are a miss)
+};
+
+// --- Clustering ---
+
+// Consecutive values going to the same place become one range
+static std::vector<Cluster> make_ranges(const CaseList& cases) {
+    std::vector<Cluster> ranges;
+    for (const auto& entry : cases) {
+        if (!ranges.empty() && ranges.back().target == entry.second && ranges.back().hi != INT64_MAX &&
+            ranges.back().hi + 1 == entry.first) {
+            ranges.back().hi = entry.first;
+            ranges.back().cases.push_back(entry);
+        } else {
+            ranges.push_back({Cluster::Kind::Range, entry.first, entry.first, entry.second, {entry}});
+        }
+    }
+    return ranges;
+}
+
+static Cluster merge(const std::vector<Cluster>& ranges, size_t first, size_t last, Cluster::Kind kind) {
+    Cluster cluster{kind, ranges[first].lo, ranges[last].hi, nullptr, {}};
+    for (size_t i = first; i <= last; i++) {
+        cluster.cases.insert(cluster.cases.end(), ranges[i].cases.begin(), ranges[i].cases.end());
+    }
+    return cluster;
+}
+
+// Splits the ranges into as few clusters as possible, where a cluster is a
+// single range or a jump table (dynamic programming over where tables start)
+static std::vector<Cluster> find_jump_tables(const std::vector<Cluster>& ranges) {
+    size_t n = ranges.size();
+    std::vector<size_t> best(n + 1, 0);   // Clusters needed for ranges[i ...]
+    std::vector<size_t> table_end(n, 0);  // The last range of the table starting at i; i if none
+    for (size_t i = n; i-- > 0;) {
+        best[i] = best[i + 1] + 1;
+        table_end[i] = i;
+        int64_t values = 0;
+        for (size_t j = i; j < n; j++) {
+            values += static_cast<int64_t>(ranges[j].cases.size());
+            wide size = wide(ranges[j].hi) - ranges[i].lo + 1;
+            if (size > MAX_JUMP_TABLE_SIZE) break;
+            bool dense = values >= MIN_JUMP_TABLE_CASES && values * 100 >= size * MIN_JUMP_TABLE_DENSITY;
+            if (j > i && dense && best[j + 1] + 1 < best[i]) {
+                best[i] = best[j + 1] + 1;
+                table_end[i] = j;
+            }
+        }
+    }
+
+    std::vector<Cluster> clusters;
+    for (size_t i = 0; i < n;) {
+        if (table_end[i] == i) {
+            clusters.push_back(ranges[i++]);
+        } else {
+            clusters.push_back(merge(ranges, i, table_end[i], Cluster::Kind::JumpTable));
+            i = table_end[i] + 1;
+        }
+    }
+    return clusters;
+}
+
+// Runs of ranges that fit in 64 values and go to at most 3 places become
+// bit tests, if they replace enough compares
+static std::vector<Cluster> find_bit_tests(const std::vector<Cluster>& clusters) {
+    std::vector<Cluster> result;
+    for (size_t i = 0; i < clusters.size();) {
+        if (clusters[i].kind != Cluster::Kind::Range) {
+            result.push_back(clusters[i++]);
+            continue;
+        }
+        std::set<BasicBlock*> targets;
+        size_t j = i;
+        for (; j < clusters.size() && clusters[j].kind == Cluster::Kind::Range; j++) {
+            if (wide(clusters[j].hi) - clusters[i].lo >= 64) break;
+            targets.insert(clusters[j].target);
+            if (targets.size() > 3) {
+                targets.erase(clusters[j].target);
+                break;
+            }
+        }
+        size_t compares = j - i;
+        if (compares >= static_cast<size_t>(MIN_BIT_TEST_COMPARES[targets.size()])) {
+            result.push_back(merge(clusters, i, j - 1, Cluster::Kind::BitTest));
+            i = j;
+        } else {
+            result.push_back(clusters[i++]);
+        }
+    }
+    return result;
+}
+
+// --- Lowering ---
+
+class SwitchLowering {
+public:
+    SwitchLowering(IRFunction& function, Instr* term, SwitchStats& stats)
+        : m_function(function), m_builder(&function), m_origin(term->parent), m_value(term->operands[0]),
+          m_default(term->targets[0]), m_targets(term->targets), m_stats(stats) {
+        for (const auto& entry : term->cases) {
+            m_cases.push_back({entry.first, term->targets[entry.second]});
+        }
+        // New blocks go right after the switch, in the order they're made
+        auto it = std::find_if(function.blocks.begin(), function.blocks.end(),
+            [&](const std::unique_ptr<BasicBlock>& block) { return block.get() == m_origin; });
+        m_following = it + 1 == function.blocks.end() ? nullptr : (it + 1)->get();
+    }
+
+    void run() {
+        std::vector<Cluster> clusters = find_bit_tests(find_jump_tables(make_ranges(m_cases)));
+        // A single jump table is what the Switch already is
+        if (clusters.size() == 1 && clusters[0].kind == Cluster::Kind::JumpTable) {
+            m_stats.jump_tables++;
+            return;
+        }
+
+        m_origin->instrs.pop_back();
+        m_blocks.push_back(m_origin);
+        if (clusters.empty()) {
+            // Only a default (not simplified away at -O0)
+            m_builder.set_insert_point(m_origin);
+            m_builder.br(m_default);
+            return;
+        }
+        emit_tree(m_origin, clusters, 0, clusters.size(), INT64_MIN, INT64_MAX);
+        update_phis();
+    }
+
+private:
+    IRFunction& m_function;
+    IRBuilder m_builder;
+    BasicBlock* m_origin;
+    Instr* m_value;
+    BasicBlock* m_default;
+    std::vector<BasicBlock*> m_targets;
+    CaseList m_cases;
+    BasicBlock* m_following;
+    std::vector<BasicBlock*> m_blocks; // Where the code of the switch is now
+    SwitchStats& m_stats;
+
+    BasicBlock* new_block() {
+        BasicBlock* block = m_following ? m_function.create_block_before(m_following) : m_function.create_block();
+        m_blocks.push_back(block);
+        return block;
+    }
+
+    void branch(BasicBlock* block, Instr* condition, BasicBlock* if_true, BasicBlock* if_false) {
+        m_builder.set_insert_point(block);
+        m_builder.cond_br(condition, if_true, if_false);
+    }
+
+    // Finds the cluster for a value known to be in [lo, hi], in 'block'
+    void emit_tree(BasicBlock* block, const std::vector<Cluster>& clusters, size_t first, size_t last,
+                   int64_t lo, int64_t hi) {
+        if (last - first <= MAX_LINEAR_CLUSTERS) {
+            for (size_t i = first; i < last; i++) {
+                BasicBlock* miss = i + 1 == last ? m_default : new_block();
+                emit_cluster(block, clusters[i], miss, lo, hi);
+                block = miss;
+            }
+            return;
+        }
+
+        //   condbr value < pivot, left, right
+        size_t middle = (first + last) / 2;
+        int64_t pivot = clusters[middle].lo;
+        BasicBlock* left = new_block();
+        BasicBlock* right = new_block();
+        m_builder.set_insert_point(block);
+        branch(block, m_builder.cmp(CondCode::LT, m_value, m_builder.const_int(pivot)), left, right);
+        m_stats.compares++;
+        emit_tree(left, clusters, first, middle, lo, pivot - 1);
+        emit_tree(right, clusters, middle, last, pivot, hi);
+    }
+
+    // Goes to the cluster's target(s) if the value is in it, else to 'miss'
+    void emit_cluster(BasicBlock* block, const Cluster& cluster, BasicBlock* miss, int64_t lo, int64_t hi) {
+        m_builder.set_insert_point(block);
+        switch (cluster.kind) {
+            case Cluster::Kind::Range:
+                m_stats.compares++;
+                branch(block, in_range(cluster.lo, cluster.hi, lo, hi), cluster.target, miss);
+                break;
+            case Cluster::Kind::JumpTable:
+                m_stats.jump_tables++;
+                m_builder.switch_br(m_value, miss, cluster.cases);
+                break;
+            case Cluster::Kind::BitTest:
+                m_stats.bit_tests++;
+                emit_bit_tests(block, cluster, miss, lo, hi);
+                break;
+        }
+    }
+
+    // value in [from, to]? Checks only the ends that [lo, hi] doesn't rule out.
+    Instr* in_range(int64_t from, int64_t to, int64_t lo, int64_t hi) {
+        if (from == to) return m_builder.cmp(CondCode::EQ, m_value, m_builder.const_int(from));
+        if (lo >= from && hi <= to) return m_builder.const_int(1);
+        if (lo >= from) return m_builder.cmp(CondCode::LE, m_value, m_builder.const_int(to));
+        if (hi <= to) return m_builder.cmp(CondCode::GE, m_value, m_builder.const_int(from));
+        // One unsigned compare: below 'from' wraps around to huge
+        Instr* offset = m_builder.binary(Opcode::Sub, m_value, m_builder.const_int(from));
+        return m_builder.cmp(CondCode::ULE, offset, m_builder.const_int(to - from));
+    }
+
+    //   offset = value - lo
+    //   condbr offset <=u hi - lo, test, miss
+    // test:
+    //   condbr bittest offset, mask1, target1, next     (most values first)
+    // next:
+    //   ...
+    void emit_bit_tests(BasicBlock* block, const Cluster& cluster, BasicBlock* miss, int64_t lo, int64_t hi) {
+        std::map<BasicBlock*, uint64_t> masks;
+        for (const auto& entry : cluster.cases) {
+            masks[entry.second] |= uint64_t(1) << (entry.first - cluster.lo);
+        }
+        std::vector<std::pair<BasicBlock*, uint64_t>> tests(masks.begin(), masks.end());
+        std::stable_sort(tests.begin(), tests.end(), [](const auto& a, const auto& b) {
+            return __builtin_popcountll(a.second) > __builtin_popcountll(b.second);
+        });
+
+        Instr* offset = m_builder.binary(Opcode::Sub, m_value, m_builder.const_int(cluster.lo));
+        if (lo < cluster.lo || hi > cluster.hi) {
+            BasicBlock* test = new_block();
+            branch(block, m_builder.cmp(CondCode::ULE, offset, m_builder.const_int(cluster.hi - cluster.lo)), test, miss);
+            block = test;
+        }
+        for (size_t i = 0; i < tests.size(); i++) {
+            BasicBlock* next = i + 1 == tests.size() ? miss : new_block();
+            m_builder.set_insert_point(block);
+            branch(block, m_builder.bit_test(offset, tests[i].second), tests[i].first, next);
+            block = next;
+        }
+    }
+
+    // The targets' phis had one incoming value from the switch; now every
+    // block of it that jumps there brings that value
+    void update_phis() {
+        for (BasicBlock* target : m_targets) {
+            std::vector<BasicBlock*> sources;
+            for (BasicBlock* block : m_blocks) {
+                std::vector<BasicBlock*> succs = block->successors();
+                if (std::find(succs.begin(), succs.end(), target) != succs.end()) sources.push_back(block);
+            }
+            for (Instr* phi : target->phis()) {
+                Instr* value = phi->incoming_value(m_origin);
+                for (size_t i = phi->targets.size(); i-- > 0;) {
+                    if (phi->targets[i] == m_origin) {
+                        phi->targets.erase(phi->targets.begin() + i);
+                        phi->operands.erase(phi->operands.begin() + i);
+                    }
+                }
+                for (BasicBlock* source : sources) {
+                    phi->targets.push_back(source);
+                    phi->operands.push_back(value);
+                }
+            }
+        }
+    }
+};
+
+SwitchStats lower_switches(IRFunction& function) {
+    SwitchStats stats;
+    std::vector<Instr*> switches;
+    for (auto& block : function.blocks) {
+        Instr* term = block->terminator();
+        if (term && term->op == Opcode::Switch) switches.push_back(term);
+    }
+    for (Instr* term : switches) {
+        SwitchLowering(function, term, stats).run();
+    }
+    if (!switches.empty()) {
+        function.remove_unreachable_blocks();
+        function.compute_predecessors();
+    }
+    return stats;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ir.hpp"
+
+// --- Switch Lowering ---
+// The optimizer sees a 'switch' as one Switch terminator. Right before
+// instruction selection it's turned into code the CPU can run, picked by
+// how the case values are spread out:
+//
+//  - Jump tables, for runs of cases that are dense enough (at least 4
+//    cases filling at least 40% of the table): one range check and an
+//    indirect jump through a table of 32-bit offsets in .rodata. These
+//    stay Switch instructions; the instruction selector emits them.
+//  - Bit tests, for cases that fit in a 64-value window and go to at most
+//    3 places: 'case 1, 3, 4, 9, 10:' is one range check and one 'bt'
+//    against the constant 0b11000011010 (Opcode::BitTest).
+//  - Everything else is a compare, against a single value or a range of
+//    consecutive values going to the same place.
+//
+// Those pieces, sorted by value, become a balanced binary search tree
+// ('value < 100?'), so finding the right one takes O(log n) compares;
+// the last 3 or fewer are tested one after the other.
+
+struct SwitchStats {
+    int jump_tables = 0;
+    int bit_tests = 0;
+    int compares = 0; // Values and ranges compared against
+};
+
+// Rewrites every Switch that doesn't become a single jump table. Adds
+// blocks, so the CFG analyses have to be redone.
+SwitchStats lower_switches(IRFunction& function);
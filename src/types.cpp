@@ -0,0 +1,184 @@
+#include "types.hpp"
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <unordered_map>
+
+// A deque, so declaring a struct doesn't move the TypeInfos that
+// type_info() handed out
+static std::deque<TypeInfo>& type_table() {
+    // In TypeId order
+    static std::deque<TypeInfo> table = {
+        {"i8",        ValueType::I64,  1,  true,  true,  1},
+        {"i16",       ValueType::I64,  2,  true,  true,  2},
+        {"i32",       ValueType::I64,  4,  true,  true,  4},
+        {"i64",       ValueType::I64,  8,  true,  true,  8},
+        {"u8",        ValueType::I64,  1,  true,  false, 1},
+        {"u16",       ValueType::I64,  2,  true,  false, 2},
+        {"u32",       ValueType::I64,  4,  true,  false, 4},
+        {"u64",       ValueType::I64,  8,  true,  false, 8},
+        {"int32x4",   ValueType::V4I32, 16, false, false, 16},
+        {"int32x8",   ValueType::V8I32, 32, false, false, 32},
+        {"float32x8", ValueType::V8F32, 32, false, false, 32},
+    };
+    return table;
+}
+
+static TypeId add_type(TypeInfo info) {
+    std::deque<TypeInfo>& table = type_table();
+    if (table.size() >= INVALID_TYPE) {
+        throw std::runtime_error("Too many types");
+    }
+    table.push_back(std::move(info));
+    return static_cast<TypeId>(table.size() - 1);
+}
+
+const TypeInfo& type_info(TypeId type) {
+    return type_table()[type];
+}
+
+TypeId find_type(const std::string& name) {
+    static const std::unordered_map<std::string, TypeId> aliases = {
+        {"int", TYPE_I64},
+        {"char", TYPE_I8},
+    };
+    auto alias = aliases.find(name);
+    if (alias != aliases.end()) return alias->second;
+
+    const std::deque<TypeInfo>& table = type_table();
+    for (size_t id = 0; id < table.size(); id++) {
+        if (table[id].name == name) return static_cast<TypeId>(id);
+    }
+    return INVALID_TYPE;
+}
+
+TypeId declare_struct(const std::string& name, std::vector<StructField> fields, bool is_ordered, bool is_soa) {
+    if (find_type(name) != INVALID_TYPE) {
+        throw std::runtime_error("Redefinition of type '" + name + "'");
+    }
+    if (fields.empty()) {
+        throw std::runtime_error("Struct '" + name + "' has no fields");
+    }
+    for (size_t i = 0; i < fields.size(); i++) {
+        const StructField& field = fields[i];
+        if (is_array_type(field.type)) {
+            throw std::runtime_error("Field '" + field.name + "' of '" + name + "' can't be an array");
+        }
+        for (size_t j = 0; j < i; j++) {
+            if (fields[j].name == field.name) {
+                throw std::runtime_error("Struct '" + name + "' has two fields called '" + field.name + "'");
+            }
+        }
+    }
+
+    // The order the fields go in memory: as declared, or by alignment.
+    // The sort is stable, so equally aligned fields keep their order.
+    std::vector<size_t> order(fields.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    if (!is_ordered) {
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return type_info(fields[a].type).align > type_info(fields[b].type).align;
+        });
+    }
+
+    TypeInfo info = {name, ValueType::I64, 0, false, false, 1};
+    for (size_t i : order) {
+        const TypeInfo& field = type_info(fields[i].type);
+        info.size = (info.size + field.align - 1) / field.align * field.align;
+        fields[i].offset = info.size;
+        info.size += field.size;
+        info.align = std::max(info.align, field.align);
+    }
+    // Padded at the end too, so every element of an array is aligned
+    info.size = (info.size + info.align - 1) / info.align * info.align;
+    info.is_struct = true;
+    info.fields = std::move(fields);
+    info.is_ordered = is_ordered;
+    info.is_soa = is_soa;
+
+    return add_type(std::move(info));
+}
+
+TypeId pointer_type(TypeId element) {
+    std::string name = type_name(element) + "*";
+    TypeId existing = find_type(name);
+    if (existing != INVALID_TYPE) return existing;
+
+    TypeInfo info = {name, ValueType::I64, 8, false, false, 8};
+    info.is_pointer = true;
+    info.element = element;
+    return add_type(std::move(info));
+}
+
+TypeId array_type(TypeId element, int64_t length) {
+    // Outer length first, like the declaration: i32[4][8] holds 4 i32[8]s
+    std::string name = type_name(element);
+    size_t dims = is_array_type(element) ? name.find('[', name.rfind('*') + 1) : name.size();
+    name.insert(dims, "[" + std::to_string(length) + "]");
+    TypeId existing = find_type(name);
+    if (existing != INVALID_TYPE) return existing;
+
+    const TypeInfo& elem = type_info(element);
+    if (length < 1) {
+        throw std::runtime_error("Array '" + name + "' must have at least one element");
+    }
+    const int64_t max_size = int64_t(1) << 31;
+    if (length >= max_size / elem.size) {
+        throw std::runtime_error("Array '" + name + "' is too big");
+    }
+
+    TypeInfo info = {name, ValueType::I64, 0, false, false, elem.align};
+    if (elem.is_soa) {
+        // One array per field, in the order the fields are in memory
+        std::vector<size_t> order(elem.fields.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return elem.fields[a].offset < elem.fields[b].offset;
+        });
+        int64_t size = 0;
+        info.soa_offsets.resize(elem.fields.size());
+        for (size_t i : order) {
+            const TypeInfo& field = type_info(elem.fields[i].type);
+            size = (size + field.align - 1) / field.align * field.align;
+            info.soa_offsets[i] = size;
+            size += length * field.size;
+        }
+        info.size = static_cast<int>((size + elem.align - 1) / elem.align * elem.align);
+    } else {
+        info.size = static_cast<int>(length * elem.size);
+    }
+    info.is_array = true;
+    info.element = element;
+    info.length = length;
+    return add_type(std::move(info));
+}
+
+int find_field(TypeId type, const std::string& name) {
+    const std::vector<StructField>& fields = type_info(type).fields;
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].name == name) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+bool is_free_conversion(TypeId from, TypeId to) {
+    if (from == to) return true;
+    const TypeInfo& a = type_info(from);
+    const TypeInfo& b = type_info(to);
+    if (!a.is_integer || !b.is_integer) return false;
+    // Same width: only i64 <-> u64, which share every bit pattern anyway
+    if (a.size == 8 && b.size == 8) return true;
+    if (a.is_signed == b.is_signed) return a.size <= b.size;
+    // An unsigned type fits in any wider signed one
+    return !a.is_signed && a.size < b.size;
+}
+
+TypeId arithmetic_type(TypeId a, TypeId b) {
+    return a == TYPE_U64 || b == TYPE_U64 ? TYPE_U64 : TYPE_I64;
+}
+
+int64_t wrap_to_type(TypeId type, int64_t value) {
+    const TypeInfo& info = type_info(type);
+    if (info.size == 8) return value;
+    return fold_extend(info.is_signed ? Opcode::SExt : Opcode::ZExt, info.size * 8, value);
+}
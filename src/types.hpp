@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ir.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --- Types ---
+// Every type of the language is interned: a TypeId is a small index into
+// one table, so the AST and the IR generator pass types around and
+// compare them as integers. Names like "u8" are only looked up once, by
+// the parser.
+//
+// The integer types are i8, i16, i32, i64 and u8 ... u64 ('int' is i64,
+// 'char' is i8). In a register every integer is 64 bits wide, kept sign-
+// or zero-extended from its own width, so reading one is free; only
+// storing a value into a narrower type costs a 'movsx'/'movzx'. In memory
+// a value takes just its own width.
+//
+// Structs are interned when the parser sees their definition:
+//
+//     struct Particle { u8 alive; i64 x; u8 kind; i32 ttl; };
+//
+// The compiler is free to lay the fields out in any order, and sorts them
+// by alignment, largest first, which leaves no padding between them
+// (every size here is a multiple of its alignment): Particle takes 16
+// bytes, where C's order would take 24. '@ordered' keeps the declared
+// order, with C's padding rules, for layouts that must match something
+// outside the program. '@soa' asks for an array of the struct to be
+// stored as one array per field, so a loop that only reads 'x' streams
+// only the 'x's.
+//
+// Pointers ("u8*") and arrays ("i32[100]") are interned the first time
+// they're asked for. A pointer is a 64-bit address. An array lives in
+// memory, N elements back to back; an array of a '@soa' struct is one
+// array per field instead, in the struct's field order, each aligned.
+
+typedef uint16_t TypeId;
+
+// The built-in types, interned first, so their ids are these constants
+enum : TypeId {
+    TYPE_I8, TYPE_I16, TYPE_I32, TYPE_I64,
+    TYPE_U8, TYPE_U16, TYPE_U32, TYPE_U64,
+    TYPE_INT32X4, TYPE_INT32X8, TYPE_FLOAT32X8,
+    NUM_BUILTIN_TYPES
+};
+
+const TypeId INVALID_TYPE = 0xFFFF;
+
+struct StructField {
+    std::string name;
+    TypeId type;
+    int offset = 0;         // In bytes, from the start of the struct
+};
+
+struct TypeInfo {
+    std::string name;
+    ValueType value_type;   // How the IR holds a value of this type (not structs)
+    int size;               // Bytes in memory
+    bool is_integer;
+    bool is_signed;         // Integers only
+    int align = 0;          // Bytes; the size, for integers and vectors
+
+    // Structs only
+    bool is_struct = false;
+    std::vector<StructField> fields = {}; // In declaration order
+    bool is_ordered = false;              // @ordered: laid out in declaration order
+    bool is_soa = false;                  // @soa: arrays of it are stored field by field
+
+    // Pointers and arrays
+    bool is_pointer = false;
+    bool is_array = false;
+    TypeId element = INVALID_TYPE;         // What it points to, or holds
+    int64_t length = 0;                    // Arrays: the number of elements
+    std::vector<int64_t> soa_offsets = {}; // Arrays of @soa structs: where each field's array starts
+};
+
+const TypeInfo& type_info(TypeId type);
+inline const std::string& type_name(TypeId type) { return type_info(type).name; }
+inline bool is_integer_type(TypeId type) { return type_info(type).is_integer; }
+inline bool is_struct_type(TypeId type) { return type_info(type).is_struct; }
+inline bool is_vector_type(TypeId type) { return is_vector(type_info(type).value_type); }
+inline bool is_pointer_type(TypeId type) { return type_info(type).is_pointer; }
+inline bool is_array_type(TypeId type) { return type_info(type).is_array; }
+
+// Interns a struct and lays it out (see above). Throws if the name is
+// taken, or a field is repeated.
+TypeId declare_struct(const std::string& name, std::vector<StructField> fields, bool is_ordered, bool is_soa);
+// The index of the field called 'name' in struct 'type', or -1
+int find_field(TypeId type, const std::string& name);
+
+// The type called 'name' ("u16", "int", "int32x4", ...), or INVALID_TYPE
+TypeId find_type(const std::string& name);
+
+// "T*" and "T[length]", interned on first use. Throws if the array is
+// empty or too big (2 GB).
+TypeId pointer_type(TypeId element);
+TypeId array_type(TypeId element, int64_t length);
+
+// True if converting needs no code: every value of 'from' is also a value
+// of 'to' (u8 -> i16, but not i8 -> u16), or both are 64 bits wide
+bool is_free_conversion(TypeId from, TypeId to);
+
+// The type of 'a + b', 'a < b', ...: every integer is widened to 64 bits
+// first, and the result is u64 if either side is, i64 otherwise
+TypeId arithmetic_type(TypeId a, TypeId b);
+
+// 'value' wrapped into the range of integer type 'type', e.g. 300 -> 44
+// for u8
+int64_t wrap_to_type(TypeId type, int64_t value);
@@ -0,0 +1,623 @@
+#include "vectorize.hpp"
+#include "strength.hpp"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+// SSE2 and AVX2 can't multiply 64-bit lanes (vpmullq is AVX-512), so a
+// multiply has to turn into a few shifts and adds
+static const int MAX_MUL_STEPS = 3;
+
+// A header phi that sums terms up: next = phi + a - b + ...
+struct Reduction {
+    Instr* phi;
+    Instr* next; // Fed back from the latch
+    std::vector<std::pair<Instr*, bool>> terms; // true if subtracted
+};
+
+// Follows the chain of adds and subtracts from 'phi' to the value the
+// latch feeds back. Every link must have exactly one user, the next link,
+// so no one in the loop sees a partial sum.
+static bool find_reduction(BasicBlock* block, Instr* phi,
+                           std::unordered_map<Instr*, std::vector<Instr*>>& users, Reduction& reduction) {
+    reduction.phi = phi;
+    reduction.next = phi->incoming_value(block);
+    reduction.terms.clear();
+    if (!reduction.next) return false;
+
+    Instr* current = phi;
+    while (current != reduction.next) {
+        const std::vector<Instr*>& uses = users[current];
+        if (uses.size() != 1) return false;
+        Instr* user = uses[0];
+        if (user->op == Opcode::Add) {
+            reduction.terms.push_back({user->operands[0] == current ? user->operands[1] : user->operands[0], false});
+        } else if (user->op == Opcode::Sub && user->operands[0] == current) {
+            reduction.terms.push_back({user->operands[1], true});
+        } else {
+            return false;
+        }
+        current = user;
+    }
+    return !reduction.terms.empty() && users[reduction.next].size() == 1;
+}
+
+// Memory is only vectorized when the loop can check up front, with a
+// compare for each pair of accesses, that running its iterations
+// 'lanes' at a time changes nothing. More pairs than this aren't worth it.
+static const int MAX_OVERLAP_CHECKS = 8;
+
+// A value as a sum of loop invariants, each times a factor, plus
+// 'constant', plus 'stride' for every iteration: the address of a[i + 1]
+// (with i counting from 0) is a + 8 + 8 per iteration
+struct Affine {
+    std::map<int, std::pair<Instr*, int64_t>> terms; // By id, so the code comes out the same every time
+    int64_t constant = 0;
+    int64_t stride = 0;
+
+    void add(const Affine& other, int64_t factor) {
+        uint64_t f = static_cast<uint64_t>(factor);
+        for (const auto& entry : other.terms) {
+            auto& term = terms.emplace(entry.first, std::make_pair(entry.second.first, int64_t{0})).first->second;
+            term.second = static_cast<int64_t>(static_cast<uint64_t>(term.second) + f * entry.second.second);
+            if (term.second == 0) terms.erase(entry.first);
+        }
+        constant = static_cast<int64_t>(static_cast<uint64_t>(constant) + f * static_cast<uint64_t>(other.constant));
+        stride = static_cast<int64_t>(static_cast<uint64_t>(stride) + f * static_cast<uint64_t>(other.stride));
+    }
+    bool same_terms(const Affine& other) const {
+        if (terms.size() != other.terms.size()) return false;
+        return std::equal(terms.begin(), terms.end(), other.terms.begin(), [](const auto& a, const auto& b) {
+            return a.first == b.first && a.second.second == b.second.second;
+        });
+    }
+    // The slot or global it's an address in, or null if that isn't known
+    Instr* root() const {
+        Instr* found = nullptr;
+        for (const auto& entry : terms) {
+            Instr* term = entry.second.first;
+            if (term->op != Opcode::StackAddr && term->op != Opcode::GlobalAddr) continue;
+            if (found || entry.second.second != 1) return nullptr;
+            found = term;
+        }
+        return found;
+    }
+};
+
+static bool find_affine(const Loop& loop, const std::unordered_map<Instr*, InductionVariable>& ivs, Instr* value,
+                        Affine& out) {
+    out = Affine();
+    if (value->is_const()) {
+        out.constant = value->imm;
+        return true;
+    }
+    if (!loop.contains(value)) {
+        out.terms[value->id] = {value, 1};
+        return true;
+    }
+    const auto& ops = value->operands;
+    Affine a, b;
+    switch (value->op) {
+        case Opcode::Phi: {
+            // i is init + step per iteration
+            auto iv = ivs.find(value);
+            if (iv == ivs.end() || !find_affine(loop, ivs, iv->second.init, out)) return false;
+            out.stride = iv->second.step;
+            return true;
+        }
+        case Opcode::Add:
+        case Opcode::Sub:
+            if (!find_affine(loop, ivs, ops[0], a) || !find_affine(loop, ivs, ops[1], b)) return false;
+            out.add(a, 1);
+            out.add(b, value->op == Opcode::Add ? 1 : -1);
+            return true;
+        case Opcode::Neg:
+            if (!find_affine(loop, ivs, ops[0], a)) return false;
+            out.add(a, -1);
+            return true;
+        case Opcode::Mul: {
+            Instr* factor = ops[1]->is_const() ? ops[1] : ops[0];
+            if (!factor->is_const() || !find_affine(loop, ivs, factor == ops[1] ? ops[0] : ops[1], a)) return false;
+            out.add(a, factor->imm);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// The value 'affine' has in the first iteration
+static Instr* emit_affine(IRBuilder& builder, const Affine& affine) {
+    Instr* sum = nullptr;
+    for (const auto& entry : affine.terms) {
+        Instr* term = entry.second.first;
+        if (entry.second.second != 1) term = builder.binary(Opcode::Mul, term, builder.const_int(entry.second.second));
+        sum = sum ? builder.binary(Opcode::Add, sum, term) : term;
+    }
+    Instr* constant = builder.const_int(affine.constant);
+    return sum ? builder.binary(Opcode::Add, sum, constant) : constant;
+}
+
+// A load or store of the loop, and where it is in the first iteration
+struct Access {
+    Instr* instr;
+    Affine address;
+    Instr* first = nullptr; // Computed before the vector loop
+};
+
+// Rewrites the scalar terms of the sums as vector code. 'prepare' runs
+// once before the vector loop (splats and constants go there), 'body' is
+// the vector loop itself.
+class LoopWidener {
+public:
+    LoopWidener(IRFunction& function, const Loop& loop, int lanes)
+        : m_loop(loop), m_lanes(lanes), m_type(vector_type(lanes)), m_prepare(&function), m_body(&function) {}
+
+    void add_induction_variable(const InductionVariable& iv) { m_ivs[iv.phi] = iv; }
+
+    // Dry run: can 'value' be widened? If not, 'reason' says why.
+    bool can_widen(Instr* value, std::string& reason);
+
+    void set_blocks(BasicBlock* prepare, BasicBlock* body) {
+        m_prepare.set_insert_point(prepare);
+        m_body.set_insert_point(body);
+        m_body_block = body;
+    }
+    // Lane k gets the value 'value' has in iteration k (of every 'lanes')
+    Instr* widen(Instr* value);
+    Instr* zero();
+    // The loads read (and the stores write) 'lanes' elements from where
+    // they were in the first iteration plus 'offset' bytes
+    void set_memory(const std::vector<Access>& accesses, Instr* offset) {
+        for (const Access& access : accesses) m_first_address[access.instr] = access.first;
+        m_offset = offset;
+    }
+    Instr* vector_address(Instr* access) {
+        return m_body.binary(Opcode::Add, m_first_address.at(access), m_offset);
+    }
+
+    ValueType type() const { return m_type; }
+    IRBuilder& prepare() { return m_prepare; }
+    IRBuilder& body() { return m_body; }
+
+private:
+    const Loop& m_loop;
+    int m_lanes;
+    ValueType m_type;
+    IRBuilder m_prepare;
+    IRBuilder m_body;
+    BasicBlock* m_body_block = nullptr;
+    std::unordered_map<Instr*, InductionVariable> m_ivs;
+    std::unordered_set<Instr*> m_checked;
+    std::unordered_map<Instr*, Instr*> m_widened;
+    std::unordered_map<Instr*, Instr*> m_first_address;
+    Instr* m_offset = nullptr;
+    Instr* m_zero = nullptr;
+
+    Instr* widen_induction_variable(const InductionVariable& iv);
+    Instr* multiply(Instr* vector, int64_t factor);
+};
+
+bool LoopWidener::can_widen(Instr* value, std::string& reason) {
+    if (value->is_const() || !m_loop.contains(value) || m_checked.count(value)) return true;
+    m_checked.insert(value);
+
+    const auto& ops = value->operands;
+    switch (value->op) {
+        case Opcode::Phi:
+            // Sums only feed the next link of their chain, so this is a counter
+            if (m_ivs.count(value)) return true;
+            reason = "%" + std::to_string(value->id) + " isn't an induction variable";
+            return false;
+        case Opcode::Add:
+        case Opcode::Sub:
+            return can_widen(ops[0], reason) && can_widen(ops[1], reason);
+        case Opcode::Neg:
+            return can_widen(ops[0], reason);
+        case Opcode::ZLoad:
+        case Opcode::SLoad:
+            // Every load was checked to read the next element each time
+            return true;
+        case Opcode::Mul: {
+            Instr* factor = ops[1]->is_const() ? ops[1] : ops[0];
+            Instr* other = factor == ops[1] ? ops[0] : ops[1];
+            if (!factor->is_const()) {
+                reason = "%" + std::to_string(value->id) + " multiplies two 64-bit variables (that needs AVX-512)";
+                return false;
+            }
+            if (find_mul_sequence(factor->imm, MAX_MUL_STEPS).empty()) {
+                reason = "%" + std::to_string(value->id) + " multiplies by " + std::to_string(factor->imm) +
+                         ", which takes too many shifts and adds without AVX-512";
+                return false;
+            }
+            return can_widen(other, reason);
+        }
+        case Opcode::SDiv:
+        case Opcode::SRem:
+        case Opcode::UDiv:
+        case Opcode::URem:
+            reason = "%" + std::to_string(value->id) + " divides, which has no vector instruction";
+            return false;
+        default:
+            reason = "%" + std::to_string(value->id) + " has no vector form";
+            return false;
+    }
+}
+
+Instr* LoopWidener::zero() {
+    if (!m_zero) m_zero = m_prepare.vec_const(m_type, std::vector<int64_t>(m_lanes, 0));
+    return m_zero;
+}
+
+Instr* LoopWidener::widen(Instr* value) {
+    auto it = m_widened.find(value);
+    if (it != m_widened.end()) return it->second;
+
+    Instr* result;
+    if (value->is_const() || !m_loop.contains(value)) {
+        result = m_prepare.splat(m_type, value);
+    } else {
+        const auto& ops = value->operands;
+        switch (value->op) {
+            case Opcode::Phi:
+                result = widen_induction_variable(m_ivs.at(value));
+                break;
+            case Opcode::Add:
+                result = m_body.vector_binary(Opcode::VAdd, widen(ops[0]), widen(ops[1]));
+                break;
+            case Opcode::Sub:
+                result = m_body.vector_binary(Opcode::VSub, widen(ops[0]), widen(ops[1]));
+                break;
+            case Opcode::Neg:
+                result = m_body.vector_binary(Opcode::VSub, zero(), widen(ops[0]));
+                break;
+            case Opcode::ZLoad:
+            case Opcode::SLoad:
+                result = m_body.vector_load(m_type, vector_address(value));
+                break;
+            default: { // Mul, checked by can_widen()
+                bool factor_first = !ops[1]->is_const();
+                result = multiply(widen(ops[factor_first ? 1 : 0]), ops[factor_first ? 0 : 1]->imm);
+                break;
+            }
+        }
+    }
+    m_widened[value] = result;
+    return result;
+}
+
+// The lanes start at init, init + step, init + 2 * step, ... and all move
+// 'lanes * step' ahead per trip
+Instr* LoopWidener::widen_induction_variable(const InductionVariable& iv) {
+    uint64_t step = static_cast<uint64_t>(iv.step);
+    std::vector<int64_t> offsets;
+    for (int k = 0; k < m_lanes; k++) offsets.push_back(static_cast<int64_t>(step * k));
+
+    Instr* start;
+    if (iv.init->is_const()) {
+        for (int64_t& offset : offsets) offset = static_cast<int64_t>(static_cast<uint64_t>(offset) + iv.init->imm);
+        start = m_prepare.vec_const(m_type, offsets);
+    } else {
+        start = m_prepare.vector_binary(Opcode::VAdd, m_prepare.splat(m_type, iv.init), m_prepare.vec_const(m_type, offsets));
+    }
+    Instr* stride = m_prepare.vec_const(m_type, std::vector<int64_t>(m_lanes, static_cast<int64_t>(step * m_lanes)));
+
+    Instr* phi = m_body.phi(m_body_block);
+    phi->type = m_type;
+    Instr* next = m_body.vector_binary(Opcode::VAdd, phi, stride);
+    m_body.add_phi_incoming(phi, start, m_prepare.insert_block());
+    m_body.add_phi_incoming(phi, next, m_body_block);
+    return phi;
+}
+
+Instr* LoopWidener::multiply(Instr* vector, int64_t factor) {
+    Instr* t = vector;
+    for (const MulStep& step : find_mul_sequence(factor, MAX_MUL_STEPS)) {
+        switch (step.kind) {
+            case MulStep::Shl:
+                t = m_body.vector_binary(Opcode::VShl, t, m_prepare.const_int(step.amount));
+                break;
+            case MulStep::LeaScale: {
+                Instr* scaled = m_body.vector_binary(Opcode::VShl, t, m_prepare.const_int(log2_exact(step.amount)));
+                t = m_body.vector_binary(Opcode::VAdd, t, scaled);
+                break;
+            }
+            case MulStep::AddX:
+                t = m_body.vector_binary(Opcode::VAdd, t, vector);
+                break;
+            case MulStep::SubX:
+                t = m_body.vector_binary(Opcode::VSub, t, vector);
+                break;
+            case MulStep::Neg:
+                t = m_body.vector_binary(Opcode::VSub, zero(), t);
+                break;
+        }
+    }
+    return t;
+}
+
+// True if doing all of access 'a's lanes and then all of 'b's, where b
+// comes after a in the loop and is 'distance' bytes past it, touches
+// memory in the same order as the scalar loop: they overlap in the same
+// iteration (0), b overlaps an earlier iteration's a (< 0), or b only
+// overlaps iterations of a that run in a later trip (>= 8 * lanes).
+static bool keeps_order(int64_t distance, int lanes) {
+    return distance <= 0 || distance >= 8 * static_cast<int64_t>(lanes);
+}
+
+bool vectorize_loop(IRFunction& function, const Loop& loop, int lanes, std::string& reason, int& overlap_checks) {
+    // 1. The shape: one block that counts up by one to an invariant bound
+    BasicBlock* header = loop.header;
+    BasicBlock* preheader = loop.preheader();
+    if (loop.blocks.size() != 1) {
+        reason = "the body has branches in it";
+        return false;
+    }
+    if (!preheader) {
+        reason = "it has no preheader";
+        return false;
+    }
+    Instr* term = header->terminator();
+    Instr* condition = term->op == Opcode::CondBr ? term->operands[0] : nullptr;
+    if (!condition || condition->op != Opcode::Cmp) {
+        reason = "it doesn't end with a comparison";
+        return false;
+    }
+    std::vector<Access> accesses; // In order
+    for (auto& instr : header->instrs) {
+        if (instr->op == Opcode::Call) {
+            reason = "it calls '" + instr->symbol + "'";
+            return false;
+        }
+        if (instr->op == Opcode::MemZero) {
+            reason = "it zeroes memory";
+            return false;
+        }
+        if (instr->is_load() || instr->op == Opcode::Store) {
+            // A lane is 64 bits, and so is every element it loads or stores
+            if (instr->imm != 64) {
+                reason = "%" + std::to_string(instr->id) + (instr->is_load() ? " loads" : " stores") + " a " +
+                         std::to_string(instr->imm) + "-bit value (only 64-bit ones fill a lane)";
+                return false;
+            }
+            accesses.push_back({instr.get(), {}});
+            continue;
+        }
+        if (instr->op == Opcode::BoundsCheck) {
+            reason = "it has a bounds check in it";
+            return false;
+        }
+        if (instr->op == Opcode::Prefetch) {
+            reason = "it prefetches";
+            return false;
+        }
+        if (instr->op == Opcode::VStore) {
+            reason = "it already stores vectors";
+            return false;
+        }
+        if (is_vector(instr->type)) {
+            reason = "it already works on " + std::string(type_suffix(instr->type)) + " vectors";
+            return false;
+        }
+    }
+
+    // 2. Every phi is a counter or a sum
+    std::unordered_map<Instr*, std::vector<Instr*>> users;
+    for (auto& instr : header->instrs) {
+        for (Instr* operand : instr->operands) users[operand].push_back(instr.get());
+    }
+    std::vector<InductionVariable> ivs;
+    std::vector<Reduction> reductions;
+    for (Instr* phi : header->phis()) {
+        InductionVariable iv;
+        Reduction reduction;
+        if (find_induction_variable(loop, preheader, phi, iv)) {
+            ivs.push_back(iv);
+        } else if (find_reduction(header, phi, users, reduction)) {
+            reductions.push_back(reduction);
+        } else {
+            reason = "%" + std::to_string(phi->id) + " is carried from one iteration to the next";
+            return false;
+        }
+    }
+
+    // 3. The counter the exit test looks at
+    const InductionVariable* counter = nullptr;
+    Instr* bound = nullptr;
+    CondCode cc = term->targets[0] == header ? condition->cond : negate_cond(condition->cond);
+    for (const InductionVariable& iv : ivs) {
+        if (condition->operands[0] == iv.next) {
+            counter = &iv;
+            bound = condition->operands[1];
+        } else if (condition->operands[1] == iv.next) {
+            counter = &iv;
+            bound = condition->operands[0];
+            cc = swap_cond(cc);
+        }
+    }
+    if (!counter || (!bound->is_const() && loop.contains(bound))) {
+        reason = "the trip count isn't known before the loop starts";
+        return false;
+    }
+    if (counter->step != 1 || (cc != CondCode::LT && cc != CondCode::LE && cc != CondCode::NE)) {
+        reason = "the loop counter doesn't count up by 1";
+        return false;
+    }
+    bool stores = std::any_of(accesses.begin(), accesses.end(),
+                              [](const Access& access) { return access.instr->op == Opcode::Store; });
+    if (reductions.empty() && !stores) {
+        reason = "there is no sum to compute or array to fill in parallel";
+        return false;
+    }
+
+    // 4. Every load and store goes to the next element each iteration, so
+    //    'lanes' of them are one vector load or store
+    std::unordered_map<Instr*, InductionVariable> iv_of;
+    for (const InductionVariable& iv : ivs) iv_of[iv.phi] = iv;
+    for (Access& access : accesses) {
+        if (!find_affine(loop, iv_of, access.instr->operands[0], access.address) || access.address.stride != 8) {
+            reason = "%" + std::to_string(access.instr->id) + (access.instr->is_load() ? " reads" : " writes") +
+                     " memory that isn't the next element each iteration";
+            return false;
+        }
+    }
+
+    // 5. Memory is touched in the same order. Two accesses to the same
+    //    place (the same invariants plus a constant) are checked here; two
+    //    different slots or globals never overlap; anything else is checked
+    //    before the vector loop starts.
+    std::vector<std::pair<const Access*, const Access*>> checks;
+    for (size_t i = 0; i < accesses.size(); i++) {
+        for (size_t j = i + 1; j < accesses.size(); j++) {
+            const Access& a = accesses[i];
+            const Access& b = accesses[j];
+            if (a.instr->is_load() && b.instr->is_load()) continue;
+            if (a.address.same_terms(b.address)) {
+                int64_t distance = static_cast<int64_t>(static_cast<uint64_t>(b.address.constant) -
+                                                        static_cast<uint64_t>(a.address.constant));
+                if (!keeps_order(distance, lanes)) {
+                    reason = "%" + std::to_string((distance > 0 ? b : a).instr->id) + " is " +
+                             std::to_string(distance > 0 ? distance : -distance) + " bytes from %" +
+                             std::to_string((distance > 0 ? a : b).instr->id) + ", less than " +
+                             std::to_string(lanes) + " iterations apart";
+                    return false;
+                }
+                continue;
+            }
+            Instr* a_root = a.address.root();
+            Instr* b_root = b.address.root();
+            if (a_root && b_root && a_root != b_root) continue;
+            checks.push_back({&a, &b});
+        }
+    }
+    if (checks.size() > static_cast<size_t>(MAX_OVERLAP_CHECKS)) {
+        reason = "it would take " + std::to_string(checks.size()) + " checks to tell its pointers apart";
+        return false;
+    }
+
+    // 6. Can all the terms and stored values be widened?
+    LoopWidener widener(function, loop, lanes);
+    for (const InductionVariable& iv : ivs) widener.add_induction_variable(iv);
+    for (const Reduction& reduction : reductions) {
+        for (auto& term_entry : reduction.terms) {
+            if (!widener.can_widen(term_entry.first, reason)) return false;
+        }
+    }
+    for (const Access& access : accesses) {
+        if (access.instr->op == Opcode::Store && !widener.can_widen(access.instr->operands[1], reason)) return false;
+    }
+
+    // --- From here on, the loop is vectorized ---
+    BasicBlock* check = function.create_block_before(header);
+    BasicBlock* prepare = function.create_block_before(header);
+    BasicBlock* vector = function.create_block_before(header);
+    BasicBlock* middle = function.create_block_before(header);
+    BasicBlock* scalar = function.create_block_before(header);
+    IRBuilder builder(&function);
+    auto bound_in = [&](IRBuilder& b) { return bound->is_const() ? b.const_int(bound->imm) : bound; };
+
+    // 7. The preheader only goes on to the vector loop if the loop counts
+    //    up from 'init' at all, and 'check' if it's by more than 'lanes'.
+    //    Then one block per overlap check: b - a, from the first
+    //    iteration's addresses, must keep the order (see keeps_order).
+    preheader->instrs.pop_back();
+    builder.set_insert_point(preheader);
+    Instr* init = counter->init;
+    Instr* counts_up = builder.cmp(cc == CondCode::LE ? CondCode::LE : CondCode::LT, init, bound_in(builder));
+    builder.cond_br(counts_up, check, scalar);
+
+    std::vector<BasicBlock*> guards = {preheader, check};
+    for (size_t i = 0; i < checks.size(); i++) guards.push_back(function.create_block_before(prepare));
+    builder.set_insert_point(check);
+    Instr* distance = builder.binary(Opcode::Sub, bound_in(builder), init);
+    for (Access& access : accesses) access.first = emit_affine(builder, access.address);
+    Instr* long_enough = builder.cmp(CondCode::GT, distance, builder.const_int(lanes));
+    builder.cond_br(long_enough, guards.size() > 2 ? guards[2] : prepare, scalar);
+    for (size_t i = 0; i < checks.size(); i++) {
+        builder.set_insert_point(guards[i + 2]);
+        Instr* apart = builder.binary(Opcode::Sub, checks[i].second->first, checks[i].first->first);
+        // 1 ... 8 * lanes - 1 apart, as one unsigned compare
+        Instr* too_close = builder.cmp(CondCode::ULT, builder.binary(Opcode::Sub, apart, builder.const_int(1)),
+                                       builder.const_int(8 * lanes - 1));
+        builder.cond_br(too_close, scalar, i + 3 < guards.size() ? guards[i + 3] : prepare);
+    }
+    overlap_checks = static_cast<int>(checks.size());
+
+    // 8. The vector loop: (trips - 1) / lanes trips, so 1 to 'lanes'
+    //    iterations are left over for the scalar loop. The loads and
+    //    stores go in the order they're in, then the sums.
+    builder.set_insert_point(prepare);
+    Instr* last = cc == CondCode::LE ? distance : builder.binary(Opcode::Sub, distance, builder.const_int(1));
+    Instr* trips = builder.binary(Opcode::UDiv, last, builder.const_int(lanes));
+    builder.br(vector);
+
+    widener.set_blocks(prepare, vector);
+    IRBuilder& body = widener.body();
+    Instr* trip = body.phi(vector);
+    if (!accesses.empty()) {
+        widener.set_memory(accesses, body.binary(Opcode::Mul, trip, body.const_int(8 * lanes)));
+    }
+    for (const Access& access : accesses) {
+        if (access.instr->is_load()) {
+            widener.widen(access.instr);
+        } else {
+            Instr* value = widener.widen(access.instr->operands[1]);
+            body.vector_store(widener.vector_address(access.instr), value);
+        }
+    }
+    std::vector<std::pair<Instr*, Instr*>> sums; // The accumulator phi and its final value
+    for (const Reduction& reduction : reductions) {
+        Instr* accumulator = body.phi(vector);
+        accumulator->type = widener.type();
+        Instr* sum = accumulator;
+        for (auto& term_entry : reduction.terms) {
+            sum = body.vector_binary(term_entry.second ? Opcode::VSub : Opcode::VAdd, sum, widener.widen(term_entry.first));
+        }
+        body.add_phi_incoming(accumulator, widener.zero(), prepare);
+        body.add_phi_incoming(accumulator, sum, vector);
+        sums.push_back({accumulator, sum});
+    }
+    Instr* next_trip = body.binary(Opcode::Add, trip, body.const_int(1));
+    body.add_phi_incoming(trip, widener.prepare().const_int(0), prepare);
+    body.add_phi_incoming(trip, next_trip, vector);
+    body.cond_br(body.cmp(CondCode::NE, next_trip, trips), vector, middle);
+
+    // 9. Where the scalar loop picks up
+    builder.set_insert_point(middle);
+    Instr* done = builder.binary(Opcode::Mul, trips, builder.const_int(lanes));
+    std::unordered_map<Instr*, Instr*> resume;
+    for (const InductionVariable& iv : ivs) {
+        resume[iv.phi] = builder.binary(Opcode::Add, iv.init, builder.binary(Opcode::Mul, done, builder.const_int(iv.step)));
+    }
+    for (size_t i = 0; i < reductions.size(); i++) {
+        Instr* start = reductions[i].phi->incoming_value(preheader);
+        resume[reductions[i].phi] = builder.binary(Opcode::Add, start, builder.reduce_add(sums[i].second));
+    }
+    builder.br(scalar);
+
+    // The guards may have folded to jumps, so not every edge is there
+    auto jumps_to_scalar = [&](BasicBlock* block) {
+        std::vector<BasicBlock*> succs = block->successors();
+        return std::find(succs.begin(), succs.end(), scalar) != succs.end();
+    };
+    builder.set_insert_point(scalar);
+    for (Instr* phi : header->phis()) {
+        Instr* start = phi->incoming_value(preheader);
+        Instr* merged = builder.phi(scalar);
+        for (BasicBlock* from : guards) {
+            if (jumps_to_scalar(from)) builder.add_phi_incoming(merged, start, from);
+        }
+        builder.add_phi_incoming(merged, resume.at(phi), middle);
+        for (size_t i = 0; i < phi->targets.size(); i++) {
+            if (phi->targets[i] == preheader) {
+                phi->targets[i] = scalar;
+                phi->operands[i] = merged;
+            }
+        }
+    }
+    builder.br(header);
+
+    function.compute_predecessors();
+    return true;
+}
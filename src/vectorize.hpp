@@ -0,0 +1,52 @@
+#pragma once
+
+#include "cfg.hpp"
+#include "ir.hpp"
+#include <string>
+
+// --- Loop Vectorization ---
+// Runs several iterations of a counted loop at once, one per lane of an
+// XMM (SSE2, 2 x i64) or YMM (AVX2, 4 x i64) register.
+//
+// What there is to vectorize are sums over induction variables and
+// arrays, and arrays filled in from others:
+//
+//     for (int i = 0; i < n; i++) s += a[i] * 3 + k;
+//     for (int i = 0; i < n; i++) c[i] = a[i] + b[i];
+//
+// A loop qualifies if it is a single block with a preheader, counts up by
+// one to a loop-invariant bound (<, <= or !=), and each of its phis is
+// either an induction variable or a sum ('s = s + x' / 's = s - x', where
+// nothing else in the loop looks at 's'). The summed terms and stored
+// values may only use induction variables, loop invariants, loads, +, -
+// and multiplication by constants that a few shifts and adds can do (SSE2
+// and AVX2 have no 64-bit multiply).
+//
+// Every load and store must move on by one 64-bit element each iteration,
+// so that 'lanes' iterations of it are one unaligned vector load or store.
+// The vector loop does each access for all lanes before the next one,
+// which is only right if no store and other access 1 to 'lanes' - 1
+// elements apart (in the wrong direction) touch the same memory. That is
+// decided here when both use the same base (a[i] and a[i + 1]) or two
+// different locals or globals; otherwise the two addresses are compared
+// before the vector loop starts, and if they're too close the scalar loop
+// runs on its own.
+//
+// The vector loop goes in front of the original one, which is kept as
+// the epilogue:
+//
+//     preheader:   if !(init < bound) goto scalar
+//     check:       if !(bound - init > lanes) goto scalar
+//     overlap:     if b - a is 1 ... 8 * lanes - 1 goto scalar (per pair)
+//     prepare:     splat the invariants, start the vector variables
+//     vector:      'lanes' iterations per trip, (trips - 1) / lanes trips
+//     middle:      sum up the lanes, compute where the counters are
+//     scalar:      merge the starting values, jump to the original loop
+//
+// The epilogue always runs between 1 and 'lanes' iterations, so any value
+// used after the loop still comes from the original code.
+
+// Vectorizes 'loop' with 'lanes' lanes (2 or 4). If it can't, it changes
+// nothing, returns false and says why in 'reason'. 'overlap_checks' is
+// how many pairs of addresses are compared before the vector loop.
+bool vectorize_loop(IRFunction& function, const Loop& loop, int lanes, std::string& reason, int& overlap_checks);
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checks division by constants and induction variable strength reduction
+# against 'div', 'idiv' and 'imul': builds and runs every program that
+# division_gen writes (see tests/division_gen.cpp).
+#
+# usage: tests/division.sh <bolt-compiler> <division_gen> [flags...]
+#        (needs nasm and cc)
+BOLT=$1
+GEN=$2
+shift 2
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+count=$("$GEN" count) || exit 1
+n=0
+status=0
+while [ "$n" -lt "$count" ]; do
+    "$GEN" "$n" > "$tmp/div.bolt" || exit 1
+    if ! "$BOLT" "$@" -o "$tmp/div.asm" "$tmp/div.bolt" > "$tmp/log" 2>&1 ||
+       ! nasm -f elf64 -o "$tmp/div.o" "$tmp/div.asm" ||
+       ! cc -o "$tmp/div" "$tmp/div.o"; then
+        cat "$tmp/log"
+        echo "FAIL program $n: didn't build"
+        status=1
+    elif ! "$tmp/div"; then
+        echo "FAIL program $n"
+        status=1
+    fi
+    n=$((n + 1))
+done
+exit $status
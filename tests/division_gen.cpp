@@ -0,0 +1,226 @@
+// Writes the Bolt programs that tests/division.sh runs. Each one checks
+// operations by constants, which the compiler strength-reduces, against
+// the same operations by a value it can't see (a parameter), which stay
+// 'div', 'idiv' and 'imul':
+//  - x / d and x % d for i8, u8, i16 and u16: every divisor with every
+//    dividend
+//  - the same for i32, u32, i64 and u64: sampled divisors and dividends
+//  - i * c with i an induction variable: sampled factors, counting up
+//    and down, by one and by more, and wrapping around
+// A program prints the first operation that came out wrong and exits 1.
+//
+// usage: division_gen count      prints how many programs there are
+//        division_gen <n>        prints program n (from 0)
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+// Divisors per program: each 16-bit one runs through 65536 dividends
+static const size_t CHUNK = 1024;
+static const int WIDE_DIVISORS = 2000;
+static const int WIDE_DIVIDENDS = 4096;
+static const int FACTORS = 600;
+
+struct IntType {
+    const char* name;
+    int bits;
+    bool is_signed;
+};
+
+static const IntType NARROW[] = {{"i8", 8, true}, {"u8", 8, false}, {"i16", 16, true}, {"u16", 16, false}};
+static const IntType WIDE[] = {{"i32", 32, true}, {"u32", 32, false}, {"i64", 64, true}, {"u64", 64, false}};
+
+// A 64-bit literal, written so that INT64_MIN parses too
+static std::string literal(int64_t value) {
+    if (value == INT64_MIN) return "(-9223372036854775807 - 1)";
+    if (value < 0) return "(" + std::to_string(value) + ")";
+    return std::to_string(value);
+}
+
+// The constant 'value' as a 'type' in the source
+static std::string constant(const IntType& type, int64_t value) {
+    if (type.bits == 64 && !type.is_signed) return "u64(" + literal(value) + ")";
+    return literal(value);
+}
+
+// 'value' cut down to 'type' and extended back to 64 bits
+static int64_t truncate(const IntType& type, int64_t value) {
+    if (type.bits == 64) return value;
+    uint64_t low = static_cast<uint64_t>(value) & ((uint64_t(1) << type.bits) - 1);
+    if (type.is_signed && (low >> (type.bits - 1))) low |= ~uint64_t(0) << type.bits;
+    return static_cast<int64_t>(low);
+}
+
+// xorshift64*, seeded the same every time
+static uint64_t next_random() {
+    static uint64_t state = 0x9e3779b97f4a7c15ull;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+}
+
+// Small numbers, numbers around every power of two, the limits of the
+// integer types, and random numbers of every size: 'count' in all
+static std::vector<int64_t> samples(int count) {
+    std::vector<int64_t> values;
+    for (int64_t i = -300; i <= 300; i++) values.push_back(i);
+    for (int shift = 9; shift < 64; shift++) {
+        for (int64_t offset = -2; offset <= 2; offset++) {
+            uint64_t power = uint64_t(1) << shift;
+            values.push_back(static_cast<int64_t>(power + offset));
+            values.push_back(static_cast<int64_t>(0 - power - offset));
+        }
+    }
+    for (int64_t edge : {INT64_MIN, INT64_MAX, int64_t(UINT32_MAX), int64_t(UINT32_MAX) - 1}) {
+        values.push_back(edge);
+    }
+    while (static_cast<int>(values.size()) < count) {
+        values.push_back(static_cast<int64_t>(next_random() >> (next_random() % 64)));
+    }
+    values.resize(count);
+    return values;
+}
+
+// x / d and x % d against the same by 'dv', returning from the check
+static void emit_compare(const std::string& divisor, const char* dividend) {
+    for (const char* op : {"/", "%"}) {
+        std::printf("        if (x %s %s != x %s d) return fail(%s, dv);\n", op, divisor.c_str(), op, dividend);
+    }
+}
+
+static void emit_fail(const char* what) {
+    std::printf("int fail(int x, int d) {\n");
+    std::printf("    print(\"%s: wrong for \", x, \" and \", d, \"\\n\");\n", what);
+    std::printf("    return 1;\n}\n\n");
+}
+
+// Makes every call, exiting with 1 at the first that fails
+static void emit_main(const std::vector<std::string>& calls) {
+    std::printf("int main() {\n");
+    for (const std::string& call : calls) {
+        std::printf("    if (%s != 0) return 1;\n", call.c_str());
+    }
+    std::printf("    return 0;\n}\n");
+}
+
+// Every dividend of 'type' by its nonzero divisors number
+// [chunk * CHUNK, (chunk + 1) * CHUNK)
+static void narrow_program(const IntType& type, size_t chunk) {
+    int64_t lo = type.is_signed ? -(int64_t(1) << (type.bits - 1)) : 0;
+    int64_t hi = type.is_signed ? (int64_t(1) << (type.bits - 1)) - 1 : (int64_t(1) << type.bits) - 1;
+    std::vector<int64_t> divisors;
+    for (int64_t d = lo; d <= hi; d++) {
+        if (d != 0) divisors.push_back(d);
+    }
+    size_t end = std::min(divisors.size(), (chunk + 1) * CHUNK);
+    divisors = std::vector<int64_t>(divisors.begin() + chunk * CHUNK, divisors.begin() + end);
+
+    emit_fail(type.name);
+    std::vector<std::string> calls;
+    for (size_t i = 0; i < divisors.size(); i++) {
+        std::printf("int check%zu(int dv) {\n", i);
+        std::printf("    %s d = %s(dv);\n", type.name, type.name);
+        std::printf("    for (int v = %s; v <= %s; v++) {\n", literal(lo).c_str(), literal(hi).c_str());
+        std::printf("        %s x = %s(v);\n", type.name, type.name);
+        emit_compare(constant(type, divisors[i]), "v");
+        std::printf("    }\n    return 0;\n}\n\n");
+        calls.push_back("check" + std::to_string(i) + "(" + literal(divisors[i]) + ")");
+    }
+    emit_main(calls);
+}
+
+// Sampled dividends of 'type' by sampled divisors
+static void wide_program(const IntType& type) {
+    std::vector<int64_t> dividends = samples(WIDE_DIVIDENDS);
+    std::printf("int dividends[%zu] = {", dividends.size());
+    for (size_t i = 0; i < dividends.size(); i++) {
+        std::printf("%s%s", i % 8 == 0 ? "\n    " : " ", (literal(dividends[i]) + ",").c_str());
+    }
+    std::printf("\n};\n\n");
+
+    // INT64_MIN / -1 doesn't fit, and 'idiv' traps on it
+    std::set<int64_t> seen = {0};
+    if (type.bits == 64 && type.is_signed) seen.insert(-1);
+    emit_fail(type.name);
+    std::vector<std::string> calls;
+    for (int64_t sample : samples(WIDE_DIVISORS)) {
+        int64_t divisor = truncate(type, sample);
+        if (!seen.insert(divisor).second) continue;
+        size_t i = calls.size();
+        std::printf("int check%zu(int dv) {\n", i);
+        std::printf("    %s d = %s(dv);\n", type.name, type.name);
+        std::printf("    for (int k = 0; k < %zu; k++) {\n", dividends.size());
+        std::printf("        %s x = %s(dividends[k]);\n", type.name, type.name);
+        emit_compare(constant(type, divisor), "dividends[k]");
+        std::printf("    }\n    return 0;\n}\n\n");
+        calls.push_back("check" + std::to_string(i) + "(" + literal(divisor) + ")");
+    }
+    emit_main(calls);
+}
+
+// i * c in loops, where i is an induction variable the loop optimizer
+// turns the product into
+static void induction_program() {
+    // Starting near 2^62, the products wrap around
+    const int64_t big = int64_t(1) << 62;
+    emit_fail("i * c");
+    std::vector<std::string> calls;
+    for (int64_t factor : samples(FACTORS)) {
+        std::string check = "check" + std::to_string(calls.size() / 2);
+        std::string c = literal(factor);
+        std::printf("int %s(int c, int a, int b) {\n", check.c_str());
+        std::printf("    for (int i = a; i < b; i++) {\n");
+        std::printf("        if (i * %s != i * c) return fail(i, c);\n    }\n", c.c_str());
+        std::printf("    for (int i = a; i < b; i += 7) {\n");
+        std::printf("        if (i * %s != i * c) return fail(i, c);\n    }\n", c.c_str());
+        std::printf("    for (int i = b; i > a; i -= 3) {\n");
+        std::printf("        if (i * %s != i * c) return fail(i, c);\n    }\n", c.c_str());
+        std::printf("    return 0;\n}\n\n");
+        calls.push_back(check + "(" + c + ", -100, 100)");
+        calls.push_back(check + "(" + c + ", " + std::to_string(big - 100) + ", " + std::to_string(big + 100) + ")");
+    }
+    emit_main(calls);
+}
+
+// Which program is number 'n', and writes it
+static int program(size_t n, bool write) {
+    size_t count = 0;
+    for (const IntType& type : NARROW) {
+        size_t divisors = (size_t(1) << type.bits) - 1;
+        for (size_t chunk = 0; chunk * CHUNK < divisors; chunk++) {
+            if (write && count == n) narrow_program(type, chunk);
+            count++;
+        }
+    }
+    for (const IntType& type : WIDE) {
+        if (write && count == n) wide_program(type);
+        count++;
+    }
+    if (write && count == n) induction_program();
+    count++;
+    return static_cast<int>(count);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s count | <n>\n", argv[0]);
+        return 2;
+    }
+    if (std::strcmp(argv[1], "count") == 0) {
+        std::printf("%d\n", program(0, false));
+        return 0;
+    }
+    size_t n = std::strtoul(argv[1], nullptr, 10);
+    if (static_cast<int>(n) >= program(0, false)) {
+        std::fprintf(stderr, "%s: there is no program %zu\n", argv[0], n);
+        return 2;
+    }
+    program(n, true);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Runs one test program: tests/run.sh <bolt-compiler> <test.bolt>
+#
+# A test says what it expects in comments at the top:
+#   // exit: N        the exit status of the program (0 if not given)
+#   // flags: A | B   the compiler flags, one build per set (-O0 | -O1
+#                     if not given)
+#   // error: TEXT    the program doesn't compile: the compiler fails,
+#                     saying TEXT
+#   // log: TEXT      the compiler says TEXT (a -stats line, a -Rpass
+#                     remark) in every build; one line of it per TEXT
+#   // hot: NAME      function NAME goes to .text, not .text.cold, in
+#                     every build; one line per function
+#   // asm: TEXT      the assembly has TEXT in it in every build; one line
+#                     of it per TEXT
+# It passes if every build compiles, says every TEXT and exits with N (or
+# fails with TEXT).
+BOLT=$1
+TEST=$2
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+expected=$(sed -n 's|^// exit: *||p' "$TEST" | head -n 1)
+flags=$(sed -n 's|^// flags: *||p' "$TEST" | head -n 1)
+error=$(sed -n 's|^// error: *||p' "$TEST" | head -n 1)
+sed -n 's|^// log: *||p' "$TEST" > "$tmp/logs"
+sed -n 's|^// hot: *||p' "$TEST" > "$tmp/hot"
+sed -n 's|^// asm: *||p' "$TEST" > "$tmp/asm"
+expected=${expected:-0}
+flags=${flags:--O0 | -O1}
+
+status=0
+echo "$flags" | tr '|' '\n' > "$tmp/flags"
+while read -r set; do
+    if [ -n "$error" ]; then
+        # shellcheck disable=SC2086
+        if "$BOLT" $set -o "$tmp/test.asm" "$TEST" > "$tmp/log" 2>&1; then
+            echo "FAIL [$set]: compiled, expected an error"
+            status=1
+        elif ! grep -qF -- "$error" "$tmp/log"; then
+            cat "$tmp/log"
+            echo "FAIL [$set]: didn't say '$error'"
+            status=1
+        fi
+        continue
+    fi
+    # shellcheck disable=SC2086
+    if ! "$BOLT" $set -o "$tmp/test.asm" "$TEST" > "$tmp/log" 2>&1 ||
+       ! nasm -f elf64 -o "$tmp/test.o" "$tmp/test.asm" ||
+       ! cc -o "$tmp/test" "$tmp/test.o"; then
+        cat "$tmp/log"
+        echo "FAIL [$set]: didn't build"
+        status=1
+        continue
+    fi
+    while read -r line; do
+        if ! grep -qF -- "$line" "$tmp/log"; then
+            cat "$tmp/log"
+            echo "FAIL [$set]: didn't say '$line'"
+            status=1
+        fi
+    done < "$tmp/logs"
+    while read -r name; do
+        section=$(awk -v label="$name:" '/^section /{s = $2} $0 == label {print s}' "$tmp/test.asm")
+        if [ "$section" != ".text" ]; then
+            echo "FAIL [$set]: $name is in '$section', not .text"
+            status=1
+        fi
+    done < "$tmp/hot"
+    while read -r line; do
+        if ! grep -qF -- "$line" "$tmp/test.asm"; then
+            echo "FAIL [$set]: the assembly has no '$line'"
+            status=1
+        fi
+    done < "$tmp/asm"
+    "$tmp/test" > /dev/null
+    got=$?
+    if [ "$got" -ne "$expected" ]; then
+        echo "FAIL [$set]: exit $got, expected $expected"
+        status=1
+    fi
+done < "$tmp/flags"
+exit $status